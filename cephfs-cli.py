@@ -46,6 +46,16 @@ user_info_file = default_info_file
 cephfs_root_dir = None
 cephfs_helper = None
 verbose = False
+# --shim spec, benchmark against simulated latency/faults
+shim_spec = None
+# -j, --min-jobs bounds of adaptive parallel ops in tree operations
+jobs = (1, 16)
+# --limit-rate bytes/s, --limit-ops ops/s, 0 unlimited
+rate_limit = (0, 0)
+# --no-uring, --direct-io size of local file io
+local_io = (True, 0)
+# --split size of files shared by several workers, None default
+split_size = None
 
 def login(cephconf, cephaddr, name=None, key=None, root=None):
     configure = locals()
@@ -57,6 +67,15 @@ def login(cephconf, cephaddr, name=None, key=None, root=None):
         return EINVAL
     global cephfs_helper
     cephfs_helper = tool.CephfsHelper()
+    if shim_spec and not cephfs_helper.set_shim(shim_spec):
+        print("invalid shim [{0}]".format(shim_spec), file=sys.stderr)
+        return EINVAL
+    cephfs_helper.set_concurrency(jobs[0], jobs[1])
+    if rate_limit[0] or rate_limit[1]:
+        cephfs_helper.set_rate_limit(rate_limit[0], rate_limit[1])
+    cephfs_helper.set_local_io(local_io[0], int(local_io[1]))
+    if split_size is not None:
+        cephfs_helper.set_split(int(split_size), int(split_size // 4))
     if cephconf:
         cephfs_helper.set_config_file(cephconf)
     if cephaddr:
@@ -151,14 +170,80 @@ def ascii_encode_dict(data):
     ascii_encode = lambda x: x.encode('ascii') if isinstance(x, unicode) else x 
     return dict(map(ascii_encode, pair) for pair in data.items())
 
+def apply_filters(args):
+    for rule in args.filters or []:
+        if not cephfs_helper.add_filter(rule):
+            print("invalid filter rule [{0}]".format(rule), file=sys.stderr)
+            return False
+    for f in args.exclude_from or []:
+        if not cephfs_helper.add_filter_file(f):
+            print("unable to read filter file [{0}]".format(f), file=sys.stderr)
+            return False
+    if args.min_size or args.max_size:
+        cephfs_helper.set_filter_size(int(args.min_size), int(args.max_size))
+    if args.newer_than or args.older_than:
+        cephfs_helper.set_filter_mtime(int(args.newer_than), int(args.older_than))
+    return True
+
+def is_glob(path):
+    return any(c in path for c in '*?[')
+
 @check
 def upload_handler(args):
     src_path, cephfs_path = args.src_path, args.cephfs_path
     if verbose:
         print('upload arguments: ', src_path, cephfs_path)
+    if not apply_filters(args):
+        return EINVAL
+    if args.dedup:
+        cephfs_helper.set_dedup(args.dedup)
+    if args.no_preflight:
+        cephfs_helper.set_preflight(False)
+    if args.manifest or args.manifest_cache:
+        if args.shard:
+            print("upload --manifest can not be sharded", file=sys.stderr)
+            return EINVAL
+        cephfs_helper.set_manifest(args.manifest_cache, args.manifest)
+    if args.shard:
+        cephfs_helper.set_shard(args.shard[0], args.shard[1])
+    if args.watch and (len(src_path) != 1 or not os.path.isdir(src_path[0]) \
+        or args.shard):
+        print("upload --watch needs one local dir and no --shard", file=sys.stderr)
+        return EINVAL
+    if args.pack:
+        if args.tar or args.watch or args.shard or args.manifest or args.manifest_cache \
+            or len(src_path) != 1 or not os.path.isdir(src_path[0]):
+            print("upload --pack needs one local dir, no --tar, --watch, --shard "
+                "or manifest", file=sys.stderr)
+            return EINVAL
+        # the small files of the dir go into containers in the cephfs dir
+        if not cephfs_helper.pack_tree(cephfs_path, src_path[0], args.container_size):
+            print("upload pack [{0}] failed".format(src_path[0]), file=sys.stderr)
+            return EPERM
+        print("upload local path [{0}] to cephfs pack [{1}] successfully".format(
+            src_path[0], cephfs_path))
+        return 0
+    if args.tar:
+        if args.watch or args.shard or args.manifest or args.manifest_cache:
+            print("upload --tar can not watch, shard or keep a manifest", file=sys.stderr)
+            return EINVAL
+        # each source is a tar stream extracted into the cephfs dir
+        for src in src_path:
+            if not cephfs_helper.ingest_tar(cephfs_path, src):
+                print("upload tar [{0}] failed".format(src), file=sys.stderr)
+                return EPERM
+            print("upload tar [{0}] to cephfs path [{1}] successfully".format(src,
+                cephfs_path), file=sys.stderr if src == '-' else sys.stdout)
+        return 0
     for src in src_path:
         dst_path = cephfs_path
-        if not os.path.exists(src):
+        if src == '-':
+            # stream stdin, the size is not known in advance
+            if dst_path[-1] == '/' or cephfs_helper.stat(dst_path) == 1:
+                print("upload stdin needs a cephfs file path, not [{0}]"\
+                    .format(dst_path), file=sys.stderr)
+                return EINVAL
+        elif not os.path.exists(src):
             print("upload local path [{0}] No such file or directory".format(src),\
                 file=sys.stderr)
             continue
@@ -180,13 +265,19 @@ def upload_handler(args):
                 dst_path = os.path.join(dst_path, dirname)
                 if dst_path[-1] != '/':
                     dst_path += '/' 
-        ret = cephfs_helper.write_tree(dst_path, src)
+        if args.watch:
+            # until ctrl-c or SIGTERM
+            print("watch local path [{0}] to cephfs path [{1}]".format(src, dst_path))
+            ret = cephfs_helper.watch_tree(dst_path, src, args.settle,
+                max(args.settle, args.max_delay))
+        else:
+            ret = cephfs_helper.write_tree(dst_path, src)
         if not ret:
             print("upload [{0}] failed".format(src), file=sys.stderr)
             return EPERM
         else:
             print("upload local path [{0}] to cephfs path [{1}] successfully".
-                format(src, dst_path))
+                format(src, dst_path), file=sys.stderr if src == '-' else sys.stdout)
     return 0
 
 @check
@@ -194,6 +285,20 @@ def download_handler(args):
     dst_path, cephfs_path = args.dst_path, args.cephfs_path
     if verbose:
         print('download arguments: ', cephfs_path, dst_path)
+    if not apply_filters(args):
+        return EINVAL
+    if is_glob(cephfs_path):
+        if args.tar or args.pack or args.mirror or args.shard or dst_path == '-':
+            print("download of a glob needs a local dir and no --tar, --pack, "
+                "--mirror or --shard", file=sys.stderr)
+            return EINVAL
+        # every match below the dst dir, at its path below the literal dirs
+        if not cephfs_helper.read_glob(cephfs_path, dst_path):
+            print("download [{0}] failed".format(cephfs_path), file=sys.stderr)
+            return EPERM
+        print("download to local path [{0}] from cephfs glob [{1}] successfully".format(
+            dst_path, cephfs_path))
+        return 0
     ppath = os.path.dirname(dst_path)
     if len(ppath)>0 and not os.path.exists(ppath):
         os.makedirs(ppath)
@@ -202,20 +307,128 @@ def download_handler(args):
         print("download path [{0}] No such file or directory".format(cephfs_path),\
             file=sys.stderr)
         return ENOENT
+    elif args.pack:
+        if args.mirror or args.shard or args.tar:
+            print("download --pack can not mirror, shard or tar", file=sys.stderr)
+            return EINVAL
+        if not args.member:
+            if not cephfs_helper.unpack_tree(cephfs_path, dst_path):
+                print("download pack [{0}] failed".format(cephfs_path), file=sys.stderr)
+                return EPERM
+            print("download cephfs pack [{0}] to [{1}] successfully".format(
+                cephfs_path, dst_path))
+            return 0
+        # members only read their own bytes, into the dir or to stdout
+        if len(args.member) > 1 and dst_path == '-':
+            print("download --pack writes one member to stdout", file=sys.stderr)
+            return EINVAL
+        for member in args.member:
+            dst = dst_path
+            if dst != '-' and (len(args.member) > 1 or os.path.isdir(dst)):
+                dst = os.path.join(dst, os.path.basename(member))
+                if not os.path.isdir(dst_path):
+                    os.makedirs(dst_path)
+            if not cephfs_helper.pack_extract(cephfs_path, member, dst):
+                print("download pack member [{0}] failed".format(member), file=sys.stderr)
+                return EPERM
+            print("download pack member [{0}] to [{1}] successfully".format(member, dst),
+                file=sys.stderr if dst == '-' else sys.stdout)
+        return 0
+    elif args.tar:
+        if args.mirror or args.shard:
+            print("download --tar can not mirror or shard", file=sys.stderr)
+            return EINVAL
+        if not cephfs_helper.export_tar(cephfs_path, dst_path):
+            print("download tar of [{0}] failed".format(cephfs_path), file=sys.stderr)
+            return EPERM
+        print("download tar of cephfs path [{0}] to [{1}] successfully".format(
+            cephfs_path, dst_path), file=sys.stderr if dst_path == '-' else sys.stdout)
+        return 0
+    elif dst_path == '-':
+        # stream to stdout, keep stdout clean
+        if ret != 0:
+            print("download [{0}] to stdout must be a file".format(cephfs_path),\
+                file=sys.stderr)
+            return EINVAL
     elif ret == 0: # file
         if os.path.isdir(dst_path):
             dst_path = os.path.join(dst_path, os.path.basename(cephfs_path))
     elif ret == 1:
-        print("download directory [{0}] is not supported".format(cephfs_path),\
+        # a mirror is the dst dir itself, run after run
+        if os.path.isdir(dst_path) and not args.mirror:
+            dst_path = os.path.join(dst_path,
+                os.path.basename(cephfs_path.rstrip('/')))
+    else:
+        print("download [{0}] is not a file or directory".format(cephfs_path),\
             file=sys.stderr)
         return EPERM
-    ret = cephfs_helper.read(cephfs_path, dst_path)
+    if args.shard:
+        if args.mirror or dst_path == '-':
+            print("download --shard can not mirror or stream", file=sys.stderr)
+            return EINVAL
+        cephfs_helper.set_shard(args.shard[0], args.shard[1])
+    if args.mirror:
+        if ret != 1 or dst_path == '-':
+            print("download --mirror [{0}] needs a cephfs dir and a local dir"\
+                .format(cephfs_path), file=sys.stderr)
+            return EINVAL
+        ret = cephfs_helper.mirror_tree(cephfs_path, dst_path)
+    else:
+        ret = cephfs_helper.read_tree(cephfs_path, dst_path)
     if not ret:
         print("download [{0}] failed".format(cephfs_path), file=sys.stderr)
         return EPERM
     else:
         print("download to local path [{0}] from cephfs path [{1}] successfully".
-            format(dst_path, cephfs_path))
+            format(dst_path, cephfs_path),
+            file=sys.stderr if dst_path == '-' else sys.stdout)
+    return 0
+
+@check
+def copy_handler(args):
+    src_path, dst_path = args.src_path, args.dst_path
+    if verbose:
+        print('cp arguments: ', src_path, dst_path)
+    into = dst_path[-1] == '/' or cephfs_helper.stat(dst_path) == 1
+    if len(src_path) > 1 and not into:
+        print("cp of several paths needs a cephfs dir, not [{0}]".format(dst_path),\
+            file=sys.stderr)
+        return EINVAL
+    for src in src_path:
+        st = cephfs_helper.stat(src)
+        if st == -1:
+            print("cp path [{0}] No such file or directory".format(src),\
+                file=sys.stderr)
+            continue
+        elif st != 0 and st != 1:
+            print("cp [{0}] is not a file or directory".format(src), file=sys.stderr)
+            continue
+        dst = dst_path
+        if into:
+            dst = os.path.join(dst_path, os.path.basename(src.rstrip('/')))
+        elif st == 1 and cephfs_helper.stat(dst) == 0:
+            print("cp cephfs dir [{0}] to exist file [{1}] is not allowed"\
+                .format(src, dst), file=sys.stderr)
+            return EPERM
+        if not cephfs_helper.copy_tree(src, dst):
+            print("cp [{0}] failed".format(src), file=sys.stderr)
+            return EPERM
+        print("cp cephfs path [{0}] to cephfs path [{1}] successfully".format(src, dst))
+    return 0
+
+@check
+def tail_handler(args):
+    src, cephfs_path = args.src_path, args.cephfs_path
+    if cephfs_path[-1] == '/' or cephfs_helper.stat(cephfs_path) == 1:
+        cephfs_path = os.path.join(cephfs_path, os.path.basename(src))
+    if verbose:
+        print('tail arguments: ', src, cephfs_path)
+    # until ctrl-c or SIGTERM
+    print("tail local file [{0}] to cephfs path [{1}]".format(src, cephfs_path))
+    if not cephfs_helper.tail_file(cephfs_path, src, int(args.flush_bytes),
+        args.flush_interval, args.fsync_interval):
+        print("tail [{0}] failed".format(src), file=sys.stderr)
+        return EPERM
     return 0
 
 @check
@@ -223,9 +436,32 @@ def remove_handler(args):
     cephfs_path = args.cephfs_path
     if verbose:
         print('remove arguments: ', cephfs_path)
+    if not apply_filters(args):
+        return EINVAL
+    if args.shard:
+        cephfs_helper.set_shard(args.shard[0], args.shard[1])
     for src in cephfs_path:
+        if is_glob(src):
+            if args.shard:
+                print("remove --shard needs a cephfs dir, not a glob [{0}]".format(src),\
+                    file=sys.stderr)
+                return EINVAL
+            # expanded in parallel, removed in one batch
+            if not cephfs_helper.remove_glob(src):
+                print("remove glob [{0}] failed".format(src), file=sys.stderr)
+                return EPERM
+            print("remove cephfs glob [{0}] successfully".format(src))
+            continue
         st = cephfs_helper.stat(src)
-        if st == 0:
+        if args.shard and st != 1:
+            # gone, the other shards removed it, this shard is done too
+            if st == -1:
+                ret = cephfs_helper.rmdir(src)
+            else:
+                print("remove --shard needs a cephfs dir, not [{0}]".format(src),\
+                    file=sys.stderr)
+                return EINVAL
+        elif st == 0:
             ret = cephfs_helper.remove(src)
         elif st == 1:
             ret = cephfs_helper.rmdir(src)
@@ -240,6 +476,17 @@ def remove_handler(args):
             print("remove cephfs path [{0}] successfully".format(src))
     return 0
 
+@check
+def shards_handler(args):
+    done = cephfs_helper.shard_merge(args.op, args.cephfs_path, args.count)
+    if done < 0:
+        print("merge shards of {0} [{1}] failed".format(args.op, args.cephfs_path),\
+            file=sys.stderr)
+        return EPERM
+    print("{0} [{1}] {2} of {3} shards done".format(args.op, args.cephfs_path,
+        done, args.count))
+    return 0 if done == args.count else EAGAIN
+
 @check
 def pwd_handler(args):
     print(cephfs_helper.getcwd())
@@ -284,6 +531,25 @@ def listdir_handler(args):
     if cephfs_path is None:
         cephfs_path = "./"
     ls = tool.StringVector()
+    if is_glob(cephfs_path) and not args.pack:
+        # the matches, one per line
+        if not cephfs_helper.expand_glob(cephfs_path, ls, True):
+            print("listdir glob [{0}] failed".format(cephfs_path), file=sys.stderr)
+            return EPERM
+        if not len(ls):
+            print("listdir glob [{0}] no match".format(cephfs_path), file=sys.stderr)
+            return ENOENT
+        for l in ls:
+            print(l)
+        return 0
+    if args.pack:
+        # members of a pack, one per line
+        if not cephfs_helper.pack_list(cephfs_path, ls):
+            print("list pack [{0}] failed".format(cephfs_path), file=sys.stderr)
+            return EPERM
+        for l in ls:
+            print(l)
+        return 0
     ret = cephfs_helper.listdir_buffer(cephfs_path, ls)
     if not ret:
         print("listdir path [{0}] failed".format(cephfs_path), file=sys.stderr)
@@ -296,6 +562,54 @@ def listdir_handler(args):
         print("empty directory")
     return 0
 
+def parse_size(arg):
+    units = {'k': 1024, 'm': 1024**2, 'g': 1024**3, 't': 1024**4}
+    try:
+        if arg[-1].lower() in units:
+            return float(arg[:-1]) * units[arg[-1].lower()]
+        return float(arg)
+    except (ValueError, IndexError):
+        raise argparse.ArgumentTypeError("invalid size " + arg)
+
+def parse_shard(arg):
+    try:
+        index, count = [int(x) for x in arg.split('/')]
+    except ValueError:
+        raise argparse.ArgumentTypeError("invalid shard " + arg)
+    if count < 1 or index < 0 or index >= count:
+        raise argparse.ArgumentTypeError("shard must be I/N with 0 <= I < N, not " + arg)
+    return index, count
+
+def parse_time(arg):
+    """epoch seconds, YYYY-MM-DD[THH:MM:SS] local time, or an age like 7d, 12h, 30m"""
+    import time
+    ages = {'s': 1, 'm': 60, 'h': 3600, 'd': 86400, 'w': 604800}
+    try:
+        if arg[-1] in ages and arg[:-1].replace('.', '', 1).isdigit():
+            return time.time() - float(arg[:-1]) * ages[arg[-1]]
+        if arg.isdigit():
+            return float(arg)
+        fmt = '%Y-%m-%dT%H:%M:%S' if 'T' in arg else '%Y-%m-%d'
+        return time.mktime(time.strptime(arg, fmt))
+    except (ValueError, IndexError):
+        raise argparse.ArgumentTypeError("invalid time " + arg)
+
+def add_filter_args(parser):
+    parser.add_argument('--exclude', metavar='PATTERN', action='append', dest='filters',
+        help='gitignore style rule of paths to leave out, may repeat')
+    parser.add_argument('--include', metavar='PATTERN', action='append', dest='filters',
+        type=lambda p: '!' + p, help='take paths an earlier --exclude left out')
+    parser.add_argument('--exclude-from', metavar='FILE', action='append',
+        help='rules from a gitignore style file')
+    parser.add_argument('--min-size', type=parse_size, default=0,
+        help='only files of at least this size')
+    parser.add_argument('--max-size', type=parse_size, default=0,
+        help='only files of at most this size')
+    parser.add_argument('--newer-than', metavar='TIME', type=parse_time, default=0,
+        help='only files modified since TIME: epoch, 2026-10-01 or an age as 7d')
+    parser.add_argument('--older-than', metavar='TIME', type=parse_time, default=0,
+        help='only files modified before TIME')
+
 def parse_cmdargs(args=None):
     parser = argparse.ArgumentParser(description='cephfs client tool')
     parser.add_argument('-v', '--version', action="store_true", help="display version")
@@ -303,6 +617,29 @@ def parse_cmdargs(args=None):
     parser.add_argument('-i', '--userfile', help='user info file',
         default=default_info_file)
     parser.add_argument('-r', '--root', help='root path in cephfs')
+    parser.add_argument('--shim', help='simulate cluster conditions, e.g. ' + \
+        'local=/tmp/fakefs,lat=2ms,bw=10gbit,short=0.01,eio=0.001,eagain=0.001')
+    parser.add_argument('-j', '--jobs', type=int, default=16,
+        help='max parallel ops of tree upload, download, cp and remove')
+    parser.add_argument('--min-jobs', type=int, default=1,
+        help='min parallel ops, adapted to cluster latency and errors')
+    parser.add_argument('--limit-rate', type=parse_size, default=0,
+        help='limit data bytes per second shared by all workers, e.g. 100m')
+    parser.add_argument('--limit-ops', type=float, default=0,
+        help='limit metadata ops per second shared by all workers')
+    parser.add_argument('--no-uring', action='store_true',
+        help='local file io with pread/pwrite instead of io_uring')
+    parser.add_argument('--direct-io', type=parse_size, default=0,
+        help='read local files of at least this size with O_DIRECT, e.g. 1g')
+    parser.add_argument('--split', type=parse_size, default=None,
+        help='tree transfers share files of at least this size between ' + \
+            'workers in quarter chunks, default 256m, 0 never')
+    parser.add_argument('--buffer-memory', type=parse_size, default=0,
+        help='cap memory of transfer buffers, default 512m')
+    parser.add_argument('--hugepages', action='store_true',
+        help='back transfer buffers with hugepages')
+    parser.add_argument('--trace', help='write chrome trace-event json of ' + \
+        'cephfs ops to file, view it in perfetto')
     sub = parser.add_subparsers(title='support subcommands')
     sub.required = False
 
@@ -318,19 +655,80 @@ def parse_cmdargs(args=None):
     config.set_defaults(func=config_handler)
 
     upload = sub.add_parser('upload', help='upload files to cephfs')
-    upload.add_argument('src_path', help='local source path', nargs='+')
+    upload.add_argument('src_path', help='local source path, - for stdin', nargs='+')
     upload.add_argument('cephfs_path', help='dst path in cephfs')
+    upload.add_argument('--dedup', metavar='INDEX_DIR',
+        help='hardlink files already uploaded, content index in cephfs INDEX_DIR')
+    upload.add_argument('--manifest', action='store_true',
+        help='keep a manifest in the cephfs tree, upload only changes next time')
+    upload.add_argument('--manifest-cache', metavar='DIR',
+        help='keep manifests in local DIR, upload only changes next time')
+    upload.add_argument('--shard', metavar='I/N', type=parse_shard,
+        help='upload shard I of N, N processes together upload the tree once')
+    upload.add_argument('--watch', action='store_true',
+        help='after the upload keep sending the files written in the local dir')
+    upload.add_argument('--settle', type=float, default=2,
+        help='watch sends a batch once no file was written for SETTLE seconds')
+    upload.add_argument('--max-delay', type=float, default=30,
+        help='watch sends a batch at most MAX_DELAY seconds after its first change')
+    upload.add_argument('--tar', action='store_true',
+        help='each source is a tar stream, gzip or zstd too, extracted into cephfs_path')
+    upload.add_argument('--no-preflight', action='store_true',
+        help='skip the check of quotas and free space before the upload')
+    upload.add_argument('--pack', action='store_true',
+        help='pack the small files of the dir into containers in cephfs_path')
+    upload.add_argument('--container-size', type=parse_size, default=1024**3,
+        help='pack containers of about SIZE, default 1g')
+    add_filter_args(upload)
     upload.set_defaults(func=upload_handler)
 
     download = sub.add_parser('download', help='download files from cephfs')
-    download.add_argument('cephfs_path', help='source path in cephfs')
-    download.add_argument('dst_path', help='local dst path')
+    download.add_argument('cephfs_path', help='source path in cephfs, or a quoted glob')
+    download.add_argument('dst_path', help='local dst path, - for stdout')
+    download.add_argument('--mirror', action='store_true',
+        help='mirror a cephfs dir, remove local paths gone from cephfs, '
+            'skip dirs not changed since the last mirror')
+    download.add_argument('--tar', action='store_true',
+        help='write the tree as a tar stream to dst_path, - for stdout')
+    download.add_argument('--shard', metavar='I/N', type=parse_shard,
+        help='download shard I of N, N processes together download the tree once')
+    download.add_argument('--pack', action='store_true',
+        help='cephfs_path is a pack, extract all of it or the members given')
+    download.add_argument('--member', action='append',
+        help='with --pack extract only this member, repeatable')
+    add_filter_args(download)
     download.set_defaults(func=download_handler)
     
+    cp = sub.add_parser('cp', help='copy files inside cephfs')
+    cp.add_argument('src_path', help='source path in cephfs', nargs='+')
+    cp.add_argument('dst_path', help='dst path in cephfs')
+    cp.set_defaults(func=copy_handler)
+
+    tail = sub.add_parser('tail', help='append a growing local file to cephfs')
+    tail.add_argument('src_path', help='local file, followed across rotation')
+    tail.add_argument('cephfs_path', help='dst path in cephfs')
+    tail.add_argument('--flush-bytes', type=parse_size, default=1024**2,
+        help='append in writes of up to this size, default 1m')
+    tail.add_argument('--flush-interval', type=float, default=1,
+        help='append what was read at least every this many seconds')
+    tail.add_argument('--fsync-interval', type=float, default=10,
+        help='fsync the cephfs file every this many seconds')
+    tail.set_defaults(func=tail_handler)
+
     remove = sub.add_parser('remove', help='remove files from cephfs')
-    remove.add_argument('cephfs_path', help='path in cephfs', nargs='+')
+    remove.add_argument('cephfs_path', help='path in cephfs, or a quoted glob',
+        nargs='+')
+    remove.add_argument('--shard', metavar='I/N', type=parse_shard,
+        help='remove shard I of N of the files, N processes remove the tree')
+    add_filter_args(remove)
     remove.set_defaults(func=remove_handler)
 
+    shards = sub.add_parser('shards', help='report the shards of a --shard run done')
+    shards.add_argument('op', choices=['upload', 'download', 'delete'])
+    shards.add_argument('cephfs_path', help='tree path in cephfs, as in the shards')
+    shards.add_argument('count', type=int, help='number of shards N')
+    shards.set_defaults(func=shards_handler)
+
     pwd = sub.add_parser('pwd', help='print working directory')
     pwd.set_defaults(func=pwd_handler)
 
@@ -345,6 +743,8 @@ def parse_cmdargs(args=None):
     listdir = sub.add_parser('ls', help='list directory')
     listdir.add_argument('cephfs_path', help='path in cephfs',
         nargs='?')
+    listdir.add_argument('--pack', action='store_true',
+        help='list the members of the pack in cephfs_path')
     listdir.set_defaults(func=listdir_handler)
 
     parsed_args = parser.parse_args(args)
@@ -368,13 +768,31 @@ def main():
     if parsed_args.userfile:
         global user_info_file 
         user_info_file = parsed_args.userfile
+    if parsed_args.trace:
+        tool.set_trace_file(parsed_args.trace)
+    if parsed_args.buffer_memory or parsed_args.hugepages:
+        tool.set_buffer_memory(int(parsed_args.buffer_memory or 512 * 1024**2),
+            parsed_args.hugepages)
+    global jobs, rate_limit, local_io, split_size
+    jobs = (parsed_args.min_jobs, parsed_args.jobs)
+    rate_limit = (parsed_args.limit_rate, parsed_args.limit_ops)
+    local_io = (not parsed_args.no_uring, parsed_args.direct_io)
+    split_size = parsed_args.split
+    if parsed_args.shim:
+        global shim_spec
+        shim_spec = parsed_args.shim
     global cephfs_root_dir
     if parsed_args.root:
         cephfs_root_dir = parsed_args.root if parsed_args.root[0]=='/' \
             else '/' + parsed_args.root
     else:
         cephfs_root_dir = None
-    return parsed_args.func(parsed_args)
+    ret = parsed_args.func(parsed_args)
+    if parsed_args.trace:
+        tool.flush_trace()
+    if verbose:
+        print('transfer buffers', tool.buffer_stats())
+    return ret
 
 if __name__ == "__main__":
     sys.exit(main())
@@ -1,8 +1,87 @@
-%module cephfstool
+%module(threads="1") cephfstool
+%include "stdint.i"
 %include "std_string.i"
 %include "std_vector.i"
 %template(StringVector) std::vector<std::string>;
+//file modes are plain numbers in python, os.O_CREAT with 0o600
+%apply unsigned int { mode_t };
 %{
 #include "cephfstool.h"
 %}
+
+//release the GIL around every call, except the cheap ones
+%nothread CephfsHelper::get_config_file;
+%nothread CephfsHelper::get_user;
+%nothread CephfsHelper::get_root;
+%nothread CephfsHelper::set_config_file;
+%nothread CephfsHelper::set_mon_addr;
+%nothread CephfsHelper::set_user_key;
+%nothread CephfsHelper::set_user_key_file;
+%nothread CephfsHelper::set_rate_limit;
+%nothread CephfsHelper::set_concurrency;
+%nothread CephfsHelper::set_local_io;
+%nothread CephfsHelper::set_split;
+%nothread CephfsHelper::set_shard;
+%nothread CephfsHelper::add_filter;
+%nothread CephfsHelper::set_filter_size;
+%nothread CephfsHelper::set_filter_mtime;
+%nothread CephfsHelper::clear_filter;
+%nothread CephfsHelper::set_dedup;
+%nothread CephfsHelper::set_manifest;
+%nothread CephfsHelper::set_preflight;
+%nothread set_buffer_memory;
+%nothread buffer_stats;
+
+//buffer protocol, no copy: read_into(path, memoryview, offset)
+%typemap(in) (char* buf, size_t len) (Py_buffer view, int has_view = 0) {
+    if(PyObject_GetBuffer($input, &view, PyBUF_WRITABLE) < 0) SWIG_fail;
+    has_view = 1;
+    $1 = (char*)view.buf;
+    $2 = (size_t)view.len;
+}
+%typemap(freearg) (char* buf, size_t len) {
+    if(has_view$argnum) PyBuffer_Release(&view$argnum);
+}
+%typemap(typecheck, precedence=SWIG_TYPECHECK_POINTER) (char* buf, size_t len) {
+    $1 = PyObject_CheckBuffer($input);
+}
+
+//write_from(path, bytes-like, offset)
+%typemap(in) (const char* buf, size_t len) (Py_buffer view, int has_view = 0) {
+    if(PyObject_GetBuffer($input, &view, PyBUF_SIMPLE) < 0) SWIG_fail;
+    has_view = 1;
+    $1 = (const char*)view.buf;
+    $2 = (size_t)view.len;
+}
+%typemap(freearg) (const char* buf, size_t len) {
+    if(has_view$argnum) PyBuffer_Release(&view$argnum);
+}
+%typemap(typecheck, precedence=SWIG_TYPECHECK_POINTER) (const char* buf, size_t len) {
+    $1 = PyObject_CheckBuffer($input);
+}
+
+//file handle, iovec calls stay in C++, pread/pwrite take buffers
+%ignore CephFile::CephFile();
+%ignore CephFile::CephFile(CephFile&&);
+%ignore CephFile::operator=;
+%ignore CephFile::preadv;
+%ignore CephFile::pwritev;
+%nothread CephFile::is_open;
+//futures and callbacks stay in C++, python has its threads
+%ignore CephfsHelper::write_async;
+%ignore CephfsHelper::read_async;
+%ignore CephfsHelper::stat_async;
+%ignore CephfsHelper::listdir_async;
+%ignore CephfsHelper::remove_async;
+%ignore CephfsHelper::set_async;
+%nothread CephFile::get_path;
+//the file keeps its helper alive
+%pythonappend CephFile::CephFile %{
+    self._helper = args[0]
+%}
+%extend CephFile {
+    CephFile* __enter__(){ return $self;}
+    void __exit__(PyObject*, PyObject*, PyObject*){ $self->close();}
+}
+
 %include "cephfstool.h"
@@ -0,0 +1,33 @@
+#!/bin/env python
+# zero-copy reads into python buffers, threads overlap as the
+# GIL is released while cephfs works
+import os
+import sys
+import threading
+import cephfstool as tool
+
+tool.set_log_dir(None)
+fs = tool.CephfsHelper()
+ret = fs.login("test_cephfs_user","","/test_cephfs_user")
+if not ret: sys.exit(1)
+
+data = bytearray(b"x" * (4 << 20))
+for i in range(4):
+    if fs.write_from("/buffer_sample/part%d" % i, data, 0) != len(data):
+        sys.exit(1)
+
+def load(i, out):
+    buf = bytearray(4 << 20)
+    n = fs.read_into("/buffer_sample/part%d" % i, memoryview(buf), 0)
+    out[i] = n
+
+sizes = {}
+threads = [threading.Thread(target=load, args=(i, sizes)) for i in range(4)]
+for t in threads: t.start()
+for t in threads: t.join()
+print(sizes)
+
+# a file handle with an explicit mode
+with tool.CephFile(fs, "/buffer_sample/private", os.O_WRONLY|os.O_CREAT, 0o600) as f:
+    if f.pwrite(data, 0) != len(data): sys.exit(1)
+fs.rmdir("/buffer_sample")
@@ -0,0 +1,920 @@
+/*
+* cephfs backend
+*
+* 20261019
+*/
+
+#include "utils.h"
+#include "backend.h"
+
+#include <thread>
+#include <unordered_map>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+//forward everything to libcephfs
+class LibCephfsBackend : public CephfsBackend {
+public:
+    int create(struct ceph_mount_info **cmount, const char *id) override{
+        return ceph_create(cmount, id);
+    }
+    int conf_read_file(struct ceph_mount_info *cmount, const char *path) override{
+        return ceph_conf_read_file(cmount, path);
+    }
+    int conf_set(struct ceph_mount_info *cmount, const char *option,
+        const char *value) override{
+        return ceph_conf_set(cmount, option, value);
+    }
+    int mount(struct ceph_mount_info *cmount, const char *root) override{
+        return ceph_mount(cmount, root);
+    }
+    void shutdown(struct ceph_mount_info *cmount) override{
+        ceph_shutdown(cmount);
+    }
+    int open(struct ceph_mount_info *cmount, const char *path,
+        int flags, mode_t mode) override{
+        return ceph_open(cmount, path, flags, mode);
+    }
+    int close(struct ceph_mount_info *cmount, int fd) override{
+        return ceph_close(cmount, fd);
+    }
+    int read(struct ceph_mount_info *cmount, int fd, char *buf,
+        int64_t size, int64_t offset) override{
+        return ceph_read(cmount, fd, buf, size, offset);
+    }
+    int write(struct ceph_mount_info *cmount, int fd, const char *buf,
+        int64_t size, int64_t offset) override{
+        return ceph_write(cmount, fd, buf, size, offset);
+    }
+    int preadv(struct ceph_mount_info *cmount, int fd, const struct iovec *iov,
+        int iovcnt, int64_t offset) override{
+        return ceph_preadv(cmount, fd, iov, iovcnt, offset);
+    }
+    int pwritev(struct ceph_mount_info *cmount, int fd, const struct iovec *iov,
+        int iovcnt, int64_t offset) override{
+        return ceph_pwritev(cmount, fd, iov, iovcnt, offset);
+    }
+    int64_t lseek(struct ceph_mount_info *cmount, int fd, int64_t offset,
+        int whence) override{
+        return ceph_lseek(cmount, fd, offset, whence);
+    }
+    int fsync(struct ceph_mount_info *cmount, int fd, int syncdataonly) override{
+        return ceph_fsync(cmount, fd, syncdataonly);
+    }
+    int ftruncate(struct ceph_mount_info *cmount, int fd, int64_t size) override{
+        return ceph_ftruncate(cmount, fd, size);
+    }
+    int fstatx(struct ceph_mount_info *cmount, int fd, struct ceph_statx *stx,
+        unsigned int want, unsigned int flags) override{
+        return ceph_fstatx(cmount, fd, stx, want, flags);
+    }
+    int fallocate(struct ceph_mount_info *cmount, int fd, int mode,
+        int64_t offset, int64_t length) override{
+        return ceph_fallocate(cmount, fd, mode, offset, length);
+    }
+    int mkdirs(struct ceph_mount_info *cmount, const char *path, mode_t mode) override{
+        return ceph_mkdirs(cmount, path, mode);
+    }
+    int rmdir(struct ceph_mount_info *cmount, const char *path) override{
+        return ceph_rmdir(cmount, path);
+    }
+    int unlink(struct ceph_mount_info *cmount, const char *path) override{
+        return ceph_unlink(cmount, path);
+    }
+    int rename(struct ceph_mount_info *cmount, const char *from, const char *to) override{
+        return ceph_rename(cmount, from, to);
+    }
+    int link(struct ceph_mount_info *cmount, const char *existing,
+        const char *newname) override{
+        return ceph_link(cmount, existing, newname);
+    }
+    int symlink(struct ceph_mount_info *cmount, const char *existing,
+        const char *newname) override{
+        return ceph_symlink(cmount, existing, newname);
+    }
+    int readlink(struct ceph_mount_info *cmount, const char *path, char *buf,
+        int64_t size) override{
+        return ceph_readlink(cmount, path, buf, size);
+    }
+    int statx(struct ceph_mount_info *cmount, const char *path,
+        struct ceph_statx *stx, unsigned int want, unsigned int flags) override{
+        return ceph_statx(cmount, path, stx, want, flags);
+    }
+    int setattrx(struct ceph_mount_info *cmount, const char *path,
+        struct ceph_statx *stx, int mask, int flags) override{
+        return ceph_setattrx(cmount, path, stx, mask, flags);
+    }
+    int getxattr(struct ceph_mount_info *cmount, const char *path,
+        const char *name, void *value, size_t size) override{
+        return ceph_getxattr(cmount, path, name, value, size);
+    }
+    int setxattr(struct ceph_mount_info *cmount, const char *path,
+        const char *name, const void *value, size_t size, int flags) override{
+        return ceph_setxattr(cmount, path, name, value, size, flags);
+    }
+    int statfs(struct ceph_mount_info *cmount, const char *path,
+        struct statvfs *stbuf) override{
+        return ceph_statfs(cmount, path, stbuf);
+    }
+    int chdir(struct ceph_mount_info *cmount, const char *path) override{
+        return ceph_chdir(cmount, path);
+    }
+    const char* getcwd(struct ceph_mount_info *cmount) override{
+        return ceph_getcwd(cmount);
+    }
+    int opendir(struct ceph_mount_info *cmount, const char *path,
+        struct ceph_dir_result **dirpp) override{
+        return ceph_opendir(cmount, path, dirpp);
+    }
+    int closedir(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp) override{
+        return ceph_closedir(cmount, dirp);
+    }
+    int readdir_r(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp,
+        struct dirent *de) override{
+        return ceph_readdir_r(cmount, dirp, de);
+    }
+    int readdirplus_r(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp,
+        struct dirent *de, struct ceph_statx *stx, unsigned want, unsigned flags) override{
+        return ceph_readdirplus_r(cmount, dirp, de, stx, want, flags, nullptr);
+    }
+    int getdnames(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp,
+        char *buf, int buflen) override{
+        return ceph_getdnames(cmount, dirp, buf, buflen);
+    }
+};
+
+CephfsBackend* libcephfs_backend(){
+    static LibCephfsBackend backend;
+    return &backend;
+}
+
+/*
+* local stand-in
+*/
+struct local_dir {
+    DIR *dp;
+};
+
+static void to_statx(const struct stat& st, struct ceph_statx *stx){
+    memset(stx, 0, sizeof(*stx));
+    stx->stx_mask = CEPH_STATX_BASIC_STATS;
+    stx->stx_blksize = st.st_blksize;
+    stx->stx_nlink = st.st_nlink;
+    stx->stx_uid = st.st_uid;
+    stx->stx_gid = st.st_gid;
+    stx->stx_mode = st.st_mode;
+    stx->stx_ino = st.st_ino;
+    stx->stx_size = st.st_size;
+    stx->stx_blocks = st.st_blocks;
+    stx->stx_dev = st.st_dev;
+    stx->stx_rdev = st.st_rdev;
+    stx->stx_atime = st.st_atim;
+    stx->stx_mtime = st.st_mtim;
+    stx->stx_ctime = st.st_ctim;
+}
+
+LocalBackend::LocalBackend(const char *dir):base(dir),cwd("/"),root(){
+    while(base.size() > 1 && base[base.size()-1] == '/')
+        base.erase(base.size()-1);
+}
+
+//map a cephfs path to the local path, leading .. is stripped like cephfs
+std::string LocalBackend::resolve(const char *path){
+    std::string full;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        full = (path != nullptr && *path == '/') ? "" : cwd;
+    }
+    full += '/';
+    if(path != nullptr) full += path;
+    std::vector<std::string> parts;
+    std::stringstream ss(full);
+    std::string part;
+    while(std::getline(ss, part, '/')){
+        if(part.empty() || part == ".") continue;
+        if(part == ".."){
+            if(!parts.empty()) parts.pop_back();
+            continue;
+        }
+        parts.push_back(part);
+    }
+    std::string local = base + root;
+    for(auto& p : parts){
+        local += '/';
+        local += p;
+    }
+    return local;
+}
+
+int LocalBackend::create(struct ceph_mount_info **cmount, const char *){
+    *cmount = reinterpret_cast<struct ceph_mount_info*>(this);
+    return 0;
+}
+
+int LocalBackend::conf_read_file(struct ceph_mount_info *, const char *){
+    return 0;
+}
+
+int LocalBackend::conf_set(struct ceph_mount_info *, const char *, const char *){
+    return 0;
+}
+
+int LocalBackend::mount(struct ceph_mount_info *cmount, const char *root){
+    std::string r = (root == nullptr) ? "" : root;
+    while(!r.empty() && r[r.size()-1] == '/')
+        r.erase(r.size()-1);
+    if(!r.empty() && r[0] != '/') r = '/' + r;
+    this->root = "";
+    cwd = "/";
+    //the stand-in creates the mount root on demand
+    int ret = mkdirs(cmount, r.c_str(), 0777);
+    if(ret < 0 && ret != -EEXIST) return ret;
+    this->root = r;
+    return 0;
+}
+
+void LocalBackend::shutdown(struct ceph_mount_info *){
+}
+
+int LocalBackend::open(struct ceph_mount_info *, const char *path,
+    int flags, mode_t mode){
+    int fd = ::open(resolve(path).c_str(), flags, mode);
+    return fd < 0 ? -errno : fd;
+}
+
+int LocalBackend::close(struct ceph_mount_info *, int fd){
+    return ::close(fd) < 0 ? -errno : 0;
+}
+
+int LocalBackend::read(struct ceph_mount_info *, int fd, char *buf,
+    int64_t size, int64_t offset){
+    ssize_t ret = ::pread(fd, buf, size, offset);
+    return ret < 0 ? -errno : (int)ret;
+}
+
+int LocalBackend::write(struct ceph_mount_info *, int fd, const char *buf,
+    int64_t size, int64_t offset){
+    ssize_t ret = ::pwrite(fd, buf, size, offset);
+    return ret < 0 ? -errno : (int)ret;
+}
+
+int LocalBackend::preadv(struct ceph_mount_info *, int fd, const struct iovec *iov,
+    int iovcnt, int64_t offset){
+    ssize_t ret = ::preadv(fd, iov, iovcnt, offset);
+    return ret < 0 ? -errno : (int)ret;
+}
+
+int LocalBackend::pwritev(struct ceph_mount_info *, int fd, const struct iovec *iov,
+    int iovcnt, int64_t offset){
+    ssize_t ret = ::pwritev(fd, iov, iovcnt, offset);
+    return ret < 0 ? -errno : (int)ret;
+}
+
+int64_t LocalBackend::lseek(struct ceph_mount_info *, int fd, int64_t offset,
+    int whence){
+    off_t ret = ::lseek(fd, offset, whence);
+    return ret < 0 ? -errno : ret;
+}
+
+int LocalBackend::fsync(struct ceph_mount_info *, int fd, int syncdataonly){
+    int ret = syncdataonly ? ::fdatasync(fd) : ::fsync(fd);
+    return ret < 0 ? -errno : 0;
+}
+
+int LocalBackend::ftruncate(struct ceph_mount_info *, int fd, int64_t size){
+    return ::ftruncate(fd, size) < 0 ? -errno : 0;
+}
+
+int LocalBackend::fstatx(struct ceph_mount_info *, int fd, struct ceph_statx *stx,
+    unsigned int, unsigned int){
+    struct stat st;
+    if(::fstat(fd, &st) < 0) return -errno;
+    to_statx(st, stx);
+    return 0;
+}
+
+int LocalBackend::fallocate(struct ceph_mount_info *, int fd, int mode,
+    int64_t offset, int64_t length){
+    return ::fallocate(fd, mode, offset, length) < 0 ? -errno : 0;
+}
+
+int LocalBackend::mkdirs(struct ceph_mount_info *, const char *path, mode_t mode){
+    std::string local = resolve(path);
+    struct stat st;
+    if(::stat(local.c_str(), &st) == 0)
+        return S_ISDIR(st.st_mode) ? -EEXIST : -ENOTDIR;
+    for(size_t pos = 1; pos <= local.size(); ++pos){
+        if(pos != local.size() && local[pos] != '/') continue;
+        std::string dir = local.substr(0, pos);
+        if(::mkdir(dir.c_str(), mode) < 0 && errno != EEXIST) return -errno;
+    }
+    return 0;
+}
+
+int LocalBackend::rmdir(struct ceph_mount_info *, const char *path){
+    return ::rmdir(resolve(path).c_str()) < 0 ? -errno : 0;
+}
+
+int LocalBackend::unlink(struct ceph_mount_info *, const char *path){
+    return ::unlink(resolve(path).c_str()) < 0 ? -errno : 0;
+}
+
+int LocalBackend::rename(struct ceph_mount_info *, const char *from, const char *to){
+    return ::rename(resolve(from).c_str(), resolve(to).c_str()) < 0 ? -errno : 0;
+}
+
+int LocalBackend::link(struct ceph_mount_info *, const char *existing,
+    const char *newname){
+    return ::link(resolve(existing).c_str(), resolve(newname).c_str()) < 0 ? -errno : 0;
+}
+
+//the target is kept as given, it names a cephfs path
+int LocalBackend::symlink(struct ceph_mount_info *, const char *existing,
+    const char *newname){
+    return ::symlink(existing, resolve(newname).c_str()) < 0 ? -errno : 0;
+}
+
+int LocalBackend::readlink(struct ceph_mount_info *, const char *path, char *buf,
+    int64_t size){
+    ssize_t ret = ::readlink(resolve(path).c_str(), buf, size);
+    return ret < 0 ? -errno : ret;
+}
+
+int LocalBackend::statx(struct ceph_mount_info *, const char *path,
+    struct ceph_statx *stx, unsigned int, unsigned int flags){
+    struct stat st;
+    std::string local = resolve(path);
+    int ret = (flags & AT_SYMLINK_NOFOLLOW) ? ::lstat(local.c_str(), &st) :
+        ::stat(local.c_str(), &st);
+    if(ret < 0) return -errno;
+    to_statx(st, stx);
+    return 0;
+}
+
+//mode and times only, the stand-in runs as one local user
+int LocalBackend::setattrx(struct ceph_mount_info *, const char *path,
+    struct ceph_statx *stx, int mask, int flags){
+    std::string local = resolve(path);
+    int at = (flags & AT_SYMLINK_NOFOLLOW) ? AT_SYMLINK_NOFOLLOW : 0;
+    if((mask & CEPH_SETATTR_MODE) &&
+        ::fchmodat(AT_FDCWD, local.c_str(), stx->stx_mode & 07777, 0) < 0)
+        return -errno;
+    if(mask & (CEPH_SETATTR_MTIME|CEPH_SETATTR_ATIME)){
+        struct timespec ts[2];
+        ts[0] = stx->stx_atime;
+        ts[1] = stx->stx_mtime;
+        if(!(mask & CEPH_SETATTR_ATIME)) ts[0].tv_nsec = UTIME_OMIT;
+        if(!(mask & CEPH_SETATTR_MTIME)) ts[1].tv_nsec = UTIME_OMIT;
+        if(::utimensat(AT_FDCWD, local.c_str(), ts, at) < 0) return -errno;
+    }
+    return 0;
+}
+
+//newest ctime, bytes, files and entries of path and everything below,
+//as the mds keeps rctime, rbytes, rfiles and rentries
+static void tree_usage(const std::string& path, struct timespec& newest,
+    uint64_t& bytes, uint64_t& files, uint64_t& entries){
+    struct stat st;
+    if(::lstat(path.c_str(), &st) < 0) return;
+    if(st.st_ctim.tv_sec > newest.tv_sec ||
+        (st.st_ctim.tv_sec == newest.tv_sec && st.st_ctim.tv_nsec > newest.tv_nsec))
+        newest = st.st_ctim;
+    if(!S_ISDIR(st.st_mode)){
+        bytes += st.st_size;
+        ++files;
+        return;
+    }
+    DIR *dp = ::opendir(path.c_str());
+    if(dp == nullptr) return;
+    struct dirent *de;
+    while((de = ::readdir(dp)) != nullptr){
+        if(strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        ++entries;
+        tree_usage(path + '/' + de->d_name, newest, bytes, files, entries);
+    }
+    ::closedir(dp);
+}
+
+//the ceph.dir.rctime, rbytes, rfiles and rentries vxattrs, ceph.quota.* are
+//user.ceph.quota.* xattrs of the local dir, user.* are local xattrs
+int LocalBackend::getxattr(struct ceph_mount_info *, const char *path,
+    const char *name, void *value, size_t size){
+    std::string local = resolve(path);
+    if(strncmp(name, "user.", 5) == 0){
+        ssize_t ret = ::getxattr(local.c_str(), name, value, size);
+        return ret < 0 ? -errno : ret;
+    }
+    if(strncmp(name, "ceph.quota.", 11) == 0){
+        ssize_t ret = ::getxattr(local.c_str(), (std::string("user.") + name).c_str(),
+            value, size);
+        if(ret < 0) return errno == ENOTSUP ? -ENODATA : -errno;
+        return ret;
+    }
+    bool rctime = strcmp(name, "ceph.dir.rctime") == 0;
+    bool rbytes = strcmp(name, "ceph.dir.rbytes") == 0;
+    bool rentries = strcmp(name, "ceph.dir.rentries") == 0;
+    if(!rctime && !rbytes && !rentries && strcmp(name, "ceph.dir.rfiles") != 0)
+        return -ENODATA;
+    struct stat st;
+    if(::stat(local.c_str(), &st) < 0) return -errno;
+    if(!S_ISDIR(st.st_mode)) return -ENODATA;
+    struct timespec newest = {0, 0};
+    uint64_t bytes = 0, files = 0, entries = 0;
+    tree_usage(local, newest, bytes, files, entries);
+    char buf[64];
+    int len;
+    if(rctime)
+        len = snprintf(buf, sizeof(buf), "%ld.%09ld", (long)newest.tv_sec,
+            (long)newest.tv_nsec);
+    else
+        len = snprintf(buf, sizeof(buf), "%llu",
+            (unsigned long long)(rbytes ? bytes : rentries ? entries : files));
+    if(size == 0) return len;
+    if((size_t)len > size) return -ERANGE;
+    memcpy(value, buf, len);
+    return len;
+}
+
+int LocalBackend::setxattr(struct ceph_mount_info *, const char *path,
+    const char *name, const void *value, size_t size, int flags){
+    std::string local = resolve(path);
+    if(strncmp(name, "ceph.quota.", 11) == 0){
+        return ::setxattr(local.c_str(), (std::string("user.") + name).c_str(),
+            value, size, flags) < 0 ? -errno : 0;
+    }
+    if(strncmp(name, "user.", 5) != 0) return -ENOTSUP;
+    return ::setxattr(local.c_str(), name, value, size, flags) < 0 ? -errno : 0;
+}
+
+int LocalBackend::statfs(struct ceph_mount_info *, const char *path,
+    struct statvfs *stbuf){
+    std::string local = resolve(path);
+    return ::statvfs(local.c_str(), stbuf) < 0 ? -errno : 0;
+}
+
+int LocalBackend::chdir(struct ceph_mount_info *, const char *path){
+    std::string local = resolve(path);
+    struct stat st;
+    if(::stat(local.c_str(), &st) < 0) return -errno;
+    if(!S_ISDIR(st.st_mode)) return -ENOTDIR;
+    std::lock_guard<std::mutex> guard(lock);
+    cwd = local.substr(base.size() + root.size());
+    if(cwd.empty()) cwd = "/";
+    return 0;
+}
+
+const char* LocalBackend::getcwd(struct ceph_mount_info *){
+    std::lock_guard<std::mutex> guard(lock);
+    return cwd.c_str();
+}
+
+int LocalBackend::opendir(struct ceph_mount_info *, const char *path,
+    struct ceph_dir_result **dirpp){
+    DIR *dp = ::opendir(resolve(path).c_str());
+    if(dp == nullptr) return -errno;
+    local_dir *ld = new local_dir;
+    ld->dp = dp;
+    *dirpp = reinterpret_cast<struct ceph_dir_result*>(ld);
+    return 0;
+}
+
+int LocalBackend::closedir(struct ceph_mount_info *, struct ceph_dir_result *dirp){
+    local_dir *ld = reinterpret_cast<local_dir*>(dirp);
+    int ret = ::closedir(ld->dp);
+    delete ld;
+    return ret < 0 ? -errno : 0;
+}
+
+int LocalBackend::readdir_r(struct ceph_mount_info *, struct ceph_dir_result *dirp,
+    struct dirent *de){
+    local_dir *ld = reinterpret_cast<local_dir*>(dirp);
+    errno = 0;
+    struct dirent *ent = ::readdir(ld->dp);
+    if(ent == nullptr) return errno ? -errno : 0;
+    memcpy(de, ent, sizeof(*de));
+    return 1;
+}
+
+int LocalBackend::readdirplus_r(struct ceph_mount_info *cmount,
+    struct ceph_dir_result *dirp, struct dirent *de, struct ceph_statx *stx,
+    unsigned, unsigned){
+    int ret = readdir_r(cmount, dirp, de);
+    if(ret <= 0) return ret;
+    local_dir *ld = reinterpret_cast<local_dir*>(dirp);
+    struct stat st;
+    if(::fstatat(dirfd(ld->dp), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+        return -errno;
+    to_statx(st, stx);
+    return 1;
+}
+
+int LocalBackend::getdnames(struct ceph_mount_info *, struct ceph_dir_result *dirp,
+    char *buf, int buflen){
+    local_dir *ld = reinterpret_cast<local_dir*>(dirp);
+    int used = 0;
+    while(true){
+        long pos = ::telldir(ld->dp);
+        errno = 0;
+        struct dirent *ent = ::readdir(ld->dp);
+        if(ent == nullptr){
+            if(errno) return -errno;
+            break;
+        }
+        int len = strlen(ent->d_name) + 1;
+        if(used + len > buflen){
+            ::seekdir(ld->dp, pos);
+            if(used == 0) return -ERANGE;
+            break;
+        }
+        memcpy(buf + used, ent->d_name, len);
+        used += len;
+    }
+    return used;
+}
+
+/*
+* fault injection
+*/
+static bool parse_usec(const std::string& s, double& usec){
+    char *end = nullptr;
+    double v = strtod(s.c_str(), &end);
+    if(end == s.c_str() || v < 0) return false;
+    std::string unit(end);
+    if(unit == "us") usec = v;
+    else if(unit.empty() || unit == "ms") usec = v * 1000;
+    else if(unit == "s") usec = v * 1000000;
+    else return false;
+    return true;
+}
+
+//bytes per second, "1250m" or "10gbit"
+static bool parse_rate(const std::string& s, double& rate){
+    char *end = nullptr;
+    double v = strtod(s.c_str(), &end);
+    if(end == s.c_str() || v < 0) return false;
+    std::string unit(end);
+    bool bits = unit.size() >= 3 && unit.substr(unit.size()-3) == "bit";
+    if(bits) unit.erase(unit.size()-3);
+    double k = bits ? 1000 : 1024;
+    if(unit.empty()) rate = v;
+    else if(unit == "k") rate = v * k;
+    else if(unit == "m") rate = v * k * k;
+    else if(unit == "g") rate = v * k * k * k;
+    else return false;
+    if(bits) rate /= 8;
+    return true;
+}
+
+bool latency_dist::parse(const std::string& spec){
+    size_t dots = spec.find("..");
+    if(spec.compare(0, 4, "exp:") == 0){
+        kind = EXP;
+        return parse_usec(spec.substr(4), a);
+    }
+    if(dots != std::string::npos){
+        kind = UNIFORM;
+        return parse_usec(spec.substr(0, dots), a) &&
+            parse_usec(spec.substr(dots+2), b) && a <= b;
+    }
+    kind = FIXED;
+    return parse_usec(spec, a);
+}
+
+int64_t latency_dist::sample(std::mt19937_64& rng) const{
+    switch(kind){
+    case FIXED:
+        return (int64_t)a;
+    case UNIFORM:
+        return (int64_t)std::uniform_real_distribution<double>(a, b)(rng);
+    case EXP:
+        return a > 0 ? (int64_t)std::exponential_distribution<double>(1.0/a)(rng) : 0;
+    default:
+        return 0;
+    }
+}
+
+static std::atomic<uint64_t> fault_backends(0);
+
+FaultBackend::FaultBackend(CephfsBackend *inner, const config& conf):
+    inner(inner),conf(conf),link_free(std::chrono::steady_clock::now()),
+    id(++fault_backends),streams(0){}
+
+const char* FaultBackend::op_name(op_t op){
+    static const char* names[OP_MAX] = {"mount", "open", "close", "read",
+        "write", "mkdirs", "rmdir", "unlink", "rename", "stat", "readdir",
+        "fsync", "setattr", "link"};
+    return names[op];
+}
+
+bool FaultBackend::parse(const char* spec, config& conf, std::string& local_dir){
+    if(spec == nullptr) return false;
+    std::stringstream ss(spec);
+    std::string item;
+    while(std::getline(ss, item, ',')){
+        if(item.empty()) continue;
+        size_t eq = item.find('=');
+        if(eq == std::string::npos) return false;
+        std::string key = item.substr(0, eq), value = item.substr(eq+1);
+        bool ok = true;
+        if(key == "local"){
+            local_dir = value;
+        }else if(key == "lat"){
+            latency_dist dist;
+            ok = dist.parse(value);
+            for(int i = 0; i < OP_MAX; ++i) conf.latency[i] = dist;
+        }else if(key.compare(0, 4, "lat.") == 0){
+            int i = 0;
+            while(i < OP_MAX && key.substr(4) != op_name((op_t)i)) ++i;
+            ok = i < OP_MAX && conf.latency[i].parse(value);
+        }else if(key == "bw"){
+            ok = parse_rate(value, conf.bandwidth);
+        }else if(key == "short" || key == "eio" || key == "eagain"){
+            double &p = key == "short" ? conf.short_write :
+                key == "eio" ? conf.eio : conf.eagain;
+            char *end = nullptr;
+            p = strtod(value.c_str(), &end);
+            ok = end != value.c_str() && *end == '\0' && p >= 0 && p <= 1;
+        }else if(key == "seed"){
+            char *end = nullptr;
+            conf.seed = strtoull(value.c_str(), &end, 10);
+            ok = end != value.c_str() && *end == '\0';
+        }else{
+            ok = false;
+        }
+        if(!ok){
+            log("ERROR")<<"invalid shim option "<<item<<std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+//every thread has its own generator of each instance, no lock on the
+//hot path, the n-th thread of an instance gets stream n of its seed
+std::mt19937_64& FaultBackend::rng(){
+    static thread_local std::unordered_map<uint64_t, std::mt19937_64> gens;
+    auto it = gens.find(id);
+    if(it == gens.end()){
+        std::seed_seq seq{(uint32_t)conf.seed, (uint32_t)(conf.seed >> 32),
+            (uint32_t)streams++};
+        it = gens.emplace(id, std::mt19937_64(seq)).first;
+    }
+    return it->second;
+}
+
+void FaultBackend::delay(op_t op){
+    int64_t usec = conf.latency[op].sample(rng());
+    if(usec > 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(usec));
+}
+
+//all threads share one simulated link
+void FaultBackend::transfer(int64_t bytes){
+    if(conf.bandwidth <= 0 || bytes <= 0) return;
+    auto cost = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(bytes / conf.bandwidth));
+    std::chrono::steady_clock::time_point done;
+    {
+        std::lock_guard<std::mutex> guard(link_lock);
+        auto now = std::chrono::steady_clock::now();
+        if(link_free < now) link_free = now;
+        link_free += cost;
+        done = link_free;
+    }
+    std::this_thread::sleep_until(done);
+}
+
+int FaultBackend::fault(op_t op){
+    delay(op);
+    if(conf.eio <= 0 && conf.eagain <= 0) return 0;
+    double u = std::uniform_real_distribution<double>(0, 1)(rng());
+    if(u < conf.eio) return -EIO;
+    if(u < conf.eio + conf.eagain) return -EAGAIN;
+    return 0;
+}
+
+int FaultBackend::create(struct ceph_mount_info **cmount, const char *id){
+    return inner->create(cmount, id);
+}
+
+int FaultBackend::conf_read_file(struct ceph_mount_info *cmount, const char *path){
+    return inner->conf_read_file(cmount, path);
+}
+
+int FaultBackend::conf_set(struct ceph_mount_info *cmount, const char *option,
+    const char *value){
+    return inner->conf_set(cmount, option, value);
+}
+
+int FaultBackend::mount(struct ceph_mount_info *cmount, const char *root){
+    delay(OP_MOUNT);
+    return inner->mount(cmount, root);
+}
+
+void FaultBackend::shutdown(struct ceph_mount_info *cmount){
+    inner->shutdown(cmount);
+}
+
+int FaultBackend::open(struct ceph_mount_info *cmount, const char *path,
+    int flags, mode_t mode){
+    int ret = fault(OP_OPEN);
+    return ret ? ret : inner->open(cmount, path, flags, mode);
+}
+
+int FaultBackend::close(struct ceph_mount_info *cmount, int fd){
+    delay(OP_CLOSE);
+    return inner->close(cmount, fd);
+}
+
+int FaultBackend::read(struct ceph_mount_info *cmount, int fd, char *buf,
+    int64_t size, int64_t offset){
+    int ret = fault(OP_READ);
+    if(ret) return ret;
+    ret = inner->read(cmount, fd, buf, size, offset);
+    transfer(ret);
+    return ret;
+}
+
+int FaultBackend::write(struct ceph_mount_info *cmount, int fd, const char *buf,
+    int64_t size, int64_t offset){
+    int ret = fault(OP_WRITE);
+    if(ret) return ret;
+    if(size > 1 && conf.short_write > 0 &&
+        std::uniform_real_distribution<double>(0, 1)(rng()) < conf.short_write){
+        size = std::uniform_int_distribution<int64_t>(1, size-1)(rng());
+    }
+    transfer(size);
+    return inner->write(cmount, fd, buf, size, offset);
+}
+
+static int64_t iov_bytes(const struct iovec *iov, int iovcnt){
+    int64_t n = 0;
+    for(int i = 0; i < iovcnt; ++i) n += iov[i].iov_len;
+    return n;
+}
+
+int FaultBackend::preadv(struct ceph_mount_info *cmount, int fd,
+    const struct iovec *iov, int iovcnt, int64_t offset){
+    int ret = fault(OP_READ);
+    if(ret) return ret;
+    ret = inner->preadv(cmount, fd, iov, iovcnt, offset);
+    transfer(ret);
+    return ret;
+}
+
+//a short vectored write keeps the leading buffers
+int FaultBackend::pwritev(struct ceph_mount_info *cmount, int fd,
+    const struct iovec *iov, int iovcnt, int64_t offset){
+    int ret = fault(OP_WRITE);
+    if(ret) return ret;
+    int64_t size = iov_bytes(iov, iovcnt);
+    if(size > 1 && conf.short_write > 0 &&
+        std::uniform_real_distribution<double>(0, 1)(rng()) < conf.short_write){
+        int64_t keep = std::uniform_int_distribution<int64_t>(1, size-1)(rng());
+        std::vector<struct iovec> part;
+        for(int i = 0; i < iovcnt && keep > 0; ++i){
+            struct iovec v = iov[i];
+            if((int64_t)v.iov_len > keep) v.iov_len = keep;
+            keep -= v.iov_len;
+            part.push_back(v);
+        }
+        transfer(iov_bytes(part.data(), part.size()));
+        return inner->pwritev(cmount, fd, part.data(), part.size(), offset);
+    }
+    transfer(size);
+    return inner->pwritev(cmount, fd, iov, iovcnt, offset);
+}
+
+int64_t FaultBackend::lseek(struct ceph_mount_info *cmount, int fd, int64_t offset,
+    int whence){
+    int ret = fault(OP_STAT);
+    return ret ? ret : inner->lseek(cmount, fd, offset, whence);
+}
+
+int FaultBackend::fsync(struct ceph_mount_info *cmount, int fd, int syncdataonly){
+    int ret = fault(OP_FSYNC);
+    return ret ? ret : inner->fsync(cmount, fd, syncdataonly);
+}
+
+int FaultBackend::ftruncate(struct ceph_mount_info *cmount, int fd, int64_t size){
+    int ret = fault(OP_SETATTR);
+    return ret ? ret : inner->ftruncate(cmount, fd, size);
+}
+
+int FaultBackend::fstatx(struct ceph_mount_info *cmount, int fd, struct ceph_statx *stx,
+    unsigned int want, unsigned int flags){
+    int ret = fault(OP_STAT);
+    return ret ? ret : inner->fstatx(cmount, fd, stx, want, flags);
+}
+
+int FaultBackend::fallocate(struct ceph_mount_info *cmount, int fd, int mode,
+    int64_t offset, int64_t length){
+    int ret = fault(OP_SETATTR);
+    return ret ? ret : inner->fallocate(cmount, fd, mode, offset, length);
+}
+
+int FaultBackend::mkdirs(struct ceph_mount_info *cmount, const char *path, mode_t mode){
+    int ret = fault(OP_MKDIRS);
+    return ret ? ret : inner->mkdirs(cmount, path, mode);
+}
+
+int FaultBackend::rmdir(struct ceph_mount_info *cmount, const char *path){
+    int ret = fault(OP_RMDIR);
+    return ret ? ret : inner->rmdir(cmount, path);
+}
+
+int FaultBackend::unlink(struct ceph_mount_info *cmount, const char *path){
+    int ret = fault(OP_UNLINK);
+    return ret ? ret : inner->unlink(cmount, path);
+}
+
+int FaultBackend::rename(struct ceph_mount_info *cmount, const char *from, const char *to){
+    int ret = fault(OP_RENAME);
+    return ret ? ret : inner->rename(cmount, from, to);
+}
+
+int FaultBackend::link(struct ceph_mount_info *cmount, const char *existing,
+    const char *newname){
+    int ret = fault(OP_LINK);
+    return ret ? ret : inner->link(cmount, existing, newname);
+}
+
+int FaultBackend::symlink(struct ceph_mount_info *cmount, const char *existing,
+    const char *newname){
+    int ret = fault(OP_LINK);
+    return ret ? ret : inner->symlink(cmount, existing, newname);
+}
+
+int FaultBackend::readlink(struct ceph_mount_info *cmount, const char *path, char *buf,
+    int64_t size){
+    int ret = fault(OP_STAT);
+    return ret ? ret : inner->readlink(cmount, path, buf, size);
+}
+
+int FaultBackend::statx(struct ceph_mount_info *cmount, const char *path,
+    struct ceph_statx *stx, unsigned int want, unsigned int flags){
+    int ret = fault(OP_STAT);
+    return ret ? ret : inner->statx(cmount, path, stx, want, flags);
+}
+
+int FaultBackend::setattrx(struct ceph_mount_info *cmount, const char *path,
+    struct ceph_statx *stx, int mask, int flags){
+    int ret = fault(OP_SETATTR);
+    return ret ? ret : inner->setattrx(cmount, path, stx, mask, flags);
+}
+
+int FaultBackend::getxattr(struct ceph_mount_info *cmount, const char *path,
+    const char *name, void *value, size_t size){
+    int ret = fault(OP_STAT);
+    return ret ? ret : inner->getxattr(cmount, path, name, value, size);
+}
+
+int FaultBackend::setxattr(struct ceph_mount_info *cmount, const char *path,
+    const char *name, const void *value, size_t size, int flags){
+    int ret = fault(OP_SETATTR);
+    return ret ? ret : inner->setxattr(cmount, path, name, value, size, flags);
+}
+
+int FaultBackend::statfs(struct ceph_mount_info *cmount, const char *path,
+    struct statvfs *stbuf){
+    int ret = fault(OP_STAT);
+    return ret ? ret : inner->statfs(cmount, path, stbuf);
+}
+
+int FaultBackend::chdir(struct ceph_mount_info *cmount, const char *path){
+    int ret = fault(OP_STAT);
+    return ret ? ret : inner->chdir(cmount, path);
+}
+
+const char* FaultBackend::getcwd(struct ceph_mount_info *cmount){
+    return inner->getcwd(cmount);
+}
+
+//a dir listing costs one round trip, entries come in batches
+int FaultBackend::opendir(struct ceph_mount_info *cmount, const char *path,
+    struct ceph_dir_result **dirpp){
+    int ret = fault(OP_READDIR);
+    return ret ? ret : inner->opendir(cmount, path, dirpp);
+}
+
+int FaultBackend::closedir(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp){
+    return inner->closedir(cmount, dirp);
+}
+
+int FaultBackend::readdir_r(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp,
+    struct dirent *de){
+    return inner->readdir_r(cmount, dirp, de);
+}
+
+int FaultBackend::readdirplus_r(struct ceph_mount_info *cmount,
+    struct ceph_dir_result *dirp, struct dirent *de, struct ceph_statx *stx,
+    unsigned want, unsigned flags){
+    return inner->readdirplus_r(cmount, dirp, de, stx, want, flags);
+}
+
+int FaultBackend::getdnames(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp,
+    char *buf, int buflen){
+    return inner->getdnames(cmount, dirp, buf, buflen);
+}
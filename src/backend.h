@@ -0,0 +1,261 @@
+/*
+* cephfs backend
+* all libcephfs calls of CephfsHelper go through CephfsBackend,
+* so that a local stand-in or a fault injector can be plugged in
+*
+* 20261019
+*/
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <atomic>
+#include <sys/uio.h>
+#include <sys/statvfs.h>
+#include <cephfs/libcephfs.h>
+
+//same signatures as libcephfs, return negative errno on failure
+class CephfsBackend {
+public:
+    virtual ~CephfsBackend(){}
+    virtual int create(struct ceph_mount_info **cmount, const char *id) = 0;
+    virtual int conf_read_file(struct ceph_mount_info *cmount, const char *path) = 0;
+    virtual int conf_set(struct ceph_mount_info *cmount, const char *option,
+        const char *value) = 0;
+    virtual int mount(struct ceph_mount_info *cmount, const char *root) = 0;
+    virtual void shutdown(struct ceph_mount_info *cmount) = 0;
+
+    virtual int open(struct ceph_mount_info *cmount, const char *path,
+        int flags, mode_t mode) = 0;
+    virtual int close(struct ceph_mount_info *cmount, int fd) = 0;
+    virtual int read(struct ceph_mount_info *cmount, int fd, char *buf,
+        int64_t size, int64_t offset) = 0;
+    virtual int write(struct ceph_mount_info *cmount, int fd, const char *buf,
+        int64_t size, int64_t offset) = 0;
+    virtual int preadv(struct ceph_mount_info *cmount, int fd, const struct iovec *iov,
+        int iovcnt, int64_t offset) = 0;
+    virtual int pwritev(struct ceph_mount_info *cmount, int fd, const struct iovec *iov,
+        int iovcnt, int64_t offset) = 0;
+    virtual int64_t lseek(struct ceph_mount_info *cmount, int fd, int64_t offset,
+        int whence) = 0;
+    virtual int fsync(struct ceph_mount_info *cmount, int fd, int syncdataonly) = 0;
+    virtual int ftruncate(struct ceph_mount_info *cmount, int fd, int64_t size) = 0;
+    virtual int fstatx(struct ceph_mount_info *cmount, int fd, struct ceph_statx *stx,
+        unsigned int want, unsigned int flags) = 0;
+    virtual int fallocate(struct ceph_mount_info *cmount, int fd, int mode,
+        int64_t offset, int64_t length) = 0;
+
+    virtual int mkdirs(struct ceph_mount_info *cmount, const char *path, mode_t mode) = 0;
+    virtual int rmdir(struct ceph_mount_info *cmount, const char *path) = 0;
+    virtual int unlink(struct ceph_mount_info *cmount, const char *path) = 0;
+    virtual int rename(struct ceph_mount_info *cmount, const char *from, const char *to) = 0;
+    virtual int link(struct ceph_mount_info *cmount, const char *existing,
+        const char *newname) = 0;
+    virtual int symlink(struct ceph_mount_info *cmount, const char *existing,
+        const char *newname) = 0;
+    virtual int readlink(struct ceph_mount_info *cmount, const char *path, char *buf,
+        int64_t size) = 0;
+    virtual int statx(struct ceph_mount_info *cmount, const char *path,
+        struct ceph_statx *stx, unsigned int want, unsigned int flags) = 0;
+    virtual int setattrx(struct ceph_mount_info *cmount, const char *path,
+        struct ceph_statx *stx, int mask, int flags) = 0;
+    virtual int getxattr(struct ceph_mount_info *cmount, const char *path,
+        const char *name, void *value, size_t size) = 0;
+    virtual int setxattr(struct ceph_mount_info *cmount, const char *path,
+        const char *name, const void *value, size_t size, int flags) = 0;
+    virtual int statfs(struct ceph_mount_info *cmount, const char *path,
+        struct statvfs *stbuf) = 0;
+    virtual int chdir(struct ceph_mount_info *cmount, const char *path) = 0;
+    virtual const char* getcwd(struct ceph_mount_info *cmount) = 0;
+
+    virtual int opendir(struct ceph_mount_info *cmount, const char *path,
+        struct ceph_dir_result **dirpp) = 0;
+    virtual int closedir(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp) = 0;
+    virtual int readdir_r(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp,
+        struct dirent *de) = 0;
+    virtual int readdirplus_r(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp,
+        struct dirent *de, struct ceph_statx *stx, unsigned want, unsigned flags) = 0;
+    virtual int getdnames(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp,
+        char *buf, int buflen) = 0;
+};
+
+//the real libcephfs, shared by all helpers
+extern CephfsBackend* libcephfs_backend();
+
+//local stand-in, keeps the cephfs tree under a local dir
+class LocalBackend : public CephfsBackend {
+    std::string base;
+    std::string cwd;
+    std::string root;
+    std::mutex lock;
+private:
+    std::string resolve(const char *path);
+public:
+    explicit LocalBackend(const char *dir);
+    int create(struct ceph_mount_info **cmount, const char *id) override;
+    int conf_read_file(struct ceph_mount_info *cmount, const char *path) override;
+    int conf_set(struct ceph_mount_info *cmount, const char *option,
+        const char *value) override;
+    int mount(struct ceph_mount_info *cmount, const char *root) override;
+    void shutdown(struct ceph_mount_info *cmount) override;
+    int open(struct ceph_mount_info *cmount, const char *path,
+        int flags, mode_t mode) override;
+    int close(struct ceph_mount_info *cmount, int fd) override;
+    int read(struct ceph_mount_info *cmount, int fd, char *buf,
+        int64_t size, int64_t offset) override;
+    int write(struct ceph_mount_info *cmount, int fd, const char *buf,
+        int64_t size, int64_t offset) override;
+    int preadv(struct ceph_mount_info *cmount, int fd, const struct iovec *iov,
+        int iovcnt, int64_t offset) override;
+    int pwritev(struct ceph_mount_info *cmount, int fd, const struct iovec *iov,
+        int iovcnt, int64_t offset) override;
+    int64_t lseek(struct ceph_mount_info *cmount, int fd, int64_t offset,
+        int whence) override;
+    int fsync(struct ceph_mount_info *cmount, int fd, int syncdataonly) override;
+    int ftruncate(struct ceph_mount_info *cmount, int fd, int64_t size) override;
+    int fstatx(struct ceph_mount_info *cmount, int fd, struct ceph_statx *stx,
+        unsigned int want, unsigned int flags) override;
+    int fallocate(struct ceph_mount_info *cmount, int fd, int mode,
+        int64_t offset, int64_t length) override;
+    int mkdirs(struct ceph_mount_info *cmount, const char *path, mode_t mode) override;
+    int rmdir(struct ceph_mount_info *cmount, const char *path) override;
+    int unlink(struct ceph_mount_info *cmount, const char *path) override;
+    int rename(struct ceph_mount_info *cmount, const char *from, const char *to) override;
+    int link(struct ceph_mount_info *cmount, const char *existing,
+        const char *newname) override;
+    int symlink(struct ceph_mount_info *cmount, const char *existing,
+        const char *newname) override;
+    int readlink(struct ceph_mount_info *cmount, const char *path, char *buf,
+        int64_t size) override;
+    int statx(struct ceph_mount_info *cmount, const char *path,
+        struct ceph_statx *stx, unsigned int want, unsigned int flags) override;
+    int setattrx(struct ceph_mount_info *cmount, const char *path,
+        struct ceph_statx *stx, int mask, int flags) override;
+    int getxattr(struct ceph_mount_info *cmount, const char *path,
+        const char *name, void *value, size_t size) override;
+    int setxattr(struct ceph_mount_info *cmount, const char *path,
+        const char *name, const void *value, size_t size, int flags) override;
+    int statfs(struct ceph_mount_info *cmount, const char *path,
+        struct statvfs *stbuf) override;
+    int chdir(struct ceph_mount_info *cmount, const char *path) override;
+    const char* getcwd(struct ceph_mount_info *cmount) override;
+    int opendir(struct ceph_mount_info *cmount, const char *path,
+        struct ceph_dir_result **dirpp) override;
+    int closedir(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp) override;
+    int readdir_r(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp,
+        struct dirent *de) override;
+    int readdirplus_r(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp,
+        struct dirent *de, struct ceph_statx *stx, unsigned want, unsigned flags) override;
+    int getdnames(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp,
+        char *buf, int buflen) override;
+};
+
+//latency of one op class, in microseconds
+//"2ms" fixed, "1ms..3ms" uniform, "exp:2ms" exponential
+struct latency_dist {
+    enum kind_t {NONE, FIXED, UNIFORM, EXP} kind;
+    double a, b;
+    latency_dist():kind(NONE),a(0),b(0){}
+    bool parse(const std::string& spec);
+    int64_t sample(std::mt19937_64& rng) const;
+};
+
+//wraps another backend, injects latency, bandwidth cap,
+//short writes and transient -EIO/-EAGAIN errors
+class FaultBackend : public CephfsBackend {
+public:
+    enum op_t {OP_MOUNT, OP_OPEN, OP_CLOSE, OP_READ, OP_WRITE, OP_MKDIRS,
+        OP_RMDIR, OP_UNLINK, OP_RENAME, OP_STAT, OP_READDIR, OP_FSYNC, OP_SETATTR,
+        OP_LINK, OP_MAX};
+    struct config {
+        latency_dist latency[OP_MAX];
+        double bandwidth;   //bytes per second, 0 no cap
+        double short_write; //probability of a short write
+        double eio;         //probability of -EIO
+        double eagain;      //probability of -EAGAIN
+        uint64_t seed;
+        config():bandwidth(0),short_write(0),eio(0),eagain(0),seed(0){}
+    };
+private:
+    CephfsBackend *inner;
+    config conf;
+    std::mutex link_lock;
+    std::chrono::steady_clock::time_point link_free;
+    //key of the generators of this instance, stream of the next thread
+    uint64_t id;
+    std::atomic<uint64_t> streams;
+private:
+    std::mt19937_64& rng();
+    void delay(op_t op);
+    void transfer(int64_t bytes);
+    int fault(op_t op);
+public:
+    FaultBackend(CephfsBackend *inner, const config& conf);
+    static const char* op_name(op_t op);
+    //"lat=2ms,lat.open=1ms..3ms,bw=10gbit,short=0.01,eio=0.001,eagain=0.001,seed=1"
+    static bool parse(const char* spec, config& conf, std::string& local_dir);
+
+    int create(struct ceph_mount_info **cmount, const char *id) override;
+    int conf_read_file(struct ceph_mount_info *cmount, const char *path) override;
+    int conf_set(struct ceph_mount_info *cmount, const char *option,
+        const char *value) override;
+    int mount(struct ceph_mount_info *cmount, const char *root) override;
+    void shutdown(struct ceph_mount_info *cmount) override;
+    int open(struct ceph_mount_info *cmount, const char *path,
+        int flags, mode_t mode) override;
+    int close(struct ceph_mount_info *cmount, int fd) override;
+    int read(struct ceph_mount_info *cmount, int fd, char *buf,
+        int64_t size, int64_t offset) override;
+    int write(struct ceph_mount_info *cmount, int fd, const char *buf,
+        int64_t size, int64_t offset) override;
+    int preadv(struct ceph_mount_info *cmount, int fd, const struct iovec *iov,
+        int iovcnt, int64_t offset) override;
+    int pwritev(struct ceph_mount_info *cmount, int fd, const struct iovec *iov,
+        int iovcnt, int64_t offset) override;
+    int64_t lseek(struct ceph_mount_info *cmount, int fd, int64_t offset,
+        int whence) override;
+    int fsync(struct ceph_mount_info *cmount, int fd, int syncdataonly) override;
+    int ftruncate(struct ceph_mount_info *cmount, int fd, int64_t size) override;
+    int fstatx(struct ceph_mount_info *cmount, int fd, struct ceph_statx *stx,
+        unsigned int want, unsigned int flags) override;
+    int fallocate(struct ceph_mount_info *cmount, int fd, int mode,
+        int64_t offset, int64_t length) override;
+    int mkdirs(struct ceph_mount_info *cmount, const char *path, mode_t mode) override;
+    int rmdir(struct ceph_mount_info *cmount, const char *path) override;
+    int unlink(struct ceph_mount_info *cmount, const char *path) override;
+    int rename(struct ceph_mount_info *cmount, const char *from, const char *to) override;
+    int link(struct ceph_mount_info *cmount, const char *existing,
+        const char *newname) override;
+    int symlink(struct ceph_mount_info *cmount, const char *existing,
+        const char *newname) override;
+    int readlink(struct ceph_mount_info *cmount, const char *path, char *buf,
+        int64_t size) override;
+    int statx(struct ceph_mount_info *cmount, const char *path,
+        struct ceph_statx *stx, unsigned int want, unsigned int flags) override;
+    int setattrx(struct ceph_mount_info *cmount, const char *path,
+        struct ceph_statx *stx, int mask, int flags) override;
+    int getxattr(struct ceph_mount_info *cmount, const char *path,
+        const char *name, void *value, size_t size) override;
+    int setxattr(struct ceph_mount_info *cmount, const char *path,
+        const char *name, const void *value, size_t size, int flags) override;
+    int statfs(struct ceph_mount_info *cmount, const char *path,
+        struct statvfs *stbuf) override;
+    int chdir(struct ceph_mount_info *cmount, const char *path) override;
+    const char* getcwd(struct ceph_mount_info *cmount) override;
+    int opendir(struct ceph_mount_info *cmount, const char *path,
+        struct ceph_dir_result **dirpp) override;
+    int closedir(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp) override;
+    int readdir_r(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp,
+        struct dirent *de) override;
+    int readdirplus_r(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp,
+        struct dirent *de, struct ceph_statx *stx, unsigned want, unsigned flags) override;
+    int getdnames(struct ceph_mount_info *cmount, struct ceph_dir_result *dirp,
+        char *buf, int buflen) override;
+};
+
+#endif
@@ -0,0 +1,154 @@
+/*
+* transfer buffers
+*
+* 20261019
+*/
+
+#include "utils.h"
+#include "bufpool.h"
+
+#include <sys/mman.h>
+
+//one cephfs object, a multiple of the 2MB hugepage
+static constexpr size_t TRANSFER_CHUNK = 4*1024*1024; //4MB
+static constexpr size_t DEFAULT_CAP = 512*1024*1024;  //512MB
+
+buffer_pool& transfer_buffers(){
+    static buffer_pool pool(TRANSFER_CHUNK, DEFAULT_CAP);
+    return pool;
+}
+
+void set_buffer_memory(uint64_t cap_bytes, bool hugepages){
+    transfer_buffers().configure(cap_bytes, hugepages);
+    log("INFO")<<"transfer buffers up to "<<cap_bytes<<" bytes"
+        <<(hugepages ? " on hugepages" : "")<<std::endl;
+}
+
+std::string buffer_stats(){
+    buffer_pool::stats_t st = transfer_buffers().stats();
+    std::stringstream ss;
+    ss<<"acquires "<<st.acquires<<" hits "<<st.hits
+        <<" waits "<<st.waits<<" peak "<<st.peak;
+    return ss.str();
+}
+
+buffer_pool::buffer_pool(size_t chunk_size, size_t cap_bytes):
+    chunk(chunk_size),cap(cap_bytes),allocated(0),hugepages(false){
+    memset(&counters, 0, sizeof(counters));
+}
+
+buffer_pool::~buffer_pool(){
+    for(char *p : free_list) unmap_chunk(p);
+}
+
+//mmap is page aligned, hugepages come from the reserved pool
+//or transparent hugepages when none are reserved
+char* buffer_pool::map_chunk(){
+    void *p = MAP_FAILED;
+    if(hugepages){
+        p = mmap(nullptr, chunk, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    }
+    if(p == MAP_FAILED){
+        p = mmap(nullptr, chunk, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if(p == MAP_FAILED) return nullptr;
+        if(hugepages) madvise(p, chunk, MADV_HUGEPAGE);
+    }
+    return (char*)p;
+}
+
+void buffer_pool::unmap_chunk(char* p){
+    munmap(p, chunk);
+}
+
+//drop free chunks above the cap, called under lock
+void buffer_pool::trim(){
+    while(allocated > cap && !free_list.empty()){
+        unmap_chunk(free_list.back());
+        free_list.pop_back();
+        allocated -= chunk;
+    }
+}
+
+void buffer_pool::configure(size_t cap_bytes, bool hugepages){
+    std::lock_guard<std::mutex> guard(lock);
+    cap = cap_bytes;
+    if(this->hugepages != hugepages){
+        //new chunks only, chunks in use keep their pages
+        this->hugepages = hugepages;
+        for(char *p : free_list) unmap_chunk(p);
+        allocated -= free_list.size() * chunk;
+        free_list.clear();
+    }
+    trim();
+    cond.notify_all();
+}
+
+char* buffer_pool::try_acquire(){
+    std::unique_lock<std::mutex> guard(lock);
+    if(free_list.empty() && allocated > 0 && allocated + chunk > cap) return nullptr;
+    ++counters.acquires;
+    if(!free_list.empty()){
+        ++counters.hits;
+        char *p = free_list.back();
+        free_list.pop_back();
+        return p;
+    }
+    allocated += chunk;
+    counters.peak = std::max<uint64_t>(counters.peak, allocated);
+    guard.unlock();
+    char *p = map_chunk();
+    if(p == nullptr){
+        guard.lock();
+        allocated -= chunk;
+        --counters.acquires;
+        cond.notify_all();
+        log("ERROR")<<"Unable to allocate transfer buffer of "<<chunk<<" bytes"<<std::endl;
+    }
+    return p;
+}
+
+char* buffer_pool::acquire(){
+    bool waited = false;
+    while(true){
+        char *p = try_acquire();
+        if(p != nullptr) return p;
+        std::unique_lock<std::mutex> guard(lock);
+        if(allocated == 0) return nullptr; //mmap failed
+        if(!waited){
+            ++counters.waits;
+            waited = true;
+        }
+        cond.wait(guard, [this]{
+            return !free_list.empty() || allocated + chunk <= cap;
+        });
+    }
+}
+
+void buffer_pool::release(char* p){
+    if(p == nullptr) return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        free_list.push_back(p);
+        trim();
+    }
+    cond.notify_one();
+}
+
+buffer_pool::stats_t buffer_pool::stats(){
+    std::lock_guard<std::mutex> guard(lock);
+    return counters;
+}
+
+buffer_lease::buffer_lease(buffer_pool& pool, int max):pool(pool){
+    char *p = pool.acquire();
+    if(p == nullptr) return;
+    chunks.push_back(p);
+    while((int)chunks.size() < max && (p = pool.try_acquire()) != nullptr)
+        chunks.push_back(p);
+}
+
+buffer_lease::~buffer_lease(){
+    for(char *p : chunks) pool.release(p);
+}
@@ -0,0 +1,72 @@
+/*
+* transfer buffers
+* page aligned chunks shared by all transfers, optionally on hugepages,
+* the total memory is capped, transfers wait for a chunk at the cap
+*
+* 20261019
+*/
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class buffer_pool {
+public:
+    struct stats_t {
+        uint64_t acquires; //chunks handed out
+        uint64_t hits;     //of them reused from the free list
+        uint64_t waits;    //acquires that waited at the cap
+        uint64_t peak;     //most bytes allocated at once
+    };
+private:
+    size_t chunk;
+    std::mutex lock;
+    std::condition_variable cond;
+    std::vector<char*> free_list;
+    size_t cap;
+    size_t allocated;  //bytes mapped, in use or free
+    bool hugepages;
+    stats_t counters;
+private:
+    char* map_chunk();
+    void unmap_chunk(char* p);
+    void trim();
+public:
+    buffer_pool(size_t chunk_size, size_t cap_bytes);
+    ~buffer_pool();
+    size_t chunk_size() const{ return chunk;}
+    //cap below one chunk still allows one chunk
+    void configure(size_t cap_bytes, bool hugepages);
+    //wait until a chunk fits under the cap
+    char* acquire();
+    //nullptr at the cap
+    char* try_acquire();
+    void release(char* p);
+    stats_t stats();
+    buffer_pool(const buffer_pool&) = delete;
+    buffer_pool& operator=(const buffer_pool&) = delete;
+};
+
+//the pool of all transfers
+extern buffer_pool& transfer_buffers();
+
+//chunks of one transfer, waits for the first, takes the rest only
+//while they fit, so a transfer always runs and never blocks another
+class buffer_lease {
+    buffer_pool& pool;
+    std::vector<char*> chunks;
+public:
+    buffer_lease(buffer_pool& pool, int max);
+    ~buffer_lease();
+    int size() const{ return chunks.size();}
+    char* const* data() const{ return chunks.data();}
+    char* operator[](int i) const{ return chunks[i];}
+    buffer_lease(const buffer_lease&) = delete;
+    buffer_lease& operator=(const buffer_lease&) = delete;
+};
+
+#endif
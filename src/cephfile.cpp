@@ -0,0 +1,129 @@
+/*
+* cephfs file handle
+*
+* 20261019
+*/
+
+#include "utils.h"
+#include "cephfstool.h"
+#include "trace.h"
+
+CephFile::CephFile(CephfsHelper& helper, const char* path, int flags, mode_t mode):
+    helper(nullptr),fd(-1){
+    if(path == nullptr || *path == '\0') return;
+    if(helper.cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return;
+    }
+    if((flags & O_CREAT) && !helper.get_safe_path(path)) return;
+    int ret = helper.open_file(path, flags, mode);
+    if(ret < 0){
+        error("Unable to open cephfs file ", path, -ret);
+        return;
+    }
+    this->helper = &helper;
+    this->fd = ret;
+    this->path = path;
+}
+
+CephFile::CephFile(CephFile&& other):helper(other.helper),fd(other.fd),
+    path(std::move(other.path)){
+    other.helper = nullptr;
+    other.fd = -1;
+}
+
+CephFile& CephFile::operator=(CephFile&& other){
+    if(this != &other){
+        close();
+        helper = other.helper;
+        fd = other.fd;
+        path = std::move(other.path);
+        other.helper = nullptr;
+        other.fd = -1;
+    }
+    return *this;
+}
+
+bool CephFile::close(){
+    if(fd < 0) return true;
+    int ret = helper->close_file(fd, path.c_str());
+    fd = -1;
+    helper = nullptr;
+    if(ret < 0){
+        error("Unable to close cephfs file ", path.c_str(), -ret);
+        return false;
+    }
+    return true;
+}
+
+int64_t CephFile::pread(char* buf, size_t len, uint64_t offset){
+    if(fd < 0 || (buf == nullptr && len > 0)) return -1;
+    return helper->read_at(fd, path.c_str(), buf, len, offset);
+}
+
+int64_t CephFile::pwrite(const char* buf, size_t len, uint64_t offset){
+    if(fd < 0 || (buf == nullptr && len > 0)) return -1;
+    return helper->write_at(fd, path.c_str(), buf, len, offset);
+}
+
+int64_t CephFile::preadv(const struct iovec* iov, int iovcnt, uint64_t offset){
+    if(fd < 0 || iov == nullptr || iovcnt <= 0) return -1;
+    trace_scope ts("read", path.c_str());
+    int ret = helper->fs->preadv(helper->cmount, fd, iov, iovcnt, offset);
+    ts.set_bytes(ret);
+    if(ret < 0){
+        error("Unable to read data from cephfs ", path.c_str(), -ret);
+        return -1;
+    }
+    helper->data_rate.acquire(ret);
+    return ret;
+}
+
+int64_t CephFile::pwritev(const struct iovec* iov, int iovcnt, uint64_t offset){
+    if(fd < 0 || iov == nullptr || iovcnt <= 0) return -1;
+    int64_t size = 0;
+    for(int i = 0; i < iovcnt; ++i) size += iov[i].iov_len;
+    helper->data_rate.acquire(size);
+    trace_scope ts("write", path.c_str(), size);
+    int ret = helper->fs->pwritev(helper->cmount, fd, iov, iovcnt, offset);
+    if(ret < 0){
+        error("Unable to write data to cephfs, path ", path.c_str(), -ret);
+        return -1;
+    }
+    return ret;
+}
+
+bool CephFile::fsync(bool dataonly){
+    if(fd < 0) return false;
+    trace_scope ts("fsync", path.c_str());
+    int ret = helper->fs->fsync(helper->cmount, fd, dataonly ? 1 : 0);
+    if(ret < 0){
+        error("Unable to fsync cephfs file ", path.c_str(), -ret);
+        return false;
+    }
+    return true;
+}
+
+bool CephFile::truncate(uint64_t size){
+    if(fd < 0) return false;
+    helper->ops_rate.acquire(1);
+    trace_scope ts("truncate", path.c_str(), size);
+    int ret = helper->fs->ftruncate(helper->cmount, fd, size);
+    if(ret < 0){
+        error("Unable to truncate cephfs file ", path.c_str(), -ret);
+        return false;
+    }
+    return true;
+}
+
+bool CephFile::fallocate(uint64_t offset, uint64_t len, int mode){
+    if(fd < 0) return false;
+    helper->ops_rate.acquire(1);
+    trace_scope ts("fallocate", path.c_str(), len);
+    int ret = helper->fs->fallocate(helper->cmount, fd, mode, offset, len);
+    if(ret < 0){
+        error("Unable to fallocate cephfs file ", path.c_str(), -ret);
+        return false;
+    }
+    return true;
+}
@@ -6,12 +6,53 @@
 
 #include "utils.h"
 #include "cephfstool.h"
+#include "trace.h"
+#include "workers.h"
+#include "localio.h"
+#include "sha256.h"
+#include "manifest.h"
+#include "walker.h"
+#include "watcher.h"
+#include "tar.h"
+#include "pack.h"
+
+#include <unistd.h>
+#include <ftw.h>
+#include <csignal>
+#include <climits>
+#include <set>
 
 bool log_to_file = true;
 std::string log_dir_prefix = "./";
 std::ofstream log_stream;
+std::mutex log_lock;
 
-static constexpr size_t BUFFER_SIZE = 1024*1024; //1MB
+//libcephfs returns int bytes
+static constexpr size_t MAX_IO_SIZE = 1024*1024*1024; //1GB
+//pooled buffers of a stream copy, see bufpool.h
+static constexpr int STREAM_DEPTH = 4;
+//zero runs skipped by transfers, a cephfs write per run is costly,
+//local holes are page sized
+static constexpr size_t UPLOAD_ZERO_BLOCK = 64*1024;
+static constexpr size_t DOWNLOAD_ZERO_BLOCK = 4096;
+//pooled buffers of a file transfer
+static constexpr int LOCAL_IO_DEPTH = 4;
+//manifest of an uploaded tree, in its root dir on cephfs
+static const char* MANIFEST_NAME = ".cephfs-manifest";
+//rctime of the last mirror run, in the local root dir
+static const char* MIRROR_STATE_NAME = ".cephfs-mirror";
+//done markers of sharded tree ops, one dir per op, path and shard count
+static const char* SHARD_DIR = "/.cephfs-shards";
+//on each dedup entry, the content it was recorded with
+static const char* DEDUP_XATTR = "user.cephfstool.dedup";
+//index of a small file pack, see pack.h, and the index images cached
+static const char* PACK_INDEX_NAME = "pack.idx";
+static constexpr size_t PACK_CACHE = 64;
+//tree transfers, see transfer_plan: files below SMALL_FILE go in batches
+//of up to SMALL_BATCH, a file costs about FILE_COST bytes of transfer in ops
+static constexpr uint64_t SMALL_FILE = 1024*1024;
+static constexpr size_t SMALL_BATCH = 16;
+static constexpr uint64_t FILE_COST = 1024*1024;
 
 void set_log_dir(const char* dir){
     if(dir != nullptr){
@@ -45,8 +86,10 @@ std::string version(){
 }
 
 void CephfsHelper::shutdown(){
+    //queued async ops still need the mount
+    set_async(async_threads, async_queue);
     if(cmount){
-        ceph_shutdown(cmount);
+        fs->shutdown(cmount);
         cmount = nullptr;
     }
 }
@@ -78,46 +121,74 @@ void CephfsHelper::set_user_key_file(const char* key) {
     }
 }
 
+bool CephfsHelper::set_shim(const char* spec){
+    if(spec == nullptr || *spec == '\0') return false;
+    if(cmount != nullptr){
+        log("ERROR")<<"shim must be set before login"<<std::endl;
+        return false;
+    }
+    FaultBackend::config conf;
+    std::string local_dir;
+    if(!FaultBackend::parse(spec, conf, local_dir)) return false;
+    CephfsBackend *base = libcephfs_backend();
+    stand_in.reset();
+    if(!local_dir.empty()){
+        stand_in.reset(new LocalBackend(local_dir.c_str()));
+        base = stand_in.get();
+    }
+    injector.reset(new FaultBackend(base, conf));
+    fs = injector.get();
+    log("INFO")<<"cephfs shim "<<spec<<std::endl;
+    return true;
+}
+
 bool CephfsHelper::login(const char* user, const char* key, const char* root){
     //user and root can be nullptr, then use default (admin and /)
     if(key != nullptr && *key != '\0'){
         user_key = key;
     }
+    const char* shim = getenv("CEPHFS_TOOL_SHIM");
+    if(injector == nullptr && shim != nullptr && *shim != '\0'){
+        if(!set_shim(shim)) return false;
+    }
     int ret = 0;
-    ret = ceph_create(&cmount, user);
+    ret = fs->create(&cmount, user);
     if(ret < 0){
         error("Unable to create cephfs with ", user, -ret);
         return false;
     }
     if(!config_file.empty()){
-        ret = ceph_conf_read_file(cmount, config_file.c_str());
+        ret = fs->conf_read_file(cmount, config_file.c_str());
         if(ret < 0){
             error("Unable to read conf file ", config_file.c_str(), -ret);
             return false;
         }
     }
     if(!mon_addr.empty()){
-        ret = ceph_conf_set(cmount, "mon host", mon_addr.c_str());
+        ret = fs->conf_set(cmount, "mon host", mon_addr.c_str());
         if(ret < 0){
             error("Unable to set cephfs config ", "", -ret);
             return false;
         }
     }
     if(!user_key.empty()){
-        ret = ceph_conf_set(cmount, "key", user_key.c_str());
+        ret = fs->conf_set(cmount, "key", user_key.c_str());
         if(ret < 0){
             error("Unable to set cephfs config ", "", -ret);
             return false;
         }
     } else if(!user_key_file.empty()){
-        ret = ceph_conf_set(cmount, "keyfile", user_key_file.c_str());
+        ret = fs->conf_set(cmount, "keyfile", user_key_file.c_str());
         if(ret < 0){
             error("Unable to set cephfs config ", "", -ret);
             return false;
         } 
     }
 
-    ret = ceph_mount(cmount, root);
+    {
+        trace_scope ts("mount", root);
+        ret = fs->mount(cmount, root);
+    }
     if(ret < 0){
         error("Unable to open cephfs ", root, -ret);
         return false;
@@ -142,25 +213,30 @@ bool CephfsHelper::write_str(const char* path, const char* content){
         return false;
     }
     if(!get_safe_path(path)) return false;
-    int fd = ceph_open(cmount, path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    int fd = open_file(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
     if(fd <= 0){
         error("Unable to open cephfs file ", path, -fd);
         return false;
     }
     size_t size = strlen(content);
-    int ret = ceph_write(cmount, fd, content, size, 0);
+    int ret;
+    {
+        data_rate.acquire(size);
+        trace_scope ts("write", path, size);
+        ret = fs->write(cmount, fd, content, size, 0);
+    }
     if(ret < 0){
         error("Unable to write data to cephfs, path: ", path, -ret);
-        ceph_close(cmount, fd);
+        close_file(fd, path);
         return false;
     }
     if(ret < (int)size){
         log("ERROR")<<"cephfs actual write "<<ret<<" bytes, but request is "
             <<size<<" bytes."<<std::endl;
-        ceph_close(cmount, fd);
+        close_file(fd, path);
         return false;
     }
-    ceph_close(cmount, fd);
+    close_file(fd, path);
     log("INFO")<<"cephfs write to "<<path<<", "<<ret<<" bytes"<<std::endl;
     return true;
 }
@@ -173,27 +249,208 @@ bool CephfsHelper::read_str(const char* path, char* buffer, size_t size){
         return false;
     }
     if(!get_safe_path(path)) return false;
-    int fd = ceph_open(cmount, path, O_RDONLY, 0644);
+    int fd = open_file(path, O_RDONLY, 0644);
     if(fd <= 0){
         error("Unable to open cephfs file ", path, -fd);
         return false;
     }
     //maybe not read all content when size is smaller than the size of fd
-    int ret = ceph_read(cmount, fd, buffer, size, 0);
+    trace_scope ts("read", path);
+    int ret = fs->read(cmount, fd, buffer, size, 0);
+    ts.set_bytes(ret);
+    data_rate.acquire(ret);
     if(ret < 0){
         error("Unable to read data from cephfs, path: ", path, -ret);
-        ceph_close(cmount, fd);
+        close_file(fd, path);
         return false;
     }
-    ceph_close(cmount, fd);
+    close_file(fd, path);
     log("INFO")<<"cephfs read from "<<path<<", "<<ret<<" bytes"<<std::endl;
     return true;
 }
 
 std::string CephfsHelper::read_str(const char* path){
-    char buffer[1024];
-    if(!read_str(path, buffer, 1024)) return "cephfs occurs an error";
-    return std::string(buffer);
+    uint64_t sz;
+    if(!length(path, sz)) return "cephfs occurs an error";
+    std::string content(sz, '\0');
+    int64_t ret = read_into(path, &content[0], sz, 0);
+    if(ret < 0) return "cephfs occurs an error";
+    content.resize(ret);
+    return content;
+}
+
+int64_t CephfsHelper::read_into(const char* path, char* buf, size_t len, uint64_t offset){
+    if(path == nullptr || *path == '\0' || (buf == nullptr && len > 0)) return -1;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return -1;
+    }
+    int fd = open_file(path, O_RDONLY, 0644);
+    if(fd <= 0){
+        error("Unable to open cephfs file ", path, -fd);
+        return -1;
+    }
+    int64_t ret = read_at(fd, path, buf, len, offset);
+    close_file(fd, path);
+    if(ret >= 0)
+        log("INFO")<<"cephfs read from "<<path<<", "<<ret<<" bytes at "<<offset<<std::endl;
+    return ret;
+}
+
+int64_t CephfsHelper::write_from(const char* path, const char* buf, size_t len,
+    uint64_t offset){
+    if(path == nullptr || *path == '\0' || (buf == nullptr && len > 0)) return -1;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return -1;
+    }
+    if(!get_safe_path(path)) return -1;
+    int fd = open_file(path, O_WRONLY|O_CREAT, 0644);
+    if(fd <= 0){
+        error("Unable to open cephfs file ", path, -fd);
+        return -1;
+    }
+    int64_t ret = write_at(fd, path, buf, len, offset);
+    close_file(fd, path);
+    if(ret >= 0)
+        log("INFO")<<"cephfs write to "<<path<<", "<<ret<<" bytes at "<<offset<<std::endl;
+    return ret;
+}
+
+//read until len bytes or eof
+int64_t CephfsHelper::read_at(int fd, const char* path, char* buf, size_t len,
+    uint64_t offset){
+    size_t done = 0;
+    while(done < len){
+        trace_scope ts("read", path);
+        int ret = fs->read(cmount, fd, buf + done,
+            std::min(len - done, MAX_IO_SIZE), offset + done);
+        ts.set_bytes(ret);
+        if(ret < 0){
+            error("Unable to read data from cephfs ", path, -ret);
+            return -1;
+        }
+        data_rate.acquire(ret);
+        if(ret == 0) break;
+        done += ret;
+    }
+    return done;
+}
+
+//write all len bytes, short writes are retried
+int64_t CephfsHelper::write_at(int fd, const char* path, const char* buf, size_t len,
+    uint64_t offset){
+    size_t done = 0;
+    while(done < len){
+        size_t n = std::min(len - done, MAX_IO_SIZE);
+        data_rate.acquire(n);
+        trace_scope ts("write", path, n);
+        int ret = fs->write(cmount, fd, buf + done, n, offset + done);
+        if(ret <= 0){
+            error("Unable to write data to cephfs, path ", path, -ret);
+            return -1;
+        }
+        done += ret;
+    }
+    return done;
+}
+
+//fill buf from a local fd, less than len only at eof
+static int64_t read_local(int fd, char* buf, size_t len){
+    size_t done = 0;
+    while(done < len){
+        ssize_t ret = ::read(fd, buf + done, len - done);
+        if(ret < 0 && errno == EINTR) continue;
+        if(ret < 0){
+            error("Unable to read local stream ", "", errno);
+            return -1;
+        }
+        if(ret == 0) break;
+        done += ret;
+    }
+    return done;
+}
+
+static bool write_local(int fd, const char* buf, size_t len){
+    size_t done = 0;
+    while(done < len){
+        ssize_t ret = ::write(fd, buf + done, len - done);
+        if(ret < 0 && errno == EINTR) continue;
+        if(ret < 0){
+            error("Unable to write local stream ", "", errno);
+            return false;
+        }
+        done += ret;
+    }
+    return true;
+}
+
+bool CephfsHelper::write_stream(const char* path, int local_fd){
+    if(path == nullptr || *path == '\0' || local_fd < 0) return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    trace_scope tf("upload", path);
+    if(!get_safe_path(path)) return false;
+    int fd = open_file(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd <= 0){
+        error("Unable to open cephfs file ", path, -fd);
+        return false;
+    }
+    //local reads run ahead while cephfs writes the previous buffers
+    buffer_pipeline pipe(transfer_buffers(), STREAM_DEPTH);
+    uint64_t offset = 0;
+    bool ok = pipe.run(
+        [local_fd](char* buf, size_t len){ return read_local(local_fd, buf, len);},
+        [&](const char* buf, size_t len){
+            bool ret = for_each_data(buf, len, UPLOAD_ZERO_BLOCK,
+                [&](size_t start, size_t n){
+                    return write_at(fd, path, buf + start, n, offset + start) >= 0;
+                });
+            offset += len;
+            return ret;
+        });
+    if(ok){
+        //trailing zeros were skipped
+        int ret = fs->ftruncate(cmount, fd, offset);
+        if(ret < 0){
+            error("Unable to truncate cephfs file ", path, -ret);
+            ok = false;
+        }
+    }
+    close_file(fd, path);
+    if(!ok) return false;
+    log("INFO")<<"cephfs write stream to "<<path<<", "<<offset<<" bytes"<<std::endl;
+    return true;
+}
+
+bool CephfsHelper::read_stream(const char* path, int local_fd){
+    if(path == nullptr || *path == '\0' || local_fd < 0) return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    trace_scope tf("download", path);
+    int fd = open_file(path, O_RDONLY, 0644);
+    if(fd <= 0){
+        error("Unable to open cephfs file ", path, -fd);
+        return false;
+    }
+    //cephfs reads run ahead until eof, the size is not needed
+    buffer_pipeline pipe(transfer_buffers(), STREAM_DEPTH);
+    uint64_t offset = 0;
+    bool ok = pipe.run(
+        [&](char* buf, size_t len){
+            int64_t n = read_at(fd, path, buf, len, offset);
+            if(n > 0) offset += n;
+            return n;
+        },
+        [local_fd](const char* buf, size_t len){ return write_local(local_fd, buf, len);});
+    close_file(fd, path);
+    if(!ok) return false;
+    log("INFO")<<"cephfs read stream from "<<path<<", "<<offset<<" bytes"<<std::endl;
+    return true;
 }
 
 bool CephfsHelper::remove(const char* path){
@@ -202,7 +459,11 @@ bool CephfsHelper::remove(const char* path){
         log("ERROR")<<"No user log in cephfs"<<std::endl;
         return false;
     }
-    int ret = ceph_unlink(cmount, path);
+    ops_rate.acquire(1);
+    trace_scope ts("unlink", path);
+    op_probe probe;
+    int ret = fs->unlink(cmount, path);
+    probe.done(ret);
     if(ret < 0){
         error("Unable to remove from cephfs, path: ", path, -ret);
         return false;
@@ -218,48 +479,313 @@ bool CephfsHelper::write(const char* path, const char* local_path){
         log("ERROR")<<"No user log in cephfs"<<std::endl;
         return false;
     }
-    std::ifstream is(local_path);
-    if(!is){
-        error("Unable to open local file ", local_path, 0);
+    if(strcmp(local_path, "-") == 0) return write_stream(path, STDIN_FILENO);
+    struct stat st;
+    //the size of a pipe is not known up front, a file at path is replaced
+    if(::stat(local_path, &st) == 0 && S_ISREG(st.st_mode) && preflight_check){
+        struct ceph_statx stx;
+        uint64_t old_size = 0, old_entries = 0;
+        ops_rate.acquire(1);
+        if(fs->statx(cmount, path, &stx, CEPH_STATX_MODE|CEPH_STATX_SIZE, 0) == 0 &&
+            S_ISREG(stx.stx_mode)){
+            old_size = stx.stx_size;
+            old_entries = 1;
+        }
+        if(!preflight(path, (uint64_t)st.st_size > old_size ? st.st_size - old_size : 0,
+            1 - old_entries)) return false;
+    }
+    return write_file(path, local_path, true);
+}
+
+//one io_uring per transfer thread, buffers come from the pool per file
+static local_io& thread_local_io(bool uring){
+    static thread_local std::unique_ptr<local_io> io;
+    if(!io || io->wants_uring() != uring)
+        io.reset(new local_io(uring));
+    return *io;
+}
+
+//sha-256 of the whole local file, holes read as zeros
+static bool hash_local(int fd, char* buf, size_t len, std::string& hex){
+    sha256 h;
+    uint64_t offset = 0;
+    while(true){
+        ssize_t n = ::pread(fd, buf, len, offset);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0) return false;
+        if(n == 0) break;
+        h.update(buf, n);
+        offset += n;
+    }
+    hex = h.hex_digest();
+    return true;
+}
+
+//two levels of 256 dirs keep each index dir small at millions of entries
+//an entry is a hardlink of the first upload of the content, no data of its own
+std::string CephfsHelper::dedup_entry(const std::string& hex){
+    return dedup_dir + '/' + hex.substr(0, 2) + '/' + hex.substr(2, 2) + '/' + hex.substr(4);
+}
+
+//sha-256 of a whole cephfs file
+bool CephfsHelper::hash_remote(const char* path, char* buf, size_t len, std::string& hex){
+    int fd = open_file(path, O_RDONLY, 0644);
+    if(fd <= 0){
+        error("Unable to open cephfs file ", path, -fd);
         return false;
     }
-    if(!get_safe_path(path)) return false;
-    int fd = ceph_open(cmount, path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    sha256 h;
+    uint64_t offset = 0;
+    int64_t n;
+    while((n = read_at(fd, path, buf, len, offset)) > 0){
+        h.update(buf, n);
+        offset += n;
+    }
+    close_file(fd, path);
+    if(n < 0) return false;
+    hex = h.hex_digest();
+    return true;
+}
+
+//"hash size mtime_ns" of the content an entry was recorded with
+static std::string dedup_stamp(const std::string& hex, const struct ceph_statx& stx){
+    return hex + ' ' + std::to_string(stx.stx_size) + ' ' +
+        std::to_string((int64_t)stx.stx_mtime.tv_sec * 1000000000 + stx.stx_mtime.tv_nsec);
+}
+
+//an entry is used only if it still holds its content, a write through any
+//link changes the mtime, then the entry is hashed again, buf of len bytes
+bool CephfsHelper::dedup_check(const std::string& entry, const std::string& hex,
+    const struct ceph_statx& stx, char* buf, size_t len){
+    std::string stamp = dedup_stamp(hex, stx);
+    char value[160];
+    ops_rate.acquire(1);
+    int ret = fs->getxattr(cmount, entry.c_str(), DEDUP_XATTR, value, sizeof(value));
+    if(ret > 0 && stamp.compare(0, std::string::npos, value, ret) == 0) return true;
+    std::string cur;
+    if(!hash_remote(entry.c_str(), buf, len, cur) || cur != hex) return false;
+    ops_rate.acquire(1);
+    ret = fs->setxattr(cmount, entry.c_str(), DEDUP_XATTR, stamp.data(), stamp.size(), 0);
+    if(ret < 0) error("Unable to stamp dedup entry ", entry.c_str(), -ret);
+    return true;
+}
+
+//1 path is now a link of the entry, 0 upload it, -1 error
+int CephfsHelper::dedup_link(const char* path, const std::string& entry,
+    const std::string& hex, uint64_t size, char* buf, size_t len){
+    struct ceph_statx stx, cur;
+    ops_rate.acquire(1);
+    int found = fs->statx(cmount, entry.c_str(), &stx,
+        CEPH_STATX_MODE|CEPH_STATX_INO|CEPH_STATX_SIZE|CEPH_STATX_MTIME, AT_SYMLINK_NOFOLLOW);
+    if(found == 0 && (!S_ISREG(stx.stx_mode) || stx.stx_size != size ||
+        !dedup_check(entry, hex, stx, buf, len))){
+        //changed in place through another link, the upload indexes it again
+        log("WARN")<<"dedup entry "<<entry<<" does not match its content, drop it"<<std::endl;
+        ops_rate.acquire(1);
+        fs->unlink(cmount, entry.c_str());
+        found = -ENOENT;
+    }else if(found < 0 && found != -ENOENT){
+        error("Unable to stat dedup entry ", entry.c_str(), -found);
+    }
+    ops_rate.acquire(1);
+    int ret = fs->statx(cmount, path, &cur, CEPH_STATX_INO|CEPH_STATX_NLINK,
+        AT_SYMLINK_NOFOLLOW);
+    if(ret == 0 && found == 0 && cur.stx_ino == stx.stx_ino) return 1;
+    //a rewrite in place would change every link of the old content
+    if(ret == 0 && (found == 0 || cur.stx_nlink > 1)){
+        ops_rate.acquire(1);
+        ret = fs->unlink(cmount, path);
+        if(ret < 0){
+            error("Unable to remove from cephfs, path: ", path, -ret);
+            return -1;
+        }
+    }
+    if(found < 0) return 0;
+    ops_rate.acquire(1);
+    trace_scope ts("link", path);
+    ret = fs->link(cmount, entry.c_str(), path);
+    if(ret < 0){
+        error("Unable to link dedup entry to ", path, -ret);
+        return 0;
+    }
+    return 1;
+}
+
+//index a new upload, stamped with its hash, a racing upload of the same
+//content may win
+void CephfsHelper::dedup_record(const char* path, const std::string& entry,
+    const std::string& hex){
+    if(!get_safe_path(entry.c_str())) return;
+    ops_rate.acquire(1);
+    trace_scope ts("link", entry.c_str());
+    int ret = fs->link(cmount, path, entry.c_str());
+    if(ret < 0){
+        if(ret != -EEXIST) error("Unable to add dedup entry ", entry.c_str(), -ret);
+        return;
+    }
+    struct ceph_statx stx;
+    ops_rate.acquire(1);
+    ret = fs->statx(cmount, entry.c_str(), &stx, CEPH_STATX_SIZE|CEPH_STATX_MTIME,
+        AT_SYMLINK_NOFOLLOW);
+    if(ret == 0){
+        std::string stamp = dedup_stamp(hex, stx);
+        ops_rate.acquire(1);
+        ret = fs->setxattr(cmount, entry.c_str(), DEDUP_XATTR, stamp.data(), stamp.size(), 0);
+    }
+    if(ret < 0) error("Unable to stamp dedup entry ", entry.c_str(), -ret);
+}
+
+//mkdirs false when the parent is known to exist, as in tree walks
+//only data regions are read, zero blocks in them are skipped too,
+//truncate sets the size, so holes stay holes in cephfs
+//local reads of the next chunks are queued while cephfs writes one
+bool CephfsHelper::write_file(const char* path, const char* local_path, bool mkdirs){
+    trace_scope tf("upload", path);
+    buffer_lease lease(transfer_buffers(), LOCAL_IO_DEPTH);
+    if(lease.size() == 0) return false;
+    local_io *io = &thread_local_io(local_uring);
+    io->attach(lease.data(), lease.size(), transfer_buffers().chunk_size());
+    const size_t chunk_size = io->buffer_size();
+    int local_fd = ::open(local_path, O_RDONLY);
+    struct stat st;
+    if(local_fd < 0 || fstat(local_fd, &st) < 0){
+        error("Unable to open local file ", local_path, errno);
+        if(local_fd >= 0) ::close(local_fd);
+        return false;
+    }
+    //large files bypass the page cache, whole aligned chunks are read
+    bool direct = false;
+    if(direct_io_size > 0 && (uint64_t)st.st_size >= direct_io_size){
+        int direct_fd = ::open(local_path, O_RDONLY|O_DIRECT);
+        if(direct_fd >= 0){
+            ::close(local_fd);
+            local_fd = direct_fd;
+            direct = true;
+        }
+    }
+    if(mkdirs && !get_safe_path(path)){
+        ::close(local_fd);
+        return false;
+    }
+    //the local file is read twice, the hash decides if it is uploaded
+    std::string entry, hex;
+    if(!dedup_dir.empty()){
+        bool hashed;
+        {
+            trace_scope ts("hash", local_path, st.st_size);
+            hashed = hash_local(local_fd, lease[0], chunk_size, hex);
+        }
+        if(!hashed){
+            error("Unable to read local file ", local_path, errno);
+            ::close(local_fd);
+            return false;
+        }
+        entry = dedup_entry(hex);
+        int linked = dedup_link(path, entry, hex, st.st_size, lease[0], chunk_size);
+        if(linked != 0){
+            ::close(local_fd);
+            if(linked > 0) log("INFO")<<"cephfs link "<<path<<" to "<<entry
+                <<", "<<st.st_size<<" bytes deduplicated"<<std::endl;
+            return linked > 0;
+        }
+    }
+    int fd = open_file(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
     if(fd <= 0){
         error("Unable to open cephfs file ", path, -fd);
+        ::close(local_fd);
         return false;
     }
-   
-    //buffer write
-    char buffer[BUFFER_SIZE] = {0};
-    size_t offset = 0;
-    while(is){
-        is.read(buffer, BUFFER_SIZE);
-        int read_count = (int)is.gcount(), write_count;
-        if(read_count <= 0) break;
-        //retry write to ceph
-        int cur_write_count = read_count, buffer_offset = 0;
-        size_t cur_offset = offset;
-        while(true){
-            write_count = ceph_write(cmount, fd, buffer + buffer_offset, 
-                    cur_write_count, cur_offset);
-            if(write_count < 0){
-                error("Unable to write data to ceph, path ", path, -write_count);
-                ceph_close(cmount, fd); 
-                return false;
+
+    struct chunk {
+        int buf;
+        uint64_t offset;
+        size_t len;
+    };
+    std::deque<chunk> queue;
+    std::vector<int> free_bufs;
+    std::vector<int64_t> result(io->buffers());
+    std::vector<bool> ready(io->buffers());
+    for(int i = io->buffers() - 1; i >= 0; --i) free_bufs.push_back(i);
+    uint64_t size = st.st_size, pos = 0, next = 0, end = 0, written = 0;
+    bool ok = true, eof = false;
+    local_io::completion done;
+    while(ok){
+        while(!eof && !free_bufs.empty()){
+            if(next >= end){
+                //next data region
+                if(pos >= size){
+                    eof = true;
+                    break;
+                }
+                off_t data = direct ? pos : ::lseek(local_fd, pos, SEEK_DATA);
+                if(data < 0 && errno == ENXIO){ //only a hole left
+                    eof = true;
+                    break;
+                }
+                if(data < 0) data = pos; //no SEEK_DATA, all is data
+                off_t hole = direct ? size : ::lseek(local_fd, data, SEEK_HOLE);
+                end = hole < 0 ? size : std::min<uint64_t>(hole, size);
+                next = data;
+                pos = std::max<uint64_t>(end, pos + 1);
+                continue;
             }
-            if(write_count >= cur_write_count) break;
-            log("WARN")<<"cephfs actual write "<<write_count
-                <<" bytes, but the request is "
-                <<cur_write_count<<" bytes, will retry"<<std::endl;
-            cur_write_count -= write_count;
-            cur_offset += write_count;
-            buffer_offset += write_count;
+            chunk c = {free_bufs.back(), next, (size_t)std::min<uint64_t>(chunk_size, end - next)};
+            free_bufs.pop_back();
+            ready[c.buf] = false;
+            //chunks are page aligned, O_DIRECT reads whole pages
+            size_t len = direct ? (c.len + 4095) / 4096 * 4096 : c.len;
+            io->submit(local_io::request{false, local_fd, c.buf, 0, len, c.offset});
+            queue.push_back(c);
+            next += c.len;
+        }
+        if(queue.empty()) break;
+        chunk c = queue.front();
+        queue.pop_front();
+        while(!ready[c.buf] && io->wait(done)){
+            ready[done.req.buf] = true;
+            result[done.req.buf] = done.res;
+        }
+        int64_t n = ready[c.buf] ? result[c.buf] : -EIO;
+        char *buffer = io->buffer(c.buf);
+        while(n >= 0 && (size_t)n < c.len){
+            //short read, finish it here
+            ssize_t ret = ::pread(local_fd, buffer + n, c.len - n, c.offset + n);
+            if(ret < 0) n = -errno;
+            else if(ret == 0) break; //local file shrank
+            else n += ret;
+        }
+        if(n < 0){
+            error("Unable to read local file ", local_path, -n);
+            ok = false;
+            break;
+        }
+        n = std::min<int64_t>(n, c.len);
+        if((size_t)n < c.len) eof = true;
+        ok = for_each_data(buffer, n, UPLOAD_ZERO_BLOCK,
+            [&](size_t start, size_t len){
+                if(write_at(fd, path, buffer + start, len, c.offset + start) < 0)
+                    return false;
+                written += len;
+                return true;
+            });
+        free_bufs.push_back(c.buf);
+    }
+    //the kernel may still fill buffers of a failed transfer
+    while(io->wait(done));
+    ::close(local_fd);
+    if(ok){
+        trace_scope ts("truncate", path, size);
+        int ret = fs->ftruncate(cmount, fd, size);
+        if(ret < 0){
+            error("Unable to truncate cephfs file ", path, -ret);
+            ok = false;
         }
-        offset += read_count;
     }
-    log("INFO")<<"cephfs write to "<<path<<", "<<offset<<" bytes"<<std::endl;
-    ceph_close(cmount, fd); 
+    close_file(fd, path);
+    if(!ok) return false;
+    if(!entry.empty()) dedup_record(path, entry, hex);
+    log("INFO")<<"cephfs write to "<<path<<", "<<size<<" bytes, "
+        <<written<<" bytes of data"<<std::endl;
     return true;
 }
 
@@ -270,38 +796,165 @@ bool CephfsHelper::read(const char* path, const char* local_path){
         log("ERROR")<<"No user log in cephfs"<<std::endl;
         return false;
     }
-    std::ofstream os(local_path);
-    if(!os){
-        error("Unable to open local file ", local_path, 0);
+    if(strcmp(local_path, "-") == 0) return read_stream(path, STDOUT_FILENO);
+    return read_file(path, local_path, true);
+}
+
+static bool pwrite_local(int fd, const char* buf, size_t len, uint64_t offset){
+    size_t done = 0;
+    while(done < len){
+        ssize_t ret = ::pwrite(fd, buf + done, len - done, offset + done);
+        if(ret < 0 && errno == EINTR) continue;
+        if(ret < 0) return false;
+        done += ret;
+    }
+    return true;
+}
+
+//holes of the cephfs file and zero blocks are not written,
+//the local file gets its size from truncate, so they become holes
+//local writes are queued while cephfs reads the next chunks
+bool CephfsHelper::read_file(const char* path, const char* local_path, bool mkdirs){
+    trace_scope tf("download", path);
+    buffer_lease lease(transfer_buffers(), LOCAL_IO_DEPTH);
+    if(lease.size() == 0) return false;
+    local_io *io = &thread_local_io(local_uring);
+    io->attach(lease.data(), lease.size(), transfer_buffers().chunk_size());
+    const size_t chunk_size = io->buffer_size();
+    int local_fd = ::open(local_path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(local_fd < 0){
+        error("Unable to open local file ", local_path, errno);
         return false;
     }
-    if(!get_safe_path(path)) return false;
-    int fd = ceph_open(cmount, path, O_RDONLY, 0644);
+    if(mkdirs && !get_safe_path(path)){
+        ::close(local_fd);
+        return false;
+    }
+    int fd = open_file(path, O_RDONLY, 0644);
     if(fd <= 0){
         error("Unable to open cephfs file ", path, -fd);
+        ::close(local_fd);
         return false;
     }
-    //buffer read
-    char buffer[BUFFER_SIZE];
-    int read_count;
-    size_t offset = 0;
-    while(true){
-        memset(buffer, 0, BUFFER_SIZE);
-        read_count = ceph_read(cmount, fd, buffer, BUFFER_SIZE, offset);
-        if(read_count < 0){
-            error("Unable to read data from cephfs ", path, -read_count);
-            ceph_close(cmount, fd);
-            return false;
-        }
-        os.write(buffer, read_count);
-        offset += read_count;
-        if(read_count < (int)BUFFER_SIZE) break;
+    int64_t size = fs->lseek(cmount, fd, 0, SEEK_END);
+    if(size < 0){
+        error("Unable to get size of cephfs file ", path, -size);
+        close_file(fd, path);
+        ::close(local_fd);
+        return false;
     }
-    ceph_close(cmount, fd);
-    log("INFO")<<"cephfs read from "<<path<<", "<<offset<<" bytes"<<std::endl;
+    //a buffer is free again when all its local writes are done
+    std::vector<int> pending(io->buffers(), 0), free_bufs;
+    for(int i = io->buffers() - 1; i >= 0; --i) free_bufs.push_back(i);
+    bool ok = true;
+    auto complete = [&](const local_io::completion& d){
+        const local_io::request& r = d.req;
+        bool good = d.res >= 0;
+        if(good && (size_t)d.res < r.len){
+            good = pwrite_local(local_fd, io->buffer(r.buf) + r.buf_off + d.res,
+                r.len - d.res, r.offset + d.res);
+        }
+        if(!good){
+            error("Unable to write local file ", local_path, d.res < 0 ? -d.res : errno);
+            ok = false;
+        }
+        if(--pending[r.buf] == 0) free_bufs.push_back(r.buf);
+    };
+    local_io::completion done;
+    int64_t pos = 0, offset = 0, written = 0;
+    while(ok && pos < size){
+        int64_t data = fs->lseek(cmount, fd, pos, SEEK_DATA);
+        if(data == -ENXIO) break; //only a hole left
+        if(data < 0) data = pos;
+        int64_t hole = fs->lseek(cmount, fd, data, SEEK_HOLE);
+        int64_t end = hole < 0 ? size : std::min(hole, size);
+        offset = data;
+        while(ok && offset < end){
+            while(free_bufs.empty() && io->wait(done)) complete(done);
+            if(!ok || free_bufs.empty()) break;
+            int b = free_bufs.back();
+            free_bufs.pop_back();
+            char *buffer = io->buffer(b);
+            int64_t read_count = read_at(fd, path, buffer,
+                std::min<int64_t>(chunk_size, end - offset), offset);
+            if(read_count < 0){
+                ok = false;
+                break;
+            }
+            if(read_count == 0){ //cephfs file shrank
+                free_bufs.push_back(b);
+                size = offset;
+                break;
+            }
+            for_each_data(buffer, read_count, DOWNLOAD_ZERO_BLOCK,
+                [&](size_t start, size_t n){
+                    io->submit(local_io::request{true, local_fd, b, start, n,
+                        (uint64_t)(offset + start)});
+                    ++pending[b];
+                    written += n;
+                    return true;
+                });
+            if(pending[b] == 0) free_bufs.push_back(b);
+            offset += read_count;
+        }
+        pos = std::max(end, pos + 1);
+    }
+    close_file(fd, path);
+    while(io->wait(done)) complete(done);
+    if(ok && ::ftruncate(local_fd, size) < 0){
+        error("Unable to truncate local file ", local_path, errno);
+        ok = false;
+    }
+    ::close(local_fd);
+    if(!ok) return false;
+    log("INFO")<<"cephfs read from "<<path<<", "<<size<<" bytes, "
+        <<written<<" bytes of data"<<std::endl;
     return true;
 }
 
+//a rewrite of a dedup linked path gets an inode of its own first, else
+//every link of the old content would change. the truncate waits for an
+//fstatx of the open fd, served from the caps the open got, so a new file
+//costs no extra round trip and plain user hardlinks still share content
+int CephfsHelper::open_file(const char* path, int flags, mode_t mode){
+    bool trunc = (flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY;
+    ops_rate.acquire(1);
+    trace_scope ts("open", path);
+    op_probe probe;
+    int fd = fs->open(cmount, path, trunc ? flags & ~O_TRUNC : flags, mode);
+    probe.done(fd);
+    if(fd < 0 || !trunc) return fd;
+    struct ceph_statx stx;
+    int ret = fs->fstatx(cmount, fd, &stx, CEPH_STATX_NLINK|CEPH_STATX_SIZE|CEPH_STATX_MODE, 0);
+    if(ret == 0 && stx.stx_nlink > 1){
+        char value[160];
+        ops_rate.acquire(1);
+        ret = fs->getxattr(cmount, path, DEDUP_XATTR, value, sizeof(value));
+        if(ret >= 0 || ret == -ERANGE){
+            fs->close(cmount, fd);
+            ops_rate.acquire(1);
+            ret = fs->unlink(cmount, path);
+            if(ret < 0 && ret != -ENOENT) return ret;
+            ops_rate.acquire(1);
+            return fs->open(cmount, path, flags|O_CREAT, stx.stx_mode & 07777);
+        }
+        ret = 0;
+    }
+    if(ret == 0 && stx.stx_size == 0) return fd;
+    ops_rate.acquire(1);
+    ret = fs->ftruncate(cmount, fd, 0);
+    if(ret < 0){
+        fs->close(cmount, fd);
+        return ret;
+    }
+    return fd;
+}
+
+int CephfsHelper::close_file(int fd, const char* path){
+    trace_scope ts("close", path);
+    return fs->close(cmount, fd);
+}
+
 void CephfsHelper::get_parent(const char* path, std::string &parent){
     if(path == nullptr || *path == '\0'){
         parent = "/";
@@ -334,13 +987,17 @@ bool CephfsHelper::get_safe_path(const char* path){
     }
     //cephfs strip leading .. auto
     const char* _path = path;
+    std::string tp;
     if(path[strlen(path)-1] != '/'){
-        std::string tp;
         get_parent(path, tp);
         _path = tp.c_str();
     }
     if(strlen(_path) == 1 && *_path == '/') return true;
-    int ret = ceph_mkdirs(cmount, _path, 0777);
+    ops_rate.acquire(1);
+    trace_scope ts("mkdirs", _path);
+    op_probe probe;
+    int ret = fs->mkdirs(cmount, _path, 0777);
+    probe.done(ret);
     if(ret < 0 && ret != -EEXIST){
         error("Unable to mkdir: ", _path, -ret);
         return false;
@@ -356,7 +1013,8 @@ bool CephfsHelper::length(const char* path, uint64_t &sz){
         return false;
     }
     struct ceph_statx stx;
-    int ret = ceph_statx(cmount, path, &stx, CEPH_STATX_SIZE, AT_SYMLINK_NOFOLLOW);
+    ops_rate.acquire(1);
+    int ret = fs->statx(cmount, path, &stx, CEPH_STATX_SIZE, AT_SYMLINK_NOFOLLOW);
     if(ret < 0){
         error("Unable to get file size, path: ", path, -ret);
         return false;
@@ -372,7 +1030,11 @@ bool CephfsHelper::rm_dir(const char* path){
         log("ERROR")<<"No user log in cephfs"<<std::endl;
         return false;
     }
-    int ret = ceph_rmdir(cmount, path);
+    ops_rate.acquire(1);
+    trace_scope ts("rmdir", path);
+    op_probe probe;
+    int ret = fs->rmdir(cmount, path);
+    probe.done(ret);
     if(ret < 0){
         error("Unable to rm dir, path: ", path, -ret);
         return false;
@@ -381,55 +1043,79 @@ bool CephfsHelper::rm_dir(const char* path){
     return true;
 }
 
-//rmdir recursive
+//rmdir recursive, files are removed by the workers,
+//then the dirs level by level from the deepest
+//a shard removes its files and every dir it finds empty, the dirs
+//of files of other shards are left to the last shard or the merge
 bool CephfsHelper::rmdir(const char* path){
     if(path == nullptr || *path == '\0') return false;
     if(cmount == nullptr){
         log("ERROR")<<"No user log in cephfs"<<std::endl;
         return false;
     }
-    struct ceph_dir_result *dirp;
-    struct dirent de;
-    struct ceph_statx stx;
-    int ret;
-    ret = ceph_opendir(cmount, path, &dirp);
-    if(ret < 0){
-        error("Unable to open path: ", path, -ret);
-        return false;
-    }
-    while ((ret = ceph_readdirplus_r(cmount, dirp, &de, &stx, 
-        CEPH_STATX_INO, AT_NO_ATTR_SYNC, nullptr)) > 0) {
-        std::string new_dir = de.d_name;
-        if(new_dir != "." && new_dir != "..") {
-            new_dir = path;
-            new_dir += '/';
-            new_dir += de.d_name;
-            if(S_ISDIR(stx.stx_mode)) {
-                if(!rmdir(new_dir.c_str())) return false;
-            } else {
-                if(!remove(new_dir.c_str())) return false;
+    if(shard_count <= 1) return remove_dirs(path);
+    //gone, all shards before this one are done
+    uint64_t files = 0;
+    bool ok = stat(path) == -1 || remove_dirs(path, &files);
+    return shard_done("delete", path, ok, files, "files") && ok;
+}
+
+bool CephfsHelper::remove_dirs(const char* path, uint64_t* files){
+    aimd_limiter limiter(min_jobs, max_jobs);
+    worker_pool pool(limiter);
+    std::vector<std::pair<int, std::string>> dirs;
+    bool ret = remove_tree(path, pool, dirs, files);
+    if(!pool.wait() || !ret) return false;
+    std::stable_sort(dirs.begin(), dirs.end(),
+        [](const std::pair<int, std::string>& a, const std::pair<int, std::string>& b){
+            return a.first > b.first;
+        });
+    size_t i = 0;
+    while(i < dirs.size()){
+        int depth = dirs[i].first;
+        for(; i < dirs.size() && dirs[i].first == depth; ++i){
+            std::string dir = dirs[i].second;
+            if(dir.size() == 1 && dir[0] == '/') continue;
+            if(shard_count <= 1 && filter.empty()){
+                pool.submit([this, dir]{ return rm_dir(dir.c_str());});
+                continue;
             }
+            pool.submit([this, dir]{
+                ops_rate.acquire(1);
+                trace_scope ts("rmdir", dir.c_str());
+                int ret = fs->rmdir(cmount, dir.c_str());
+                //files filtered out or of other shards left, or another shard was first
+                if(ret == 0 || ret == -ENOTEMPTY || ret == -ENOENT) return true;
+                error("Unable to rm dir, path: ", dir.c_str(), -ret);
+                return false;
+            });
         }
+        if(!pool.wait()) return false;
     }
-    if(ret < 0) {
-        error("Unable to open path: ", path, -ret);
-        return false;
-    }
-    ret = ceph_closedir(cmount, dirp);
-    if(ret < 0) {
-        error("Unable to close path: ", path, -ret);
-        return false;
-    }
-    if(strlen(path) == 1 && *path == '/') return true;
-    ret = ceph_rmdir(cmount, path);
-    if(ret < 0) {
-        error("Unable to remove path: ", path, -ret);
-        return false;
-    }
-    log("INFO")<<"cephfs remove dir "<<path<<std::endl;
     return true;
 }
 
+bool CephfsHelper::remove_tree(const std::string& path, worker_pool& pool,
+    std::vector<std::pair<int, std::string>>& dirs, uint64_t* files){
+    cephfs_dir_source source(fs, cmount, &ops_rate);
+    tree_walker walker(source);
+    //other shards remove dirs under the walk
+    walker.set_skip_gone(shard_count > 1);
+    dirs.push_back(std::make_pair(0, path));
+    return walker.walk(path, [&](const walk_entry& e){
+        //kept, with the dirs above it
+        if(filter.skip(e, false)) return tree_walker::VISIT_SKIP;
+        if(S_ISDIR(e.mode)){
+            dirs.push_back(std::make_pair(e.depth + 1, e.path));
+        }else if(shard_count <= 1 || shard_of(e.path, 0, shard_count) == shard_index){
+            std::string file = e.path;
+            pool.submit([this, file]{ return remove(file.c_str());});
+            if(files != nullptr) ++*files;
+        }
+        return pool.ok() ? tree_walker::VISIT_ENTER : tree_walker::VISIT_STOP;
+    });
+}
+
 bool CephfsHelper::exists(const char* path){
     if(path == nullptr || *path == '\0') return false;
     if(cmount == nullptr){
@@ -437,7 +1123,8 @@ bool CephfsHelper::exists(const char* path){
         return false;
     }
     struct ceph_statx stx;
-    int ret = ceph_statx(cmount, path, &stx, 0, AT_SYMLINK_NOFOLLOW);
+    ops_rate.acquire(1);
+    int ret = fs->statx(cmount, path, &stx, 0, AT_SYMLINK_NOFOLLOW);
     return (ret == 0);
 }
 
@@ -449,7 +1136,8 @@ bool CephfsHelper::rename(const char* src, const char* dst){
         return false;
     }
     if(!get_safe_path(dst)) return false;
-    int ret = ceph_rename(cmount, src, dst);
+    ops_rate.acquire(1);
+    int ret = fs->rename(cmount, src, dst);
     if(ret < 0){
         error("Unable to rename file, src: ", src, -ret);
         return false;
@@ -465,6 +1153,7 @@ bool CephfsHelper::write_tree(const char* path, const char* local_path){
         log("ERROR")<<"No user log in cephfs"<<std::endl;
         return false;
     }
+    if(strcmp(local_path, "-") == 0) return write(path, local_path);
     int ret;
     struct stat st;
     ret = ::stat(local_path, &st);
@@ -475,112 +1164,2356 @@ bool CephfsHelper::write_tree(const char* path, const char* local_path){
     if(S_ISREG(st.st_mode)){
         //regular file, just write to cephfs
         //if path is a dir, write will be failed
-        if(!write(path, local_path)) return false;
-    }else if(S_ISDIR(st.st_mode)){
-        DIR *dp;
-        struct dirent *de;
-        dp = opendir(local_path);
-        if(dp == nullptr){
-            error("Unable to open local dir ", local_path, errno);
+        if(shard_count <= 1) return write(path, local_path);
+        bool mine = shard_of(path, 0, shard_count) == shard_index;
+        bool ok = !mine || write(path, local_path);
+        return shard_done("upload", path, ok, mine ? st.st_size : 0, "bytes") && ok;
+    }
+    if(!S_ISDIR(st.st_mode)) return true;
+    if(!manifest_cache.empty() || manifest_remote){
+        if(shard_count > 1){
+            //every shard would store a manifest of files it did not send
+            log("ERROR")<<"Unable to shard a manifest upload of "<<local_path<<std::endl;
             return false;
         }
-        while((de = readdir(dp)) != nullptr){
-            //skip .  ..  .*
-            if(de->d_name[0] == '.') continue;
-            std::string new_path = path;
-            std::string new_local_path = local_path;
-            if(new_path[new_path.size()-1] != '/') new_path += '/';
-            new_path += de->d_name;
-            if(new_local_path[new_local_path.size()-1] != '/')
-                new_local_path += '/';
-            new_local_path += de->d_name;
-            if(!write_tree(new_path.c_str(), new_local_path.c_str())){
-                closedir(dp);
-                return false;
-            }
+        return sync_tree(path, local_path);
+    }
+    std::vector<std::string> dirs;
+    std::vector<tree_file> files;
+    if(!upload_tree(path, local_path, dirs, files)) return false;
+    //every shard checks the whole tree, none starts what cannot fit, the
+    //files it overwrites are not known without a stat each, so all count
+    uint64_t bytes = 0;
+    for(const tree_file& f : files) bytes += f.size;
+    if(!preflight(path, bytes, dirs.size() + files.size())) return false;
+    bytes = 0;
+    bool ok = make_dirs(dirs) && transfer_files(files, true, &bytes);
+    log("INFO")<<"transfer buffers "<<buffer_stats()<<std::endl;
+    if(shard_count > 1) ok = shard_done("upload", path, ok, bytes, "bytes") && ok;
+    return ok;
+}
+
+//walk the local dir, collect the remote dirs, parents first, and the files
+bool CephfsHelper::upload_tree(const std::string& path, const std::string& local_path,
+    std::vector<std::string>& dirs, std::vector<tree_file>& files){
+    std::string dir = path;
+    if(dir[dir.size()-1] != '/') dir += '/';
+    dirs.push_back(dir);
+    local_dir_source source;
+    tree_walker walker(source);
+    std::string remote;
+    return walker.walk(local_path, [&](const walk_entry& e){
+        //skip .* unless included
+        if(filter.skip(e, true)) return tree_walker::VISIT_SKIP;
+        remote.assign(dir).append(e.rel);
+        if(S_ISDIR(e.mode)){
+            dirs.push_back(remote + '/');
+            return tree_walker::VISIT_ENTER;
         }
-        closedir(dp);
-    }
-    return true;
+        if(S_ISREG(e.mode)) files.push_back(tree_file{remote, e.path, e.size});
+        return tree_walker::VISIT_SKIP;
+    });
 }
 
-bool CephfsHelper::chdir(const char* path){
-    if(path == nullptr || *path == '\0') return false;
-    if(cmount == nullptr){
-        log("ERROR")<<"No user log in cephfs"<<std::endl;
-        return false;
-    }
-    int ret = ceph_chdir(cmount, path);
-    if(ret < 0){
-        error("Unable to cd, path: ", path, -ret);
-        return false;
-    }
-    log("INFO")<<"cephfs chdir "<<path<<std::endl;
+//mkdirs each remote dir once, a parent comes before its children
+bool CephfsHelper::make_dirs(const std::vector<std::string>& dirs){
+    for(const std::string& d : dirs)
+        if(!get_safe_path(d.c_str())) return false;
     return true;
 }
 
-std::string CephfsHelper::getcwd(){
-    if(cmount == nullptr){
-        log("ERROR")<<"No user log in cephfs"<<std::endl;
+//one cache file per cephfs tree, named by the hash of root and path
+std::string CephfsHelper::manifest_cache_file(const std::string& dir){
+    if(manifest_cache.empty()) return "";
+    sha256 h;
+    h.update(root.data(), root.size());
+    h.update("", 1);
+    h.update(dir.data(), dir.size());
+    return manifest_cache + '/' + h.hex_digest().substr(0, 32) + ".manifest";
+}
+
+//the cache first, else the manifest on cephfs, empty for a new tree
+bool CephfsHelper::load_manifest(const std::string& dir, manifest_view& mf){
+    std::string file = manifest_cache_file(dir);
+    if(!file.empty() && mf.open(file.c_str())) return true;
+    if(!manifest_remote) return false;
+    std::string remote = dir + MANIFEST_NAME;
+    if(stat(remote.c_str()) != 0) return false;
+    char tmp[] = "/tmp/cephfs-manifest-XXXXXX";
+    if(file.empty()){
+        int fd = mkstemp(tmp);
+        if(fd < 0){
+            error("Unable to create temp file ", tmp, errno);
+            return false;
+        }
+        ::close(fd);
+    }else if(!mk_local_dirs(manifest_cache)){
+        error("Unable to mkdir local dir ", manifest_cache.c_str(), errno);
         return false;
     }
-    return std::string(ceph_getcwd(cmount));
+    const char* local = file.empty() ? tmp : file.c_str();
+    bool ok = read_file(remote.c_str(), local, false) && mf.open(local);
+    if(file.empty()) ::unlink(tmp);
+    return ok;
 }
 
-int CephfsHelper::stat(const char* path){
-    if(path == nullptr || *path == '\0') return false;
-    if(cmount == nullptr){
-        log("ERROR")<<"No user log in cephfs"<<std::endl;
+bool CephfsHelper::store_manifest(const std::string& dir, manifest_builder& builder){
+    std::string file = manifest_cache_file(dir);
+    char tmp[] = "/tmp/cephfs-manifest-XXXXXX";
+    if(file.empty()){
+        int fd = mkstemp(tmp);
+        if(fd < 0){
+            error("Unable to create temp file ", tmp, errno);
+            return false;
+        }
+        ::close(fd);
+    }else if(!mk_local_dirs(manifest_cache)){
+        error("Unable to mkdir local dir ", manifest_cache.c_str(), errno);
         return false;
     }
-    struct ceph_statx stx;
-    int ret = ceph_statx(cmount, path, &stx, CEPH_STATX_MODE, AT_SYMLINK_NOFOLLOW);
-    if(ret == 0){
-        if(S_ISREG(stx.stx_mode))
-            return 0;
-        else if(S_ISDIR(stx.stx_mode))
-            return 1;
-        else return 2;
-    }
-    //error("Unable to stat, path: ", path, -ret);
-    return -1;
+    const char* local = file.empty() ? tmp : file.c_str();
+    bool ok = builder.write(local);
+    if(ok && manifest_remote) ok = write_file((dir + MANIFEST_NAME).c_str(), local, false);
+    if(file.empty()) ::unlink(tmp);
+    return ok;
 }
 
-bool CephfsHelper::listdir(const char* path,
-    std::vector<std::string>& list){
-    if(path == nullptr || *path == '\0') return false;
+//every dir and regular file under local_path, filtered as in upload_tree
+bool CephfsHelper::scan_local(const std::string& local_path, manifest_builder& builder){
+    local_dir_source source;
+    tree_walker walker(source);
+    return walker.walk(local_path, [&](const walk_entry& e){
+        if((!S_ISDIR(e.mode) && !S_ISREG(e.mode)) || filter.skip(e, true))
+            return tree_walker::VISIT_SKIP;
+        builder.add(e.rel, S_ISDIR(e.mode) ? 0 : e.size, e.mtime_ns, e.mode);
+        return tree_walker::VISIT_ENTER;
+    });
+}
+
+//diff the local tree with the manifest of the last upload, cephfs is not
+//walked at all, new dirs are made and new or changed files are written
+//removed files stay on cephfs, as in a plain upload
+bool CephfsHelper::sync_tree(const std::string& path, const std::string& local_path){
+    std::string dir = path;
+    if(dir[dir.size()-1] != '/') dir += '/';
+    manifest_view old_mf, new_mf;
+    if(!load_manifest(dir, old_mf))
+        log("INFO")<<"no manifest of "<<dir<<", upload all"<<std::endl;
+    manifest_builder builder;
+    {
+        trace_scope ts("scan", local_path.c_str());
+        if(!scan_local(local_path, builder)) return false;
+    }
+    std::string image = builder.serialize();
+    new_mf.attach(image.data(), image.size());
+    std::string local_dir = local_path;
+    if(local_dir[local_dir.size()-1] != '/') local_dir += '/';
+    std::vector<std::string> dirs(1, dir);
+    std::vector<tree_file> files;
+    //what the changes add, a changed file replaces its last upload, a
+    //smaller one frees nothing before the transfer ends
+    uint64_t bytes = 0, entries = 0;
+    manifest_diff(old_mf, new_mf, [&](manifest_change kind, const std::string& rel,
+        const manifest_record* old, const manifest_record* cur){
+        if(kind == MF_REMOVED) return;
+        if(kind == MF_ADDED) ++entries;
+        std::string new_path = dir + rel;
+        if(S_ISDIR(cur->mode)){
+            //a dir sorts before its files
+            if(kind == MF_ADDED) dirs.push_back(new_path + '/');
+            return;
+        }
+        uint64_t old_size = kind == MF_CHANGED && S_ISREG(old->mode) ? old->size : 0;
+        if(cur->size > old_size) bytes += cur->size - old_size;
+        files.push_back(tree_file{new_path, local_dir + rel, cur->size});
+    });
+    if(!preflight(dir, bytes, entries)) return false;
+    bool ok = make_dirs(dirs) && transfer_files(files, true);
+    log("INFO")<<"cephfs sync "<<local_path<<" to "<<dir<<", "<<files.size()<<" of "
+        <<new_mf.size()<<" paths changed"<<std::endl;
+    log("INFO")<<"transfer buffers "<<buffer_stats()<<std::endl;
+    //a failed run keeps the old manifest, its changes are sent again
+    return ok && store_manifest(dir, builder);
+}
+
+bool CephfsHelper::read_tree(const char* path, const char* local_path){
+    if(path == nullptr || *path == '\0' ||
+        local_path == nullptr || *local_path == '\0') return false;
     if(cmount == nullptr){
         log("ERROR")<<"No user log in cephfs"<<std::endl;
         return false;
     }
-    struct ceph_dir_result *dirp;
-    struct dirent de;
-    int ret;
-    ret = ceph_opendir(cmount, path, &dirp);
-    if(ret < 0){
-        error("Unable to open path: ", path, -ret);
-        return false;
-    }
-    list.clear();
-    while ((ret = ceph_readdir_r(cmount, dirp, &de)) > 0) {
-        std::string name = de.d_name;
-        if(name != "." && name != "..") {
-            list.push_back(name);
-        }
+    int type = stat(path);
+    if(type == 0 && shard_count > 1){
+        bool mine = shard_of(path, 0, shard_count) == shard_index;
+        uint64_t sz = 0;
+        bool ok = !mine || (length(path, sz) && read(path, local_path));
+        return shard_done("download", path, ok, sz, "bytes") && ok;
     }
-    if(ret < 0) {
-        error("Unable to read path: ", path, -ret);
+    if(type == 0) return read(path, local_path);
+    if(type != 1){
+        error("Unable to read tree, not a file or dir: ", path, 0);
         return false;
     }
-    ret = ceph_closedir(cmount, dirp);
-    if(ret < 0) {
-        error("Unable to close path: ", path, -ret);
+    if(strcmp(local_path, "-") == 0){
+        error("Unable to read a dir to stdout: ", path, 0);
         return false;
     }
-    return true;
+    std::vector<tree_file> files;
+    uint64_t bytes = 0;
+    bool ok = download_tree(path, local_path, files) && transfer_files(files, false, &bytes);
+    log("INFO")<<"transfer buffers "<<buffer_stats()<<std::endl;
+    if(shard_count > 1) ok = shard_done("download", path, ok, bytes, "bytes") && ok;
+    return ok;
 }
 
-bool CephfsHelper::listdir_buffer(const char* path,
+//walk the remote dir, mkdir each local dir, collect the files
+bool CephfsHelper::download_tree(const std::string& path, const std::string& local_path,
+    std::vector<tree_file>& files){
+    if(!mk_local_dirs(local_path)){
+        error("Unable to mkdir local dir ", local_path.c_str(), errno);
+        return false;
+    }
+    std::string local_dir = local_path;
+    if(local_dir[local_dir.size()-1] != '/') local_dir += '/';
+    cephfs_dir_source source(fs, cmount, &ops_rate);
+    tree_walker walker(source);
+    std::string local;
+    return walker.walk(path, [&](const walk_entry& e){
+        if(strcmp(e.name, MANIFEST_NAME) == 0 || filter.skip(e, false))
+            return tree_walker::VISIT_SKIP;
+        local.assign(local_dir).append(e.rel);
+        if(S_ISDIR(e.mode)){
+            if(mk_local_dirs(local)) return tree_walker::VISIT_ENTER;
+            error("Unable to mkdir local dir ", local.c_str(), errno);
+            return tree_walker::VISIT_STOP;
+        }
+        if(S_ISREG(e.mode))
+            files.push_back(tree_file{e.path, local, e.size});
+        else
+            log("WARN")<<"skip cephfs path "<<e.path<<", not a file or dir"<<std::endl;
+        return tree_walker::VISIT_SKIP;
+    });
+}
+
+//a split file gets its final size before its chunks are written in place
+bool CephfsHelper::presize(const tree_file& f, bool upload){
+    //shards write chunks of the same file, none may truncate the others,
+    //nor replace a linked inode, a dedup entry changed so is hashed again
+    int trunc = shard_count > 1 ? 0 : O_TRUNC;
+    if(upload){
+        int fd = open_file(f.path.c_str(), O_WRONLY|O_CREAT|trunc, 0644);
+        if(fd <= 0){
+            error("Unable to open cephfs file ", f.path.c_str(), -fd);
+            return false;
+        }
+        int ret = fs->ftruncate(cmount, fd, f.size);
+        close_file(fd, f.path.c_str());
+        if(ret < 0){
+            error("Unable to truncate cephfs file ", f.path.c_str(), -ret);
+            return false;
+        }
+        return true;
+    }
+    int fd = ::open(f.local_path.c_str(), O_WRONLY|O_CREAT|trunc, 0644);
+    if(fd < 0 || ::ftruncate(fd, f.size) < 0){
+        error("Unable to create local file ", f.local_path.c_str(), errno);
+        if(fd >= 0) ::close(fd);
+        return false;
+    }
+    ::close(fd);
+    return true;
+}
+
+//fill buf at offset from a local file, less than len only at eof
+static int64_t pread_local(int fd, char* buf, size_t len, uint64_t offset){
+    size_t done = 0;
+    while(done < len){
+        ssize_t ret = ::pread(fd, buf + done, len - done, offset + done);
+        if(ret < 0 && errno == EINTR) continue;
+        if(ret < 0) return -1;
+        if(ret == 0) break;
+        done += ret;
+    }
+    return done;
+}
+
+//one chunk of a split file, zero blocks are skipped as in whole files
+bool CephfsHelper::transfer_range(const tree_file& f, uint64_t offset, uint64_t len,
+    bool upload){
+    const char *path = f.path.c_str(), *local_path = f.local_path.c_str();
+    trace_scope tf(upload ? "upload" : "download", path, len);
+    buffer_lease lease(transfer_buffers(), 1);
+    if(lease.size() == 0) return false;
+    char *buffer = lease[0];
+    const size_t chunk_size = transfer_buffers().chunk_size();
+    int local_fd = ::open(local_path, upload ? O_RDONLY : O_WRONLY);
+    if(local_fd < 0){
+        error("Unable to open local file ", local_path, errno);
+        return false;
+    }
+    int fd = open_file(path, upload ? O_WRONLY : O_RDONLY, 0644);
+    if(fd <= 0){
+        error("Unable to open cephfs file ", path, -fd);
+        ::close(local_fd);
+        return false;
+    }
+    bool ok = true;
+    for(uint64_t done = 0; ok && done < len;){
+        size_t n = std::min<uint64_t>(chunk_size, len - done);
+        uint64_t pos = offset + done;
+        int64_t got = upload ? pread_local(local_fd, buffer, n, pos) :
+            read_at(fd, path, buffer, n, pos);
+        if(got < 0){
+            if(upload) error("Unable to read local file ", local_path, errno);
+            ok = false;
+            break;
+        }
+        auto put = [&](size_t start, size_t count){
+            if(upload) return write_at(fd, path, buffer + start, count, pos + start) >= 0;
+            if(pwrite_local(local_fd, buffer + start, count, pos + start)) return true;
+            error("Unable to write local file ", local_path, errno);
+            return false;
+        };
+        //not truncated when sharded, old data may sit under the zeros
+        if(shard_count > 1) ok = got == 0 || put(0, got);
+        else ok = for_each_data(buffer, got,
+            upload ? UPLOAD_ZERO_BLOCK : DOWNLOAD_ZERO_BLOCK, put);
+        if((size_t)got < n){
+            //shrank since the walk, the size stays as it was then
+            log("WARN")<<"file shrank during transfer "<<(upload ? local_path : path)<<std::endl;
+            break;
+        }
+        done += n;
+    }
+    close_file(fd, path);
+    ::close(local_fd);
+    return ok;
+}
+
+//the files of a tree transfer in transfer_plan order on the workers
+bool CephfsHelper::transfer_files(const std::vector<tree_file>& files, bool upload,
+    uint64_t* bytes){
+    transfer_plan plan(split_size, split_chunk, SMALL_FILE, SMALL_BATCH, FILE_COST);
+    //dedup hashes a whole file before it is sent
+    bool split = !upload || dedup_dir.empty();
+    for(const tree_file& f : files) plan.add(f.size, split);
+    std::function<bool(const transfer_plan::task&)> keep;
+    if(shard_count > 1) keep = [&](const transfer_plan::task& t){
+        return shard_of(files[t.file].path, t.offset, shard_count) == shard_index;
+    };
+    std::vector<transfer_plan::batch> batches = plan.schedule(max_jobs, keep);
+    std::vector<bool> presized(files.size(), false);
+    size_t split_files = 0;
+    uint64_t total = 0;
+    for(const transfer_plan::batch& b : batches){
+        for(const transfer_plan::task& t : b){
+            total += t.len;
+            if(!t.chunk || presized[t.file]) continue;
+            if(!presize(files[t.file], upload)) return false;
+            presized[t.file] = true;
+            ++split_files;
+        }
+    }
+    if(bytes != nullptr) *bytes = total;
+    std::string shard;
+    if(shard_count > 1)
+        shard = ", shard " + std::to_string(shard_index) + " of " + std::to_string(shard_count);
+    log("INFO")<<"transfer plan of "<<files.size()<<" files, "<<split_files
+        <<" split, "<<batches.size()<<" tasks"<<shard<<std::endl;
+    aimd_limiter limiter(min_jobs, max_jobs);
+    worker_pool pool(limiter);
+    for(const transfer_plan::batch& b : batches){
+        if(!pool.ok()) break;
+        pool.submit([this, &files, b, upload]{
+            for(const transfer_plan::task& t : b){
+                const tree_file& f = files[t.file];
+                bool ret;
+                if(t.chunk) ret = transfer_range(f, t.offset, t.len, upload);
+                else if(upload) ret = write_file(f.path.c_str(), f.local_path.c_str(), false);
+                else ret = read_file(f.path.c_str(), f.local_path.c_str(), false);
+                if(!ret) return false;
+            }
+            return true;
+        });
+    }
+    return pool.wait();
+}
+
+//mode and mtime of stx, so a copy looks like its source
+bool CephfsHelper::set_attrs(const char* path, const struct ceph_statx& stx){
+    struct ceph_statx attrs = stx;
+    ops_rate.acquire(1);
+    trace_scope ts("setattr", path);
+    int ret = fs->setattrx(cmount, path, &attrs, CEPH_SETATTR_MODE|CEPH_SETATTR_MTIME, 0);
+    if(ret < 0){
+        error("Unable to set attrs of cephfs path ", path, -ret);
+        return false;
+    }
+    return true;
+}
+
+//cephfs reads run ahead while the previous buffers are written,
+//libcephfs has no copy_file_range, so the data passes through the pool
+//zero blocks are skipped and truncate sets the size, as in uploads
+bool CephfsHelper::copy_file(const char* src, const char* dst,
+    const struct ceph_statx& stx, bool mkdirs){
+    trace_scope tf("copy", src);
+    if(mkdirs && !get_safe_path(dst)) return false;
+    int src_fd = open_file(src, O_RDONLY, 0644);
+    if(src_fd <= 0){
+        error("Unable to open cephfs file ", src, -src_fd);
+        return false;
+    }
+    int fd = open_file(dst, O_WRONLY|O_CREAT|O_TRUNC, stx.stx_mode & 0777);
+    if(fd <= 0){
+        error("Unable to open cephfs file ", dst, -fd);
+        close_file(src_fd, src);
+        return false;
+    }
+    buffer_pipeline pipe(transfer_buffers(), STREAM_DEPTH);
+    uint64_t read_offset = 0, offset = 0;
+    bool ok = pipe.run(
+        [&](char* buf, size_t len){
+            int64_t n = read_at(src_fd, src, buf, len, read_offset);
+            if(n > 0) read_offset += n;
+            return n;
+        },
+        [&](const char* buf, size_t len){
+            bool ret = for_each_data(buf, len, UPLOAD_ZERO_BLOCK,
+                [&](size_t start, size_t n){
+                    return write_at(fd, dst, buf + start, n, offset + start) >= 0;
+                });
+            offset += len;
+            return ret;
+        });
+    close_file(src_fd, src);
+    if(ok){
+        int ret = fs->ftruncate(cmount, fd, offset);
+        if(ret < 0){
+            error("Unable to truncate cephfs file ", dst, -ret);
+            ok = false;
+        }
+    }
+    close_file(fd, dst);
+    if(!ok || !set_attrs(dst, stx)) return false;
+    log("INFO")<<"cephfs copy from "<<src<<" to "<<dst<<", "<<offset<<" bytes"<<std::endl;
+    return true;
+}
+
+bool CephfsHelper::copy(const char* src, const char* dst){
+    if(src == nullptr || *src == '\0' || dst == nullptr || *dst == '\0') return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    struct ceph_statx stx;
+    ops_rate.acquire(1);
+    int ret = fs->statx(cmount, src, &stx, CEPH_STATX_MODE|CEPH_STATX_MTIME, 0);
+    if(ret < 0){
+        error("Unable to stat cephfs path ", src, -ret);
+        return false;
+    }
+    if(!S_ISREG(stx.stx_mode)){
+        error("Unable to copy, not a file: ", src, 0);
+        return false;
+    }
+    return copy_file(src, dst, stx, true);
+}
+
+bool CephfsHelper::copy_tree(const char* src, const char* dst){
+    if(src == nullptr || *src == '\0' || dst == nullptr || *dst == '\0') return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    int type = stat(src);
+    if(type == 0) return copy(src, dst);
+    if(type != 1){
+        error("Unable to copy tree, not a file or dir: ", src, 0);
+        return false;
+    }
+    std::string from = src, to = dst;
+    while(from.size() > 1 && from[from.size()-1] == '/') from.pop_back();
+    while(to.size() > 1 && to[to.size()-1] == '/') to.pop_back();
+    if(to == from || (to.compare(0, from.size(), from) == 0 &&
+        (from == "/" || to[from.size()] == '/'))){
+        error("Unable to copy a dir into itself: ", dst, 0);
+        return false;
+    }
+    aimd_limiter limiter(min_jobs, max_jobs);
+    worker_pool pool(limiter);
+    std::vector<std::pair<std::string, struct ceph_statx>> dirs;
+    bool ok = copy_dir(from, to, pool, dirs);
+    ok = pool.wait() && ok;
+    //files change the mtime of their dir, deepest dirs first
+    for(auto it = dirs.rbegin(); ok && it != dirs.rend(); ++it)
+        ok = set_attrs(it->first.c_str(), it->second);
+    log("INFO")<<"transfer buffers "<<buffer_stats()<<std::endl;
+    return ok;
+}
+
+static struct ceph_statx entry_statx(const walk_entry& e){
+    struct ceph_statx stx;
+    memset(&stx, 0, sizeof(stx));
+    stx.stx_mode = e.mode;
+    stx.stx_size = e.size;
+    stx.stx_mtime.tv_sec = e.mtime_ns / 1000000000;
+    stx.stx_mtime.tv_nsec = e.mtime_ns % 1000000000;
+    return stx;
+}
+
+//walk the source dir, mkdirs each target dir once, the workers copy files
+bool CephfsHelper::copy_dir(const std::string& src, const std::string& dst,
+    worker_pool& pool, std::vector<std::pair<std::string, struct ceph_statx>>& dirs){
+    std::string dir = dst;
+    if(dir[dir.size()-1] != '/') dir += '/';
+    if(!get_safe_path(dir.c_str())) return false;
+    struct ceph_statx stx;
+    ops_rate.acquire(1);
+    int ret = fs->statx(cmount, src.c_str(), &stx, CEPH_STATX_MODE|CEPH_STATX_MTIME, 0);
+    if(ret < 0){
+        error("Unable to stat cephfs path ", src.c_str(), -ret);
+        return false;
+    }
+    dirs.push_back(std::make_pair(dst, stx));
+    cephfs_dir_source source(fs, cmount, &ops_rate);
+    tree_walker walker(source);
+    std::string target;
+    return walker.walk(src, [&](const walk_entry& e){
+        if(!pool.ok()) return tree_walker::VISIT_STOP;
+        target.assign(dir).append(e.rel);
+        if(S_ISDIR(e.mode)){
+            if(!get_safe_path((target + '/').c_str())) return tree_walker::VISIT_STOP;
+            dirs.push_back(std::make_pair(target, entry_statx(e)));
+            return tree_walker::VISIT_ENTER;
+        }
+        if(S_ISREG(e.mode)){
+            std::string from = e.path, to = target;
+            struct ceph_statx attrs = entry_statx(e);
+            pool.submit([this, from, to, attrs]{
+                return copy_file(from.c_str(), to.c_str(), attrs, false);
+            });
+        }else{
+            log("WARN")<<"skip cephfs path "<<e.path<<", not a file or dir"<<std::endl;
+        }
+        return tree_walker::VISIT_SKIP;
+    });
+}
+
+//ceph.dir.rctime "sec.nsec", the newest change anywhere below a dir
+bool CephfsHelper::get_rctime(const char* path, int64_t& rctime){
+    char buf[64];
+    ops_rate.acquire(1);
+    trace_scope ts("getxattr", path);
+    int ret = fs->getxattr(cmount, path, "ceph.dir.rctime", buf, sizeof(buf) - 1);
+    if(ret <= 0) return false;
+    buf[ret] = '\0';
+    char *end;
+    int64_t sec = strtoll(buf, &end, 10);
+    int64_t nsec = 0;
+    if(*end == '.'){
+        int digits = 0;
+        for(++end; *end >= '0' && *end <= '9' && digits < 9; ++end, ++digits)
+            nsec = nsec * 10 + (*end - '0');
+        for(; digits < 9; ++digits) nsec *= 10;
+    }
+    rctime = sec * 1000000000 + nsec;
+    return true;
+}
+
+//a ceph.quota.* or ceph.dir.r* number, false when unset or 0
+bool CephfsHelper::get_xattr_u64(const char* path, const char* name, uint64_t& value){
+    char buf[64];
+    ops_rate.acquire(1);
+    int ret = fs->getxattr(cmount, path, name, buf, sizeof(buf) - 1);
+    if(ret <= 0) return false;
+    buf[ret] = '\0';
+    value = strtoull(buf, nullptr, 10);
+    return value > 0;
+}
+
+//bytes and entries an upload adds below path, fails when they cannot fit
+//the quota of path or an ancestor or the free space of the pool, callers
+//count only what replaces nothing, uploads merge into what is there
+bool CephfsHelper::preflight(const std::string& path, uint64_t need_bytes,
+    uint64_t need_entries){
+    if(!preflight_check) return true;
+    trace_scope ts("preflight", path.c_str());
+    std::string cur = path;
+    while(cur.size() > 1 && cur[cur.size()-1] == '/') cur.erase(cur.size() - 1);
+    struct ceph_statx stx;
+    ops_rate.acquire(1);
+    int ret = fs->statx(cmount, cur.c_str(), &stx, CEPH_STATX_MODE, 0);
+    bool is_dir = ret == 0 && S_ISDIR(stx.stx_mode);
+    //path, if a dir, then each existing ancestor up to the root
+    std::string space_dir, parent;
+    int quotas = 0;
+    while(true){
+        if(is_dir){
+            if(space_dir.empty()) space_dir = cur;
+            uint64_t max, used = 0;
+            if(get_xattr_u64(cur.c_str(), "ceph.quota.max_bytes", max)){
+                ++quotas;
+                get_xattr_u64(cur.c_str(), "ceph.dir.rbytes", used);
+                if(used + need_bytes > max){
+                    log("ERROR")<<"Unable to upload "<<need_bytes<<" more bytes to "<<path
+                        <<", quota max_bytes "<<max<<" of "<<cur<<" has "<<used
+                        <<" used"<<std::endl;
+                    error("Preflight failed, path: ", path.c_str(), EDQUOT);
+                    return false;
+                }
+            }
+            used = 0;
+            if(get_xattr_u64(cur.c_str(), "ceph.quota.max_files", max)){
+                ++quotas;
+                get_xattr_u64(cur.c_str(), "ceph.dir.rentries", used);
+                if(used + need_entries > max){
+                    log("ERROR")<<"Unable to upload "<<need_entries<<" more entries to "
+                        <<path<<", quota max_files "<<max<<" of "<<cur<<" has "<<used
+                        <<" used"<<std::endl;
+                    error("Preflight failed, path: ", path.c_str(), EDQUOT);
+                    return false;
+                }
+            }
+        }
+        if(cur == "/" || cur == ".") break;
+        get_parent(cur.c_str(), parent);
+        cur = parent;
+        ops_rate.acquire(1);
+        is_dir = fs->statx(cmount, cur.c_str(), &stx, CEPH_STATX_MODE, 0) == 0 &&
+            S_ISDIR(stx.stx_mode);
+    }
+    uint64_t avail = 0;
+    struct statvfs sv;
+    if(!space_dir.empty()){
+        ops_rate.acquire(1);
+        ret = fs->statfs(cmount, space_dir.c_str(), &sv);
+        if(ret < 0){
+            //no free space to compare, the quotas were checked
+            error("Unable to statfs cephfs, path: ", space_dir.c_str(), -ret);
+        }else{
+            avail = (uint64_t)sv.f_bavail * sv.f_frsize;
+            if(need_bytes > avail){
+                log("ERROR")<<"Unable to upload "<<need_bytes<<" more bytes to "<<path
+                    <<", cephfs has "<<avail<<" bytes free"<<std::endl;
+                error("Preflight failed, path: ", path.c_str(), ENOSPC);
+                return false;
+            }
+        }
+    }
+    log("INFO")<<"preflight "<<path<<" "<<need_bytes<<" bytes "<<need_entries
+        <<" entries more, "<<quotas<<" quotas, "<<avail<<" bytes free"<<std::endl;
+    return true;
+}
+
+static int remove_local_entry(const char* path, const struct stat*, int flag, struct FTW*){
+    int ret = flag == FTW_DP ? ::rmdir(path) : ::unlink(path);
+    if(ret < 0) error("Unable to remove local path ", path, errno);
+    return 0;
+}
+
+static void remove_local(const std::string& path){
+    log("INFO")<<"remove local "<<path<<", gone from cephfs"<<std::endl;
+    nftw(path.c_str(), remove_local_entry, 16, FTW_DEPTH|FTW_PHYS);
+}
+
+bool CephfsHelper::mirror_tree(const char* path, const char* local_path){
+    if(path == nullptr || *path == '\0' ||
+        local_path == nullptr || *local_path == '\0') return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    if(stat(path) != 1){
+        error("Unable to mirror, not a dir: ", path, 0);
+        return false;
+    }
+    std::string state = local_path;
+    if(state[state.size()-1] != '/') state += '/';
+    state += MIRROR_STATE_NAME;
+    int64_t since = -1, rctime = 0;
+    std::ifstream is(state.c_str());
+    if(!(is >> since)) since = -1;
+    is.close();
+    //rctime is read before the walk, later changes are newer than it
+    bool pruned = get_rctime(path, rctime);
+    if(!pruned){
+        log("WARN")<<"no rctime of "<<path<<", mirror all"<<std::endl;
+        since = -1;
+    }else if(since >= rctime){
+        log("INFO")<<"cephfs mirror "<<path<<", no change since last run"<<std::endl;
+        return true;
+    }
+    aimd_limiter limiter(min_jobs, max_jobs);
+    worker_pool pool(limiter);
+    bool ok = mirror_dir(path, local_path, since, pool);
+    ok = pool.wait() && ok;
+    log("INFO")<<"transfer buffers "<<buffer_stats()<<std::endl;
+    if(!ok || !pruned) return ok;
+    std::ofstream os(state.c_str(), std::ios::trunc);
+    os<<rctime<<std::endl;
+    if(!os){
+        error("Unable to write mirror state ", state.c_str(), errno);
+        return false;
+    }
+    return true;
+}
+
+//a dir changed after since: its files changed after since are read,
+//its subdirs are walked only if their rctime is newer too,
+//local paths no longer in cephfs are removed
+//a dir missing locally has no local entries, so all below it is read
+bool CephfsHelper::mirror_dir(const std::string& path, const std::string& local_path,
+    int64_t since, worker_pool& pool){
+    if(!mk_local_dirs(local_path)){
+        error("Unable to mkdir local dir ", local_path.c_str(), errno);
+        return false;
+    }
+    std::string local_dir = local_path;
+    if(local_dir[local_dir.size()-1] != '/') local_dir += '/';
+    cephfs_dir_source source(fs, cmount, &ops_rate);
+    tree_walker walker(source);
+    std::unordered_set<std::string> names;
+    std::string local;
+    size_t skipped = 0;
+    bool ok = walker.walk(path, [&](const walk_entry& e){
+        if(!pool.ok()) return tree_walker::VISIT_STOP;
+        if(strcmp(e.name, MANIFEST_NAME) == 0) return tree_walker::VISIT_SKIP;
+        names.insert(e.name);
+        local.assign(local_dir).append(e.rel);
+        struct stat st;
+        bool exists = ::lstat(local.c_str(), &st) == 0;
+        if(S_ISDIR(e.mode)){
+            if(exists && !S_ISDIR(st.st_mode)){
+                remove_local(local);
+                exists = false;
+            }
+            int64_t rctime;
+            if(exists && since >= 0 && get_rctime(e.path.c_str(), rctime) && rctime <= since){
+                ++skipped;
+                return tree_walker::VISIT_SKIP;
+            }
+            if(mk_local_dirs(local)) return tree_walker::VISIT_ENTER;
+            error("Unable to mkdir local dir ", local.c_str(), errno);
+            return tree_walker::VISIT_STOP;
+        }
+        if(S_ISREG(e.mode)){
+            if(exists && S_ISDIR(st.st_mode)){
+                remove_local(local);
+                exists = false;
+            }
+            if(exists && e.ctime_ns <= since && (uint64_t)st.st_size == e.size)
+                return tree_walker::VISIT_SKIP;
+            std::string from = e.path, to = local;
+            pool.submit([this, from, to]{
+                return read_file(from.c_str(), to.c_str(), false);
+            });
+        }
+        return tree_walker::VISIT_SKIP;
+    }, [&](const std::string&, const std::string& rel, int){
+        //the walk saw every name of the dir, the rest is gone from cephfs
+        if(!pool.ok()) return false;
+        std::string dir = rel.empty() ? local_dir : local_dir + rel + '/';
+        DIR *dp = opendir(dir.c_str());
+        if(dp == nullptr){
+            error("Unable to open local dir ", dir.c_str(), errno);
+            return false;
+        }
+        struct dirent *le;
+        std::vector<std::string> gone;
+        while((le = readdir(dp)) != nullptr){
+            if(strcmp(le->d_name, ".") == 0 || strcmp(le->d_name, "..") == 0 ||
+                strcmp(le->d_name, MIRROR_STATE_NAME) == 0) continue;
+            if(names.count(le->d_name) == 0) gone.push_back(dir + le->d_name);
+        }
+        closedir(dp);
+        for(const std::string& p : gone) remove_local(p);
+        names.clear();
+        return true;
+    });
+    if(skipped > 0)
+        log("INFO")<<"cephfs mirror "<<path<<", "<<skipped<<" dirs unchanged"<<std::endl;
+    return ok;
+}
+
+//set by SIGINT, SIGTERM or stop_watch, watch_tree and tail_file send
+//what they have and end
+static volatile sig_atomic_t follow_stop = 0;
+
+static void on_follow_signal(int){
+    follow_stop = 1;
+}
+
+//SIGINT and SIGTERM end a follow while it runs
+class follow_signals {
+    struct sigaction old_int, old_term;
+public:
+    follow_signals(){
+        follow_stop = 0;
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = on_follow_signal;
+        sigaction(SIGINT, &sa, &old_int);
+        sigaction(SIGTERM, &sa, &old_term);
+    }
+    ~follow_signals(){
+        sigaction(SIGINT, &old_int, nullptr);
+        sigaction(SIGTERM, &old_term, nullptr);
+    }
+};
+
+static int64_t wall_ns(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void CephfsHelper::stop_watch(){
+    follow_stop = 1;
+}
+
+//an upload of the tree, then the files inotify reports written are sent,
+//once no event came for settle_sec or max_delay_sec after the first one
+bool CephfsHelper::watch_tree(const char* path, const char* local_path,
+    double settle_sec, double max_delay_sec){
+    if(path == nullptr || *path == '\0' ||
+        local_path == nullptr || *local_path == '\0') return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    follow_signals signals;
+    tree_watcher watcher;
+    //watch first, files written during the first upload are sent again
+    if(!watcher.open(local_path)) return false;
+    int64_t since = wall_ns();
+    if(!write_tree(path, local_path)) return false;
+    log("INFO")<<"cephfs watch "<<local_path<<" to "<<path<<", "
+        <<watcher.watches()<<" dirs"<<std::endl;
+    const int64_t settle = settle_sec * 1e9, max_delay = max_delay_sec * 1e9;
+    watch_changes changes;
+    int64_t first = 0, last = 0;
+    bool ok = true;
+    while(ok){
+        int n = watcher.poll(follow_stop ? 0 : 200, changes);
+        if(n < 0){
+            ok = false;
+            break;
+        }
+        int64_t now = wall_ns();
+        if(n > 0){
+            if(first == 0) first = now;
+            last = now;
+        }
+        bool due = !changes.empty() && (follow_stop || now - last >= settle ||
+            now - first >= max_delay);
+        if(due){
+            int64_t batch_since = since;
+            since = now;
+            ok = push_changes(path, local_path, changes, batch_since);
+            changes.clear();
+            first = 0;
+        }
+        if(follow_stop && changes.empty()) break;
+    }
+    log("INFO")<<"cephfs watch "<<local_path<<" ended"<<std::endl;
+    return ok;
+}
+
+//new bytes of a growing local file are appended at the end of the cephfs
+//file in writes of up to flush_bytes, at least every flush_sec, with an
+//fsync every fsync_sec. a restart resumes at the cephfs size when the
+//local file is at least as long, else it reads the local file from 0.
+//a truncated local file is read again from 0, a rotated one to its end,
+//then the new file is followed, cephfs keeps all bytes in order
+bool CephfsHelper::tail_file(const char* path, const char* local_path, uint64_t flush_bytes,
+    double flush_sec, double fsync_sec){
+    if(path == nullptr || *path == '\0' ||
+        local_path == nullptr || *local_path == '\0') return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    follow_signals signals;
+    if(!get_safe_path(path)) return false;
+    int fd = open_file(path, O_WRONLY|O_CREAT, 0644);
+    if(fd <= 0){
+        error("Unable to open cephfs file ", path, -fd);
+        return false;
+    }
+    struct ceph_statx stx;
+    ops_rate.acquire(1);
+    int ret = fs->statx(cmount, path, &stx, CEPH_STATX_SIZE, 0);
+    if(ret < 0){
+        error("Unable to stat cephfs file ", path, -ret);
+        close_file(fd, path);
+        return false;
+    }
+    uint64_t remote_off = stx.stx_size, local_off = 0;
+    int local_fd = -1;
+    struct stat st;
+    if(::stat(local_path, &st) == 0 && (uint64_t)st.st_size >= remote_off)
+        local_off = remote_off;
+    buffer_lease lease(transfer_buffers(), 1);
+    if(lease.size() == 0){
+        close_file(fd, path);
+        return false;
+    }
+    char *buf = lease[0];
+    size_t cap = std::max<uint64_t>(1, std::min<uint64_t>(flush_bytes,
+        transfer_buffers().chunk_size()));
+    size_t fill = 0;
+    const int64_t flush_ns = flush_sec * 1e9, fsync_ns = fsync_sec * 1e9;
+    int64_t first = 0, synced = wall_ns();
+    bool dirty = false, rotated = false, ok = true;
+    log("INFO")<<"cephfs tail "<<local_path<<" to "<<path<<" from "<<local_off
+        <<", cephfs at "<<remote_off<<std::endl;
+    while(ok){
+        bool stop = follow_stop;
+        if(local_fd < 0){
+            local_fd = ::open(local_path, O_RDONLY);
+            if(local_fd < 0 && errno != ENOENT){
+                error("Unable to open local file ", local_path, errno);
+                ok = false;
+                break;
+            }
+        }
+        ssize_t got = 0;
+        if(local_fd >= 0){
+            do{
+                got = ::pread(local_fd, buf + fill, cap - fill, local_off);
+            }while(got < 0 && errno == EINTR);
+            if(got < 0){
+                error("Unable to read local file ", local_path, errno);
+                ok = false;
+                break;
+            }
+            if(got > 0){
+                if(fill == 0) first = wall_ns();
+                fill += got;
+                local_off += got;
+            }else{
+                struct stat cur, now_st;
+                if(fstat(local_fd, &cur) < 0){
+                    error("Unable to get stat local file ", local_path, errno);
+                    ok = false;
+                    break;
+                }
+                if((uint64_t)cur.st_size < local_off){
+                    log("WARN")<<"local file truncated "<<local_path<<", read from 0"<<std::endl;
+                    local_off = 0;
+                }else if(::stat(local_path, &now_st) < 0 || now_st.st_ino != cur.st_ino ||
+                    now_st.st_dev != cur.st_dev){
+                    //read to the end, a last write may follow the rename,
+                    //so once more after a pause, then follow the new file
+                    if(rotated){
+                        log("INFO")<<"local file rotated "<<local_path<<std::endl;
+                        ::close(local_fd);
+                        local_fd = -1;
+                        local_off = 0;
+                    }
+                    rotated = !rotated;
+                }
+            }
+        }
+        int64_t now = wall_ns();
+        //small appends wait for more while the file grows
+        if(fill == cap || (fill > 0 && (stop || now - first >= flush_ns))){
+            ok = write_at(fd, path, buf, fill, remote_off) == (int64_t)fill;
+            if(!ok) break;
+            remote_off += fill;
+            fill = 0;
+            dirty = true;
+        }
+        if(ok && dirty && (stop || now - synced >= fsync_ns)){
+            ret = fs->fsync(cmount, fd, 0);
+            if(ret < 0){
+                error("Unable to fsync cephfs file ", path, -ret);
+                ok = false;
+            }
+            synced = now;
+            dirty = false;
+        }
+        if(stop && fill == 0) break;
+        if(got == 0 && !stop) usleep(100000);
+    }
+    if(local_fd >= 0) ::close(local_fd);
+    close_file(fd, path);
+    log("INFO")<<"cephfs tail "<<local_path<<" ended, cephfs at "<<remote_off<<std::endl;
+    return ok;
+}
+
+//files written and new subtrees of one batch, an overflow rescans the
+//tree for files changed since the last batch began
+bool CephfsHelper::push_changes(const std::string& path, const std::string& local_path,
+    watch_changes& changes, int64_t since){
+    std::string dir = path;
+    if(dir[dir.size()-1] != '/') dir += '/';
+    std::string local_dir = local_path;
+    if(local_dir[local_dir.size()-1] != '/') local_dir += '/';
+    //one second of slack for coarse timestamps
+    int64_t newer = changes.overflow ? since - 1000000000 : -1;
+    if(changes.overflow){
+        log("WARN")<<"inotify queue overflow, rescan "<<local_path<<std::endl;
+        changes.subtrees.insert("");
+    }
+    local_dir_source source;
+    tree_walker walker(source);
+    walker.set_skip_gone(true);
+    std::string remote;
+    for(const std::string& sub : changes.subtrees){
+        //a whole new dir, or the tree after an overflow
+        int64_t after = sub.empty() ? newer : -1;
+        std::string base = sub.empty() ? dir : dir + sub + '/';
+        if(!get_safe_path(base.c_str())) return false;
+        bool ok = walker.walk(local_dir + sub, [&](const walk_entry& e){
+            remote.assign(base).append(e.rel);
+            if(filter.skip_path(sub.empty() ? e.rel : sub + '/' + e.rel, e.mode, e.size,
+                e.mtime_ns, true)) return tree_walker::VISIT_SKIP;
+            if(S_ISDIR(e.mode)){
+                remote += '/';
+                return get_safe_path(remote.c_str()) ? tree_walker::VISIT_ENTER :
+                    tree_walker::VISIT_STOP;
+            }
+            if(S_ISREG(e.mode) && std::max(e.mtime_ns, e.ctime_ns) >= after)
+                changes.files.insert(sub.empty() ? e.rel : sub + '/' + e.rel);
+            return tree_walker::VISIT_SKIP;
+        });
+        //gone since the event
+        if(!ok && ::access((local_dir + sub).c_str(), F_OK) == 0) return false;
+    }
+    std::vector<tree_file> files;
+    for(const std::string& rel : changes.files){
+        std::string local = local_dir + rel;
+        struct stat st;
+        //removed or replaced by a dir since the event
+        if(::stat(local.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) continue;
+        int64_t mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        if(filter.skip_path(rel, st.st_mode, st.st_size, mtime, true)) continue;
+        std::string target = dir + rel;
+        if(!get_safe_path(target.c_str())) return false;
+        files.push_back(tree_file{target, local, (uint64_t)st.st_size});
+    }
+    uint64_t bytes = 0;
+    bool ok = transfer_files(files, true, &bytes);
+    log("INFO")<<"cephfs watch pushed "<<files.size()<<" files, "<<bytes<<" bytes of "
+        <<local_path<<std::endl;
+    return ok;
+}
+
+//a pool chunk of a tar transfer, released by the last task holding it
+struct pooled_chunk {
+    char *data;
+    explicit pooled_chunk(char* p):data(p){}
+    ~pooled_chunk(){ transfer_buffers().release(data);}
+};
+
+//one piece of an export stream, read by a worker, written in order
+struct tar_piece {
+    tar_entry entry;
+    bool header;        //the entry header goes before the data
+    std::string path;
+    uint64_t offset;
+    uint64_t len;
+    std::shared_ptr<pooled_chunk> buf;
+    int64_t got;        //bytes read, -1 on error
+    bool done;
+};
+
+bool CephfsHelper::ingest_tar(const char* path, const char* tar_path){
+    if(path == nullptr || *path == '\0' ||
+        tar_path == nullptr || *tar_path == '\0') return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    int local_fd = STDIN_FILENO;
+    if(strcmp(tar_path, "-") != 0){
+        local_fd = ::open(tar_path, O_RDONLY);
+        if(local_fd < 0){
+            error("Unable to open local tar ", tar_path, errno);
+            return false;
+        }
+    }
+    bool ok = ingest_stream(path, local_fd);
+    if(local_fd != STDIN_FILENO) ::close(local_fd);
+    return ok;
+}
+
+//entries are created as the stream is parsed, the file data is written
+//by the workers, dir attrs and hardlinks follow once all data is written
+bool CephfsHelper::ingest_stream(const std::string& path, int local_fd){
+    trace_scope tf("ingest", path.c_str());
+    tar_reader reader(local_fd);
+    if(!reader.open()) return false;
+    std::string dir = path;
+    if(dir[dir.size()-1] != '/') dir += '/';
+    if(!get_safe_path(dir.c_str())) return false;
+    aimd_limiter limiter(min_jobs, max_jobs);
+    worker_pool pool(limiter);
+    //remote dirs known to exist, '/' ended
+    std::set<std::string> made;
+    made.insert(dir);
+    std::vector<std::pair<std::string, struct ceph_statx>> dirs;
+    std::vector<std::pair<std::string, std::string>> links;
+    uint64_t files = 0, bytes = 0;
+    bool ok = true;
+    tar_entry e;
+    std::string rel, remote, parent;
+    while(ok && pool.ok() && reader.next(e)){
+        if(!tar_clean_path(e.path, rel)){
+            log("WARN")<<"skip tar entry "<<e.path<<", not below "<<dir<<std::endl;
+            continue;
+        }
+        uint32_t mode = e.mode | (e.type == TAR_DIR ? S_IFDIR :
+            e.type == TAR_SYMLINK ? S_IFLNK : S_IFREG);
+        if(filter.skip_path(rel, mode, e.size, e.mtime * 1000000000LL, true)) continue;
+        remote = dir + rel;
+        struct ceph_statx stx;
+        memset(&stx, 0, sizeof(stx));
+        stx.stx_mode = mode;
+        stx.stx_size = e.size;
+        stx.stx_mtime.tv_sec = e.mtime;
+        if(e.type == TAR_DIR){
+            if(made.insert(remote + '/').second) ok = get_safe_path((remote + '/').c_str());
+            dirs.push_back(std::make_pair(remote, stx));
+            continue;
+        }
+        parent = remote.substr(0, remote.rfind('/') + 1);
+        if(made.insert(parent).second && !get_safe_path(parent.c_str())){
+            ok = false;
+            break;
+        }
+        if(e.type == TAR_HARDLINK){
+            std::string target;
+            if(!tar_clean_path(e.link, target)){
+                log("WARN")<<"skip tar hardlink "<<e.path<<" to "<<e.link<<std::endl;
+                continue;
+            }
+            links.push_back(std::make_pair(dir + target, remote));
+        }else if(e.type == TAR_SYMLINK){
+            ops_rate.acquire(1);
+            trace_scope ts("symlink", remote.c_str());
+            int ret = fs->symlink(cmount, e.link.c_str(), remote.c_str());
+            if(ret == -EEXIST){
+                fs->unlink(cmount, remote.c_str());
+                ret = fs->symlink(cmount, e.link.c_str(), remote.c_str());
+            }
+            if(ret < 0){
+                error("Unable to create cephfs symlink ", remote.c_str(), -ret);
+                ok = false;
+            }
+        }else{
+            ok = ingest_file(reader, remote, stx, pool);
+            ++files;
+            bytes += e.size;
+        }
+    }
+    ok = pool.wait() && ok && reader.ok();
+    //the targets are written now
+    for(size_t i = 0; ok && i < links.size(); ++i){
+        const char *from = links[i].first.c_str(), *to = links[i].second.c_str();
+        ops_rate.acquire(2);
+        fs->unlink(cmount, to);
+        int ret = fs->link(cmount, from, to);
+        if(ret < 0){
+            error("Unable to link cephfs file ", to, -ret);
+            ok = false;
+        }
+    }
+    //files change the mtime of their dir, deepest dirs first
+    for(auto it = dirs.rbegin(); ok && it != dirs.rend(); ++it)
+        ok = set_attrs(it->first.c_str(), it->second);
+    if(!ok) return false;
+    log("INFO")<<"cephfs ingest "<<reader.compression()<<" stream to "<<dir<<", "<<files
+        <<" files, "<<bytes<<" bytes, "<<dirs.size()<<" dirs, "<<links.size()
+        <<" hardlinks"<<std::endl;
+    log("INFO")<<"transfer buffers "<<buffer_stats()<<std::endl;
+    return true;
+}
+
+//the data of a file entry is read here into pool chunks, the workers
+//write them, a small file in one task, a large one a task per chunk,
+//zero blocks are skipped and truncate sets the size, as in uploads
+bool CephfsHelper::ingest_file(tar_reader& reader, const std::string& path,
+    const struct ceph_statx& stx, worker_pool& pool){
+    buffer_pool& bufs = transfer_buffers();
+    uint64_t size = stx.stx_size;
+    if(size <= bufs.chunk_size()){
+        std::shared_ptr<pooled_chunk> buf(new pooled_chunk(bufs.acquire()));
+        if(buf->data == nullptr || reader.read(buf->data, size) != (int64_t)size)
+            return false;
+        pool.submit([this, buf, path, stx]{
+            trace_scope tf("upload", path.c_str());
+            int fd = open_file(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, stx.stx_mode & 0777);
+            if(fd <= 0){
+                error("Unable to open cephfs file ", path.c_str(), -fd);
+                return false;
+            }
+            bool ok = for_each_data(buf->data, stx.stx_size, UPLOAD_ZERO_BLOCK,
+                [&](size_t start, size_t n){
+                    return write_at(fd, path.c_str(), buf->data + start, n, start) >= 0;
+                });
+            int ret = ok ? fs->ftruncate(cmount, fd, stx.stx_size) : 0;
+            if(ret < 0){
+                error("Unable to truncate cephfs file ", path.c_str(), -ret);
+                ok = false;
+            }
+            close_file(fd, path.c_str());
+            return ok && set_attrs(path.c_str(), stx);
+        });
+        return true;
+    }
+    int fd = open_file(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, stx.stx_mode & 0777);
+    if(fd <= 0){
+        error("Unable to open cephfs file ", path.c_str(), -fd);
+        return false;
+    }
+    //the size first, so skipped zero blocks read as zeros
+    int ret = fs->ftruncate(cmount, fd, size);
+    if(ret < 0){
+        error("Unable to truncate cephfs file ", path.c_str(), -ret);
+        close_file(fd, path.c_str());
+        return false;
+    }
+    //closed once the last chunk task is gone, the last to finish sets attrs
+    std::shared_ptr<int> file(new int(fd), [this, path](int* p){
+        close_file(*p, path.c_str());
+        delete p;
+    });
+    uint64_t chunk = bufs.chunk_size();
+    std::shared_ptr<std::atomic<uint64_t>> left(
+        new std::atomic<uint64_t>((size + chunk - 1) / chunk));
+    for(uint64_t offset = 0; offset < size; offset += chunk){
+        uint64_t len = std::min(chunk, size - offset);
+        std::shared_ptr<pooled_chunk> buf(new pooled_chunk(bufs.acquire()));
+        if(buf->data == nullptr || reader.read(buf->data, len) != (int64_t)len ||
+            !pool.ok()) return false;
+        pool.submit([this, buf, file, left, path, stx, offset, len]{
+            trace_scope tf("upload", path.c_str());
+            bool ok = for_each_data(buf->data, len, UPLOAD_ZERO_BLOCK,
+                [&](size_t start, size_t n){
+                    return write_at(*file, path.c_str(), buf->data + start, n,
+                        offset + start) >= 0;
+                });
+            return ok && (--*left > 0 || set_attrs(path.c_str(), stx));
+        });
+    }
+    return true;
+}
+
+bool CephfsHelper::export_tar(const char* path, const char* tar_path){
+    if(path == nullptr || *path == '\0' ||
+        tar_path == nullptr || *tar_path == '\0') return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    int local_fd = STDOUT_FILENO;
+    if(strcmp(tar_path, "-") != 0){
+        local_fd = ::open(tar_path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        if(local_fd < 0){
+            error("Unable to open local tar ", tar_path, errno);
+            return false;
+        }
+    }
+    bool ok = export_stream(path, local_fd);
+    if(local_fd != STDOUT_FILENO && ::close(local_fd) < 0){
+        error("Unable to close local tar ", tar_path, errno);
+        ok = false;
+    }
+    return ok;
+}
+
+//the tree is walked in stream order, the workers read the files ahead
+//into pool chunks, a window of pieces keeps the order of the stream,
+//it is drained when full or when the pool is at its cap
+bool CephfsHelper::export_stream(const std::string& path, int local_fd){
+    trace_scope tf("export", path.c_str());
+    struct ceph_statx stx;
+    ops_rate.acquire(1);
+    int ret = fs->statx(cmount, path.c_str(), &stx,
+        CEPH_STATX_MODE|CEPH_STATX_SIZE|CEPH_STATX_MTIME, 0);
+    if(ret < 0){
+        error("Unable to stat cephfs path ", path.c_str(), -ret);
+        return false;
+    }
+    tar_writer writer(local_fd);
+    buffer_pool& bufs = transfer_buffers();
+    aimd_limiter limiter(min_jobs, max_jobs);
+    worker_pool pool(limiter);
+    std::mutex lock;
+    std::condition_variable cond;
+    std::atomic<bool> failed(false);
+    std::deque<std::shared_ptr<tar_piece>> window;
+    size_t depth = max_jobs * 2;
+    uint64_t files = 0;
+    //write the oldest piece once it is read
+    auto drain = [&]{
+        std::shared_ptr<tar_piece> p = window.front();
+        window.pop_front();
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            cond.wait(guard, [&]{ return p->done || failed.load();});
+            if(!p->done || p->got < 0) return false;
+        }
+        if(p->header && !writer.header(p->entry)) return false;
+        if((uint64_t)p->got < p->len)
+            log("WARN")<<"cephfs file "<<p->path<<" shrank while exported, "
+                <<"its end is zeros"<<std::endl;
+        return p->got == 0 || writer.data(p->buf->data, p->got);
+    };
+    auto add = [&](const std::shared_ptr<tar_piece>& p){
+        p->got = 0;
+        p->done = p->len == 0;
+        if(p->len > 0){
+            //the reads in the window hold the pool, write them out first
+            char *b;
+            while((b = bufs.try_acquire()) == nullptr && !window.empty())
+                if(!drain()) return false;
+            if(b == nullptr && (b = bufs.acquire()) == nullptr) return false;
+            p->buf.reset(new pooled_chunk(b));
+            pool.submit([this, p, &lock, &cond, &failed]{
+                trace_scope ts("download", p->path.c_str());
+                int64_t got = -1;
+                int fd = open_file(p->path.c_str(), O_RDONLY, 0644);
+                if(fd <= 0){
+                    error("Unable to open cephfs file ", p->path.c_str(), -fd);
+                }else{
+                    got = read_at(fd, p->path.c_str(), p->buf->data, p->len, p->offset);
+                    close_file(fd, p->path.c_str());
+                }
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    p->got = got;
+                    p->done = true;
+                    if(got < 0) failed.store(true);
+                }
+                cond.notify_all();
+                return got >= 0;
+            });
+        }
+        window.push_back(p);
+        while(window.size() > depth)
+            if(!drain()) return false;
+        return true;
+    };
+    //a file is a header piece and a piece per chunk of its data
+    auto add_entry = [&](const std::string& remote, const std::string& name, uint32_t mode,
+        uint64_t size, int64_t mtime_ns){
+        std::shared_ptr<tar_piece> p(new tar_piece());
+        p->header = true;
+        p->path = remote;
+        p->entry.path = name;
+        p->entry.mode = mode & 07777;
+        p->entry.size = S_ISREG(mode) ? size : 0;
+        p->entry.mtime = mtime_ns / 1000000000;
+        if(S_ISDIR(mode)){
+            p->entry.type = TAR_DIR;
+        }else if(S_ISLNK(mode)){
+            char target[PATH_MAX];
+            ops_rate.acquire(1);
+            int ret = fs->readlink(cmount, remote.c_str(), target, sizeof(target));
+            if(ret < 0){
+                error("Unable to read cephfs symlink ", remote.c_str(), -ret);
+                return false;
+            }
+            p->entry.type = TAR_SYMLINK;
+            p->entry.link.assign(target, ret);
+        }else if(S_ISREG(mode)){
+            p->entry.type = TAR_FILE;
+            ++files;
+        }else{
+            log("WARN")<<"skip cephfs path "<<remote<<", not a file, dir or symlink"
+                <<std::endl;
+            return true;
+        }
+        uint64_t chunk = bufs.chunk_size();
+        for(uint64_t offset = 0; ; offset += chunk){
+            p->offset = offset;
+            p->len = std::min(chunk, p->entry.size - offset);
+            if(!add(p)) return false;
+            if(offset + p->len >= p->entry.size) return true;
+            std::shared_ptr<tar_piece> next(new tar_piece());
+            next->header = false;
+            next->path = remote;
+            p = next;
+            p->entry.size = size;
+        }
+    };
+    bool ok;
+    if(S_ISDIR(stx.stx_mode)){
+        cephfs_dir_source source(fs, cmount, &ops_rate);
+        tree_walker walker(source);
+        ok = walker.walk(path, [&](const walk_entry& e){
+            if(filter.skip(e, false)) return tree_walker::VISIT_SKIP;
+            if(!add_entry(e.path, e.rel, e.mode, e.size, e.mtime_ns))
+                return tree_walker::VISIT_STOP;
+            return S_ISDIR(e.mode) ? tree_walker::VISIT_ENTER : tree_walker::VISIT_SKIP;
+        });
+    }else{
+        std::string name = path.substr(path.rfind('/') + 1);
+        ok = add_entry(path, name, stx.stx_mode, stx.stx_size,
+            stx.stx_mtime.tv_sec * 1000000000LL + stx.stx_mtime.tv_nsec);
+    }
+    while(ok && !window.empty()) ok = drain();
+    ok = pool.wait() && ok && writer.finish();
+    if(!ok) return false;
+    log("INFO")<<"cephfs export "<<path<<" to tar stream, "<<files<<" files, "
+        <<writer.bytes()<<" bytes"<<std::endl;
+    log("INFO")<<"transfer buffers "<<buffer_stats()<<std::endl;
+    return true;
+}
+
+//a name starting with '.' only matches a component starting with '.'
+static bool glob_name(const std::string& comp, const char* name){
+    if(name[0] == '.' && comp[0] != '.') return false;
+    return glob_match(comp.c_str(), name);
+}
+
+static std::string glob_join(const std::string& dir, const char* name){
+    if(dir.empty()) return name;
+    if(dir[dir.size()-1] == '/') return dir + name;
+    return dir + '/' + name;
+}
+
+//path of a hit below the literal dirs of its pattern
+static std::string glob_rel(const std::string& base, const std::string& path){
+    if(base.empty()) return path;
+    if(base[base.size()-1] == '/') return path.substr(base.size());
+    return path.substr(base.size() + 1);
+}
+
+//an entry of a dir listed for component k is a hit, a dir to list for a
+//later component, or both, ** also matches no dir at all
+void CephfsHelper::glob_entry(const std::vector<std::string>& comps, size_t k,
+    const glob_hit& h, const char* name, bool nested, std::vector<glob_hit>& found,
+    std::vector<std::pair<std::string, size_t>>& deeper){
+    bool dir = S_ISDIR(h.mode);
+    bool last = k + 1 == comps.size();
+    if(comps[k] == "**"){
+        if(name[0] == '.') return;
+        size_t hits = found.size();
+        if(last) found.push_back(h);
+        else glob_entry(comps, k + 1, h, name, nested, found, deeper);
+        if(dir && (nested || found.size() == hits)) deeper.push_back(std::make_pair(h.path, k));
+        return;
+    }
+    if(!glob_name(comps[k], name)) return;
+    if(last) found.push_back(h);
+    else if(dir) deeper.push_back(std::make_pair(h.path, k + 1));
+}
+
+bool CephfsHelper::expand_glob(const char* pattern, std::vector<std::string>& paths,
+    bool nested){
+    if(pattern == nullptr || *pattern == '\0') return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    std::string base;
+    std::vector<glob_hit> hits;
+    if(!glob_expand(pattern, base, hits, nested)) return false;
+    for(const glob_hit& h : hits) paths.push_back(h.path);
+    return true;
+}
+
+bool CephfsHelper::glob_expand(const char* pattern, std::string& base,
+    std::vector<glob_hit>& hits, bool nested){
+    std::vector<std::string> comps;
+    for(const char *p = pattern; *p; ){
+        const char *q = strchr(p, '/');
+        if(q == nullptr) q = p + strlen(p);
+        std::string comp(p, q - p);
+        if(!comp.empty() && comp != ".") comps.push_back(comp);
+        p = *q ? q + 1 : q;
+    }
+    if(comps.empty()){
+        log("ERROR")<<"Unable to glob "<<pattern<<", no name to match"<<std::endl;
+        return false;
+    }
+    //the literal dirs are not listed
+    base = pattern[0] == '/' ? "/" : "";
+    size_t first = 0;
+    while(first + 1 < comps.size() && !has_glob(comps[first]))
+        base = glob_join(base, comps[first++].c_str());
+    std::vector<std::pair<std::string, size_t>> level(1, std::make_pair(base, first));
+    std::mutex lock;
+    aimd_limiter limiter(min_jobs, max_jobs);
+    worker_pool pool(limiter);
+    size_t dirs = 0;
+    //a level at a time, its dirs listed in parallel
+    while(!level.empty()){
+        std::vector<std::pair<std::string, size_t>> next;
+        for(const auto& s : level){
+            pool.submit([this, &comps, &lock, &next, &hits, nested, s]{
+                return glob_dir(comps, s.first, s.second, nested, lock, next, hits);
+            });
+        }
+        if(!pool.wait()) return false;
+        dirs += level.size();
+        level.swap(next);
+    }
+    std::sort(hits.begin(), hits.end(), [](const glob_hit& a, const glob_hit& b){
+        return manifest_compare(a.path.data(), a.path.size(), b.path.data(), b.path.size()) < 0;
+    });
+    //** reaches a path on more than one way, a dir sorts right before
+    //the paths below it
+    size_t n = 0;
+    for(size_t i = 0; i < hits.size(); ++i){
+        if(n > 0 && hits[i].path == hits[n-1].path) continue;
+        if(n > 0 && !nested && S_ISDIR(hits[n-1].mode) &&
+            hits[i].path.compare(0, hits[n-1].path.size(), hits[n-1].path) == 0 &&
+            hits[i].path[hits[n-1].path.size()] == '/') continue;
+        if(n != i) hits[n] = std::move(hits[i]);
+        ++n;
+    }
+    hits.resize(n);
+    log("INFO")<<"cephfs glob "<<pattern<<", "<<n<<" paths, "<<dirs<<" dirs listed"<<std::endl;
+    return true;
+}
+
+//the hits and next levels of dir at component k
+bool CephfsHelper::glob_dir(const std::vector<std::string>& comps, std::string dir,
+    size_t k, bool nested, std::mutex& lock,
+    std::vector<std::pair<std::string, size_t>>& next, std::vector<glob_hit>& hits){
+    //literal components need no listing, a missing one is no match
+    while(k + 1 < comps.size() && !has_glob(comps[k]))
+        dir = glob_join(dir, comps[k++].c_str());
+    if(!has_glob(comps[k])){
+        std::string path = glob_join(dir, comps[k].c_str());
+        struct ceph_statx stx;
+        ops_rate.acquire(1);
+        int ret = fs->statx(cmount, path.c_str(), &stx,
+            CEPH_STATX_MODE|CEPH_STATX_SIZE|CEPH_STATX_MTIME, AT_SYMLINK_NOFOLLOW);
+        if(ret == -ENOENT || ret == -ENOTDIR) return true;
+        if(ret < 0){
+            error("Unable to stat path ", path.c_str(), -ret);
+            return false;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        hits.push_back(glob_hit{path, stx.stx_mode, stx.stx_size,
+            (int64_t)stx.stx_mtime.tv_sec * 1000000000 + stx.stx_mtime.tv_nsec});
+        return true;
+    }
+    cephfs_dir_source source(fs, cmount, &ops_rate);
+    int ret = source.open(dir.empty() ? "." : dir.c_str());
+    if(ret == -ENOENT || ret == -ENOTDIR) return true;
+    if(ret < 0){
+        error("Unable to open dir ", dir.c_str(), -ret);
+        return false;
+    }
+    std::vector<glob_hit> found;
+    std::vector<std::pair<std::string, size_t>> deeper;
+    dir_source::item it;
+    while((ret = source.next(it)) > 0){
+        if(strcmp(it.name, ".") == 0 || strcmp(it.name, "..") == 0) continue;
+        glob_hit h{glob_join(dir, it.name), it.mode, it.size, it.mtime_ns};
+        glob_entry(comps, k, h, it.name, nested, found, deeper);
+    }
+    source.close();
+    if(ret < 0){
+        error("Unable to read dir ", dir.c_str(), -ret);
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    hits.insert(hits.end(), found.begin(), found.end());
+    next.insert(next.end(), deeper.begin(), deeper.end());
+    return true;
+}
+
+bool CephfsHelper::remove_glob(const char* pattern){
+    if(pattern == nullptr || *pattern == '\0') return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    std::string base;
+    std::vector<glob_hit> hits;
+    if(!glob_expand(pattern, base, hits, false)) return false;
+    aimd_limiter limiter(min_jobs, max_jobs);
+    worker_pool pool(limiter);
+    std::vector<std::string> dirs;
+    uint64_t files = 0;
+    for(const glob_hit& h : hits){
+        if(!pool.ok()) break;
+        if(S_ISDIR(h.mode)){
+            dirs.push_back(h.path);
+            continue;
+        }
+        if(filter.skip_path(glob_rel(base, h.path), h.mode, h.size, h.mtime_ns, false))
+            continue;
+        std::string path = h.path;
+        pool.submit([this, path]{ return remove(path.c_str());});
+        ++files;
+    }
+    if(!pool.wait()) return false;
+    //each tree by all the workers
+    for(const std::string& dir : dirs)
+        if(!remove_dirs(dir.c_str())) return false;
+    log("INFO")<<"cephfs remove glob "<<pattern<<", "<<files<<" files, "
+        <<dirs.size()<<" dirs"<<std::endl;
+    return true;
+}
+
+bool CephfsHelper::read_glob(const char* pattern, const char* local_path){
+    if(pattern == nullptr || *pattern == '\0' ||
+        local_path == nullptr || *local_path == '\0') return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    std::string base;
+    std::vector<glob_hit> hits;
+    if(!glob_expand(pattern, base, hits, false)) return false;
+    std::string local_dir = local_path;
+    if(local_dir[local_dir.size()-1] != '/') local_dir += '/';
+    aimd_limiter limiter(min_jobs, max_jobs);
+    worker_pool pool(limiter);
+    std::vector<std::pair<std::string, std::string>> dirs;
+    uint64_t files = 0;
+    for(const glob_hit& h : hits){
+        if(!pool.ok()) break;
+        std::string rel = glob_rel(base, h.path), to = local_dir + rel;
+        if(S_ISDIR(h.mode)){
+            dirs.push_back(std::make_pair(h.path, to));
+            continue;
+        }
+        if(!S_ISREG(h.mode) ||
+            filter.skip_path(rel, h.mode, h.size, h.mtime_ns, false)) continue;
+        std::string parent = to.substr(0, to.rfind('/') + 1);
+        if(!mk_local_dirs(parent)){
+            error("Unable to mkdir local dir ", parent.c_str(), errno);
+            return false;
+        }
+        std::string from = h.path;
+        pool.submit([this, from, to]{ return read_file(from.c_str(), to.c_str(), false);});
+        ++files;
+    }
+    if(!pool.wait()) return false;
+    for(const auto& d : dirs)
+        if(!read_tree(d.first.c_str(), d.second.c_str())) return false;
+    log("INFO")<<"cephfs download glob "<<pattern<<" to "<<local_dir<<", "<<files
+        <<" files, "<<dirs.size()<<" dirs"<<std::endl;
+    return true;
+}
+
+static std::string container_name(uint64_t generation, uint32_t id){
+    char name[48];
+    snprintf(name, sizeof(name), "%016llx-%08u.pack", (unsigned long long)generation, id);
+    return name;
+}
+
+//generation of a container name, false for other names
+static bool container_generation(const std::string& name, uint64_t& generation){
+    unsigned long long g;
+    unsigned id;
+    return sscanf(name.c_str(), "%16llx-%8u", &g, &id) == 2 &&
+        name == container_name(generation = g, id);
+}
+
+bool CephfsHelper::pack_tree(const char* path, const char* local_path,
+    uint64_t container_size){
+    if(path == nullptr || *path == '\0' ||
+        local_path == nullptr || *local_path == '\0') return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    std::string dir = path;
+    if(dir[dir.size()-1] != '/') dir += '/';
+    std::vector<pack_file> files;
+    local_dir_source source;
+    tree_walker walker(source);
+    bool ok = walker.walk(local_path, [&](const walk_entry& e){
+        //skip .* unless included
+        if(filter.skip(e, true)) return tree_walker::VISIT_SKIP;
+        if(S_ISDIR(e.mode)) return tree_walker::VISIT_ENTER;
+        if(S_ISREG(e.mode))
+            files.push_back(pack_file{e.rel, e.path, e.size, (uint32_t)e.mode, e.mtime_ns});
+        return tree_walker::VISIT_SKIP;
+    });
+    if(!ok) return false;
+    std::sort(files.begin(), files.end(), [](const pack_file& a, const pack_file& b){
+        return manifest_compare(a.rel.data(), a.rel.size(), b.rel.data(), b.rel.size()) < 0;
+    });
+    //consecutive members up to container_size, a larger file alone
+    std::vector<size_t> starts;
+    uint64_t bytes = 0, total = 0;
+    for(size_t i = 0; i < files.size(); ++i){
+        if(starts.empty() || bytes + files[i].size > container_size){
+            if(starts.empty() || bytes > 0) starts.push_back(i);
+            bytes = 0;
+        }
+        bytes += files[i].size;
+        total += files[i].size;
+    }
+    size_t count = starts.size();
+    starts.push_back(files.size());
+    //the old pack stays whole until the new one is complete
+    if(!preflight(dir, total, count + 1) || !get_safe_path(dir.c_str())) return false;
+    const uint64_t generation = wall_ns();
+    std::vector<std::pair<uint64_t, uint64_t>> indexes(count);
+    {
+        aimd_limiter limiter(min_jobs, max_jobs);
+        worker_pool pool(limiter);
+        for(size_t c = 0; c < count && pool.ok(); ++c){
+            pool.submit([this, &files, &starts, &indexes, &dir, generation, c]{
+                return write_container(dir + container_name(generation, c), files,
+                    starts[c], starts[c+1], indexes[c]);
+            });
+        }
+        ok = pool.wait();
+    }
+    pack_index_builder top;
+    top.set_generation(generation);
+    for(size_t c = 0; c < count; ++c)
+        top.add(files[starts[c]].rel, c, indexes[c].first, indexes[c].second, 0);
+    std::string image = top.serialize();
+    //renamed over the old index, readers of either see whole containers
+    std::string index = dir + PACK_INDEX_NAME;
+    std::string tmp = index + '.' + std::to_string(generation) + ".tmp";
+    int ret = 0;
+    if(ok){
+        int fd = open_file(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        if(fd <= 0) error("Unable to open cephfs file ", tmp.c_str(), -fd);
+        ok = fd > 0 && write_at(fd, tmp.c_str(), image.data(), image.size(), 0) >= 0;
+        if(fd > 0) close_file(fd, tmp.c_str());
+    }
+    if(ok){
+        ops_rate.acquire(1);
+        ret = fs->rename(cmount, tmp.c_str(), index.c_str());
+        if(ret < 0) error("Unable to rename pack index to ", index.c_str(), -ret);
+        ok = ret == 0;
+    }
+    if(!ok){
+        //the new generation was never published
+        for(size_t c = 0; c < count; ++c){
+            ops_rate.acquire(1);
+            fs->unlink(cmount, (dir + container_name(generation, c)).c_str());
+        }
+        ops_rate.acquire(1);
+        fs->unlink(cmount, tmp.c_str());
+        return false;
+    }
+    //the old generations, a reader still on them gets an error, no data
+    //of another pack
+    std::vector<std::string> names;
+    if(listdir(dir.c_str(), names)){
+        for(const std::string& name : names){
+            uint64_t g;
+            if(container_generation(name, g) && g != generation){
+                ops_rate.acquire(1);
+                fs->unlink(cmount, (dir + name).c_str());
+            }
+        }
+    }
+    log("INFO")<<"cephfs pack "<<local_path<<" to "<<dir<<", "<<files.size()<<" files, "
+        <<total<<" bytes in "<<count<<" containers"<<std::endl;
+    log("INFO")<<"transfer buffers "<<buffer_stats()<<std::endl;
+    return true;
+}
+
+//members begin to end back to back through one pool chunk, then the
+//index, its offset and size go to index
+bool CephfsHelper::write_container(const std::string& path,
+    const std::vector<pack_file>& files, size_t begin, size_t end,
+    std::pair<uint64_t, uint64_t>& index){
+    trace_scope tf("pack", path.c_str());
+    buffer_lease lease(transfer_buffers(), 1);
+    if(lease.size() == 0) return false;
+    char *buf = lease[0];
+    const size_t chunk = transfer_buffers().chunk_size();
+    int fd = open_file(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd <= 0){
+        error("Unable to open cephfs file ", path.c_str(), -fd);
+        return false;
+    }
+    //offset counts the bytes written and the fill in buf
+    uint64_t offset = 0;
+    size_t fill = 0;
+    auto flush = [&]{
+        bool ret = write_at(fd, path.c_str(), buf, fill, offset - fill) >= 0;
+        fill = 0;
+        return ret;
+    };
+    pack_index_builder members;
+    bool ok = true;
+    for(size_t i = begin; ok && i < end; ++i){
+        const pack_file& f = files[i];
+        int local_fd = ::open(f.local_path.c_str(), O_RDONLY);
+        if(local_fd < 0){
+            error("Unable to open local file ", f.local_path.c_str(), errno);
+            ok = false;
+            break;
+        }
+        uint64_t start = offset;
+        while(true){
+            if(fill == chunk && !(ok = flush())) break;
+            int64_t n = read_local(local_fd, buf + fill, chunk - fill);
+            if(n < 0){
+                ok = false;
+                break;
+            }
+            fill += n;
+            offset += n;
+            if(fill < chunk) break;
+        }
+        ::close(local_fd);
+        if(offset - start != f.size)
+            log("WARN")<<"local file "<<f.local_path<<" changed while packed, "
+                <<offset - start<<" bytes packed"<<std::endl;
+        members.add(f.rel, f.mode, start, offset - start, f.mtime_ns);
+    }
+    std::string image;
+    if(ok){
+        image = members.serialize();
+        index = std::make_pair(offset, (uint64_t)image.size());
+        ok = (fill == 0 || flush()) &&
+            write_at(fd, path.c_str(), image.data(), image.size(), offset) >= 0;
+    }
+    close_file(fd, path.c_str());
+    return ok;
+}
+
+//len bytes at offset of a cephfs file, all of them or false
+bool CephfsHelper::read_range(const std::string& path, uint64_t offset, uint64_t len,
+    std::string& data){
+    int fd = open_file(path.c_str(), O_RDONLY, 0644);
+    if(fd <= 0){
+        error("Unable to open cephfs file ", path.c_str(), -fd);
+        return false;
+    }
+    data.resize(len);
+    int64_t ret = len == 0 ? 0 : read_at(fd, path.c_str(), &data[0], len, offset);
+    close_file(fd, path.c_str());
+    if(ret != (int64_t)len){
+        if(ret >= 0) error("Unable to read all of cephfs file ", path.c_str(), EIO);
+        return false;
+    }
+    return true;
+}
+
+//an index image of a pack, least recently used ones are dropped, the
+//container indexes of a generation never change, pack.idx is stat'ed
+//each time and read again once it was replaced, by any process
+std::shared_ptr<std::string> CephfsHelper::load_pack_index(const std::string& path,
+    uint64_t offset, int64_t len){
+    std::string key = path + '@' + std::to_string(offset), stamp;
+    //pack.idx may be renamed over between the stat and the read
+    const bool top = len < 0;
+    for(int tries = 0; tries < (top ? 2 : 1); ++tries){
+        if(top){
+            struct ceph_statx stx;
+            ops_rate.acquire(1);
+            int ret = fs->statx(cmount, path.c_str(), &stx,
+                CEPH_STATX_INO|CEPH_STATX_SIZE|CEPH_STATX_MTIME, 0);
+            if(ret < 0){
+                error("Unable to stat pack index ", path.c_str(), -ret);
+                return nullptr;
+            }
+            len = stx.stx_size;
+            stamp = std::to_string(stx.stx_ino) + ' ' + std::to_string(stx.stx_size) + ' ' +
+                std::to_string((int64_t)stx.stx_mtime.tv_sec * 1000000000 +
+                stx.stx_mtime.tv_nsec);
+        }
+        {
+            std::lock_guard<std::mutex> guard(pack_lock);
+            auto it = pack_cache.find(key);
+            if(it != pack_cache.end() && it->second.stamp == stamp){
+                pack_lru.splice(pack_lru.begin(), pack_lru, it->second.lru);
+                return it->second.image;
+            }
+        }
+        std::shared_ptr<std::string> image(new std::string());
+        pack_index_view view;
+        if(!read_range(path, offset, len, *image) ||
+            !view.attach(image->data(), image->size())) continue;
+        std::lock_guard<std::mutex> guard(pack_lock);
+        auto it = pack_cache.find(key);
+        if(it != pack_cache.end()){
+            pack_lru.erase(it->second.lru);
+            pack_cache.erase(it);
+        }
+        if(pack_cache.size() >= PACK_CACHE){
+            pack_cache.erase(pack_lru.back());
+            pack_lru.pop_back();
+        }
+        pack_lru.push_front(key);
+        pack_cache[key] = pack_cached{image, stamp, pack_lru.begin()};
+        return image;
+    }
+    log("ERROR")<<"Unable to read pack index "<<path<<" at "<<offset
+        <<", not a pack"<<std::endl;
+    return nullptr;
+}
+
+//the record of member and the path of its container
+bool CephfsHelper::find_member(const std::string& path, const std::string& member,
+    pack_record& rec, std::string& container){
+    std::string dir = path, rel;
+    if(dir[dir.size()-1] != '/') dir += '/';
+    if(!tar_clean_path(member, rel)){
+        log("ERROR")<<"Unable to find pack member "<<member<<", not a member path"<<std::endl;
+        return false;
+    }
+    std::shared_ptr<std::string> top = load_pack_index(dir + PACK_INDEX_NAME, 0, -1);
+    if(!top) return false;
+    pack_index_view view;
+    view.attach(top->data(), top->size());
+    int64_t c = view.floor(rel);
+    if(c >= 0){
+        const pack_record& r = view.at(c);
+        container = dir + container_name(view.generation(), r.mode);
+        std::shared_ptr<std::string> image = load_pack_index(container, r.offset, r.size);
+        if(!image) return false;
+        pack_index_view members;
+        members.attach(image->data(), image->size());
+        int64_t i = members.find(rel);
+        if(i >= 0){
+            rec = members.at(i);
+            return true;
+        }
+    }
+    log("ERROR")<<"Unable to find pack member "<<rel<<" in "<<dir<<std::endl;
+    return false;
+}
+
+bool CephfsHelper::pack_list(const char* path, std::vector<std::string>& list){
+    if(path == nullptr || *path == '\0') return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    std::string dir = path;
+    if(dir[dir.size()-1] != '/') dir += '/';
+    std::shared_ptr<std::string> top = load_pack_index(dir + PACK_INDEX_NAME, 0, -1);
+    if(!top) return false;
+    pack_index_view view;
+    view.attach(top->data(), top->size());
+    //containers hold consecutive ranges, so the list stays sorted
+    for(size_t c = 0; c < view.size(); ++c){
+        const pack_record& r = view.at(c);
+        std::shared_ptr<std::string> image = load_pack_index(
+            dir + container_name(view.generation(), r.mode), r.offset, r.size);
+        if(!image) return false;
+        pack_index_view members;
+        members.attach(image->data(), image->size());
+        for(size_t i = 0; i < members.size(); ++i) list.push_back(members.path(i));
+    }
+    return true;
+}
+
+int64_t CephfsHelper::pack_read(const char* path, const char* member, char* buf,
+    size_t len, uint64_t offset){
+    if(path == nullptr || *path == '\0' || member == nullptr ||
+        (buf == nullptr && len > 0)) return -1;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return -1;
+    }
+    pack_record rec;
+    std::string container;
+    if(!find_member(path, member, rec, container)) return -1;
+    if(offset >= rec.size) return 0;
+    len = std::min<uint64_t>(len, rec.size - offset);
+    int fd = open_file(container.c_str(), O_RDONLY, 0644);
+    if(fd <= 0){
+        error("Unable to open cephfs file ", container.c_str(), -fd);
+        return -1;
+    }
+    int64_t ret = read_at(fd, container.c_str(), buf, len, rec.offset + offset);
+    close_file(fd, container.c_str());
+    return ret;
+}
+
+//mode and mtime of a member on its local file
+static void set_local_attrs(int fd, const pack_record& r){
+    struct timespec ts[2];
+    ts[0].tv_sec = 0;
+    ts[0].tv_nsec = UTIME_OMIT;
+    ts[1].tv_sec = r.mtime_ns / 1000000000;
+    ts[1].tv_nsec = r.mtime_ns % 1000000000;
+    ::futimens(fd, ts);
+    ::fchmod(fd, r.mode & 07777);
+}
+
+bool CephfsHelper::pack_extract(const char* path, const char* member,
+    const char* local_path){
+    if(path == nullptr || *path == '\0' || member == nullptr ||
+        local_path == nullptr || *local_path == '\0') return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    pack_record rec;
+    std::string container;
+    if(!find_member(path, member, rec, container)) return false;
+    bool to_stdout = strcmp(local_path, "-") == 0;
+    int local_fd = to_stdout ? STDOUT_FILENO :
+        ::open(local_path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(local_fd < 0){
+        error("Unable to open local file ", local_path, errno);
+        return false;
+    }
+    int fd = open_file(container.c_str(), O_RDONLY, 0644);
+    if(fd <= 0){
+        error("Unable to open cephfs file ", container.c_str(), -fd);
+        if(!to_stdout) ::close(local_fd);
+        return false;
+    }
+    //only the range of the member is read, ahead of the local writes
+    buffer_pipeline pipe(transfer_buffers(), STREAM_DEPTH);
+    uint64_t done = 0;
+    bool ok = pipe.run(
+        [&](char* buf, size_t len){
+            len = std::min<uint64_t>(len, rec.size - done);
+            int64_t n = len == 0 ? 0 : read_at(fd, container.c_str(), buf, len,
+                rec.offset + done);
+            if(n > 0) done += n;
+            return n;
+        },
+        [local_fd](const char* buf, size_t len){ return write_local(local_fd, buf, len);});
+    close_file(fd, container.c_str());
+    if(!to_stdout){
+        if(ok) set_local_attrs(local_fd, rec);
+        ::close(local_fd);
+    }
+    if(!ok || done != rec.size) return false;
+    log("INFO")<<"cephfs pack extract "<<member<<" of "<<path<<", "<<done<<" bytes"<<std::endl;
+    return true;
+}
+
+bool CephfsHelper::unpack_tree(const char* path, const char* local_path){
+    if(path == nullptr || *path == '\0' ||
+        local_path == nullptr || *local_path == '\0') return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    std::string dir = path, local_dir = local_path;
+    if(dir[dir.size()-1] != '/') dir += '/';
+    if(local_dir[local_dir.size()-1] != '/') local_dir += '/';
+    std::shared_ptr<std::string> top = load_pack_index(dir + PACK_INDEX_NAME, 0, -1);
+    if(!top) return false;
+    if(!mk_local_dirs(local_dir)){
+        error("Unable to mkdir local dir ", local_dir.c_str(), errno);
+        return false;
+    }
+    pack_index_view view;
+    view.attach(top->data(), top->size());
+    aimd_limiter limiter(min_jobs, max_jobs);
+    worker_pool pool(limiter);
+    std::atomic<uint64_t> files(0), bytes(0);
+    const uint64_t generation = view.generation();
+    for(size_t c = 0; c < view.size() && pool.ok(); ++c){
+        const pack_record r = view.at(c);
+        pool.submit([this, &dir, &local_dir, generation, r, &files, &bytes]{
+            return unpack_container(dir + container_name(generation, r.mode), r, local_dir,
+                files, bytes);
+        });
+    }
+    if(!pool.wait()) return false;
+    log("INFO")<<"cephfs unpack "<<dir<<" to "<<local_dir<<", "<<files.load()<<" files, "
+        <<bytes.load()<<" bytes"<<std::endl;
+    log("INFO")<<"transfer buffers "<<buffer_stats()<<std::endl;
+    return true;
+}
+
+//the container is read front to back in pool chunks, its members are in
+//offset order, filtered members are passed over
+bool CephfsHelper::unpack_container(const std::string& path, const pack_record& index,
+    const std::string& local_dir, std::atomic<uint64_t>& files,
+    std::atomic<uint64_t>& bytes){
+    trace_scope tf("unpack", path.c_str());
+    std::shared_ptr<std::string> image = load_pack_index(path, index.offset, index.size);
+    if(!image) return false;
+    pack_index_view members;
+    members.attach(image->data(), image->size());
+    buffer_lease lease(transfer_buffers(), 1);
+    if(lease.size() == 0) return false;
+    char *buf = lease[0];
+    const size_t chunk = transfer_buffers().chunk_size();
+    int fd = open_file(path.c_str(), O_RDONLY, 0644);
+    if(fd <= 0){
+        error("Unable to open cephfs file ", path.c_str(), -fd);
+        return false;
+    }
+    uint64_t win_start = 0, win_len = 0;
+    std::string local, parent;
+    bool ok = true;
+    for(size_t i = 0; ok && i < members.size(); ++i){
+        const pack_record& r = members.at(i);
+        std::string rel = members.path(i);
+        if(filter.skip_path(rel, r.mode, r.size, r.mtime_ns, false)) continue;
+        local = local_dir + rel;
+        std::string dir = local.substr(0, local.rfind('/') + 1);
+        if(dir != parent){
+            if(!mk_local_dirs(dir)){
+                error("Unable to mkdir local dir ", dir.c_str(), errno);
+                ok = false;
+                break;
+            }
+            parent = dir;
+        }
+        int local_fd = ::open(local.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        if(local_fd < 0){
+            error("Unable to open local file ", local.c_str(), errno);
+            ok = false;
+            break;
+        }
+        uint64_t pos = r.offset, end = r.offset + r.size;
+        while(ok && pos < end){
+            if(pos < win_start || pos >= win_start + win_len){
+                //the data ends where the index starts
+                win_start = pos;
+                win_len = std::min<uint64_t>(chunk, index.offset - pos);
+                ok = win_len > 0 &&
+                    read_at(fd, path.c_str(), buf, win_len, pos) == (int64_t)win_len;
+                if(!ok) error("Unable to read pack member ", local.c_str(), EIO);
+                continue;
+            }
+            size_t n = std::min(end, win_start + win_len) - pos;
+            ok = write_local(local_fd, buf + (pos - win_start), n);
+            pos += n;
+        }
+        if(ok) set_local_attrs(local_fd, r);
+        ::close(local_fd);
+        ++files;
+        bytes += r.size;
+    }
+    close_file(fd, path.c_str());
+    return ok;
+}
+
+void CephfsHelper::set_rate_limit(double bytes_per_sec, double ops_per_sec){
+    data_rate.set_rate(bytes_per_sec);
+    ops_rate.set_rate(ops_per_sec);
+    log("INFO")<<"cephfs rate limit "<<(int64_t)bytes_per_sec<<" bytes/s, "
+        <<(int64_t)ops_per_sec<<" ops/s"<<std::endl;
+}
+
+void CephfsHelper::set_local_io(bool uring, uint64_t direct_size){
+    local_uring = uring;
+    direct_io_size = direct_size;
+}
+
+void CephfsHelper::set_dedup(const char* index_dir){
+    dedup_dir = index_dir == nullptr ? "" : index_dir;
+    while(dedup_dir.size() > 1 && dedup_dir[dedup_dir.size()-1] == '/') dedup_dir.pop_back();
+}
+
+void CephfsHelper::set_manifest(const char* cache_dir, bool remote){
+    manifest_cache = cache_dir == nullptr ? "" : cache_dir;
+    manifest_remote = remote;
+}
+
+void CephfsHelper::set_split(uint64_t file_size, uint64_t chunk_size){
+    split_size = file_size;
+    split_chunk = chunk_size > 0 ? chunk_size : transfer_buffers().chunk_size();
+}
+
+bool CephfsHelper::add_filter(const char* rule){
+    return rule != nullptr && filter.add(rule);
+}
+
+bool CephfsHelper::add_filter_file(const char* file){
+    return file != nullptr && filter.load(file);
+}
+
+void CephfsHelper::set_filter_size(uint64_t min_size, uint64_t max_size){
+    filter.set_size(min_size, max_size);
+}
+
+void CephfsHelper::set_filter_mtime(int64_t newer_sec, int64_t older_sec){
+    filter.set_mtime(newer_sec, older_sec);
+}
+
+void CephfsHelper::clear_filter(){
+    filter.clear();
+}
+
+void CephfsHelper::set_preflight(bool on){
+    preflight_check = on;
+}
+
+void CephfsHelper::set_async(int threads, size_t queue_limit){
+    std::shared_ptr<task_executor> old;
+    {
+        std::lock_guard<std::mutex> guard(async_lock);
+        async_threads = std::max(1, threads);
+        async_queue = std::max<size_t>(1, queue_limit);
+        old.swap(async_exec);
+    }
+    //runs the ops queued on it, then joins
+    old.reset();
+}
+
+void CephfsHelper::submit_async(std::function<void()> task){
+    std::shared_ptr<task_executor> exec;
+    {
+        std::lock_guard<std::mutex> guard(async_lock);
+        if(!async_exec) async_exec.reset(new task_executor(async_threads, async_queue));
+        exec = async_exec;
+    }
+    exec->submit(std::move(task));
+}
+
+bool CephfsHelper::set_shard(int index, int count){
+    if(count < 1 || index < 0 || index >= count){
+        log("ERROR")<<"Invalid shard "<<index<<" of "<<count<<std::endl;
+        return false;
+    }
+    shard_index = index;
+    shard_count = count;
+    return true;
+}
+
+//the same dir for every shard of one op on one tree
+std::string CephfsHelper::shard_dir(const char* op, const char* path, int count){
+    std::string tree = path;
+    while(tree.size() > 1 && tree[tree.size()-1] == '/') tree.pop_back();
+    std::string key = std::string(op) + '\0' + tree + '\0' + std::to_string(count);
+    sha256 h;
+    h.update(key.data(), key.size());
+    return std::string(SHARD_DIR) + '/' + h.hex_digest().substr(0, 32);
+}
+
+//"ok|failed count unit" in the marker of this shard
+bool CephfsHelper::shard_done(const char* op, const char* path, bool ok,
+    uint64_t count, const char* unit){
+    std::string marker = shard_dir(op, path, shard_count) + '/' +
+        std::to_string(shard_index) + "-of-" + std::to_string(shard_count);
+    std::string state = std::string(ok ? "ok " : "failed ") + std::to_string(count) +
+        ' ' + unit + '\n';
+    log("INFO")<<"cephfs "<<op<<" "<<path<<" shard "<<shard_index<<" of "<<shard_count
+        <<" "<<state;
+    return write_str(marker.c_str(), state.c_str());
+}
+
+int CephfsHelper::shard_merge(const char* op, const char* path, int count){
+    if(op == nullptr || path == nullptr || *path == '\0' || count < 1) return -1;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return -1;
+    }
+    std::string dir = shard_dir(op, path, count);
+    int done = 0;
+    uint64_t total = 0;
+    std::string unit;
+    for(int i = 0; i < count; ++i){
+        std::string marker = dir + '/' + std::to_string(i) + "-of-" + std::to_string(count);
+        if(stat(marker.c_str()) != 0){
+            log("INFO")<<"cephfs "<<op<<" "<<path<<" shard "<<i<<" not done"<<std::endl;
+            continue;
+        }
+        std::stringstream ss(read_str(marker.c_str()));
+        std::string state;
+        uint64_t n = 0;
+        ss>>state>>n>>unit;
+        if(state != "ok"){
+            log("INFO")<<"cephfs "<<op<<" "<<path<<" shard "<<i<<" failed"<<std::endl;
+            continue;
+        }
+        ++done;
+        total += n;
+    }
+    log("INFO")<<"cephfs "<<op<<" "<<path<<" "<<done<<" of "<<count<<" shards done, "
+        <<total<<" "<<unit<<std::endl;
+    if(done < count) return done;
+    //dirs the shards left to each other
+    if(strcmp(op, "delete") == 0 && stat(path) == 1 && !remove_dirs(path)) return -1;
+    for(int i = 0; i < count; ++i)
+        remove((dir + '/' + std::to_string(i) + "-of-" + std::to_string(count)).c_str());
+    rm_dir(dir.c_str());
+    return done;
+}
+
+void CephfsHelper::set_concurrency(int min_jobs, int max_jobs){
+    this->min_jobs = std::max(1, min_jobs);
+    this->max_jobs = std::max(this->min_jobs, max_jobs);
+}
+
+bool CephfsHelper::chdir(const char* path){
+    if(path == nullptr || *path == '\0') return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    int ret = fs->chdir(cmount, path);
+    if(ret < 0){
+        error("Unable to cd, path: ", path, -ret);
+        return false;
+    }
+    log("INFO")<<"cephfs chdir "<<path<<std::endl;
+    return true;
+}
+
+std::string CephfsHelper::getcwd(){
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return "";
+    }
+    return std::string(fs->getcwd(cmount));
+}
+
+int CephfsHelper::stat(const char* path){
+    if(path == nullptr || *path == '\0') return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    struct ceph_statx stx;
+    ops_rate.acquire(1);
+    int ret = fs->statx(cmount, path, &stx, CEPH_STATX_MODE, AT_SYMLINK_NOFOLLOW);
+    if(ret == 0){
+        if(S_ISREG(stx.stx_mode))
+            return 0;
+        else if(S_ISDIR(stx.stx_mode))
+            return 1;
+        else return 2;
+    }
+    //error("Unable to stat, path: ", path, -ret);
+    return -1;
+}
+
+bool CephfsHelper::listdir(const char* path,
+    std::vector<std::string>& list){
+    if(path == nullptr || *path == '\0') return false;
+    if(cmount == nullptr){
+        log("ERROR")<<"No user log in cephfs"<<std::endl;
+        return false;
+    }
+    struct ceph_dir_result *dirp;
+    struct dirent de;
+    int ret;
+    ops_rate.acquire(1);
+    ret = fs->opendir(cmount, path, &dirp);
+    if(ret < 0){
+        error("Unable to open path: ", path, -ret);
+        return false;
+    }
+    list.clear();
+    trace_scope ts("readdir", path);
+    while ((ret = fs->readdir_r(cmount, dirp, &de)) > 0) {
+        std::string name = de.d_name;
+        if(name != "." && name != "..") {
+            list.push_back(name);
+        }
+    }
+    if(ret < 0) {
+        error("Unable to read path: ", path, -ret);
+        return false;
+    }
+    ret = fs->closedir(cmount, dirp);
+    if(ret < 0) {
+        error("Unable to close path: ", path, -ret);
+        return false;
+    }
+    return true;
+}
+
+bool CephfsHelper::listdir_buffer(const char* path,
     std::vector<std::string>& list){
     if(path == nullptr || *path == '\0') return false;
     if(cmount == nullptr){
@@ -589,12 +3522,14 @@ bool CephfsHelper::listdir_buffer(const char* path,
     }
     struct ceph_dir_result *dirp;
     int ret;
-    ret = ceph_opendir(cmount, path, &dirp);
+    ops_rate.acquire(1);
+    ret = fs->opendir(cmount, path, &dirp);
     if(ret < 0){
         error("Unable to open path: ", path, -ret);
         return false;
     }
     list.clear();
+    trace_scope ts("readdir", path);
     int buflen = 512, pos;
     char *buf = new char[buflen];
     if(buf == nullptr){
@@ -602,7 +3537,7 @@ bool CephfsHelper::listdir_buffer(const char* path,
         return false;
     }
     while(true){
-        ret = ceph_getdnames(cmount, dirp, buf, buflen);
+        ret = fs->getdnames(cmount, dirp, buf, buflen);
         if(ret == -ERANGE) { //expand the buffer
             delete [] buf;
             buflen *= 2;
@@ -628,7 +3563,7 @@ bool CephfsHelper::listdir_buffer(const char* path,
         error("Unable to read path: ", path, -ret);
         return false;
     }
-    ret = ceph_closedir(cmount, dirp);
+    ret = fs->closedir(cmount, dirp);
     if(ret < 0) {
         error("Unable to close path: ", path, -ret);
         return false;
@@ -636,3 +3571,72 @@ bool CephfsHelper::listdir_buffer(const char* path,
     return true;
 }
 
+
+std::future<int64_t> CephfsHelper::write_async(const char* path, const char* buf,
+    size_t len, uint64_t offset){
+    std::string p = path ? path : "";
+    return run_async<int64_t>([this, p, buf, len, offset]{
+        return write_from(p.c_str(), buf, len, offset);
+    });
+}
+
+void CephfsHelper::write_async(const char* path, const char* buf, size_t len,
+    uint64_t offset, std::function<void(int64_t)> done){
+    std::string p = path ? path : "";
+    submit_async([this, p, buf, len, offset, done]{
+        done(write_from(p.c_str(), buf, len, offset));
+    });
+}
+
+std::future<int64_t> CephfsHelper::read_async(const char* path, char* buf, size_t len,
+    uint64_t offset){
+    std::string p = path ? path : "";
+    return run_async<int64_t>([this, p, buf, len, offset]{
+        return read_into(p.c_str(), buf, len, offset);
+    });
+}
+
+void CephfsHelper::read_async(const char* path, char* buf, size_t len, uint64_t offset,
+    std::function<void(int64_t)> done){
+    std::string p = path ? path : "";
+    submit_async([this, p, buf, len, offset, done]{
+        done(read_into(p.c_str(), buf, len, offset));
+    });
+}
+
+std::future<int> CephfsHelper::stat_async(const char* path){
+    std::string p = path ? path : "";
+    return run_async<int>([this, p]{ return stat(p.c_str());});
+}
+
+void CephfsHelper::stat_async(const char* path, std::function<void(int)> done){
+    std::string p = path ? path : "";
+    submit_async([this, p, done]{ done(stat(p.c_str()));});
+}
+
+std::future<bool> CephfsHelper::listdir_async(const char* path,
+    std::vector<std::string>& list){
+    std::string p = path ? path : "";
+    std::vector<std::string> *out = &list;
+    return run_async<bool>([this, p, out]{ return listdir_buffer(p.c_str(), *out);});
+}
+
+void CephfsHelper::listdir_async(const char* path,
+    std::function<void(bool, std::vector<std::string>&)> done){
+    std::string p = path ? path : "";
+    submit_async([this, p, done]{
+        std::vector<std::string> list;
+        bool ret = listdir_buffer(p.c_str(), list);
+        done(ret, list);
+    });
+}
+
+std::future<bool> CephfsHelper::remove_async(const char* path){
+    std::string p = path ? path : "";
+    return run_async<bool>([this, p]{ return remove(p.c_str());});
+}
+
+void CephfsHelper::remove_async(const char* path, std::function<void(bool)> done){
+    std::string p = path ? path : "";
+    submit_async([this, p, done]{ done(remove(p.c_str()));});
+}
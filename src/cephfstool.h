@@ -8,24 +8,194 @@
 #define CEPHFSTOOL_H
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <list>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <fcntl.h>
 #include <cephfs/libcephfs.h>
+#include "backend.h"
+#include "ratelimit.h"
+#include "filter.h"
+
+class worker_pool;
+class task_executor;
+class CephFile;
+class manifest_builder;
+class manifest_view;
+struct watch_changes;
+class tar_reader;
+struct pack_record;
 
 //all function write the error msg to log file or stdout
 class CephfsHelper {
+    friend class CephFile;
+    struct tree_file {
+        std::string path;
+        std::string local_path;
+        uint64_t size;
+    };
+    struct glob_hit {
+        std::string path;
+        uint32_t mode;
+        uint64_t size;
+        int64_t mtime_ns;
+    };
+    struct pack_cached {
+        std::shared_ptr<std::string> image;
+        std::string stamp;  //of pack.idx, inode, size and mtime
+        std::list<std::string>::iterator lru;
+    };
+    struct pack_file {
+        std::string rel;
+        std::string local_path;
+        uint64_t size;
+        uint32_t mode;
+        int64_t mtime_ns;
+    };
 private:
     struct ceph_mount_info *cmount;
+    //all cephfs calls go through fs, libcephfs by default
+    CephfsBackend *fs;
+    std::unique_ptr<CephfsBackend> stand_in;
+    std::unique_ptr<CephfsBackend> injector;
     std::string config_file;
     std::string mon_addr;
     std::string user;
     std::string user_key;
     std::string user_key_file;
     std::string root;
+    //bounds of adaptive in-flight ops of tree operations
+    int min_jobs;
+    int max_jobs;
+    //shared by all workers, bytes of data and metadata ops
+    rate_limiter data_rate;
+    rate_limiter ops_rate;
+    //tree transfers split files of split_size up into split_chunk tasks
+    uint64_t split_size;
+    uint64_t split_chunk;
+    //local file io, io_uring if the kernel has it, O_DIRECT from this size
+    bool local_uring;
+    uint64_t direct_io_size;
+    //content index of uploads, empty when dedup is off
+    std::string dedup_dir;
+    //manifests of tree uploads, a local cache dir and/or next to the data
+    std::string manifest_cache;
+    bool manifest_remote;
+    //tree upload, download and rmdir take the files of shard_index only
+    int shard_index;
+    int shard_count;
+    //rules of tree upload, download and rmdir
+    path_filter filter;
+    //uploads check quota and free space first
+    bool preflight_check;
+    //pack index images by path@offset, most recently used first
+    std::mutex pack_lock;
+    std::map<std::string, pack_cached> pack_cache;
+    std::list<std::string> pack_lru;
+    //executor of the async ops, made by the first one
+    std::mutex async_lock;
+    std::shared_ptr<task_executor> async_exec;
+    int async_threads;
+    size_t async_queue;
 private:
     void get_parent(const char* path, std::string &parent);
+    int open_file(const char* path, int flags, mode_t mode);
+    int close_file(int fd, const char* path);
+    int64_t read_at(int fd, const char* path, char* buf, size_t len, uint64_t offset);
+    int64_t write_at(int fd, const char* path, const char* buf, size_t len,
+        uint64_t offset);
+    bool write_file(const char* path, const char* local_path, bool mkdirs);
+    bool read_file(const char* path, const char* local_path, bool mkdirs);
+    bool upload_tree(const std::string& path, const std::string& local_path,
+        std::vector<std::string>& dirs, std::vector<tree_file>& files);
+    bool make_dirs(const std::vector<std::string>& dirs);
+    bool get_xattr_u64(const char* path, const char* name, uint64_t& value);
+    bool preflight(const std::string& path, uint64_t bytes, uint64_t entries);
+    bool download_tree(const std::string& path, const std::string& local_path,
+        std::vector<tree_file>& files);
+    bool presize(const tree_file& f, bool upload);
+    bool transfer_range(const tree_file& f, uint64_t offset, uint64_t len, bool upload);
+    //bytes, of this shard, planned
+    bool transfer_files(const std::vector<tree_file>& files, bool upload,
+        uint64_t* bytes = nullptr);
+    bool remove_dirs(const char* path, uint64_t* files = nullptr);
+    bool remove_tree(const std::string& path, worker_pool& pool,
+        std::vector<std::pair<int, std::string>>& dirs, uint64_t* files);
+    std::string shard_dir(const char* op, const char* path, int count);
+    bool shard_done(const char* op, const char* path, bool ok, uint64_t count,
+        const char* unit);
+    std::string dedup_entry(const std::string& hex);
+    bool hash_remote(const char* path, char* buf, size_t len, std::string& hex);
+    bool dedup_check(const std::string& entry, const std::string& hex,
+        const struct ceph_statx& stx, char* buf, size_t len);
+    int dedup_link(const char* path, const std::string& entry, const std::string& hex,
+        uint64_t size, char* buf, size_t len);
+    void dedup_record(const char* path, const std::string& entry, const std::string& hex);
+    std::string manifest_cache_file(const std::string& dir);
+    bool load_manifest(const std::string& dir, manifest_view& mf);
+    bool store_manifest(const std::string& dir, manifest_builder& builder);
+    bool scan_local(const std::string& local_path, manifest_builder& builder);
+    bool sync_tree(const std::string& path, const std::string& local_path);
+    bool get_rctime(const char* path, int64_t& rctime);
+    bool push_changes(const std::string& path, const std::string& local_path,
+        watch_changes& changes, int64_t since);
+    bool mirror_dir(const std::string& path, const std::string& local_path,
+        int64_t since, worker_pool& pool);
+    bool ingest_stream(const std::string& path, int local_fd);
+    bool ingest_file(tar_reader& reader, const std::string& path,
+        const struct ceph_statx& stx, worker_pool& pool);
+    bool export_stream(const std::string& path, int local_fd);
+    bool write_container(const std::string& path, const std::vector<pack_file>& files,
+        size_t begin, size_t end, std::pair<uint64_t, uint64_t>& index);
+    bool read_range(const std::string& path, uint64_t offset, uint64_t len,
+        std::string& data);
+    //len -1 reads the whole file
+    std::shared_ptr<std::string> load_pack_index(const std::string& path,
+        uint64_t offset, int64_t len);
+    bool find_member(const std::string& path, const std::string& member,
+        pack_record& rec, std::string& container);
+    bool unpack_container(const std::string& path, const pack_record& index,
+        const std::string& local_dir, std::atomic<uint64_t>& files,
+        std::atomic<uint64_t>& bytes);
+    bool set_attrs(const char* path, const struct ceph_statx& stx);
+    bool copy_file(const char* src, const char* dst, const struct ceph_statx& stx,
+        bool mkdirs);
+    bool copy_dir(const std::string& src, const std::string& dst, worker_pool& pool,
+        std::vector<std::pair<std::string, struct ceph_statx>>& dirs);
+    bool glob_expand(const char* pattern, std::string& base,
+        std::vector<glob_hit>& hits, bool nested);
+    bool glob_dir(const std::vector<std::string>& comps, std::string dir, size_t k,
+        bool nested, std::mutex& lock, std::vector<std::pair<std::string, size_t>>& next,
+        std::vector<glob_hit>& hits);
+    static void glob_entry(const std::vector<std::string>& comps, size_t k,
+        const glob_hit& h, const char* name, bool nested, std::vector<glob_hit>& found,
+        std::vector<std::pair<std::string, size_t>>& deeper);
+    void submit_async(std::function<void()> task);
+    template<typename T>
+    std::future<T> run_async(std::function<T()> op){
+        std::shared_ptr<std::packaged_task<T()>> task(
+            new std::packaged_task<T()>(std::move(op)));
+        std::future<T> result = task->get_future();
+        submit_async([task]{ (*task)();});
+        return result;
+    }
 public:
-    CephfsHelper():cmount(nullptr),
-        config_file("/usr/local/cephfstool/conf/ceph.conf"){}
-    CephfsHelper(const char *conf):cmount(nullptr),config_file(conf){}
+    CephfsHelper():cmount(nullptr),fs(libcephfs_backend()),
+        config_file("/usr/local/cephfstool/conf/ceph.conf"),
+        min_jobs(1),max_jobs(16),split_size(256*1024*1024),split_chunk(64*1024*1024),
+        local_uring(true),direct_io_size(0),manifest_remote(false),
+        shard_index(0),shard_count(1),preflight_check(true),
+        async_threads(64),async_queue(1024){}
+    CephfsHelper(const char *conf):cmount(nullptr),fs(libcephfs_backend()),
+        config_file(conf),min_jobs(1),max_jobs(16),split_size(256*1024*1024),
+        split_chunk(64*1024*1024),local_uring(true),direct_io_size(0),manifest_remote(false),
+        shard_index(0),shard_count(1),preflight_check(true),
+        async_threads(64),async_queue(1024){}
     ~CephfsHelper(){ shutdown();}
     void shutdown();
 
@@ -33,6 +203,54 @@ public:
     void set_mon_addr(const char* addr);
     void set_user_key(const char* key);
     void set_user_key_file(const char* key);
+    //benchmark shim, must be set before login, see FaultBackend::parse
+    //local=dir runs against a local stand-in instead of cephfs
+    //env CEPHFS_TOOL_SHIM is used if not set
+    bool set_shim(const char* spec);
+    //tree operations adapt their in-flight ops between min and max jobs
+    void set_concurrency(int min_jobs, int max_jobs);
+    //tree transfers split files of at least file_size bytes into tasks of
+    //chunk_size, so several workers share a large file, 0 never splits
+    void set_split(uint64_t file_size, uint64_t chunk_size);
+    //this process runs shard index of count of write_tree, read_tree and
+    //rmdir, the files are shared by a hash of their path, split files by
+    //chunk, each shard leaves a done marker on cephfs, 0 of 1 runs all
+    bool set_shard(int index, int count);
+    //gitignore style rules of tree upload, download and rmdir, see
+    //filter.h, names starting with '.' stay out of uploads unless included,
+    //an excluded dir is not walked, rmdir keeps what is excluded
+    bool add_filter(const char* rule);
+    //one rule a line
+    bool add_filter_file(const char* file);
+    //files of size in [min_size, max_size], 0 max no limit
+    void set_filter_size(uint64_t min_size, uint64_t max_size);
+    //files of mtime in [newer_sec, older_sec), seconds since the epoch, 0 no limit
+    void set_filter_mtime(int64_t newer_sec, int64_t older_sec);
+    void clear_filter();
+    //write and write_tree first compare what they upload against the
+    //ceph.quota.max_bytes and max_files of the target and its ancestors
+    //and the free space of the pool, and fail before any data is sent
+    void set_preflight(bool on);
+    //shards of op "upload", "download" or "delete" of path done, the markers
+    //are removed when all count are done, -1 on error
+    int shard_merge(const char* op, const char* path, int count);
+    //limit bytes/s of data and ops/s of metadata, 0 unlimited,
+    //can be changed while a transfer is running
+    void set_rate_limit(double bytes_per_sec, double ops_per_sec);
+    //queue local reads and writes on io_uring, else pread/pwrite,
+    //local files of at least direct_size bytes are read with O_DIRECT, 0 never
+    void set_local_io(bool uring, uint64_t direct_size);
+    //uploaded files are hashed first and looked up in a content index
+    //under index_dir, a known content becomes a hardlink of the indexed
+    //file instead of a new upload, nullptr or "" turns it off
+    void set_dedup(const char* index_dir);
+    //write_tree keeps a manifest of each uploaded tree, in cache_dir and,
+    //if remote, in the tree on cephfs, the next write_tree of the same
+    //tree uploads only what changed since, nullptr and false turn it off
+    void set_manifest(const char* cache_dir, bool remote);
+    //the async ops run on threads threads, at most queue_limit wait for
+    //one, then the next async call blocks, waits for the pending ops first
+    void set_async(int threads, size_t queue_limit);
     const char* get_config_file() const{ return config_file.c_str();}
     const char* get_user() const{ return user.c_str();}
     const char* get_root() const{ return root.c_str();}
@@ -44,12 +262,82 @@ public:
     //read string from cephfs
     bool read_str(const char* path, char* buffer, size_t size);
     std::string read_str(const char* path);
+    //read up to len bytes at offset into buf, return bytes read or -1
+    int64_t read_into(const char* path, char* buf, size_t len, uint64_t offset = 0);
+    //write len bytes of buf at offset, file is created if not exists,
+    //return bytes written or -1
+    int64_t write_from(const char* path, const char* buf, size_t len,
+        uint64_t offset = 0);
     //write file to cephfs, path must be a file name, not a dir name
+    //local_path - reads stdin
     bool write(const char* path, const char* local_path);
-    //read from cephfs, then write to local file
+    //read from cephfs, then write to local file, local_path - writes stdout
     bool read(const char* path, const char* local_path);
+    //write everything from a local fd until eof, e.g. a pipe
+    bool write_stream(const char* path, int local_fd);
+    //read a whole cephfs file to a local fd, log to a file then, not stdout
+    bool read_stream(const char* path, int local_fd);
     //write a whole dir tree to cephfs
     bool write_tree(const char* path, const char* local_path);
+    //read a whole dir tree from cephfs to local dir
+    bool read_tree(const char* path, const char* local_path);
+    //make local_path a mirror of a cephfs dir, files and dirs gone from
+    //cephfs are removed locally. the ceph.dir.rctime of the last run is
+    //kept in local_path, subtrees not changed since are skipped whole
+    bool mirror_tree(const char* path, const char* local_path);
+    //write_tree, then keep uploading the local files written, found by
+    //inotify, in batches once events settle for settle_sec or at most
+    //max_delay_sec after the first, until SIGINT, SIGTERM or stop_watch
+    bool watch_tree(const char* path, const char* local_path, double settle_sec,
+        double max_delay_sec);
+    //follow a growing local file, append its new bytes to the cephfs file
+    //in writes of up to flush_bytes, at least every flush_sec, fsync every
+    //fsync_sec, a truncated or rotated local file is followed from 0,
+    //until SIGINT, SIGTERM or stop_watch
+    bool tail_file(const char* path, const char* local_path, uint64_t flush_bytes,
+        double flush_sec, double fsync_sec);
+    //ends watch_tree and tail_file, from another thread or a signal handler
+    static void stop_watch();
+    //extract a tar stream into the dir path, tar_path - reads stdin,
+    //gzip and zstd are detected, the workers write the files while the
+    //stream is parsed, memory is bounded by the transfer buffers
+    bool ingest_tar(const char* path, const char* tar_path);
+    //write the tree below the cephfs dir path, or a single file, as a tar
+    //stream, tar_path - writes stdout, the workers read files ahead
+    bool export_tar(const char* path, const char* tar_path);
+    //pack the small files of a local tree into the cephfs dir path, as
+    //containers of about container_size with a sorted index each, a
+    //larger file gets a container of its own, the workers write the
+    //containers, a pack is replaced whole, see pack.h
+    bool pack_tree(const char* path, const char* local_path,
+        uint64_t container_size = 1024*1024*1024);
+    //member paths of the pack in dir path, sorted
+    bool pack_list(const char* path, std::vector<std::string>& list);
+    //read a member, only its byte range of its container is read,
+    //return bytes read, -1 on error
+    int64_t pack_read(const char* path, const char* member, char* buf, size_t len,
+        uint64_t offset = 0);
+    //extract a member to local_path, - writes stdout
+    bool pack_extract(const char* path, const char* member, const char* local_path);
+    //extract all members to the local dir, a worker per container
+    bool unpack_tree(const char* path, const char* local_path);
+    //cephfs paths matching pattern, * ? [..] in a name, ** any dirs, a
+    //name starting with '.' only by a '.' in the pattern, only the dirs
+    //the pattern needs are listed, a level at a time by the workers,
+    //nested false leaves out the paths below a matched dir, sorted
+    bool expand_glob(const char* pattern, std::vector<std::string>& paths,
+        bool nested = true);
+    //remove the paths of a glob, files by the workers, dirs whole, the
+    //filters apply, true if nothing matches
+    bool remove_glob(const char* pattern);
+    //download the paths of a glob into the local dir, each at its path
+    //below the literal dirs the pattern starts with
+    bool read_glob(const char* pattern, const char* local_path);
+    //copy a cephfs file to another cephfs path, keeps mode and mtime,
+    //the data passes through memory only, never the local disk
+    bool copy(const char* src, const char* dst);
+    //copy a whole dir tree inside cephfs, files are copied by the workers
+    bool copy_tree(const char* src, const char* dst);
     //if path or parent is no exist, then mkdir
     bool get_safe_path(const char* path);
     //change cwd
@@ -74,9 +362,70 @@ public:
     bool listdir(const char* path, std::vector<std::string>& list);
     //listdir use buffer
     bool listdir_buffer(const char* path, std::vector<std::string>& list);
+
+    //async ops, each returns at once, runs the op above of the same name
+    //on the executor, see set_async, and gives its result by the future
+    //or by done, called on an executor thread, buf and list must stay
+    //valid until then, the ops of one caller may finish in any order
+    std::future<int64_t> write_async(const char* path, const char* buf, size_t len,
+        uint64_t offset = 0);
+    void write_async(const char* path, const char* buf, size_t len, uint64_t offset,
+        std::function<void(int64_t)> done);
+    std::future<int64_t> read_async(const char* path, char* buf, size_t len,
+        uint64_t offset = 0);
+    void read_async(const char* path, char* buf, size_t len, uint64_t offset,
+        std::function<void(int64_t)> done);
+    std::future<int> stat_async(const char* path);
+    void stat_async(const char* path, std::function<void(int)> done);
+    std::future<bool> listdir_async(const char* path, std::vector<std::string>& list);
+    void listdir_async(const char* path,
+        std::function<void(bool, std::vector<std::string>&)> done);
+    std::future<bool> remove_async(const char* path);
+    void remove_async(const char* path, std::function<void(bool)> done);
+};
+
+//an open cephfs file, keeps the fd across calls, closed on destruction
+//move only, the helper must stay logged in while the file is open
+class CephFile {
+    CephfsHelper *helper;
+    int fd;
+    std::string path;
+public:
+    CephFile():helper(nullptr),fd(-1){}
+    //O_CREAT also makes the parent dirs, check is_open for errors
+    CephFile(CephfsHelper& helper, const char* path, int flags = O_RDONLY,
+        mode_t mode = 0644);
+    ~CephFile(){ close();}
+    CephFile(CephFile&& other);
+    CephFile& operator=(CephFile&& other);
+    CephFile(const CephFile&) = delete;
+    CephFile& operator=(const CephFile&) = delete;
+
+    bool is_open() const{ return fd >= 0;}
+    const char* get_path() const{ return path.c_str();}
+    bool close();
+    //read up to len bytes at offset, less only at eof, return bytes or -1
+    int64_t pread(char* buf, size_t len, uint64_t offset);
+    //write all len bytes at offset, short writes are retried, return len or -1
+    int64_t pwrite(const char* buf, size_t len, uint64_t offset);
+    //one vectored call, may be short, return bytes or -1
+    int64_t preadv(const struct iovec* iov, int iovcnt, uint64_t offset);
+    int64_t pwritev(const struct iovec* iov, int iovcnt, uint64_t offset);
+    bool fsync(bool dataonly = false);
+    bool truncate(uint64_t size);
+    //mode as fallocate(2), 0 reserves space and extends the file
+    bool fallocate(uint64_t offset, uint64_t len, int mode = 0);
 };
 
 extern void set_log_dir(const char* dir);
+//chrome trace-event json of every cephfs op, see trace.h
+extern bool set_trace_file(const char* file);
+extern bool flush_trace();
+//memory of all transfer buffers, transfers wait at the cap, default 512MB
+//hugepages backs new buffers with 2MB pages when the system has them
+extern void set_buffer_memory(uint64_t cap_bytes, bool hugepages);
+//pool counters, "acquires N hits N waits N peak N"
+extern std::string buffer_stats();
 extern std::string version();
 
 #endif
@@ -0,0 +1,229 @@
+/*
+* path filter of tree operations
+*
+* 20261019
+*/
+
+#include "utils.h"
+#include "filter.h"
+
+#include <climits>
+
+//[abc] [a-z] [!a], p after '[', false if the class does not close
+static bool match_class(const char*& p, char c, bool& matched){
+    const char* q = p;
+    bool neg = *q == '!' || *q == '^';
+    if(neg) ++q;
+    bool hit = false;
+    bool first = true;
+    while(*q && (*q != ']' || first)){
+        char lo = *q, hi = *q;
+        if(q[1] == '-' && q[2] && q[2] != ']'){
+            hi = q[2];
+            q += 2;
+        }
+        if(c >= lo && c <= hi) hit = true;
+        ++q;
+        first = false;
+    }
+    if(*q != ']') return false;
+    p = q + 1;
+    matched = hit != neg;
+    return true;
+}
+
+bool glob_match(const char* p, const char* s){
+    while(*p){
+        if(p[0] == '*' && p[1] == '*'){
+            p += 2;
+            if(*p == '/'){
+                //"**/" is zero or more dirs
+                ++p;
+                for(const char* t = s; ; ++t){
+                    if(glob_match(p, t)) return true;
+                    t = strchr(t, '/');
+                    if(t == nullptr) return false;
+                }
+            }
+            for(const char* t = s; ; ++t){
+                if(glob_match(p, t)) return true;
+                if(*t == '\0') return false;
+            }
+        }
+        if(*p == '*'){
+            ++p;
+            for(const char* t = s; ; ++t){
+                if(glob_match(p, t)) return true;
+                if(*t == '\0' || *t == '/') return false;
+            }
+        }
+        if(*s == '\0') return false;
+        if(*p == '?'){
+            if(*s == '/') return false;
+            ++p;
+            ++s;
+            continue;
+        }
+        if(*p == '['){
+            const char* q = p + 1;
+            bool matched;
+            if(*s != '/' && match_class(q, *s, matched)){
+                if(!matched) return false;
+                p = q;
+                ++s;
+                continue;
+            }
+        }
+        if(*p == '\\' && p[1]) ++p;
+        if(*p != *s) return false;
+        ++p;
+        ++s;
+    }
+    return *s == '\0';
+}
+
+bool has_glob(const std::string& s){
+    return s.find_first_of("*?[\\") != std::string::npos;
+}
+
+path_filter::path_filter(){
+    clear();
+}
+
+void path_filter::clear(){
+    rules.clear();
+    min_size = 0;
+    max_size = UINT64_MAX;
+    newer_ns = 0;
+    older_ns = INT64_MAX;
+    compile();
+}
+
+bool path_filter::empty() const{
+    return rules.empty() && min_size == 0 && max_size == UINT64_MAX &&
+        newer_ns == 0 && older_ns == INT64_MAX;
+}
+
+bool path_filter::add(const std::string& line){
+    std::string s = line;
+    while(!s.empty() && (s.back() == '\r' || s.back() == '\n')) s.pop_back();
+    //trailing spaces are not part of the rule unless escaped
+    while(!s.empty() && s.back() == ' ' && (s.size() < 2 || s[s.size()-2] != '\\'))
+        s.pop_back();
+    if(s.empty() || s[0] == '#') return true;
+    rule r;
+    r.negate = s[0] == '!';
+    if(r.negate) s.erase(0, 1);
+    else if(s[0] == '\\') s.erase(0, 1);
+    r.dir_only = !s.empty() && s.back() == '/';
+    while(!s.empty() && s.back() == '/') s.pop_back();
+    r.anchored = s.find('/') != std::string::npos;
+    if(!s.empty() && s[0] == '/') s.erase(0, 1);
+    if(s.empty()){
+        log("ERROR")<<"Invalid filter rule "<<line<<std::endl;
+        return false;
+    }
+    r.pattern = s;
+    rules.push_back(r);
+    compile();
+    return true;
+}
+
+bool path_filter::load(const char* file){
+    std::ifstream is(file);
+    if(!is){
+        error("Unable to open filter file ", file, errno);
+        return false;
+    }
+    std::string line;
+    while(std::getline(is, line))
+        if(!add(line)) return false;
+    return true;
+}
+
+void path_filter::set_size(uint64_t min, uint64_t max){
+    min_size = min;
+    max_size = max == 0 ? UINT64_MAX : max;
+}
+
+void path_filter::set_mtime(int64_t newer_sec, int64_t older_sec){
+    newer_ns = newer_sec * 1000000000;
+    older_ns = older_sec == 0 ? INT64_MAX : older_sec * 1000000000;
+}
+
+void path_filter::compile(){
+    names.clear();
+    suffixes.clear();
+    suffix_lens.clear();
+    globs.clear();
+    for(size_t i = 0; i < rules.size(); ++i){
+        const rule& r = rules[i];
+        if(!r.anchored && !has_glob(r.pattern)){
+            names[r.pattern].push_back(i);
+        }else if(!r.anchored && r.pattern[0] == '*' && r.pattern.size() > 1 &&
+            !has_glob(r.pattern.substr(1))){
+            std::string suffix = r.pattern.substr(1);
+            suffixes[suffix].push_back(i);
+            if(std::find(suffix_lens.begin(), suffix_lens.end(), suffix.size()) ==
+                suffix_lens.end()) suffix_lens.push_back(suffix.size());
+        }else{
+            globs.push_back(i);
+        }
+    }
+}
+
+int path_filter::last_match(const std::string& rel, const char* name, bool dir) const{
+    int best = -1;
+    auto take = [&](const std::vector<int>& idx){
+        for(auto it = idx.rbegin(); it != idx.rend(); ++it){
+            if(*it <= best) return;
+            if(!rules[*it].dir_only || dir){
+                best = *it;
+                return;
+            }
+        }
+    };
+    if(!names.empty()){
+        auto it = names.find(name);
+        if(it != names.end()) take(it->second);
+    }
+    size_t len = strlen(name);
+    for(size_t n : suffix_lens){
+        if(n > len) continue;
+        auto it = suffixes.find(name + len - n);
+        if(it != suffixes.end()) take(it->second);
+    }
+    for(auto it = globs.rbegin(); it != globs.rend() && *it > best; ++it){
+        const rule& r = rules[*it];
+        if(r.dir_only && !dir) continue;
+        if(glob_match(r.pattern.c_str(), r.anchored ? rel.c_str() : name)){
+            best = *it;
+            break;
+        }
+    }
+    return best;
+}
+
+bool path_filter::skip(const std::string& rel, const char* name, uint32_t mode,
+    uint64_t size, int64_t mtime_ns, bool dotfiles) const{
+    bool dir = S_ISDIR(mode);
+    int i = rules.empty() ? -1 : last_match(rel, name, dir);
+    if(i >= 0 && !rules[i].negate) return true;
+    if(i < 0 && dotfiles && name[0] == '.') return true;
+    if(dir) return false;
+    return size < min_size || size > max_size || mtime_ns < newer_ns ||
+        mtime_ns >= older_ns;
+}
+
+bool path_filter::skip_path(const std::string& rel, uint32_t mode, uint64_t size,
+    int64_t mtime_ns, bool dotfiles) const{
+    for(size_t pos = rel.find('/'); pos != std::string::npos; pos = rel.find('/', pos + 1)){
+        std::string dir = rel.substr(0, pos);
+        size_t start = dir.rfind('/');
+        const char* name = dir.c_str() + (start == std::string::npos ? 0 : start + 1);
+        if(skip(dir, name, S_IFDIR, 0, 0, dotfiles)) return true;
+    }
+    size_t start = rel.rfind('/');
+    return skip(rel, rel.c_str() + (start == std::string::npos ? 0 : start + 1),
+        mode, size, mtime_ns, dotfiles);
+}
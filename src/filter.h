@@ -0,0 +1,67 @@
+/*
+* path filter of tree operations
+* gitignore style rules: a later rule wins, ! includes again, a trailing /
+* matches dirs only, a rule with a / inside matches the path from the tree
+* root, else the name at any depth, * ? [..] and ** globs
+* the rules are compiled into buckets, names and suffixes are hash lookups,
+* only real globs are matched one by one
+* an excluded dir is never walked, files below it can not come back
+*
+* 20261019
+*/
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "walker.h"
+
+//* and ? stop at '/', ** crosses it
+bool glob_match(const char* pattern, const char* text);
+//s has a glob or an escape, else it only matches itself
+bool has_glob(const std::string& s);
+
+class path_filter {
+    struct rule {
+        std::string pattern;
+        bool negate;
+        bool dir_only;
+        bool anchored;   //matched against the path, not the name
+    };
+    std::vector<rule> rules;
+    //compiled, rule indexes
+    std::unordered_map<std::string, std::vector<int>> names;
+    std::unordered_map<std::string, std::vector<int>> suffixes;
+    std::vector<size_t> suffix_lens;
+    std::vector<int> globs;
+    //files only, 0 and INT64_MAX when not set
+    uint64_t min_size, max_size;
+    int64_t newer_ns, older_ns;
+private:
+    void compile();
+    //index of the last rule matching, -1 none
+    int last_match(const std::string& rel, const char* name, bool dir) const;
+public:
+    path_filter();
+    bool add(const std::string& line);
+    //one rule a line, # comments
+    bool load(const char* file);
+    void set_size(uint64_t min, uint64_t max);
+    //mtime in [newer_sec, older_sec), 0 not set
+    void set_mtime(int64_t newer_sec, int64_t older_sec);
+    void clear();
+    bool empty() const;
+    //dotfiles, names starting with '.' are out unless a rule includes them
+    bool skip(const std::string& rel, const char* name, uint32_t mode, uint64_t size,
+        int64_t mtime_ns, bool dotfiles) const;
+    bool skip(const walk_entry& e, bool dotfiles) const{
+        return skip(e.rel, e.name, e.mode, e.size, e.mtime_ns, dotfiles);
+    }
+    //rel and all dirs above it
+    bool skip_path(const std::string& rel, uint32_t mode, uint64_t size,
+        int64_t mtime_ns, bool dotfiles) const;
+};
+
+#endif
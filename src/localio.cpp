@@ -0,0 +1,221 @@
+/*
+* local file io of transfers
+*
+* 20261019
+*/
+
+#include "utils.h"
+#include "localio.h"
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+static constexpr unsigned RING_ENTRIES = 64;
+
+static int64_t run_sync(char* p, const local_io::request& req){
+    ssize_t ret;
+    do{
+        ret = req.write ? ::pwrite(req.fd, p, req.len, req.offset) :
+            ::pread(req.fd, p, req.len, req.offset);
+    }while(ret < 0 && errno == EINTR);
+    return ret < 0 ? -errno : ret;
+}
+
+local_io::local_io(bool uring):
+    size(0),want_uring(uring),ring_fd(-1),entries(0),fixed(false),
+    sq_ptr(nullptr),cq_ptr(nullptr),sqe_ptr(nullptr),sq_len(0),cq_len(0),sqe_len(0),
+    sq_tail(nullptr),sq_mask(nullptr),sq_array(nullptr),
+    cq_head(nullptr),cq_tail(nullptr),cq_mask(nullptr),cqes(nullptr){
+    if(uring && !setup_uring()) close_uring();
+    //the sync path completes at once, one slot is enough
+    slots.resize(ring_fd >= 0 ? entries : 1);
+    for(int i = slots.size() - 1; i >= 0; --i) free_slots.push_back(i);
+}
+
+local_io::~local_io(){
+    //the kernel may still use the buffers
+    completion c;
+    while(wait(c));
+    close_uring();
+}
+
+void local_io::attach(char* const* buffers, int count, size_t buffer_size){
+    completion c;
+    while(wait(c));
+    bufs.assign(buffers, buffers + count);
+    size = buffer_size;
+    if(uring() && bufs != registered) register_buffers();
+}
+
+#ifdef HAVE_IO_URING
+static int uring_enter(int fd, unsigned submit, unsigned min_complete, unsigned flags){
+    return syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, nullptr, 0);
+}
+
+bool local_io::setup_uring(){
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring_fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+    if(ring_fd < 0){
+        //old kernel or blocked by seccomp
+        log("INFO")<<"io_uring unavailable ("<<errno<<"), use pread/pwrite"<<std::endl;
+        return false;
+    }
+    entries = p.sq_entries;
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single) sq_len = cq_len = std::max(sq_len, cq_len);
+    sq_ptr = mmap(nullptr, sq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+        ring_fd, IORING_OFF_SQ_RING);
+    if(sq_ptr == MAP_FAILED){
+        sq_ptr = nullptr;
+        return false;
+    }
+    if(single){
+        cq_ptr = sq_ptr;
+    }else{
+        cq_ptr = mmap(nullptr, cq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+            ring_fd, IORING_OFF_CQ_RING);
+        if(cq_ptr == MAP_FAILED){
+            cq_ptr = nullptr;
+            return false;
+        }
+    }
+    sqe_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqe_ptr = mmap(nullptr, sqe_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+        ring_fd, IORING_OFF_SQES);
+    if(sqe_ptr == MAP_FAILED){
+        sqe_ptr = nullptr;
+        return false;
+    }
+    char *sq = (char*)sq_ptr, *cq = (char*)cq_ptr;
+    sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    sq_array = (unsigned*)(sq + p.sq_off.array);
+    cq_head = (unsigned*)(cq + p.cq_off.head);
+    cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    cqes = cq + p.cq_off.cqes;
+    return true;
+}
+
+//registered buffers skip the page pinning of every request,
+//RLIMIT_MEMLOCK may refuse, then plain read/write is used
+void local_io::register_buffers(){
+    if(fixed) syscall(__NR_io_uring_register, ring_fd, IORING_UNREGISTER_BUFFERS,
+        nullptr, 0);
+    std::vector<struct iovec> iov(bufs.size());
+    for(size_t i = 0; i < bufs.size(); ++i){
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = size;
+    }
+    fixed = !iov.empty() && syscall(__NR_io_uring_register, ring_fd,
+        IORING_REGISTER_BUFFERS, iov.data(), iov.size()) == 0;
+    registered = fixed ? bufs : std::vector<char*>();
+}
+
+void local_io::close_uring(){
+    if(sqe_ptr) munmap(sqe_ptr, sqe_len);
+    if(cq_ptr && cq_ptr != sq_ptr) munmap(cq_ptr, cq_len);
+    if(sq_ptr) munmap(sq_ptr, sq_len);
+    sqe_ptr = cq_ptr = sq_ptr = nullptr;
+    if(ring_fd >= 0) ::close(ring_fd);
+    ring_fd = -1;
+    fixed = false;
+    registered.clear();
+}
+
+//move one completion from the ring to done
+bool local_io::reap(bool block){
+    unsigned head = *cq_head;
+    while(head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)){
+        if(!block) return false;
+        if(uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR){
+            error("io_uring wait failed ", "", errno);
+            return false;
+        }
+    }
+    struct io_uring_cqe *cqe = (struct io_uring_cqe*)cqes + (head & *cq_mask);
+    int slot = cqe->user_data;
+    done.push_back(completion{slots[slot], cqe->res});
+    __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+    free_slots.push_back(slot);
+    return true;
+}
+
+void local_io::submit_uring(const request& req){
+    if(free_slots.empty() && !reap(true)){
+        done.push_back(completion{req, run_sync(bufs[req.buf] + req.buf_off, req)});
+        return;
+    }
+    int slot = free_slots.back();
+    free_slots.pop_back();
+    slots[slot] = req;
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe*)sqe_ptr + index;
+    memset(sqe, 0, sizeof(*sqe));
+    if(fixed){
+        sqe->opcode = req.write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = req.buf;
+    }else{
+        sqe->opcode = req.write ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+    sqe->fd = req.fd;
+    sqe->off = req.offset;
+    sqe->addr = (uint64_t)(uintptr_t)(bufs[req.buf] + req.buf_off);
+    sqe->len = req.len;
+    sqe->user_data = slot;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    while(uring_enter(ring_fd, 1, 0, 0) < 0){
+        if(errno == EINTR) continue;
+        if(errno == EAGAIN || errno == EBUSY){
+            reap(true);
+            continue;
+        }
+        //the entry stays queued and is picked up by the next enter
+        error("io_uring submit failed ", "", errno);
+        break;
+    }
+}
+#else
+bool local_io::setup_uring(){
+    return false;
+}
+
+void local_io::close_uring(){
+}
+
+bool local_io::reap(bool){
+    return false;
+}
+
+void local_io::submit_uring(const request&){
+}
+
+void local_io::register_buffers(){
+}
+#endif
+
+void local_io::submit(const request& req){
+    if(uring()){
+        submit_uring(req);
+        return;
+    }
+    done.push_back(completion{req, run_sync(bufs[req.buf] + req.buf_off, req)});
+}
+
+bool local_io::wait(completion& c){
+    if(done.empty() && !(uring() && slots.size() > free_slots.size() && reap(true)))
+        return false;
+    c = done.front();
+    done.pop_front();
+    return true;
+}
@@ -0,0 +1,75 @@
+/*
+* local file io of transfers
+* reads and writes are queued on io_uring with registered buffers,
+* so the local disk works while the transfer thread waits for cephfs
+* without io_uring every request runs at once with pread/pwrite
+* the buffers are attached per transfer, see bufpool.h
+*
+* 20261019
+*/
+#ifndef LOCALIO_H
+#define LOCALIO_H
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+class local_io {
+public:
+    struct request {
+        bool write;
+        int fd;
+        int buf;        //index of the buffer
+        size_t buf_off; //start in the buffer
+        size_t len;
+        uint64_t offset;
+    };
+    struct completion {
+        request req;
+        int64_t res;    //bytes or -errno
+    };
+private:
+    size_t size;
+    std::vector<char*> bufs;
+    std::vector<char*> registered;
+    bool want_uring;
+    //io_uring, ring_fd -1 when not used
+    int ring_fd;
+    unsigned entries;
+    bool fixed;         //buffers registered
+    void *sq_ptr, *cq_ptr, *sqe_ptr;
+    size_t sq_len, cq_len, sqe_len;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    void *cqes;
+    std::vector<request> slots;
+    std::vector<int> free_slots;
+    std::deque<completion> done;
+private:
+    bool setup_uring();
+    void close_uring();
+    bool reap(bool block);
+    void submit_uring(const request& req);
+    void register_buffers();
+public:
+    explicit local_io(bool uring);
+    ~local_io();
+    //use these buffers for the next requests, waits for pending ones,
+    //they are registered again only when they changed
+    void attach(char* const* buffers, int count, size_t buffer_size);
+    bool uring() const{ return ring_fd >= 0;}
+    bool wants_uring() const{ return want_uring;}
+    size_t buffer_size() const{ return size;}
+    int buffers() const{ return bufs.size();}
+    char* buffer(int i){ return bufs[i];}
+    //queue a request, waits for a slot when the ring is full
+    void submit(const request& req);
+    //wait one finished request, false if nothing is pending
+    bool wait(completion& c);
+    int pending() const{ return slots.size() - free_slots.size() + done.size();}
+    local_io(const local_io&) = delete;
+    local_io& operator=(const local_io&) = delete;
+};
+
+#endif
@@ -0,0 +1,156 @@
+/*
+* tree manifest
+*
+* 20261019
+*/
+
+#include "utils.h"
+#include "manifest.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char MANIFEST_MAGIC[8] = "CEPHMF1";
+static constexpr uint32_t MANIFEST_VERSION = 1;
+
+void manifest_builder::add(const std::string& path, uint64_t size, int64_t mtime_ns,
+    uint32_t mode, const uint8_t* hash){
+    manifest_record r;
+    memset(&r, 0, sizeof(r));
+    r.name_off = names.size();
+    r.name_len = path.size();
+    r.mode = mode;
+    r.size = size;
+    r.mtime_ns = mtime_ns;
+    if(hash != nullptr){
+        r.flags = manifest_record::HAS_HASH;
+        memcpy(r.hash, hash, sizeof(r.hash));
+    }
+    records.push_back(r);
+    names.append(path);
+    names.push_back('\0');
+}
+
+std::string manifest_builder::serialize(){
+    const char *base = names.data();
+    std::sort(records.begin(), records.end(),
+        [base](const manifest_record& a, const manifest_record& b){
+            return manifest_compare(base + a.name_off, a.name_len,
+                base + b.name_off, b.name_len) < 0;
+        });
+    manifest_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MANIFEST_MAGIC, sizeof(h.magic));
+    h.version = MANIFEST_VERSION;
+    h.count = records.size();
+    h.names_size = names.size();
+    std::string image;
+    image.reserve(sizeof(h) + records.size() * sizeof(manifest_record) + names.size());
+    image.append((const char*)&h, sizeof(h));
+    image.append((const char*)records.data(), records.size() * sizeof(manifest_record));
+    image.append(names);
+    return image;
+}
+
+bool manifest_builder::write(const char* file){
+    std::string image = serialize();
+    std::string tmp = std::string(file) + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd < 0){
+        error("Unable to open manifest ", tmp.c_str(), errno);
+        return false;
+    }
+    size_t done = 0;
+    while(done < image.size()){
+        ssize_t ret = ::write(fd, image.data() + done, image.size() - done);
+        if(ret < 0 && errno == EINTR) continue;
+        if(ret < 0){
+            error("Unable to write manifest ", tmp.c_str(), errno);
+            ::close(fd);
+            ::unlink(tmp.c_str());
+            return false;
+        }
+        done += ret;
+    }
+    ::close(fd);
+    if(::rename(tmp.c_str(), file) < 0){
+        error("Unable to rename manifest to ", file, errno);
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+//sizes and every name inside the image, names in order
+bool manifest_view::check(const char* data, size_t len){
+    if(len < sizeof(manifest_header)) return false;
+    const manifest_header *h = (const manifest_header*)data;
+    if(memcmp(h->magic, MANIFEST_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != MANIFEST_VERSION) return false;
+    size_t body = len - sizeof(manifest_header);
+    if(h->count > body / sizeof(manifest_record) ||
+        h->count * sizeof(manifest_record) + h->names_size != body) return false;
+    records = (const manifest_record*)(data + sizeof(manifest_header));
+    names = data + sizeof(manifest_header) + h->count * sizeof(manifest_record);
+    for(uint64_t i = 0; i < h->count; ++i){
+        const manifest_record& r = records[i];
+        if(r.name_off >= h->names_size || r.name_len >= h->names_size - r.name_off ||
+            names[r.name_off + r.name_len] != '\0') return false;
+        if(i > 0 && manifest_compare(names + records[i-1].name_off, records[i-1].name_len,
+            names + r.name_off, r.name_len) >= 0) return false;
+    }
+    count = h->count;
+    return true;
+}
+
+bool manifest_view::open(const char* file){
+    close();
+    int fd = ::open(file, O_RDONLY);
+    if(fd < 0) return false;
+    struct stat st;
+    if(fstat(fd, &st) < 0 || st.st_size == 0){
+        ::close(fd);
+        return false;
+    }
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(p == MAP_FAILED) return false;
+    map = p;
+    map_len = st.st_size;
+    if(!check((const char*)p, map_len)){
+        log("WARN")<<"ignore broken manifest "<<file<<std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool manifest_view::attach(const char* data, size_t len){
+    close();
+    if(check(data, len)) return true;
+    close();
+    return false;
+}
+
+void manifest_view::close(){
+    if(map != nullptr) munmap(map, map_len);
+    map = nullptr;
+    map_len = 0;
+    records = nullptr;
+    names = nullptr;
+    count = 0;
+}
+
+int64_t manifest_view::find(const std::string& path) const{
+    size_t lo = 0, hi = count;
+    while(lo < hi){
+        size_t mid = lo + (hi - lo) / 2;
+        int c = manifest_compare(name(mid), records[mid].name_len, path.data(), path.size());
+        if(c == 0) return mid;
+        if(c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
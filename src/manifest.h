@@ -0,0 +1,120 @@
+/*
+* tree manifest
+* a binary snapshot of a tree: records sorted by path with size, mtime,
+* mode and an optional sha-256, then the path names
+* written after a tree transfer, mapped on the next run, so a diff is a
+* linear merge of two sorted arrays instead of stats on both sides
+*
+* 20261019
+*/
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+//on disk, host byte order, records follow the header, names follow the records
+struct manifest_header {
+    char magic[8];       //"CEPHMF1"
+    uint32_t version;
+    uint32_t flags;
+    uint64_t count;      //records
+    uint64_t names_size; //bytes of names, each ends with '\0'
+};
+
+struct manifest_record {
+    uint64_t name_off;   //in names
+    uint32_t name_len;   //without '\0'
+    uint32_t mode;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint32_t flags;      //HAS_HASH
+    uint32_t reserved;
+    uint8_t hash[32];
+    static constexpr uint32_t HAS_HASH = 1;
+};
+
+//paths are relative to the tree root, without leading '/'
+class manifest_builder {
+    std::vector<manifest_record> records;
+    std::string names;
+public:
+    void add(const std::string& path, uint64_t size, int64_t mtime_ns, uint32_t mode,
+        const uint8_t* hash = nullptr);
+    size_t size() const{ return records.size();}
+    //sorted by path, the image a manifest_view maps
+    std::string serialize();
+    //to a temp file renamed over file, never a half written manifest
+    bool write(const char* file);
+};
+
+//read only, mapped from a file or on a buffer owned by the caller
+class manifest_view {
+    void *map;
+    size_t map_len;
+    const manifest_record *records;
+    const char *names;
+    uint64_t count;
+private:
+    bool check(const char* data, size_t len);
+public:
+    manifest_view():map(nullptr),map_len(0),records(nullptr),names(nullptr),count(0){}
+    ~manifest_view(){ close();}
+    manifest_view(const manifest_view&) = delete;
+    manifest_view& operator=(const manifest_view&) = delete;
+    //false for a missing, foreign or broken file, the view is empty then
+    bool open(const char* file);
+    bool attach(const char* data, size_t len);
+    void close();
+    size_t size() const{ return count;}
+    const manifest_record& at(size_t i) const{ return records[i];}
+    const char* name(size_t i) const{ return names + records[i].name_off;}
+    std::string path(size_t i) const{ return std::string(name(i), records[i].name_len);}
+    //index of path or -1, binary search
+    int64_t find(const std::string& path) const;
+};
+
+//byte order of paths, a dir sorts before the paths in it
+inline int manifest_compare(const char* a, size_t alen, const char* b, size_t blen){
+    int c = memcmp(a, b, std::min(alen, blen));
+    if(c != 0) return c;
+    return alen < blen ? -1 : alen > blen ? 1 : 0;
+}
+
+//fn(kind, path, old record or nullptr, new record or nullptr) for each
+//path that is not the same in both, in path order
+enum manifest_change {MF_ADDED, MF_CHANGED, MF_REMOVED};
+
+template<typename F>
+void manifest_diff(const manifest_view& old_mf, const manifest_view& new_mf, F fn){
+    size_t i = 0, j = 0;
+    while(i < old_mf.size() || j < new_mf.size()){
+        int c;
+        if(i == old_mf.size()) c = 1;
+        else if(j == new_mf.size()) c = -1;
+        else c = manifest_compare(old_mf.name(i), old_mf.at(i).name_len,
+            new_mf.name(j), new_mf.at(j).name_len);
+        if(c < 0){
+            fn(MF_REMOVED, old_mf.path(i), &old_mf.at(i), (const manifest_record*)nullptr);
+            ++i;
+        }else if(c > 0){
+            fn(MF_ADDED, new_mf.path(j), (const manifest_record*)nullptr, &new_mf.at(j));
+            ++j;
+        }else{
+            const manifest_record& a = old_mf.at(i);
+            const manifest_record& b = new_mf.at(j);
+            bool same = a.size == b.size && a.mtime_ns == b.mtime_ns && a.mode == b.mode;
+            if(same && (a.flags & b.flags & manifest_record::HAS_HASH))
+                same = memcmp(a.hash, b.hash, sizeof(a.hash)) == 0;
+            if(!same) fn(MF_CHANGED, new_mf.path(j), &a, &b);
+            ++i;
+            ++j;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,103 @@
+/*
+* small file packs
+*
+* 20261019
+*/
+
+#include "utils.h"
+#include "pack.h"
+#include "manifest.h"
+
+static const char PACK_MAGIC[8] = "CEPHPK1";
+static constexpr uint32_t PACK_VERSION = 2;
+
+void pack_index_builder::add(const std::string& path, uint32_t mode, uint64_t offset,
+    uint64_t size, int64_t mtime_ns){
+    pack_record r;
+    memset(&r, 0, sizeof(r));
+    r.name_off = names.size();
+    r.name_len = path.size();
+    r.mode = mode;
+    r.offset = offset;
+    r.size = size;
+    r.mtime_ns = mtime_ns;
+    records.push_back(r);
+    names.append(path);
+    names.push_back('\0');
+}
+
+void pack_index_builder::clear(){
+    records.clear();
+    names.clear();
+    generation = 0;
+}
+
+std::string pack_index_builder::serialize(){
+    const char *base = names.data();
+    std::sort(records.begin(), records.end(),
+        [base](const pack_record& a, const pack_record& b){
+            return manifest_compare(base + a.name_off, a.name_len,
+                base + b.name_off, b.name_len) < 0;
+        });
+    pack_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, PACK_MAGIC, sizeof(h.magic));
+    h.version = PACK_VERSION;
+    h.count = records.size();
+    h.names_size = names.size();
+    h.generation = generation;
+    std::string image;
+    image.reserve(sizeof(h) + records.size() * sizeof(pack_record) + names.size());
+    image.append((const char*)&h, sizeof(h));
+    image.append((const char*)records.data(), records.size() * sizeof(pack_record));
+    image.append(names);
+    return image;
+}
+
+//sizes and every name inside the image, names in order
+bool pack_index_view::attach(const char* data, size_t len){
+    records = nullptr;
+    names = nullptr;
+    count = 0;
+    gen = 0;
+    if(len < sizeof(pack_header)) return false;
+    const pack_header *h = (const pack_header*)data;
+    if(memcmp(h->magic, PACK_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != PACK_VERSION) return false;
+    size_t body = len - sizeof(pack_header);
+    if(h->count > body / sizeof(pack_record) ||
+        h->count * sizeof(pack_record) + h->names_size != body) return false;
+    const pack_record *recs = (const pack_record*)(data + sizeof(pack_header));
+    const char *strs = data + sizeof(pack_header) + h->count * sizeof(pack_record);
+    for(uint64_t i = 0; i < h->count; ++i){
+        const pack_record& r = recs[i];
+        if(r.name_off >= h->names_size || r.name_len >= h->names_size - r.name_off ||
+            strs[r.name_off + r.name_len] != '\0') return false;
+        if(i > 0 && manifest_compare(strs + recs[i-1].name_off, recs[i-1].name_len,
+            strs + r.name_off, r.name_len) >= 0) return false;
+    }
+    records = recs;
+    names = strs;
+    count = h->count;
+    gen = h->generation;
+    return true;
+}
+
+int64_t pack_index_view::find(const std::string& path) const{
+    int64_t i = floor(path);
+    if(i < 0 || manifest_compare(name(i), records[i].name_len,
+        path.data(), path.size()) != 0) return -1;
+    return i;
+}
+
+int64_t pack_index_view::floor(const std::string& path) const{
+    size_t lo = 0, hi = count;
+    while(lo < hi){
+        size_t mid = lo + (hi - lo) / 2;
+        if(manifest_compare(name(mid), records[mid].name_len, path.data(), path.size()) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (int64_t)lo - 1;
+}
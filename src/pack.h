@@ -0,0 +1,79 @@
+/*
+* small file packs
+* a pack is a cephfs dir of container files GGGGGGGGGGGGGGGG-NNNNNNNN.pack
+* and an index pack.idx, members are sorted by path and cut into containers
+* in order, a container holds the data of its members back to back, then
+* its own index, so a member costs one index read and one range read
+* pack.idx has a record per container, named by its first member, and the
+* generation G of its containers, a repack writes a new generation, renames
+* its pack.idx over the old one, then removes the old containers
+*
+* 20261019
+*/
+#ifndef PACK_H
+#define PACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//on disk, host byte order, records follow the header, names follow the records
+struct pack_header {
+    char magic[8];       //"CEPHPK1"
+    uint32_t version;
+    uint32_t flags;
+    uint64_t count;      //records
+    uint64_t names_size; //bytes of names, each ends with '\0'
+    uint64_t generation; //of the containers, in pack.idx
+};
+
+//a member of a container, or in pack.idx a container, then offset and
+//size are its index in it, and mode its number
+struct pack_record {
+    uint64_t name_off;   //in names
+    uint32_t name_len;   //without '\0'
+    uint32_t mode;
+    uint64_t offset;
+    uint64_t size;
+    int64_t mtime_ns;
+};
+
+//paths are relative to the packed tree root, without leading '/'
+class pack_index_builder {
+    std::vector<pack_record> records;
+    std::string names;
+    uint64_t generation;
+public:
+    pack_index_builder():generation(0){}
+    void set_generation(uint64_t g){ generation = g;}
+    void add(const std::string& path, uint32_t mode, uint64_t offset, uint64_t size,
+        int64_t mtime_ns);
+    size_t size() const{ return records.size();}
+    void clear();
+    //sorted by path, the image a pack_index_view reads
+    std::string serialize();
+};
+
+//read only, on a buffer owned by the caller
+class pack_index_view {
+    const pack_record *records;
+    const char *names;
+    uint64_t count;
+    uint64_t gen;
+public:
+    pack_index_view():records(nullptr),names(nullptr),count(0),gen(0){}
+    //false for a foreign or broken image, the view is empty then
+    bool attach(const char* data, size_t len);
+    size_t size() const{ return count;}
+    uint64_t generation() const{ return gen;}
+    const pack_record& at(size_t i) const{ return records[i];}
+    const char* name(size_t i) const{ return names + records[i].name_off;}
+    std::string path(size_t i) const{ return std::string(name(i), records[i].name_len);}
+    //index of path or -1, binary search
+    int64_t find(const std::string& path) const;
+    //index of the last record not after path or -1, the container of path
+    int64_t floor(const std::string& path) const;
+};
+
+#endif
@@ -0,0 +1,42 @@
+/*
+* token bucket rate limit shared by all workers
+*
+* 20261019
+*/
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+//each caller reserves its slot on a shared virtual clock with one CAS,
+//then sleeps alone, so workers are never serialized on a lock.
+//up to BURST of unused time is credited back, short bursts pass at once
+class rate_limiter {
+    static constexpr int64_t BURST_NS = 200 * 1000 * 1000; //200ms
+    std::atomic<double> rate;  //units per second, 0 unlimited
+    std::atomic<int64_t> next; //ns, when the reserved capacity runs out
+    static int64_t now_ns(){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+public:
+    rate_limiter():rate(0),next(0){}
+    void set_rate(double per_sec){ rate.store(per_sec > 0 ? per_sec : 0);}
+    double get_rate() const{ return rate.load();}
+    void acquire(int64_t units){
+        double r = rate.load(std::memory_order_relaxed);
+        if(r <= 0 || units <= 0) return;
+        int64_t cost = (int64_t)(units * 1e9 / r);
+        int64_t now = now_ns(), start, old = next.load();
+        do{
+            start = old > now - BURST_NS ? old : now - BURST_NS;
+        }while(!next.compare_exchange_weak(old, start + cost));
+        if(start > now)
+            std::this_thread::sleep_for(std::chrono::nanoseconds(start - now));
+    }
+};
+
+#endif
@@ -0,0 +1,28 @@
+/*
+* sha-256 of file contents, FIPS 180-4
+* in tree, so dedup needs no crypto library
+*
+* 20261019
+*/
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class sha256 {
+    uint32_t state[8];
+    uint8_t block[64];
+    size_t used;    //bytes in block
+    uint64_t total; //bytes hashed
+private:
+    void compress(const uint8_t* p);
+public:
+    sha256();
+    void update(const void* data, size_t len);
+    //64 lowercase hex chars, the hash can not be updated after
+    std::string hex_digest();
+};
+
+#endif
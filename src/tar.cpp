@@ -0,0 +1,495 @@
+/*
+* tar streams of tree ingest and export
+*
+* 20261019
+*/
+
+#include "utils.h"
+#include "tar.h"
+
+#include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+static constexpr size_t BLOCK = 512;
+static constexpr size_t INPUT_SIZE = 1024*1024;
+//gnu long names and pax headers are held in memory
+static constexpr uint64_t MAX_LONG = 1024*1024;
+//11 octal digits of the ustar size field
+static constexpr uint64_t MAX_OCTAL = 077777777777ULL;
+
+bool tar_clean_path(const std::string& path, std::string& rel){
+    rel.clear();
+    size_t start = 0;
+    while(start <= path.size()){
+        size_t end = path.find('/', start);
+        if(end == std::string::npos) end = path.size();
+        std::string part = path.substr(start, end - start);
+        start = end + 1;
+        if(part.empty() || part == ".") continue;
+        if(part == "..") return false;
+        if(!rel.empty()) rel += '/';
+        rel += part;
+    }
+    return !rel.empty();
+}
+
+//octal, or base-256 when the high bit of the first byte is set
+static uint64_t parse_number(const char* field, size_t len){
+    uint64_t value = 0;
+    if((unsigned char)field[0] & 0x80){
+        value = (unsigned char)field[0] & 0x7f;
+        for(size_t i = 1; i < len; ++i) value = (value << 8) | (unsigned char)field[i];
+        return value;
+    }
+    size_t i = 0;
+    while(i < len && (field[i] == ' ' || field[i] == '\0')) ++i;
+    for(; i < len && field[i] >= '0' && field[i] <= '7'; ++i)
+        value = value * 8 + (field[i] - '0');
+    return value;
+}
+
+static void put_number(char* field, size_t len, uint64_t value){
+    uint64_t max = (1ULL << (3 * (len - 1))) - 1;
+    if(value <= max){
+        snprintf(field, len, "%0*llo", (int)len - 1, (unsigned long long)value);
+        return;
+    }
+    memset(field, 0, len);
+    for(size_t i = len - 1; i > 0; --i, value >>= 8) field[i] = value & 0xff;
+    field[0] = (char)0x80;
+}
+
+//a field of up to len bytes, nul terminated when shorter
+static std::string get_field(const char* field, size_t len){
+    return std::string(field, strnlen(field, len));
+}
+
+static bool check_sum(const char* block){
+    uint64_t expect = parse_number(block + 148, 8);
+    uint64_t sum = 0;
+    int64_t signed_sum = 0;
+    for(size_t i = 0; i < BLOCK; ++i){
+        char c = (i >= 148 && i < 156) ? ' ' : block[i];
+        sum += (unsigned char)c;
+        signed_sum += (signed char)c;
+    }
+    return sum == expect || (uint64_t)signed_sum == expect;
+}
+
+tar_reader::tar_reader(int fd):
+    fd(fd),format("tar"),zs(nullptr),zds(nullptr),in_pos(0),in_len(0),in_eof(false),
+    failed(false),remaining(0),padding(0){
+    in.resize(INPUT_SIZE);
+}
+
+tar_reader::~tar_reader(){
+    close_codec();
+}
+
+void tar_reader::close_codec(){
+#ifdef HAVE_ZLIB
+    if(zs){
+        inflateEnd((z_stream*)zs);
+        delete (z_stream*)zs;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if(zds) ZSTD_freeDStream((ZSTD_DStream*)zds);
+#endif
+    zs = zds = nullptr;
+}
+
+//refill the input buffer once it is used up
+bool tar_reader::fill_input(){
+    if(in_pos < in_len || in_eof) return true;
+    in_pos = in_len = 0;
+    while(true){
+        ssize_t n = ::read(fd, in.data(), in.size());
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0){
+            error("Unable to read tar stream ", "", errno);
+            failed = true;
+            return false;
+        }
+        if(n == 0) in_eof = true;
+        in_len = n;
+        return true;
+    }
+}
+
+bool tar_reader::open(){
+    //the magic may come in several reads of a pipe
+    while(in_len < 4 && !in_eof){
+        ssize_t n = ::read(fd, in.data() + in_len, in.size() - in_len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0){
+            error("Unable to read tar stream ", "", errno);
+            failed = true;
+            return false;
+        }
+        if(n == 0) in_eof = true;
+        in_len += n;
+    }
+    const unsigned char *m = (const unsigned char*)in.data();
+    bool gzip = in_len >= 2 && m[0] == 0x1f && m[1] == 0x8b;
+    bool zstd = in_len >= 4 && m[0] == 0x28 && m[1] == 0xb5 && m[2] == 0x2f && m[3] == 0xfd;
+    if(gzip){
+#ifdef HAVE_ZLIB
+        z_stream *z = new z_stream;
+        memset(z, 0, sizeof(*z));
+        if(inflateInit2(z, 15 + 32) != Z_OK){
+            delete z;
+            log("ERROR")<<"Unable to init gzip stream"<<std::endl;
+            failed = true;
+            return false;
+        }
+        zs = z;
+        format = "gzip";
+#else
+        log("ERROR")<<"Unable to read gzip tar stream, built without zlib"<<std::endl;
+        failed = true;
+        return false;
+#endif
+    }else if(zstd){
+#ifdef HAVE_ZSTD
+        ZSTD_DStream *ds = ZSTD_createDStream();
+        if(ds == nullptr || ZSTD_isError(ZSTD_initDStream(ds))){
+            if(ds) ZSTD_freeDStream(ds);
+            log("ERROR")<<"Unable to init zstd stream"<<std::endl;
+            failed = true;
+            return false;
+        }
+        zds = ds;
+        format = "zstd";
+#else
+        log("ERROR")<<"Unable to read zstd tar stream, built without zstd"<<std::endl;
+        failed = true;
+        return false;
+#endif
+    }
+    return true;
+}
+
+//up to len decompressed bytes, less only at the end of the stream
+int64_t tar_reader::read_raw(char* buf, size_t len){
+    size_t done = 0;
+    while(done < len){
+        if(failed || !fill_input()) return -1;
+        size_t before_in = in_pos, before_out = done;
+        if(zs == nullptr && zds == nullptr){
+            size_t n = std::min(len - done, in_len - in_pos);
+            memcpy(buf + done, in.data() + in_pos, n);
+            in_pos += n;
+            done += n;
+        }
+#ifdef HAVE_ZLIB
+        else if(zs){
+            z_stream *z = (z_stream*)zs;
+            z->next_in = (Bytef*)in.data() + in_pos;
+            z->avail_in = in_len - in_pos;
+            z->next_out = (Bytef*)buf + done;
+            z->avail_out = len - done;
+            int ret = inflate(z, Z_NO_FLUSH);
+            in_pos = in_len - z->avail_in;
+            done = len - z->avail_out;
+            if(ret == Z_STREAM_END){
+                //concatenated members go on, anything else ends the stream
+                if(!fill_input()) return -1;
+                if(in_pos == in_len || (unsigned char)in[in_pos] != 0x1f){
+                    in_pos = in_len;
+                    in_eof = true;
+                    break;
+                }
+                inflateReset(z);
+            }else if(ret != Z_OK && ret != Z_BUF_ERROR){
+                log("ERROR")<<"Unable to inflate tar stream ("<<ret<<")"<<std::endl;
+                failed = true;
+                return -1;
+            }
+        }
+#endif
+#ifdef HAVE_ZSTD
+        else if(zds){
+            ZSTD_inBuffer ib = {in.data() + in_pos, in_len - in_pos, 0};
+            ZSTD_outBuffer ob = {buf + done, len - done, 0};
+            size_t ret = ZSTD_decompressStream((ZSTD_DStream*)zds, &ob, &ib);
+            if(ZSTD_isError(ret)){
+                log("ERROR")<<"Unable to decompress tar stream, "
+                    <<ZSTD_getErrorName(ret)<<std::endl;
+                failed = true;
+                return -1;
+            }
+            in_pos += ib.pos;
+            done += ob.pos;
+        }
+#endif
+        if(in_pos == before_in && done == before_out && in_eof) break;
+    }
+    return done;
+}
+
+bool tar_reader::skip(uint64_t len){
+    char buf[64*1024];
+    while(len > 0){
+        size_t n = std::min<uint64_t>(len, sizeof(buf));
+        int64_t ret = read_raw(buf, n);
+        if(ret < 0) return false;
+        if((size_t)ret < n){
+            log("ERROR")<<"Unable to skip tar data, stream truncated"<<std::endl;
+            failed = true;
+            return false;
+        }
+        len -= n;
+    }
+    return true;
+}
+
+//the data of a gnu long name or pax header, with its padding
+bool tar_reader::read_long(uint64_t size, std::string& value){
+    if(size > MAX_LONG){
+        log("ERROR")<<"Unable to read tar header of "<<size<<" bytes"<<std::endl;
+        failed = true;
+        return false;
+    }
+    value.resize(size);
+    if(size > 0 && read_raw(&value[0], size) != (int64_t)size){
+        log("ERROR")<<"Unable to read tar header, stream truncated"<<std::endl;
+        failed = true;
+        return false;
+    }
+    return skip((BLOCK - size % BLOCK) % BLOCK);
+}
+
+//"len key=value\n" records, only the keys of one entry that matter here
+static void parse_pax(const std::string& data, std::string& path, std::string& link,
+    bool& has_size, uint64_t& size, bool& has_mtime, int64_t& mtime){
+    size_t pos = 0;
+    while(pos < data.size()){
+        char *end;
+        uint64_t len = strtoull(data.c_str() + pos, &end, 10);
+        size_t key = end - data.c_str() + 1;
+        if(len == 0 || *end != ' ' || pos + len > data.size()) return;
+        size_t eq = data.find('=', key);
+        size_t stop = pos + len - 1;
+        pos += len;
+        if(eq == std::string::npos || eq >= stop) continue;
+        std::string name = data.substr(key, eq - key);
+        std::string value = data.substr(eq + 1, stop - eq - 1);
+        if(name == "path") path = value;
+        else if(name == "linkpath") link = value;
+        else if(name == "size"){
+            has_size = true;
+            size = strtoull(value.c_str(), nullptr, 10);
+        }else if(name == "mtime"){
+            has_mtime = true;
+            mtime = strtoll(value.c_str(), nullptr, 10);
+        }
+    }
+}
+
+bool tar_reader::next(tar_entry& e){
+    if(failed || !skip(remaining + padding)) return false;
+    remaining = padding = 0;
+    std::string long_name, long_link, pax_path, pax_link;
+    bool has_size = false, has_mtime = false;
+    uint64_t pax_size = 0;
+    int64_t pax_mtime = 0;
+    char block[BLOCK];
+    while(true){
+        int64_t n = read_raw(block, BLOCK);
+        if(n < 0) return false;
+        //a stream may end without its zero blocks
+        if(n == 0) return false;
+        if(n < (int64_t)BLOCK){
+            log("ERROR")<<"Unable to read tar header, stream truncated"<<std::endl;
+            failed = true;
+            return false;
+        }
+        size_t i = 0;
+        while(i < BLOCK && block[i] == '\0') ++i;
+        if(i == BLOCK) return false;
+        if(!check_sum(block)){
+            log("ERROR")<<"Unable to read tar header, bad checksum"<<std::endl;
+            failed = true;
+            return false;
+        }
+        char type = block[156];
+        uint64_t size = parse_number(block + 124, 12);
+        if(type == 'L' || type == 'K'){
+            std::string value;
+            if(!read_long(size, value)) return false;
+            value.resize(strnlen(value.c_str(), value.size()));
+            (type == 'L' ? long_name : long_link) = value;
+            continue;
+        }
+        if(type == 'x' || type == 'g'){
+            std::string value;
+            if(!read_long(size, value)) return false;
+            //global headers apply to all entries, none of their keys is used
+            if(type == 'x') parse_pax(value, pax_path, pax_link, has_size, pax_size,
+                has_mtime, pax_mtime);
+            continue;
+        }
+        e.path = get_field(block, 100);
+        std::string prefix = get_field(block + 345, 155);
+        if(memcmp(block + 257, "ustar", 5) == 0 && !prefix.empty())
+            e.path = prefix + '/' + e.path;
+        if(!long_name.empty()) e.path = long_name;
+        if(!pax_path.empty()) e.path = pax_path;
+        e.link = get_field(block + 157, 100);
+        if(!long_link.empty()) e.link = long_link;
+        if(!pax_link.empty()) e.link = pax_link;
+        e.type = (type == '\0' || type == '7') ? (char)TAR_FILE : type;
+        e.mode = parse_number(block + 100, 8) & 07777;
+        e.size = has_size ? pax_size : size;
+        e.mtime = has_mtime ? pax_mtime : parse_number(block + 136, 12);
+        remaining = e.size;
+        padding = (BLOCK - e.size % BLOCK) % BLOCK;
+        //old tars mark dirs by a trailing '/' only
+        if(e.type == TAR_FILE && !e.path.empty() && e.path[e.path.size()-1] == '/')
+            e.type = TAR_DIR;
+        if(e.type != TAR_FILE && e.type != TAR_DIR && e.type != TAR_SYMLINK &&
+            e.type != TAR_HARDLINK){
+            log("WARN")<<"skip tar entry "<<e.path<<" of type "<<type<<std::endl;
+            if(!skip(remaining + padding)) return false;
+            remaining = padding = 0;
+            long_name.clear();
+            long_link.clear();
+            pax_path.clear();
+            pax_link.clear();
+            has_size = has_mtime = false;
+            continue;
+        }
+        if(e.type != TAR_FILE) e.size = 0;
+        return true;
+    }
+}
+
+int64_t tar_reader::read(char* buf, size_t len){
+    size_t n = std::min<uint64_t>(len, remaining);
+    if(n == 0) return 0;
+    int64_t ret = read_raw(buf, n);
+    if(ret < 0) return -1;
+    if((size_t)ret < n){
+        log("ERROR")<<"Unable to read tar data, stream truncated"<<std::endl;
+        failed = true;
+        return -1;
+    }
+    remaining -= n;
+    return n;
+}
+
+tar_writer::tar_writer(int fd):fd(fd),written(0),remaining(0),padding(0){}
+
+bool tar_writer::write_all(const char* buf, size_t len){
+    size_t done = 0;
+    while(done < len){
+        ssize_t ret = ::write(fd, buf + done, len - done);
+        if(ret < 0 && errno == EINTR) continue;
+        if(ret < 0){
+            error("Unable to write tar stream ", "", errno);
+            return false;
+        }
+        done += ret;
+    }
+    written += len;
+    return true;
+}
+
+//the ustar name is split at a '/' into prefix and name
+static bool split_name(const std::string& name, size_t& cut){
+    if(name.size() <= 100){
+        cut = 0;
+        return true;
+    }
+    size_t pos = name.find('/', name.size() - 101);
+    if(pos == std::string::npos || pos > 155 || pos + 1 >= name.size()) return false;
+    cut = pos;
+    return true;
+}
+
+bool tar_writer::write_header(const std::string& name, const std::string& link, char type,
+    mode_t mode, uint64_t size, int64_t mtime){
+    char block[BLOCK];
+    memset(block, 0, sizeof(block));
+    size_t cut;
+    if(split_name(name, cut) && cut > 0){
+        memcpy(block + 345, name.data(), cut);
+        memcpy(block, name.data() + cut + 1, name.size() - cut - 1);
+    }else{
+        //too long, the pax header before has the path
+        memcpy(block, name.data(), std::min<size_t>(name.size(), 100));
+    }
+    put_number(block + 100, 8, mode & 07777);
+    put_number(block + 108, 8, 0);
+    put_number(block + 116, 8, 0);
+    put_number(block + 124, 12, size);
+    put_number(block + 136, 12, mtime < 0 ? 0 : mtime);
+    block[156] = type;
+    memcpy(block + 157, link.data(), std::min<size_t>(link.size(), 100));
+    memcpy(block + 257, "ustar", 6);
+    memcpy(block + 263, "00", 2);
+    memset(block + 148, ' ', 8);
+    unsigned sum = 0;
+    for(size_t i = 0; i < BLOCK; ++i) sum += (unsigned char)block[i];
+    snprintf(block + 148, 8, "%06o", sum);
+    block[155] = ' ';
+    return write_all(block, BLOCK);
+}
+
+//a record counts the digits of its own length
+static void pax_record(std::string& out, const char* key, const std::string& value){
+    size_t len = strlen(key) + value.size() + 3;
+    size_t total = len + std::to_string(len).size();
+    if(std::to_string(total).size() != std::to_string(len).size()) ++total;
+    out += std::to_string(total) + ' ' + key + '=' + value + '\n';
+}
+
+bool tar_writer::header(const tar_entry& e){
+    if(!end_entry()) return false;
+    std::string name = e.path;
+    if(e.type == TAR_DIR && (name.empty() || name[name.size()-1] != '/')) name += '/';
+    uint64_t size = e.type == TAR_FILE ? e.size : 0;
+    size_t cut;
+    std::string pax;
+    if(!split_name(name, cut)) pax_record(pax, "path", name);
+    if(e.link.size() > 100) pax_record(pax, "linkpath", e.link);
+    if(size > MAX_OCTAL) pax_record(pax, "size", std::to_string(size));
+    if(!pax.empty()){
+        if(!write_header("././@PaxHeader", "", 'x', 0644, pax.size(), e.mtime)) return false;
+        pax.resize(pax.size() + (BLOCK - pax.size() % BLOCK) % BLOCK, '\0');
+        if(!write_all(pax.data(), pax.size())) return false;
+    }
+    if(!write_header(name, e.link, e.type, e.mode, size, e.mtime)) return false;
+    remaining = size;
+    padding = (BLOCK - size % BLOCK) % BLOCK;
+    return true;
+}
+
+bool tar_writer::data(const char* buf, size_t len){
+    len = std::min<uint64_t>(len, remaining);
+    remaining -= len;
+    return write_all(buf, len);
+}
+
+bool tar_writer::end_entry(){
+    static const char zeros[BLOCK] = {0};
+    uint64_t left = remaining + padding;
+    remaining = padding = 0;
+    while(left > 0){
+        size_t n = std::min<uint64_t>(left, BLOCK);
+        if(!write_all(zeros, n)) return false;
+        left -= n;
+    }
+    return true;
+}
+
+bool tar_writer::finish(){
+    static const char zeros[2 * BLOCK] = {0};
+    return end_entry() && write_all(zeros, sizeof(zeros));
+}
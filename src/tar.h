@@ -0,0 +1,91 @@
+/*
+* tar streams of tree ingest and export
+* tar_reader parses ustar, pax and gnu long names from a local fd,
+* gzip and zstd streams are detected by their magic and decompressed
+* when built with zlib or zstd, tar_writer emits ustar, with a pax
+* header for long paths and large files
+*
+* 20261019
+*/
+#ifndef TAR_H
+#define TAR_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+//typeflag of an entry, others are skipped
+enum tar_type {TAR_FILE = '0', TAR_HARDLINK = '1', TAR_SYMLINK = '2', TAR_DIR = '5'};
+
+struct tar_entry {
+    std::string path;   //as in the stream
+    std::string link;   //target of a symlink or hardlink
+    char type;
+    mode_t mode;        //permission bits
+    uint64_t size;      //data bytes of a file
+    int64_t mtime;      //sec
+};
+
+//path of an entry relative to the extract dir, without ./, / or . parts,
+//false if it is empty or leaves the dir through ..
+bool tar_clean_path(const std::string& path, std::string& rel);
+
+class tar_reader {
+    int fd;
+    std::string format;
+    //compressed input, only used when decompressing
+    std::vector<char> in;
+    void *zs;           //z_stream
+    void *zds;          //ZSTD_DStream
+    size_t in_pos, in_len;
+    bool in_eof;
+    bool failed;
+    uint64_t remaining; //data bytes of the current entry
+    uint64_t padding;   //to the next 512 byte block
+private:
+    bool fill_input();
+    int64_t read_raw(char* buf, size_t len);
+    bool read_block(char* block);
+    bool skip(uint64_t len);
+    bool read_long(uint64_t size, std::string& value);
+    void close_codec();
+public:
+    explicit tar_reader(int fd);
+    ~tar_reader();
+    //detect the compression from the first bytes
+    bool open();
+    //"tar", "gzip" or "zstd"
+    const char* compression() const{ return format.c_str();}
+    //the next file, dir, symlink or hardlink, the rest of the data of
+    //the previous entry is skipped, false at the end or on error
+    bool next(tar_entry& e);
+    //up to len bytes of the data of the entry, less only at its end
+    int64_t read(char* buf, size_t len);
+    bool ok() const{ return !failed;}
+    tar_reader(const tar_reader&) = delete;
+    tar_reader& operator=(const tar_reader&) = delete;
+};
+
+class tar_writer {
+    int fd;
+    uint64_t written;
+    uint64_t remaining; //data bytes the current entry still needs
+    uint64_t padding;
+private:
+    bool write_all(const char* buf, size_t len);
+    bool write_header(const std::string& name, const std::string& link, char type,
+        mode_t mode, uint64_t size, int64_t mtime);
+public:
+    explicit tar_writer(int fd);
+    //a dir path gets its trailing '/', the data of a file follows
+    bool header(const tar_entry& e);
+    bool data(const char* buf, size_t len);
+    //zeros for the data not written, then the padding of the entry
+    bool end_entry();
+    //two zero blocks close the archive
+    bool finish();
+    uint64_t bytes() const{ return written;}
+};
+
+#endif
@@ -0,0 +1,137 @@
+/*
+* timeline trace of cephfs ops
+*
+* 20261019
+*/
+
+#include "utils.h"
+#include "trace.h"
+
+#include <mutex>
+#include <memory>
+#include <unistd.h>
+
+std::atomic<bool> trace_enabled(false);
+
+struct trace_event {
+    const char* name;
+    std::string path;
+    int64_t bytes;
+    int64_t begin; //ns since trace start
+    int64_t end;
+};
+
+//one buffer per thread, the lock is only contended by flush
+struct trace_buffer {
+    int tid;
+    std::mutex lock;
+    std::vector<trace_event> events;
+};
+
+static std::mutex trace_lock;
+static std::string trace_file;
+static std::vector<std::shared_ptr<trace_buffer>> trace_buffers;
+static std::chrono::steady_clock::time_point trace_start =
+    std::chrono::steady_clock::now();
+
+static trace_buffer* this_thread_buffer(){
+    static thread_local std::shared_ptr<trace_buffer> buffer;
+    if(!buffer){
+        buffer = std::make_shared<trace_buffer>();
+        buffer->events.reserve(4096);
+        std::lock_guard<std::mutex> guard(trace_lock);
+        buffer->tid = trace_buffers.size() + 1;
+        trace_buffers.push_back(buffer);
+    }
+    return buffer.get();
+}
+
+void trace_record(const char* name, const char* path, int64_t bytes,
+    std::chrono::steady_clock::time_point begin,
+    std::chrono::steady_clock::time_point end){
+    trace_buffer *buffer = this_thread_buffer();
+    trace_event ev;
+    ev.name = name;
+    if(path != nullptr) ev.path = path;
+    ev.bytes = bytes;
+    ev.begin = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        begin - trace_start).count();
+    ev.end = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        end - trace_start).count();
+    std::lock_guard<std::mutex> guard(buffer->lock);
+    buffer->events.push_back(std::move(ev));
+}
+
+static void json_escape(std::ostream& os, const std::string& s){
+    for(char c : s){
+        if(c == '"' || c == '\\') os<<'\\'<<c;
+        else if((unsigned char)c < 0x20){
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            os<<buf;
+        }else os<<c;
+    }
+}
+
+static void flush_at_exit(){
+    flush_trace();
+}
+
+bool set_trace_file(const char* file){
+    if(file == nullptr || *file == '\0') return false;
+    static bool registered = false;
+    std::lock_guard<std::mutex> guard(trace_lock);
+    trace_file = file;
+    if(!registered){
+        std::atexit(flush_at_exit);
+        registered = true;
+    }
+    trace_enabled.store(true);
+    return true;
+}
+
+bool flush_trace(){
+    std::lock_guard<std::mutex> guard(trace_lock);
+    if(!trace_enabled.exchange(false) || trace_file.empty()) return false;
+    std::ofstream os(trace_file);
+    if(!os){
+        error("Unable to open trace file ", trace_file.c_str(), errno);
+        return false;
+    }
+    int pid = getpid();
+    size_t count = 0;
+    os<<"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    os<<"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":"<<pid
+        <<",\"args\":{\"name\":\"cephfstool\"}}";
+    for(auto& buffer : trace_buffers){
+        std::lock_guard<std::mutex> bguard(buffer->lock);
+        os<<",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":"<<pid
+            <<",\"tid\":"<<buffer->tid<<",\"args\":{\"name\":\"worker "
+            <<buffer->tid<<"\"}}";
+        for(auto& ev : buffer->events){
+            char ts[64];
+            snprintf(ts, sizeof(ts), "\"ts\":%.3f,\"dur\":%.3f",
+                ev.begin / 1000.0, (ev.end - ev.begin) / 1000.0);
+            os<<",\n{\"name\":\""<<ev.name<<"\",\"cat\":\"cephfs\",\"ph\":\"X\","
+                <<ts<<",\"pid\":"<<pid<<",\"tid\":"<<buffer->tid<<",\"args\":{";
+            os<<"\"path\":\"";
+            json_escape(os, ev.path);
+            os<<"\"";
+            if(ev.bytes >= 0) os<<",\"bytes\":"<<ev.bytes;
+            os<<"}}";
+        }
+        count += buffer->events.size();
+        buffer->events.clear();
+    }
+    os<<"\n]}\n";
+    log("INFO")<<"write "<<count<<" trace events to "<<trace_file<<std::endl;
+    return true;
+}
+
+//env CEPHFS_TOOL_TRACE enables tracing for the whole process
+static struct trace_env_init {
+    trace_env_init(){
+        const char* file = getenv("CEPHFS_TOOL_TRACE");
+        if(file != nullptr && *file != '\0') set_trace_file(file);
+    }
+} trace_env;
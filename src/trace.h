@@ -0,0 +1,51 @@
+/*
+* timeline trace of cephfs ops
+* events are kept in per-thread buffers and written as
+* chrome trace-event json, open it in perfetto or chrome://tracing
+*
+* 20261019
+*/
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdint>
+
+extern std::atomic<bool> trace_enabled;
+
+//start tracing, events are written to file at exit or flush_trace
+//env CEPHFS_TOOL_TRACE=file starts tracing at load time
+extern bool set_trace_file(const char* file);
+//write all events to the trace file and stop tracing
+extern bool flush_trace();
+
+void trace_record(const char* name, const char* path, int64_t bytes,
+    std::chrono::steady_clock::time_point begin,
+    std::chrono::steady_clock::time_point end);
+
+//record one complete event for the lifetime of the scope
+//a relaxed load and a branch when tracing is off
+class trace_scope {
+    const char* name;
+    const char* path;
+    int64_t bytes;
+    bool on;
+    std::chrono::steady_clock::time_point begin;
+public:
+    trace_scope(const char* name, const char* path, int64_t bytes = -1):
+        name(name),path(path),bytes(bytes),
+        on(trace_enabled.load(std::memory_order_relaxed)){
+        if(on) begin = std::chrono::steady_clock::now();
+    }
+    ~trace_scope(){
+        if(on) trace_record(name, path, bytes, begin,
+            std::chrono::steady_clock::now());
+    }
+    void set_bytes(int64_t n){ bytes = n;}
+    trace_scope(const trace_scope&) = delete;
+    trace_scope& operator=(const trace_scope&) = delete;
+};
+
+#endif
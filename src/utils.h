@@ -20,13 +20,16 @@
 #include <chrono>
 #include <random>
 #include <algorithm>
+#include <mutex>
 
 #include <dirent.h>
+#include <sys/stat.h>
 
 //log
 extern bool log_to_file;
 extern std::string log_dir_prefix;
 extern std::ofstream log_stream;
+extern std::mutex log_lock;
 
 inline std::ostream& get_stream(){
     if (log_to_file){
@@ -39,11 +42,27 @@ inline std::ostream& get_stream(){
     return std::cout;
 }
 
+//each thread formats a line in its own buffer,
+//std::endl writes the whole line to the log under log_lock
+class log_buf : public std::stringbuf {
+protected:
+    int sync() override{
+        std::lock_guard<std::mutex> guard(log_lock);
+        get_stream()<<str();
+        get_stream().flush();
+        str("");
+        return 0;
+    }
+};
+
 inline std::ostream& log(const char *level){
+    static thread_local log_buf buf;
+    static thread_local std::ostream os(&buf);
     std::time_t t = std::time(nullptr);
-    char buf[100];
-    std::strftime(buf, 100, "%F %T", std::localtime(&t));
-    return get_stream()<<buf<<" ["<<level<<"] ";
+    char tbuf[100];
+    struct tm tm;
+    std::strftime(tbuf, 100, "%F %T", localtime_r(&t, &tm));
+    return os<<tbuf<<" ["<<level<<"] ";
 }
 
 inline void error(const char* msg, const char* path, int e){
@@ -56,8 +75,10 @@ inline void error(const char* msg, const char* path, int e){
         _path = "";
     else
         _path = path;
+    char ebuf[256];
     if(e != 0)
-        log("ERROR")<<_msg<<_path<<": ("<<e<<") "<<strerror(e)<<std::endl;
+        log("ERROR")<<_msg<<_path<<": ("<<e<<") "
+            <<strerror_r(e, ebuf, sizeof(ebuf))<<std::endl;
     else
         log("ERROR")<<_msg<<_path<<std::endl;
 }
@@ -115,6 +136,48 @@ inline size_t parse_obj_size(const std::string& arg){
     return parse_obj_size(arg.c_str());
 }
 
+//mkdir -p for local path
+inline bool mk_local_dirs(const std::string& path){
+    for(size_t pos = 1; pos <= path.size(); ++pos){
+        if(pos != path.size() && path[pos] != '/') continue;
+        std::string dir = path.substr(0, pos);
+        if(::mkdir(dir.c_str(), 0777) < 0 && errno != EEXIST) return false;
+    }
+    return true;
+}
+
+//all len bytes are zero, memcmp against a zero page is vectorized by libc
+inline bool is_zero(const char* buf, size_t len){
+    static const char zeros[4096] = {0};
+    while(len >= sizeof(zeros)){
+        if(memcmp(buf, zeros, sizeof(zeros)) != 0) return false;
+        buf += sizeof(zeros);
+        len -= sizeof(zeros);
+    }
+    return memcmp(buf, zeros, len) == 0;
+}
+
+//fn(pos, n) for each run of blocks in buf that are not all zero,
+//stops at the first fn returning false
+template<typename F>
+inline bool for_each_data(const char* buf, size_t len, size_t block, F fn){
+    size_t pos = 0, start = 0;
+    bool in_run = false;
+    while(pos < len){
+        size_t n = std::min(block, len - pos);
+        bool zero = is_zero(buf + pos, n);
+        if(!zero && !in_run){
+            start = pos;
+            in_run = true;
+        }else if(zero && in_run){
+            if(!fn(start, pos - start)) return false;
+            in_run = false;
+        }
+        pos += n;
+    }
+    return in_run ? fn(start, len - start) : true;
+}
+
 inline bool mkTempFile(const char* path, size_t size, random_generator& rg){
     std::ofstream os(path);
     if(!os){
@@ -0,0 +1,131 @@
+/*
+* tree walker
+*
+* 20261019
+*/
+
+#include "utils.h"
+#include "walker.h"
+#include "trace.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+int local_dir_source::open(const char* path){
+    close();
+    dp = ::opendir(path);
+    return dp == nullptr ? -errno : 0;
+}
+
+int local_dir_source::next(item& it){
+    while(true){
+        errno = 0;
+        struct dirent *de = ::readdir((DIR*)dp);
+        if(de == nullptr) return errno ? -errno : 0;
+        struct stat st;
+        if(fstatat(dirfd((DIR*)dp), de->d_name, &st, 0) < 0){
+            //gone since readdir
+            if(errno == ENOENT) continue;
+            return -errno;
+        }
+        it.name = de->d_name;
+        it.mode = st.st_mode;
+        it.size = st.st_size;
+        it.mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        it.ctime_ns = (int64_t)st.st_ctim.tv_sec * 1000000000 + st.st_ctim.tv_nsec;
+        return 1;
+    }
+}
+
+void local_dir_source::close(){
+    if(dp != nullptr) ::closedir((DIR*)dp);
+    dp = nullptr;
+}
+
+int cephfs_dir_source::open(const char* path){
+    close();
+    this->path = path;
+    ops_rate->acquire(1);
+    int ret = fs->opendir(cmount, path, &dirp);
+    if(ret < 0) dirp = nullptr;
+    return ret;
+}
+
+int cephfs_dir_source::next(item& it){
+    int ret;
+    {
+        trace_scope ts("readdir", path.c_str());
+        ret = fs->readdirplus_r(cmount, dirp, &de, &stx,
+            CEPH_STATX_MODE|CEPH_STATX_SIZE|CEPH_STATX_MTIME|CEPH_STATX_CTIME,
+            AT_NO_ATTR_SYNC);
+    }
+    if(ret <= 0) return ret;
+    it.name = de.d_name;
+    it.mode = stx.stx_mode;
+    it.size = stx.stx_size;
+    it.mtime_ns = (int64_t)stx.stx_mtime.tv_sec * 1000000000 + stx.stx_mtime.tv_nsec;
+    it.ctime_ns = (int64_t)stx.stx_ctime.tv_sec * 1000000000 + stx.stx_ctime.tv_nsec;
+    return 1;
+}
+
+void cephfs_dir_source::close(){
+    if(dirp != nullptr) fs->closedir(cmount, dirp);
+    dirp = nullptr;
+}
+
+bool tree_walker::walk(const std::string& root, visit_fn visit, listed_fn listed){
+    arena.clear();
+    pending.clear();
+    std::string base = root;
+    while(base.size() > 1 && base[base.size()-1] == '/') base.pop_back();
+    arena.push_back('\0');
+    pending.push_back(std::make_pair(0, 0));
+    while(!pending.empty()){
+        size_t off = pending.back().first;
+        int depth = pending.back().second;
+        pending.pop_back();
+        dir_rel.assign(arena, off, arena.size() - off - 1);
+        arena.resize(off);
+        dir_path.assign(base);
+        if(!dir_rel.empty()){
+            if(dir_path[dir_path.size()-1] != '/') dir_path += '/';
+            dir_path += dir_rel;
+        }
+        int ret = source.open(dir_path.c_str());
+        if(ret == -ENOENT && skip_gone && !dir_rel.empty()) continue;
+        if(ret < 0){
+            error("Unable to open dir ", dir_path.c_str(), -ret);
+            return false;
+        }
+        dir_source::item it;
+        while((ret = source.next(it)) > 0){
+            if(strcmp(it.name, ".") == 0 || strcmp(it.name, "..") == 0) continue;
+            path.assign(dir_path);
+            if(path[path.size()-1] != '/') path += '/';
+            path += it.name;
+            rel.assign(dir_rel);
+            if(!rel.empty()) rel += '/';
+            rel += it.name;
+            walk_entry e = {path, rel, it.name, depth, it.mode, it.size,
+                it.mtime_ns, it.ctime_ns};
+            visit_t v = visit(e);
+            if(v == VISIT_STOP){
+                source.close();
+                return false;
+            }
+            if(v == VISIT_ENTER && S_ISDIR(it.mode)){
+                pending.push_back(std::make_pair(arena.size(), depth + 1));
+                arena.append(rel);
+                arena.push_back('\0');
+            }
+        }
+        source.close();
+        if(ret < 0){
+            error("Unable to read dir ", dir_path.c_str(), -ret);
+            return false;
+        }
+        if(listed && !listed(dir_path, dir_rel, depth)) return false;
+    }
+    return true;
+}
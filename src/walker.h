@@ -0,0 +1,105 @@
+/*
+* tree walker
+* iterative walk of a local dir or a cephfs dir shared by all tree ops
+* a dir is listed whole and closed before the next one is opened, its
+* subdirs wait as paths in one stack arena, the entry paths are built in
+* reused buffers, so depth costs no stack frame or open handle, and a walk
+* of millions of entries does not allocate per entry
+*
+* 20261019
+*/
+#ifndef WALKER_H
+#define WALKER_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "backend.h"
+#include "ratelimit.h"
+
+struct walk_entry {
+    const std::string& path; //root and rel
+    const std::string& rel;  //below the root, no leading '/'
+    const char* name;
+    int depth;               //0 in the root
+    uint32_t mode;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+};
+
+//lists one dir at a time
+class dir_source {
+public:
+    struct item {
+        const char* name;
+        uint32_t mode;
+        uint64_t size;
+        int64_t mtime_ns;
+        int64_t ctime_ns;
+    };
+    virtual ~dir_source(){}
+    //negative errno
+    virtual int open(const char* path) = 0;
+    //1 an item, 0 the end, negative errno
+    virtual int next(item& it) = 0;
+    virtual void close() = 0;
+};
+
+//opendir and fstatat on the dir fd, links are followed
+class local_dir_source : public dir_source {
+    void *dp;
+public:
+    local_dir_source():dp(nullptr){}
+    ~local_dir_source(){ close();}
+    int open(const char* path) override;
+    int next(item& it) override;
+    void close() override;
+};
+
+//readdirplus, one metadata op per dir is charged to the ops rate
+class cephfs_dir_source : public dir_source {
+    CephfsBackend *fs;
+    struct ceph_mount_info *cmount;
+    rate_limiter *ops_rate;
+    struct ceph_dir_result *dirp;
+    std::string path;
+    struct dirent de;
+    struct ceph_statx stx;
+public:
+    cephfs_dir_source(CephfsBackend *fs, struct ceph_mount_info *cmount,
+        rate_limiter *ops_rate):fs(fs),cmount(cmount),ops_rate(ops_rate),dirp(nullptr){}
+    ~cephfs_dir_source(){ close();}
+    int open(const char* path) override;
+    int next(item& it) override;
+    void close() override;
+};
+
+class tree_walker {
+public:
+    enum visit_t {VISIT_STOP, VISIT_SKIP, VISIT_ENTER};
+    //each entry of a dir in turn, VISIT_ENTER walks a dir later,
+    //VISIT_STOP ends the walk with false
+    typedef std::function<visit_t(const walk_entry& e)> visit_fn;
+    //after the last entry of a dir, before any of its subdirs
+    typedef std::function<bool(const std::string& path, const std::string& rel,
+        int depth)> listed_fn;
+private:
+    dir_source& source;
+    std::string arena;  //rel paths of pending dirs, '\0' ended
+    std::vector<std::pair<size_t, int>> pending; //arena offset, depth
+    std::string dir_path, dir_rel, path, rel;
+    bool skip_gone;
+public:
+    explicit tree_walker(dir_source& source):source(source),skip_gone(false){}
+    //a subdir removed since it was visited is left out, not an error,
+    //e.g. when other processes remove the same tree
+    void set_skip_gone(bool skip){ skip_gone = skip;}
+    //entries below root, not root itself, false on an error or a stop
+    bool walk(const std::string& root, visit_fn visit, listed_fn listed = nullptr);
+    tree_walker(const tree_walker&) = delete;
+    tree_walker& operator=(const tree_walker&) = delete;
+};
+
+#endif
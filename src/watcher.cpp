@@ -0,0 +1,109 @@
+/*
+* local tree watcher
+*
+* 20261019
+*/
+
+#include "utils.h"
+#include "watcher.h"
+#include "walker.h"
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+//events of a watched dir
+static constexpr uint32_t WATCH_MASK = IN_CLOSE_WRITE|IN_MOVED_TO|IN_CREATE|
+    IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR;
+static constexpr size_t EVENT_BUF = 64*1024;
+
+tree_watcher::tree_watcher():fd(-1),buf(new char[EVENT_BUF]){
+}
+
+tree_watcher::~tree_watcher(){
+    if(fd >= 0) ::close(fd);
+    delete[] buf;
+}
+
+bool tree_watcher::open(const std::string& root){
+    this->root = root;
+    while(this->root.size() > 1 && this->root[this->root.size()-1] == '/')
+        this->root.pop_back();
+    fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if(fd < 0){
+        error("Unable to init inotify ", root.c_str(), errno);
+        return false;
+    }
+    return add_tree("");
+}
+
+bool tree_watcher::add_dir(const std::string& rel){
+    std::string path = rel.empty() ? root : root + '/' + rel;
+    int wd = inotify_add_watch(fd, path.c_str(), WATCH_MASK);
+    if(wd < 0){
+        //gone already, its parent reports what replaced it
+        if(errno == ENOENT || errno == ENOTDIR) return true;
+        //ENOSPC, fs.inotify.max_user_watches is too low for the tree
+        error("Unable to watch local dir ", path.c_str(), errno);
+        return false;
+    }
+    dirs[wd] = rel;
+    return true;
+}
+
+bool tree_watcher::add_tree(const std::string& rel){
+    if(!add_dir(rel)) return false;
+    local_dir_source source;
+    tree_walker walker(source);
+    walker.set_skip_gone(true);
+    std::string base = rel.empty() ? root : root + '/' + rel;
+    std::string sub;
+    return walker.walk(base, [&](const walk_entry& e){
+        if(e.name[0] == '.' || !S_ISDIR(e.mode)) return tree_walker::VISIT_SKIP;
+        sub = rel.empty() ? e.rel : rel + '/' + e.rel;
+        return add_dir(sub) ? tree_walker::VISIT_ENTER : tree_walker::VISIT_STOP;
+    });
+}
+
+int tree_watcher::poll(int timeout_ms, watch_changes& c){
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int ret = ::poll(&pfd, 1, timeout_ms);
+    if(ret < 0) return errno == EINTR ? 0 : -1;
+    if(ret == 0) return 0;
+    int events = 0;
+    while(true){
+        ssize_t len = ::read(fd, buf, EVENT_BUF);
+        if(len < 0){
+            if(errno == EAGAIN || errno == EINTR) break;
+            error("Unable to read inotify events ", root.c_str(), errno);
+            return -1;
+        }
+        for(char *p = buf; p < buf + len;){
+            struct inotify_event *ev = (struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            ++events;
+            if(ev->mask & IN_Q_OVERFLOW){
+                c.overflow = true;
+                continue;
+            }
+            auto it = dirs.find(ev->wd);
+            if(it == dirs.end()) continue;
+            if(ev->mask & IN_IGNORED){
+                dirs.erase(it);
+                continue;
+            }
+            if(ev->len == 0 || ev->name[0] == '.') continue;
+            std::string rel = it->second.empty() ? ev->name : it->second + '/' + ev->name;
+            if(ev->mask & IN_ISDIR){
+                //files may be in it before its watch, walk it whole
+                if(ev->mask & (IN_CREATE|IN_MOVED_TO)){
+                    c.subtrees.insert(rel);
+                    if(!add_tree(rel)) return -1;
+                }
+            }else if(ev->mask & (IN_CLOSE_WRITE|IN_MOVED_TO)){
+                c.files.insert(rel);
+            }
+        }
+    }
+    return events;
+}
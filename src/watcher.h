@@ -0,0 +1,51 @@
+/*
+* local tree watcher
+* inotify watches on every dir of a local tree, the events are coalesced
+* into the set of files written and the dirs new since the last take
+* a lost event queue is reported as overflow, the tree must be rescanned
+*
+* 20261019
+*/
+#ifndef WATCHER_H
+#define WATCHER_H
+
+#include <set>
+#include <string>
+#include <unordered_map>
+
+struct watch_changes {
+    std::set<std::string> files;    //rel paths closed after write or moved in
+    std::set<std::string> subtrees; //rel dirs made or moved in, walk them whole
+    bool overflow;                  //events were lost
+    watch_changes():overflow(false){}
+    bool empty() const{ return files.empty() && subtrees.empty() && !overflow;}
+    void clear(){
+        files.clear();
+        subtrees.clear();
+        overflow = false;
+    }
+};
+
+//names starting with '.' are not watched or reported, as in upload
+class tree_watcher {
+    int fd;
+    std::string root;
+    std::unordered_map<int, std::string> dirs; //watch descriptor, rel dir
+    char *buf;
+private:
+    bool add_dir(const std::string& rel);
+public:
+    tree_watcher();
+    ~tree_watcher();
+    bool open(const std::string& root);
+    //watch rel and every dir below, again after an overflow
+    bool add_tree(const std::string& rel);
+    //events of up to timeout_ms added to c, the number of events,
+    //0 on timeout or -1 on error
+    int poll(int timeout_ms, watch_changes& c);
+    size_t watches() const{ return dirs.size();}
+    tree_watcher(const tree_watcher&) = delete;
+    tree_watcher& operator=(const tree_watcher&) = delete;
+};
+
+#endif
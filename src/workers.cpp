@@ -0,0 +1,325 @@
+/*
+* parallel workers for tree transfers
+*
+* 20261019
+*/
+
+#include "utils.h"
+#include "workers.h"
+
+//a window slower than this times the baseline is congestion
+static constexpr double LATENCY_TOLERANCE = 2.0;
+static constexpr double DECREASE_FACTOR = 0.7;
+
+aimd_limiter::aimd_limiter(int min_limit, int max_limit):
+    min_limit(std::max(1, min_limit)),max_limit(std::max(1, max_limit)),
+    inflight(0),samples(0),errors(0),latency_sum(0),baseline(0){
+    if(this->max_limit < this->min_limit) this->max_limit = this->min_limit;
+    limit = std::min(std::max(4, this->min_limit), this->max_limit);
+}
+
+aimd_limiter*& aimd_limiter::current_thread(){
+    static thread_local aimd_limiter* limiter = nullptr;
+    return limiter;
+}
+
+int aimd_limiter::current(){
+    std::lock_guard<std::mutex> guard(lock);
+    return (int)limit;
+}
+
+void aimd_limiter::acquire(){
+    std::unique_lock<std::mutex> guard(lock);
+    cond.wait(guard, [this]{ return inflight < (int)limit;});
+    ++inflight;
+}
+
+void aimd_limiter::release(){
+    std::lock_guard<std::mutex> guard(lock);
+    --inflight;
+    cond.notify_one();
+}
+
+void aimd_limiter::observe(int64_t usec, bool ok){
+    std::lock_guard<std::mutex> guard(lock);
+    ++samples;
+    if(!ok) ++errors;
+    latency_sum += usec;
+    if(samples < std::max(4, (int)limit)) return;
+    double mean = latency_sum / samples;
+    double old = limit;
+    if(baseline <= 0 || mean < baseline) baseline = mean;
+    if(errors > 0 || mean > baseline * LATENCY_TOLERANCE){
+        limit = std::max((double)min_limit, limit * DECREASE_FACTOR);
+    }else{
+        limit = std::min((double)max_limit, limit + 1);
+    }
+    //let the baseline follow a cluster that got slower for good
+    baseline *= 1.05;
+    if((int)old != (int)limit){
+        log("INFO")<<"concurrency "<<(int)old<<" -> "<<(int)limit
+            <<", mean latency "<<(int64_t)mean<<"us, errors "<<errors<<std::endl;
+        cond.notify_all();
+    }
+    samples = errors = 0;
+    latency_sum = 0;
+}
+
+worker_pool::worker_pool(aimd_limiter& limiter):limiter(limiter),
+    queue_limit(limiter.max() * 4),running(0),stopping(false),failed(false){
+    for(int i = 0; i < limiter.max(); ++i)
+        threads.emplace_back(&worker_pool::run, this);
+}
+
+worker_pool::~worker_pool(){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    not_empty.notify_all();
+    for(auto& t : threads) t.join();
+}
+
+void worker_pool::run(){
+    aimd_limiter::current_thread() = &limiter;
+    while(true){
+        std::function<bool()> task;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            not_empty.wait(guard, [this]{ return stopping || !tasks.empty();});
+            if(tasks.empty()) break;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+            ++running;
+        }
+        not_full.notify_one();
+        if(!failed.load()){
+            limiter.acquire();
+            bool ret = task();
+            limiter.release();
+            if(!ret) failed.store(true);
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            --running;
+            if(running == 0 && tasks.empty()) idle.notify_all();
+        }
+    }
+    aimd_limiter::current_thread() = nullptr;
+}
+
+void worker_pool::submit(std::function<bool()> task){
+    std::unique_lock<std::mutex> guard(lock);
+    not_full.wait(guard, [this]{ return tasks.size() < queue_limit;});
+    tasks.push_back(std::move(task));
+    guard.unlock();
+    not_empty.notify_one();
+}
+
+bool worker_pool::wait(){
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this]{ return running == 0 && tasks.empty();});
+    return !failed.load();
+}
+
+task_executor::task_executor(int threads, size_t queue_limit):
+    limiter(1, threads),queue_limit(std::max<size_t>(1, queue_limit)),stopping(false){
+    for(int i = 0; i < limiter.max(); ++i)
+        this->threads.emplace_back(&task_executor::run, this);
+}
+
+task_executor::~task_executor(){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    not_empty.notify_all();
+    for(auto& t : threads) t.join();
+}
+
+void task_executor::run(){
+    aimd_limiter::current_thread() = &limiter;
+    while(true){
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            not_empty.wait(guard, [this]{ return stopping || !tasks.empty();});
+            if(tasks.empty()) break;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        not_full.notify_one();
+        limiter.acquire();
+        task();
+        limiter.release();
+    }
+    aimd_limiter::current_thread() = nullptr;
+}
+
+void task_executor::submit(std::function<void()> task){
+    std::unique_lock<std::mutex> guard(lock);
+    not_full.wait(guard, [this]{ return tasks.size() < queue_limit;});
+    tasks.push_back(std::move(task));
+    guard.unlock();
+    not_empty.notify_one();
+}
+
+size_t task_executor::queued(){
+    std::lock_guard<std::mutex> guard(lock);
+    return tasks.size();
+}
+
+buffer_pipeline::buffer_pipeline(buffer_pool& pool, int depth):
+    pool(pool),depth(depth),buffer_size(pool.chunk_size()),stopping(false),total(0){
+}
+
+//a block with len 0 ends the stream, negative len is an error
+void buffer_pipeline::produce(fill_fn& fill){
+    while(true){
+        char *buf;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            cond.wait(guard, [this]{ return stopping || !free_list.empty();});
+            if(stopping) return;
+            buf = free_list.front();
+            free_list.pop_front();
+        }
+        int64_t n = fill(buf, buffer_size);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            full_list.push_back(block{buf, n});
+        }
+        cond.notify_all();
+        if(n <= 0) return;
+    }
+}
+
+bool buffer_pipeline::run(fill_fn fill, drain_fn drain){
+    //one buffer still works, fill and drain take turns
+    buffer_lease lease(pool, depth);
+    if(lease.size() == 0) return false;
+    free_list.assign(lease.data(), lease.data() + lease.size());
+    full_list.clear();
+    stopping = false;
+    total = 0;
+    std::thread producer(&buffer_pipeline::produce, this, std::ref(fill));
+    bool ok = true;
+    while(true){
+        block b;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            cond.wait(guard, [this]{ return !full_list.empty();});
+            b = full_list.front();
+            full_list.pop_front();
+        }
+        if(b.len < 0) ok = false;
+        if(b.len <= 0) break;
+        if(!drain(b.data, b.len)){
+            ok = false;
+            break;
+        }
+        total += b.len;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            free_list.push_back(b.data);
+        }
+        cond.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    cond.notify_all();
+    producer.join();
+    return ok;
+}
+
+transfer_plan::transfer_plan(uint64_t split_size, uint64_t chunk_size, uint64_t small_size,
+    size_t batch_files, uint64_t file_cost):split_size(split_size),
+    chunk_size(std::max<uint64_t>(chunk_size, 1)),small_size(small_size),
+    file_cost(file_cost),batch_files(std::max<size_t>(batch_files, 1)){
+}
+
+size_t transfer_plan::add(uint64_t size, bool split){
+    sizes.push_back(size);
+    splittable.push_back(split);
+    return sizes.size() - 1;
+}
+
+std::vector<transfer_plan::batch> transfer_plan::schedule(int workers,
+    const std::function<bool(const task&)>& keep) const{
+    typedef std::pair<uint64_t, batch> costed;
+    std::vector<costed> large, small;
+    //a few batches per worker at least, a small tree still runs in parallel
+    uint64_t small_cost = 0;
+    for(size_t i = 0; i < sizes.size(); ++i){
+        if(is_split(i) || sizes[i] >= small_size) continue;
+        if(keep && !keep(task{i, 0, sizes[i], false})) continue;
+        small_cost += sizes[i] + file_cost;
+    }
+    uint64_t batch_cost = std::min(chunk_size,
+        small_cost / (std::max(workers, 1) * 4) + 1);
+    batch cur;
+    uint64_t cur_cost = 0;
+    for(size_t i = 0; i < sizes.size(); ++i){
+        if(is_split(i)){
+            for(uint64_t off = 0; off < sizes[i]; off += chunk_size){
+                uint64_t len = std::min(chunk_size, sizes[i] - off);
+                task t = {i, off, len, true};
+                if(!keep || keep(t)) large.push_back(costed(len, batch(1, t)));
+            }
+            continue;
+        }
+        task t = {i, 0, sizes[i], false};
+        if(keep && !keep(t)) continue;
+        if(sizes[i] >= small_size){
+            large.push_back(costed(sizes[i] + file_cost, batch(1, t)));
+        }else{
+            //in walk order, files of a dir stay together
+            cur.push_back(t);
+            cur_cost += sizes[i] + file_cost;
+            if(cur.size() >= batch_files || cur_cost >= batch_cost){
+                small.push_back(costed(cur_cost, batch()));
+                small.back().second.swap(cur);
+                cur_cost = 0;
+            }
+        }
+    }
+    if(!cur.empty()) small.push_back(costed(cur_cost, cur));
+    std::stable_sort(large.begin(), large.end(),
+        [](const costed& a, const costed& b){ return a.first > b.first;});
+    uint64_t large_total = 0, small_total = 0;
+    for(const costed& c : large) large_total += c.first;
+    for(const costed& c : small) small_total += c.first;
+    //take from the side with the lower share done, both end together
+    std::vector<batch> order;
+    order.reserve(large.size() + small.size());
+    size_t i = 0, j = 0;
+    uint64_t large_done = 0, small_done = 0;
+    while(i < large.size() || j < small.size()){
+        bool take_large = j == small.size() || (i < large.size() &&
+            (double)large_done * small_total <= (double)small_done * large_total);
+        if(take_large){
+            large_done += large[i].first;
+            order.push_back(large[i++].second);
+        }else{
+            small_done += small[j].first;
+            order.push_back(small[j++].second);
+        }
+    }
+    return order;
+}
+
+int shard_of(const std::string& path, uint64_t offset, int count){
+    if(count <= 1) return 0;
+    uint64_t h = 14695981039346656037ULL;
+    for(unsigned char c : path){
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    for(int i = 0; i < 8; ++i){
+        h ^= (offset >> (i * 8)) & 0xff;
+        h *= 1099511628211ULL;
+    }
+    return h % count;
+}
@@ -0,0 +1,187 @@
+/*
+* parallel workers for tree transfers
+* aimd_limiter adapts the number of in-flight ops to the cluster
+* buffer_pipeline overlaps the two sides of a stream copy
+* transfer_plan orders the files of a tree transfer by size
+* task_executor runs the independent ops of the async api
+*
+* 20261019
+*/
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bufpool.h"
+
+//additive increase, multiplicative decrease of in-flight ops
+//every window (about limit completions) the mean op latency is compared
+//with the lowest seen, errors or a slowdown shrink the limit
+class aimd_limiter {
+    std::mutex lock;
+    std::condition_variable cond;
+    int min_limit, max_limit;
+    double limit;
+    int inflight;
+    //current window
+    int samples, errors;
+    double latency_sum;
+    double baseline; //usec, lowest window mean
+public:
+    aimd_limiter(int min_limit, int max_limit);
+    int max() const{ return max_limit;}
+    int current();
+    void acquire();
+    void release();
+    //one cephfs op finished, usec latency, ok false on error
+    void observe(int64_t usec, bool ok);
+    //limiter of the tree operation running on this thread
+    static aimd_limiter*& current_thread();
+};
+
+//time one cephfs op and report it to the limiter of this thread
+class op_probe {
+    aimd_limiter *limiter;
+    std::chrono::steady_clock::time_point start;
+public:
+    op_probe():limiter(aimd_limiter::current_thread()){
+        if(limiter) start = std::chrono::steady_clock::now();
+    }
+    //expected errors like -ENOENT, -EEXIST do not slow down
+    void done(int ret){
+        if(limiter == nullptr) return;
+        auto usec = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        limiter->observe(usec, ret >= 0 || ret == -ENOENT || ret == -EEXIST);
+    }
+};
+
+//max_limit threads, each task runs once the limiter admits it
+//submit blocks when the queue is full, the first failed task cancels the rest
+class worker_pool {
+    aimd_limiter& limiter;
+    std::mutex lock;
+    std::condition_variable not_empty, not_full, idle;
+    std::deque<std::function<bool()>> tasks;
+    size_t queue_limit;
+    int running;
+    bool stopping;
+    std::atomic<bool> failed;
+    std::vector<std::thread> threads;
+private:
+    void run();
+public:
+    explicit worker_pool(aimd_limiter& limiter);
+    ~worker_pool();
+    void submit(std::function<bool()> task);
+    //wait all submitted tasks, false if any failed
+    bool wait();
+    bool ok() const{ return !failed.load();}
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+};
+
+//threads for independent tasks, a failed task cancels nothing, the
+//limiter admits them like the ops of a tree operation, submit blocks
+//while queue_limit tasks wait, the destructor runs the queued tasks first
+class task_executor {
+    aimd_limiter limiter;
+    std::mutex lock;
+    std::condition_variable not_empty, not_full;
+    std::deque<std::function<void()>> tasks;
+    size_t queue_limit;
+    bool stopping;
+    std::vector<std::thread> threads;
+private:
+    void run();
+public:
+    task_executor(int threads, size_t queue_limit);
+    ~task_executor();
+    void submit(std::function<void()> task);
+    //tasks waiting for a thread
+    size_t queued();
+    task_executor(const task_executor&) = delete;
+    task_executor& operator=(const task_executor&) = delete;
+};
+
+//orders the files of a tree transfer to shorten its makespan
+//files from split_size up become chunk tasks that several workers share,
+//large tasks run largest first, small files go in batches spread evenly
+//between them, so small file ops overlap large file bandwidth and the
+//last tasks are short ones, no worker is left alone with a giant file
+class transfer_plan {
+public:
+    struct task {
+        size_t file;     //index from add
+        uint64_t offset;
+        uint64_t len;
+        bool chunk;      //part of a split file, else the whole file
+    };
+    //tasks one worker runs in a row
+    typedef std::vector<task> batch;
+private:
+    uint64_t split_size, chunk_size, small_size, file_cost;
+    size_t batch_files;
+    std::vector<uint64_t> sizes;
+    std::vector<bool> splittable;
+public:
+    //file_cost, the per file ops in bytes of transfer time
+    transfer_plan(uint64_t split_size, uint64_t chunk_size, uint64_t small_size,
+        size_t batch_files, uint64_t file_cost);
+    //split false keeps the file in one task, e.g. when it is hashed
+    size_t add(uint64_t size, bool split = true);
+    bool is_split(size_t file) const{
+        return splittable[file] && split_size > 0 && sizes[file] >= split_size;
+    }
+    //in the order to run on the worker threads, only tasks keep takes
+    std::vector<batch> schedule(int workers,
+        const std::function<bool(const task&)>& keep = nullptr) const;
+};
+
+//the shard of count a file, or the chunk at offset of it, belongs to,
+//fnv-1a of the path, the same on every node and every run
+int shard_of(const std::string& path, uint64_t offset, int count);
+
+//copy a stream through up to depth pooled buffers, fill runs on its own
+//thread while drain consumes the previous buffers on the caller
+class buffer_pipeline {
+public:
+    //put up to len bytes in buf, 0 at eof, negative on error
+    typedef std::function<int64_t(char* buf, size_t len)> fill_fn;
+    //consume all len bytes, false on error
+    typedef std::function<bool(const char* buf, size_t len)> drain_fn;
+private:
+    struct block {
+        char *data;
+        int64_t len;
+    };
+    buffer_pool& pool;
+    int depth;
+    size_t buffer_size;
+    std::mutex lock;
+    std::condition_variable cond;
+    std::deque<char*> free_list;
+    std::deque<block> full_list;
+    bool stopping;
+    int64_t total;
+private:
+    void produce(fill_fn& fill);
+public:
+    buffer_pipeline(buffer_pool& pool, int depth);
+    //false if fill or drain failed or no buffer could be allocated
+    bool run(fill_fn fill, drain_fn drain);
+    //bytes drained by the last run
+    int64_t bytes() const{ return total;}
+    buffer_pipeline(const buffer_pipeline&) = delete;
+    buffer_pipeline& operator=(const buffer_pipeline&) = delete;
+};
+
+#endif
@@ -0,0 +1,926 @@
+#include "src/utils.h"
+#include "src/cephfstool.h"
+#include "src/trace.h"
+#include <gtest/gtest.h>
+#include <thread>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+/*
+ * test cephfs helper against the local stand-in
+ */
+const char* shim_dir = "/tmp/cephfs_tool_shim";
+
+class CephfsToolShim : public testing::Test {
+protected:
+    random_generator rg;
+    virtual void SetUp(){
+        set_log_dir("./");
+        system("/bin/rm -rf /tmp/cephfs_tool_shim");
+    }
+    virtual void TearDown(){
+        system("/bin/rm -rf /tmp/cephfs_tool_shim");
+    }
+    void login(CephfsHelper& helper, const char* spec){
+        std::string full = std::string("local=") + shim_dir;
+        if(spec != nullptr && *spec != '\0'){
+            full += ',';
+            full += spec;
+        }
+        ASSERT_TRUE(helper.set_shim(full.c_str()));
+        ASSERT_TRUE(helper.login(nullptr, nullptr, "/test_root"));
+    }
+    void cmp_file_size(const char* tf, size_t size){
+        struct stat st;
+        stat(tf, &st);
+        EXPECT_EQ((size_t)st.st_size, size);
+    }
+    void round_trip(CephfsHelper& helper, const char* fsize){
+        const char* path = "/cephfs_tool_test_file";
+        size_t size = parse_obj_size(fsize);
+        const char *tf = "/tmp/tmpfile_shim";
+        EXPECT_TRUE(mkTempFile(tf, size, rg));
+        EXPECT_TRUE(helper.write(path, tf));
+        remove(tf);
+        uint64_t sz = 0;
+        EXPECT_TRUE(helper.length(path, sz));
+        EXPECT_EQ(sz, size);
+        EXPECT_TRUE(helper.read(path, tf));
+        cmp_file_size(tf, size);
+        remove(tf);
+        EXPECT_TRUE(helper.remove(path));
+    }
+};
+
+TEST_F(CephfsToolShim, bad_spec){
+    CephfsHelper helper;
+    EXPECT_FALSE(helper.set_shim("lat=abc"));
+    EXPECT_FALSE(helper.set_shim("lat.nosuchop=1ms"));
+    EXPECT_FALSE(helper.set_shim("eio=2"));
+    EXPECT_FALSE(helper.set_shim("eio=abc"));
+    EXPECT_FALSE(helper.set_shim("short=0.1x"));
+    EXPECT_FALSE(helper.set_shim("seed=x"));
+    EXPECT_FALSE(helper.set_shim("unknown=1"));
+    EXPECT_TRUE(helper.set_shim("lat=1ms..3ms,lat.open=exp:2ms,bw=10gbit"));
+}
+
+//the same seed gives the same faults, per instance, on any thread
+TEST_F(CephfsToolShim, fault_seed){
+    LocalBackend local(shim_dir);
+    struct ceph_mount_info *cmount;
+    ASSERT_EQ(0, local.create(&cmount, nullptr));
+    ASSERT_EQ(0, local.mount(cmount, "/"));
+    FaultBackend::config conf;
+    std::string dir;
+    ASSERT_TRUE(FaultBackend::parse("eio=0.5,seed=7", conf, dir));
+    auto faults = [&](FaultBackend& fs){
+        std::string pattern;
+        struct ceph_statx stx;
+        for(int i = 0; i < 64; ++i)
+            pattern += fs.statx(cmount, "/", &stx, 0, 0) == -EIO ? 'x' : '.';
+        return pattern;
+    };
+    FaultBackend a(&local, conf), b(&local, conf);
+    std::string first = faults(a);
+    EXPECT_NE(std::string::npos, first.find('x'));
+    EXPECT_EQ(first, faults(b));
+    std::string other;
+    std::thread t([&]{ FaultBackend c(&local, conf); other = faults(c);});
+    t.join();
+    EXPECT_EQ(first, other);
+    conf.seed = 8;
+    FaultBackend d(&local, conf);
+    EXPECT_NE(first, faults(d));
+}
+
+TEST_F(CephfsToolShim, stand_in_root){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    EXPECT_TRUE(helper.write_str("/a/b/file", "hello cephfs"));
+    struct stat st;
+    EXPECT_EQ(0, stat("/tmp/cephfs_tool_shim/test_root/a/b/file", &st));
+    EXPECT_EQ("hello cephfs", helper.read_str("../a/b/file"));
+    EXPECT_TRUE(helper.chdir("/a"));
+    EXPECT_STREQ("/a", helper.getcwd().c_str());
+    EXPECT_EQ(0, helper.stat("b/file"));
+    EXPECT_EQ(1, helper.stat("b"));
+    EXPECT_TRUE(helper.rmdir("/a"));
+    EXPECT_FALSE(helper.exists("/a"));
+}
+
+TEST_F(CephfsToolShim, write_read){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    round_trip(helper, "3m");
+}
+
+TEST_F(CephfsToolShim, short_write){
+    CephfsHelper helper;
+    login(helper, "short=0.5,seed=7");
+    round_trip(helper, "5m");
+}
+
+TEST_F(CephfsToolShim, eio){
+    CephfsHelper helper;
+    login(helper, "eio=1");
+    EXPECT_FALSE(helper.write_str("/file", "hello cephfs"));
+}
+
+TEST_F(CephfsToolShim, latency){
+    CephfsHelper helper;
+    login(helper, "lat=2ms");
+    timer t;
+    EXPECT_FALSE(helper.exists("/file"));
+    EXPECT_FALSE(helper.exists("/file"));
+    EXPECT_GE(t.elapsed(), 4);
+}
+
+TEST_F(CephfsToolShim, bandwidth){
+    CephfsHelper helper;
+    login(helper, "bw=80mbit");
+    timer t;
+    round_trip(helper, "2m");
+    //2MB each way over 10MB/s
+    EXPECT_GE(t.elapsed(), 350);
+}
+
+TEST_F(CephfsToolShim, tree){
+    CephfsHelper helper;
+    login(helper, "lat=exp:100us");
+    system("mkdir -p /tmp/test_shim/a/b; \
+            echo 1 > /tmp/test_shim/a/b/c; \
+            echo 2 > /tmp/test_shim/a/b/d; \
+            mkdir -p /tmp/test_shim/e; \
+            echo 3 > /tmp/test_shim/e/f;");
+    EXPECT_TRUE(helper.write_tree("/tree/", "/tmp/test_shim/"));
+    std::vector<std::string> list;
+    EXPECT_TRUE(helper.listdir_buffer("/tree/a/b", list));
+    std::sort(list.begin(), list.end());
+    ASSERT_EQ(2u, list.size());
+    EXPECT_EQ("c", list[0]);
+    EXPECT_EQ("d", list[1]);
+    EXPECT_TRUE(helper.rmdir("/tree"));
+    EXPECT_FALSE(helper.exists("/tree"));
+    system("/bin/rm -rf /tmp/test_shim");
+}
+
+TEST_F(CephfsToolShim, trace){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    const char* tf = "/tmp/cephfs_tool_trace.json";
+    ASSERT_TRUE(set_trace_file(tf));
+    round_trip(helper, "3m");
+    ASSERT_TRUE(flush_trace());
+    EXPECT_FALSE(trace_enabled.load());
+    std::ifstream is(tf);
+    std::stringstream ss;
+    ss<<is.rdbuf();
+    std::string json = ss.str();
+    EXPECT_EQ(0u, json.find("{\"displayTimeUnit\""));
+    const char* ops[] = {"upload", "download", "open", "write", "read", "close", "unlink"};
+    for(auto op : ops){
+        std::string ev = std::string("\"name\":\"") + op + "\",\"cat\":\"cephfs\"";
+        EXPECT_NE(std::string::npos, json.find(ev))<<op;
+    }
+    EXPECT_NE(std::string::npos, json.find("\"bytes\":3145728"));
+    remove(tf);
+    EXPECT_FALSE(flush_trace());
+}
+
+TEST_F(CephfsToolShim, tree_parallel){
+    CephfsHelper helper;
+    login(helper, "lat=2ms");
+    helper.set_concurrency(1, 8);
+    system("mkdir -p /tmp/test_shim/a/b /tmp/test_shim/c /tmp/test_shim/empty; \
+            for i in $(seq 1 20); do echo $i > /tmp/test_shim/a/b/f$i; \
+            head -c 100000 /dev/urandom > /tmp/test_shim/c/g$i; done");
+    timer t;
+    EXPECT_TRUE(helper.write_tree("/tree/", "/tmp/test_shim/"));
+    EXPECT_EQ(1, helper.stat("/tree/empty"));
+    EXPECT_TRUE(helper.read_tree("/tree", "/tmp/test_shim_down"));
+    EXPECT_EQ(0, system("diff -r /tmp/test_shim /tmp/test_shim_down"));
+    EXPECT_TRUE(helper.rmdir("/tree"));
+    EXPECT_FALSE(helper.exists("/tree"));
+    //40 files each way and delete, at least 3 round trips each serially
+    EXPECT_LT(t.elapsed(), 120 * 6);
+    EXPECT_FALSE(helper.read_tree("/tree", "/tmp/test_shim_down"));
+    system("/bin/rm -rf /tmp/test_shim /tmp/test_shim_down");
+}
+
+TEST_F(CephfsToolShim, tree_faults){
+    CephfsHelper helper;
+    login(helper, "eio=0.2,seed=3");
+    system("mkdir -p /tmp/test_shim/a; \
+            for i in $(seq 1 50); do echo $i > /tmp/test_shim/a/f$i; done");
+    EXPECT_FALSE(helper.write_tree("/tree/", "/tmp/test_shim/"));
+    system("/bin/rm -rf /tmp/test_shim");
+}
+
+TEST_F(CephfsToolShim, rate_limit){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    helper.set_rate_limit(10*1024*1024, 0);
+    timer t;
+    size_t size = parse_obj_size("5m");
+    const char *tf = "/tmp/tmpfile_shim";
+    EXPECT_TRUE(mkTempFile(tf, size, rg));
+    EXPECT_TRUE(helper.write("/file", tf));
+    remove(tf);
+    //5MB at 10MB/s, minus the burst credit and the last chunk
+    EXPECT_GE(t.elapsed(), 150);
+    helper.set_rate_limit(0, 100);
+    t.reset();
+    for(int i = 0; i < 60; ++i) helper.exists("/file");
+    EXPECT_GE(t.elapsed(), 350);
+    helper.set_rate_limit(0, 0);
+    EXPECT_TRUE(helper.remove("/file"));
+}
+
+TEST_F(CephfsToolShim, read_into_write_from){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    std::string data(3*1024*1024 + 17, 'a');
+    for(size_t i = 0; i < data.size(); ++i) data[i] = 'a' + i % 26;
+    EXPECT_EQ((int64_t)data.size(),
+        helper.write_from("/dir/file", data.data(), data.size()));
+    EXPECT_EQ(10, helper.write_from("/dir/file", "0123456789", 10, 5));
+    data.replace(5, 10, "0123456789");
+    std::vector<char> buf(data.size() + 100);
+    EXPECT_EQ((int64_t)data.size(),
+        helper.read_into("/dir/file", buf.data(), buf.size()));
+    EXPECT_EQ(data, std::string(buf.data(), data.size()));
+    EXPECT_EQ(20, helper.read_into("/dir/file", buf.data(), 20, 1024*1024));
+    EXPECT_EQ(data.substr(1024*1024, 20), std::string(buf.data(), 20));
+    EXPECT_EQ(0, helper.read_into("/dir/file", buf.data(), 20, data.size()));
+    EXPECT_EQ(data, helper.read_str("/dir/file"));
+    EXPECT_EQ(-1, helper.read_into("/dir/nofile", buf.data(), 20));
+    EXPECT_TRUE(helper.rmdir("/dir"));
+}
+
+TEST_F(CephfsToolShim, cephfile){
+    CephfsHelper helper;
+    login(helper, "short=0.3,seed=5");
+    {
+        CephFile missing(helper, "/dir/nofile");
+        EXPECT_FALSE(missing.is_open());
+        EXPECT_EQ(-1, missing.pread(nullptr, 0, 0));
+    }
+    CephFile f(helper, "/dir/file", O_RDWR|O_CREAT|O_TRUNC);
+    ASSERT_TRUE(f.is_open());
+    std::string data(1024*1024, 'x');
+    for(int i = 0; i < 4; ++i)
+        EXPECT_EQ((int64_t)data.size(), f.pwrite(data.data(), data.size(), i * data.size()));
+    char a[3] = {'a', 'b', 'c'}, b[5] = {'d', 'e', 'f', 'g', 'h'};
+    struct iovec iov[2] = {{a, sizeof(a)}, {b, sizeof(b)}};
+    int64_t n = f.pwritev(iov, 2, 10);
+    EXPECT_GT(n, 0);
+    EXPECT_LE(n, 8);
+    EXPECT_TRUE(f.fsync());
+    EXPECT_TRUE(f.truncate(100));
+    EXPECT_TRUE(f.fallocate(0, 4096));
+    CephFile g(std::move(f));
+    EXPECT_FALSE(f.is_open());
+    ASSERT_TRUE(g.is_open());
+    char x[4] = {0}, y[4] = {0};
+    struct iovec riov[2] = {{x, sizeof(x)}, {y, sizeof(y)}};
+    EXPECT_EQ(8, g.preadv(riov, 2, 8));
+    EXPECT_EQ('x', x[0]);
+    EXPECT_EQ('a', x[2]);
+    std::vector<char> buf(8192);
+    EXPECT_EQ(4096, g.pread(buf.data(), buf.size(), 0));
+    EXPECT_EQ(0, buf[100]);
+    CephFile h;
+    h = std::move(g);
+    EXPECT_TRUE(h.close());
+    EXPECT_FALSE(h.is_open());
+    EXPECT_EQ(0, helper.stat("/dir/file"));
+    uint64_t sz = 0;
+    EXPECT_TRUE(helper.length("/dir/file", sz));
+    EXPECT_EQ(4096u, sz);
+    EXPECT_TRUE(helper.rmdir("/dir"));
+}
+
+TEST_F(CephfsToolShim, stream){
+    CephfsHelper helper;
+    login(helper, "short=0.2,seed=11");
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    //the writer does not know the size in advance
+    std::thread producer([&]{
+        std::string chunk(100000, 'z');
+        for(int i = 0; i < 100; ++i){
+            chunk[0] = 'a' + i % 26;
+            write(fds[1], chunk.data(), chunk.size());
+        }
+        close(fds[1]);
+    });
+    EXPECT_TRUE(helper.write_stream("/dir/stream", fds[0]));
+    producer.join();
+    close(fds[0]);
+    uint64_t sz = 0;
+    EXPECT_TRUE(helper.length("/dir/stream", sz));
+    EXPECT_EQ(10000000u, sz);
+    const char* tf = "/tmp/tmpfile_stream";
+    int out = open(tf, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    ASSERT_GE(out, 0);
+    EXPECT_TRUE(helper.read_stream("/dir/stream", out));
+    close(out);
+    cmp_file_size(tf, 10000000);
+    std::ifstream is(tf);
+    is.seekg(100000 * 27);
+    EXPECT_EQ('b', is.get());
+    remove(tf);
+    EXPECT_FALSE(helper.read_stream("/dir/nofile", 1));
+    EXPECT_TRUE(helper.rmdir("/dir"));
+}
+
+TEST_F(CephfsToolShim, sparse){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    //64MB with two data islands, a zero filled region, a trailing hole
+    system("rm -f /tmp/sparse_src /tmp/sparse_down; truncate -s 64M /tmp/sparse_src; \
+            head -c 100000 /dev/urandom | dd of=/tmp/sparse_src bs=1M seek=3 conv=notrunc 2>/dev/null; \
+            dd if=/dev/zero of=/tmp/sparse_src bs=1M seek=10 count=8 conv=notrunc 2>/dev/null; \
+            head -c 5000 /dev/urandom | dd of=/tmp/sparse_src bs=1M seek=40 conv=notrunc 2>/dev/null");
+    EXPECT_TRUE(helper.write("/sparse", "/tmp/sparse_src"));
+    struct stat st;
+    ASSERT_EQ(0, stat("/tmp/cephfs_tool_shim/test_root/sparse", &st));
+    EXPECT_EQ(64*1024*1024, st.st_size);
+    EXPECT_LT(st.st_blocks * 512, 4*1024*1024);
+    EXPECT_TRUE(helper.read("/sparse", "/tmp/sparse_down"));
+    ASSERT_EQ(0, stat("/tmp/sparse_down", &st));
+    EXPECT_EQ(64*1024*1024, st.st_size);
+    EXPECT_LT(st.st_blocks * 512, 4*1024*1024);
+    EXPECT_EQ(0, system("cmp -s /tmp/sparse_src /tmp/sparse_down"));
+    //all zero file, nothing but the size
+    system("dd if=/dev/zero of=/tmp/sparse_src bs=1M count=3 2>/dev/null");
+    EXPECT_TRUE(helper.write("/sparse", "/tmp/sparse_src"));
+    uint64_t sz = 0;
+    EXPECT_TRUE(helper.length("/sparse", sz));
+    EXPECT_EQ(3u*1024*1024, sz);
+    EXPECT_TRUE(helper.read("/sparse", "/tmp/sparse_down"));
+    EXPECT_EQ(0, system("cmp -s /tmp/sparse_src /tmp/sparse_down"));
+    EXPECT_TRUE(helper.remove("/sparse"));
+    system("rm -f /tmp/sparse_src /tmp/sparse_down");
+}
+
+TEST(Sparse, for_each_data){
+    std::vector<char> buf(10 * 4096, 0);
+    EXPECT_TRUE(is_zero(buf.data(), buf.size()));
+    buf[4096 + 7] = 1;
+    buf[3 * 4096] = 1;
+    buf.back() = 1;
+    EXPECT_FALSE(is_zero(buf.data(), buf.size()));
+    std::vector<std::pair<size_t, size_t>> runs;
+    EXPECT_TRUE(for_each_data(buf.data(), buf.size(), 4096,
+        [&](size_t pos, size_t n){ runs.push_back(std::make_pair(pos, n)); return true;}));
+    ASSERT_EQ(3u, runs.size());
+    EXPECT_EQ(std::make_pair((size_t)4096, (size_t)4096), runs[0]);
+    EXPECT_EQ(std::make_pair((size_t)3 * 4096, (size_t)4096), runs[1]);
+    EXPECT_EQ(std::make_pair((size_t)9 * 4096, (size_t)4096), runs[2]);
+}
+
+TEST_F(CephfsToolShim, local_io){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    helper.set_local_io(false, 0);
+    round_trip(helper, "3m");
+    //O_DIRECT where the local fs supports it, else buffered
+    helper.set_local_io(true, 1024*1024);
+    round_trip(helper, "3m");
+    system("head -c 3000001 /dev/urandom > /tmp/tmpfile_direct");
+    EXPECT_TRUE(helper.write("/direct", "/tmp/tmpfile_direct"));
+    EXPECT_TRUE(helper.read("/direct", "/tmp/tmpfile_direct_down"));
+    EXPECT_EQ(0, system("cmp -s /tmp/tmpfile_direct /tmp/tmpfile_direct_down"));
+    system("rm -f /tmp/tmpfile_direct /tmp/tmpfile_direct_down");
+    EXPECT_TRUE(helper.remove("/direct"));
+}
+
+TEST_F(CephfsToolShim, copy_tree){
+    CephfsHelper helper;
+    login(helper, "lat=exp:100us");
+    system("mkdir -p /tmp/test_shim/a/b; \
+            head -c 5000000 /dev/urandom > /tmp/test_shim/a/b/c; \
+            echo 2 > /tmp/test_shim/a/d");
+    EXPECT_TRUE(helper.write_tree("/src", "/tmp/test_shim"));
+    const char* root = "/tmp/cephfs_tool_shim/test_root";
+    //write_tree does not keep attrs, set them in the stand-in
+    system("touch -d 2020-01-02 /tmp/cephfs_tool_shim/test_root/src/a/b/c \
+            /tmp/cephfs_tool_shim/test_root/src/a/b; \
+            chmod 600 /tmp/cephfs_tool_shim/test_root/src/a/d");
+    EXPECT_TRUE(helper.copy_tree("/src/", "/dst"));
+    EXPECT_EQ(0, system("cmp -s /tmp/test_shim/a/b/c /tmp/cephfs_tool_shim/test_root/dst/a/b/c"));
+    EXPECT_EQ("2\n", helper.read_str("/dst/a/d"));
+    struct stat src_st, dst_st;
+    std::string src = std::string(root) + "/src/a/", dst = std::string(root) + "/dst/a/";
+    ASSERT_EQ(0, stat((src + "d").c_str(), &src_st));
+    ASSERT_EQ(0, stat((dst + "d").c_str(), &dst_st));
+    EXPECT_EQ(0600u, dst_st.st_mode & 07777);
+    ASSERT_EQ(0, stat((src + "b/c").c_str(), &src_st));
+    ASSERT_EQ(0, stat((dst + "b/c").c_str(), &dst_st));
+    EXPECT_EQ(src_st.st_mtime, dst_st.st_mtime);
+    ASSERT_EQ(0, stat((src + "b").c_str(), &src_st));
+    ASSERT_EQ(0, stat((dst + "b").c_str(), &dst_st));
+    EXPECT_EQ(src_st.st_mtime, dst_st.st_mtime);
+    //single file, into a new dir
+    EXPECT_TRUE(helper.copy("/src/a/d", "/one/d"));
+    EXPECT_EQ("2\n", helper.read_str("/one/d"));
+    EXPECT_FALSE(helper.copy_tree("/src", "/src/a/x"));
+    EXPECT_FALSE(helper.copy("/src/a", "/two"));
+    EXPECT_FALSE(helper.copy_tree("/nosuch", "/two"));
+    system("/bin/rm -rf /tmp/test_shim");
+}
+
+TEST_F(CephfsToolShim, dedup){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    helper.set_dedup("/.dedup/");
+    system("mkdir -p /tmp/test_shim/a /tmp/test_shim/b; \
+            head -c 3000000 /dev/urandom > /tmp/test_shim/a/model; \
+            cp /tmp/test_shim/a/model /tmp/test_shim/b/model; \
+            echo other > /tmp/test_shim/b/other");
+    //files of one tree upload in parallel, a racing copy is not linked
+    EXPECT_TRUE(helper.write("/tree/a/model", "/tmp/test_shim/a/model"));
+    EXPECT_TRUE(helper.write_tree("/tree", "/tmp/test_shim"));
+    EXPECT_TRUE(helper.write("/copy/model", "/tmp/test_shim/a/model"));
+    const char* root = "/tmp/cephfs_tool_shim/test_root";
+    struct stat a, b, c;
+    ASSERT_EQ(0, stat((std::string(root) + "/tree/a/model").c_str(), &a));
+    ASSERT_EQ(0, stat((std::string(root) + "/tree/b/model").c_str(), &b));
+    ASSERT_EQ(0, stat((std::string(root) + "/copy/model").c_str(), &c));
+    EXPECT_EQ(a.st_ino, b.st_ino);
+    EXPECT_EQ(a.st_ino, c.st_ino);
+    //two index levels, one entry per content
+    EXPECT_EQ(0, system("test $(find /tmp/cephfs_tool_shim/test_root/.dedup -type f | wc -l) = 2"));
+    //a new content at a deduplicated path replaces the link, the others keep theirs
+    system("echo changed > /tmp/test_shim/a/model");
+    EXPECT_TRUE(helper.write("/copy/model", "/tmp/test_shim/a/model"));
+    EXPECT_EQ("changed\n", helper.read_str("/copy/model"));
+    EXPECT_TRUE(helper.read("/tree/b/model", "/tmp/test_shim/down"));
+    EXPECT_EQ(0, system("cmp -s /tmp/test_shim/b/model /tmp/test_shim/down"));
+    //without dedup nothing is linked
+    helper.set_dedup(nullptr);
+    EXPECT_TRUE(helper.write("/plain/model", "/tmp/test_shim/b/model"));
+    ASSERT_EQ(0, stat((std::string(root) + "/plain/model").c_str(), &c));
+    EXPECT_NE(b.st_ino, c.st_ino);
+    system("/bin/rm -rf /tmp/test_shim");
+}
+
+//a plain rewrite of a linked path leaves the other links and the index
+TEST_F(CephfsToolShim, dedup_rewrite){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    helper.set_dedup("/.dedup/");
+    system("mkdir -p /tmp/test_shim; printf aaaa > /tmp/test_shim/orig; \
+            printf bbbb > /tmp/test_shim/other");
+    EXPECT_TRUE(helper.write("/one", "/tmp/test_shim/orig"));
+    EXPECT_TRUE(helper.write("/two", "/tmp/test_shim/orig"));
+    helper.set_dedup(nullptr);
+    EXPECT_TRUE(helper.write("/two", "/tmp/test_shim/other"));
+    EXPECT_EQ("aaaa", helper.read_str("/one"));
+    EXPECT_EQ("bbbb", helper.read_str("/two"));
+    EXPECT_TRUE(helper.write_str("/one", "cccc"));
+    helper.set_dedup("/.dedup/");
+    EXPECT_TRUE(helper.write("/three", "/tmp/test_shim/orig"));
+    EXPECT_EQ("aaaa", helper.read_str("/three"));
+    //changed in place behind the tool, same size, the entry is hashed again
+    system("sleep 0.01; printf dddd > /tmp/cephfs_tool_shim/test_root/three");
+    EXPECT_TRUE(helper.write("/four", "/tmp/test_shim/orig"));
+    EXPECT_EQ("aaaa", helper.read_str("/four"));
+    EXPECT_TRUE(helper.write("/five", "/tmp/test_shim/orig"));
+    struct stat four, five;
+    ASSERT_EQ(0, stat("/tmp/cephfs_tool_shim/test_root/four", &four));
+    ASSERT_EQ(0, stat("/tmp/cephfs_tool_shim/test_root/five", &five));
+    EXPECT_EQ(four.st_ino, five.st_ino);
+    system("/bin/rm -rf /tmp/test_shim");
+}
+
+//a user hardlink without the dedup stamp is rewritten in place
+TEST_F(CephfsToolShim, hardlink_rewrite){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    system("mkdir -p /tmp/test_shim; printf bbbb > /tmp/test_shim/other");
+    EXPECT_TRUE(helper.write_str("/hl_one", "aaaa"));
+    ASSERT_EQ(0, link("/tmp/cephfs_tool_shim/test_root/hl_one",
+        "/tmp/cephfs_tool_shim/test_root/hl_two"));
+    chmod("/tmp/cephfs_tool_shim/test_root/hl_one", 0600);
+    EXPECT_TRUE(helper.write("/hl_two", "/tmp/test_shim/other"));
+    EXPECT_EQ("bbbb", helper.read_str("/hl_one"));
+    struct stat one, two;
+    ASSERT_EQ(0, stat("/tmp/cephfs_tool_shim/test_root/hl_one", &one));
+    ASSERT_EQ(0, stat("/tmp/cephfs_tool_shim/test_root/hl_two", &two));
+    EXPECT_EQ(one.st_ino, two.st_ino);
+    EXPECT_EQ(0600u, two.st_mode & 0777);
+    EXPECT_TRUE(helper.write_str("/hl_one", "cc"));
+    EXPECT_EQ("cc", helper.read_str("/hl_two"));
+    system("/bin/rm -rf /tmp/test_shim");
+}
+
+TEST_F(CephfsToolShim, manifest){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    system("/bin/rm -rf /tmp/test_shim /tmp/test_shim_cache; mkdir -p /tmp/test_shim/a/b; \
+            echo 1 > /tmp/test_shim/a/b/c; echo 2 > /tmp/test_shim/a/d");
+    helper.set_manifest("/tmp/test_shim_cache", true);
+    EXPECT_TRUE(helper.write_tree("/tree", "/tmp/test_shim"));
+    EXPECT_EQ("1\n", helper.read_str("/tree/a/b/c"));
+    EXPECT_TRUE(helper.exists("/tree/.cephfs-manifest"));
+    //unchanged files are not sent again, a remote edit survives
+    EXPECT_TRUE(helper.write_str("/tree/a/d", "remote"));
+    system("echo 3 > /tmp/test_shim/a/b/c; touch -d 2020-01-01 /tmp/test_shim/a/b/c; \
+            mkdir /tmp/test_shim/e; echo 4 > /tmp/test_shim/e/f");
+    EXPECT_TRUE(helper.write_tree("/tree", "/tmp/test_shim"));
+    EXPECT_EQ("3\n", helper.read_str("/tree/a/b/c"));
+    EXPECT_EQ("4\n", helper.read_str("/tree/e/f"));
+    EXPECT_EQ("remote", helper.read_str("/tree/a/d"));
+    //the manifest on cephfs is enough without the cache
+    system("/bin/rm -rf /tmp/test_shim_cache; echo 5 > /tmp/test_shim/e/f");
+    EXPECT_TRUE(helper.write_tree("/tree", "/tmp/test_shim"));
+    EXPECT_EQ("5\n", helper.read_str("/tree/e/f"));
+    EXPECT_EQ("remote", helper.read_str("/tree/a/d"));
+    //downloads leave the manifest out
+    EXPECT_TRUE(helper.read_tree("/tree", "/tmp/test_shim_down"));
+    EXPECT_NE(0, access("/tmp/test_shim_down/.cephfs-manifest", F_OK));
+    EXPECT_EQ(0, access("/tmp/test_shim_down/a/b/c", F_OK));
+    system("/bin/rm -rf /tmp/test_shim /tmp/test_shim_cache /tmp/test_shim_down");
+}
+
+TEST_F(CephfsToolShim, mirror){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    system("/bin/rm -rf /tmp/test_mirror");
+    EXPECT_TRUE(helper.write_str("/m/a/x", "1111"));
+    EXPECT_TRUE(helper.write_str("/m/b/y", "2222"));
+    EXPECT_TRUE(helper.write_str("/m/b/z", "3333"));
+    EXPECT_TRUE(helper.mirror_tree("/m", "/tmp/test_mirror"));
+    EXPECT_EQ(0, access("/tmp/test_mirror/.cephfs-mirror", F_OK));
+    EXPECT_EQ(0, system("grep -q 2222 /tmp/test_mirror/b/y"));
+    //ctime ticks are coarse, keep the changes apart from the last run
+    usleep(20000);
+    //a local edit of the same size in a subtree that did not change stays
+    system("echo -n LLLL > /tmp/test_mirror/a/x");
+    EXPECT_TRUE(helper.write_str("/m/b/y", "5555"));
+    EXPECT_TRUE(helper.remove("/m/b/z"));
+    EXPECT_TRUE(helper.write_str("/m/c/w", "6"));
+    EXPECT_TRUE(helper.mirror_tree("/m", "/tmp/test_mirror"));
+    EXPECT_EQ(0, system("grep -q LLLL /tmp/test_mirror/a/x"));
+    EXPECT_EQ(0, system("grep -q 5555 /tmp/test_mirror/b/y"));
+    EXPECT_NE(0, access("/tmp/test_mirror/b/z", F_OK));
+    EXPECT_EQ(0, system("grep -q 6 /tmp/test_mirror/c/w"));
+    //a dir gone from cephfs goes locally too
+    usleep(20000);
+    EXPECT_TRUE(helper.rmdir("/m/c"));
+    EXPECT_TRUE(helper.mirror_tree("/m", "/tmp/test_mirror"));
+    EXPECT_NE(0, access("/tmp/test_mirror/c", F_OK));
+    EXPECT_TRUE(helper.mirror_tree("/m", "/tmp/test_mirror"));
+    EXPECT_FALSE(helper.mirror_tree("/m/a/x", "/tmp/test_mirror"));
+    system("/bin/rm -rf /tmp/test_mirror");
+}
+
+TEST_F(CephfsToolShim, split_transfer){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    helper.set_concurrency(1, 4);
+    helper.set_split(8*1024*1024, 3*1024*1024);
+    //a file split in chunks with a zero region, beside small files
+    system("mkdir -p /tmp/test_shim/d; head -c 20000001 /dev/urandom > /tmp/test_shim/big; \
+            dd if=/dev/zero of=/tmp/test_shim/big bs=1M seek=5 count=6 conv=notrunc 2>/dev/null; \
+            for i in $(seq 1 30); do echo $i > /tmp/test_shim/d/f$i; done");
+    EXPECT_TRUE(helper.write_tree("/tree", "/tmp/test_shim"));
+    struct stat st;
+    ASSERT_EQ(0, stat("/tmp/cephfs_tool_shim/test_root/tree/big", &st));
+    EXPECT_EQ(20000001, st.st_size);
+    EXPECT_LT(st.st_blocks * 512, 20000001 - 5*1024*1024);
+    EXPECT_TRUE(helper.read_tree("/tree", "/tmp/test_shim_down"));
+    EXPECT_EQ(0, system("diff -r /tmp/test_shim /tmp/test_shim_down"));
+    //a shorter upload over it truncates, a split download replaces a longer file
+    system("head -c 9000000 /dev/urandom > /tmp/test_shim/big");
+    EXPECT_TRUE(helper.write_tree("/tree", "/tmp/test_shim"));
+    EXPECT_TRUE(helper.read_tree("/tree", "/tmp/test_shim_down"));
+    EXPECT_EQ(0, system("diff -r /tmp/test_shim /tmp/test_shim_down"));
+    system("/bin/rm -rf /tmp/test_shim /tmp/test_shim_down");
+}
+
+TEST_F(CephfsToolShim, shard){
+    system("mkdir -p /tmp/test_shim/d; head -c 10000001 /dev/urandom > /tmp/test_shim/big; \
+            for i in $(seq 1 40); do echo $i > /tmp/test_shim/d/f$i; done");
+    const char* shards = "/tmp/cephfs_tool_shim/test_root/.cephfs-shards";
+    //three processes share the tree, each chunk of big goes to one of them
+    for(int i = 0; i < 3; ++i){
+        CephfsHelper helper;
+        login(helper, nullptr);
+        helper.set_split(4*1024*1024, 1024*1024);
+        ASSERT_TRUE(helper.set_shard(i, 3));
+        EXPECT_TRUE(helper.write_tree("/tree", "/tmp/test_shim"));
+        if(i < 2){
+            EXPECT_EQ(i + 1, helper.shard_merge("upload", "/tree/", 3));
+        }
+    }
+    CephfsHelper helper;
+    login(helper, nullptr);
+    EXPECT_FALSE(helper.set_shard(3, 3));
+    EXPECT_EQ(0, system("diff -r /tmp/test_shim /tmp/cephfs_tool_shim/test_root/tree"));
+    EXPECT_EQ(3, helper.shard_merge("upload", "/tree", 3));
+    //all done, the markers are gone
+    EXPECT_EQ(0, system((std::string("test -z \"$(ls ") + shards + ")\"").c_str()));
+    //a sharded delete leaves dirs of later shards to them or to the merge
+    for(int i = 0; i < 2; ++i){
+        CephfsHelper h;
+        login(h, nullptr);
+        ASSERT_TRUE(h.set_shard(i, 2));
+        EXPECT_TRUE(h.rmdir("/tree"));
+    }
+    EXPECT_EQ(2, helper.shard_merge("delete", "/tree", 2));
+    EXPECT_EQ(-1, helper.stat("/tree"));
+    system("/bin/rm -rf /tmp/test_shim");
+}
+
+TEST_F(CephfsToolShim, watch){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    system("mkdir -p /tmp/test_watch/d; echo old > /tmp/test_watch/d/a");
+    bool ok = false;
+    std::thread t([&]{ ok = helper.watch_tree("/w", "/tmp/test_watch", 0.2, 2);});
+    const char* remote = "/tmp/cephfs_tool_shim/test_root/w";
+    //the first upload
+    for(int i = 0; i < 50 && access((std::string(remote) + "/d/a").c_str(), F_OK) != 0; ++i)
+        usleep(100000);
+    usleep(300000);
+    //a changed file, a new dir with files in it, a hidden file
+    system("echo new > /tmp/test_watch/d/a; mkdir -p /tmp/test_watch/n/m; \
+            echo x > /tmp/test_watch/n/m/x; echo h > /tmp/test_watch/.h");
+    for(int i = 0; i < 50 && access((std::string(remote) + "/n/m/x").c_str(), F_OK) != 0; ++i)
+        usleep(100000);
+    usleep(500000);
+    CephfsHelper::stop_watch();
+    t.join();
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(0, system("diff -r -x .h /tmp/test_watch /tmp/cephfs_tool_shim/test_root/w"));
+    EXPECT_NE(0, access((std::string(remote) + "/.h").c_str(), F_OK));
+    system("/bin/rm -rf /tmp/test_watch");
+}
+
+TEST_F(CephfsToolShim, tail){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    const char* local = "/tmp/test_tail.log";
+    const char* remote = "/tmp/cephfs_tool_shim/test_root/logs/job.log";
+    system("/bin/rm -f /tmp/test_tail.log*; printf 'one\\n' > /tmp/test_tail.log");
+    auto remote_size = [&]{
+        struct stat st;
+        return ::stat(remote, &st) == 0 ? st.st_size : -1;
+    };
+    auto wait_size = [&](off_t size){
+        for(int i = 0; i < 50 && remote_size() != size; ++i) usleep(100000);
+        EXPECT_EQ(size, remote_size());
+    };
+    bool ok = false;
+    std::thread t([&]{ ok = helper.tail_file("/logs/job.log", local, 1024*1024, 0.1, 0.2);});
+    wait_size(4);
+    CephfsHelper::stop_watch();
+    t.join();
+    EXPECT_TRUE(ok);
+    //a restart resumes at the cephfs size
+    system("printf 'two\\n' >> /tmp/test_tail.log");
+    std::thread t2([&]{ ok = helper.tail_file("/logs/job.log", local, 1024*1024, 0.1, 0.2);});
+    wait_size(8);
+    //a copytruncate, then a rename and a new file
+    system(": > /tmp/test_tail.log; printf 'three\\n' >> /tmp/test_tail.log");
+    wait_size(14);
+    system("mv /tmp/test_tail.log /tmp/test_tail.log.1; printf 'four\\n' >> /tmp/test_tail.log.1; \
+            printf 'five\\n' > /tmp/test_tail.log");
+    wait_size(24);
+    CephfsHelper::stop_watch();
+    t2.join();
+    EXPECT_TRUE(ok);
+    std::ifstream is(remote);
+    std::string all((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+    EXPECT_EQ("one\ntwo\nthree\nfour\nfive\n", all);
+    system("/bin/rm -f /tmp/test_tail.log*");
+}
+
+TEST_F(CephfsToolShim, filter){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    system("mkdir -p /tmp/test_shim/src /tmp/test_shim/build/deep; \
+            echo a > /tmp/test_shim/src/a.c; echo o > /tmp/test_shim/src/a.o; \
+            echo b > /tmp/test_shim/build/deep/b; echo e > /tmp/test_shim/.env; \
+            echo g > /tmp/test_shim/.git");
+    ASSERT_TRUE(helper.add_filter("*.o"));
+    ASSERT_TRUE(helper.add_filter("build/"));
+    ASSERT_TRUE(helper.add_filter("!.env"));
+    EXPECT_TRUE(helper.write_tree("/tree", "/tmp/test_shim"));
+    const std::string root = "/tmp/cephfs_tool_shim/test_root/tree";
+    EXPECT_EQ(0, access((root + "/src/a.c").c_str(), F_OK));
+    EXPECT_EQ(0, access((root + "/.env").c_str(), F_OK));
+    EXPECT_NE(0, access((root + "/src/a.o").c_str(), F_OK));
+    EXPECT_NE(0, access((root + "/build").c_str(), F_OK));
+    EXPECT_NE(0, access((root + "/.git").c_str(), F_OK));
+    //remove only the c files, the rest and its dirs stay
+    helper.clear_filter();
+    system("echo o > /tmp/cephfs_tool_shim/test_root/tree/src/b.o");
+    ASSERT_TRUE(helper.add_filter("*"));
+    ASSERT_TRUE(helper.add_filter("!*/"));
+    ASSERT_TRUE(helper.add_filter("!*.c"));
+    EXPECT_TRUE(helper.rmdir("/tree"));
+    EXPECT_NE(0, access((root + "/src/a.c").c_str(), F_OK));
+    EXPECT_EQ(0, access((root + "/src/b.o").c_str(), F_OK));
+    EXPECT_EQ(0, access((root + "/.env").c_str(), F_OK));
+    //download of files of at least 3 bytes
+    helper.clear_filter();
+    system("echo long > /tmp/cephfs_tool_shim/test_root/tree/src/long");
+    helper.set_filter_size(3, 0);
+    EXPECT_TRUE(helper.read_tree("/tree", "/tmp/test_shim_down"));
+    EXPECT_EQ(0, access("/tmp/test_shim_down/src/long", F_OK));
+    EXPECT_NE(0, access("/tmp/test_shim_down/src/b.o", F_OK));
+    system("/bin/rm -rf /tmp/test_shim /tmp/test_shim_down");
+}
+
+TEST_F(CephfsToolShim, preflight){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    system("mkdir -p /tmp/test_shim/d /tmp/cephfs_tool_shim/test_root/q/old; \
+            head -c 3000 /dev/zero > /tmp/test_shim/a; \
+            head -c 3000 /dev/zero > /tmp/test_shim/d/b; \
+            head -c 2000 /dev/zero > /tmp/cephfs_tool_shim/test_root/q/old/c");
+    const char* quota = "/tmp/cephfs_tool_shim/test_root/q";
+    if(setxattr(quota, "user.ceph.quota.max_bytes", "7000", 4, 0) < 0){
+        system("/bin/rm -rf /tmp/test_shim");
+        return; //no user xattrs on this fs
+    }
+    //6000 more bytes over 2000 used
+    EXPECT_FALSE(helper.write_tree("/q/tree", "/tmp/test_shim"));
+    EXPECT_NE(0, access("/tmp/cephfs_tool_shim/test_root/q/tree", F_OK));
+    system("head -c 5500 /dev/zero > /tmp/test_shim_big");
+    EXPECT_FALSE(helper.write("/q/a", "/tmp/test_shim_big"));
+    helper.set_preflight(false);
+    EXPECT_TRUE(helper.write("/q/a", "/tmp/test_shim_big"));
+    helper.set_preflight(true);
+    EXPECT_TRUE(helper.remove("/q/a"));
+    //a tree upload merges, the 2000 already in old stay
+    EXPECT_EQ(0, setxattr(quota, "user.ceph.quota.max_bytes", "4000", 4, 0));
+    EXPECT_FALSE(helper.write_tree("/q/old", "/tmp/test_shim/d"));
+    EXPECT_NE(0, access("/tmp/cephfs_tool_shim/test_root/q/old/b", F_OK));
+    //a file upload replaces the file at its path
+    system("head -c 3500 /dev/zero > /tmp/test_shim_big");
+    EXPECT_TRUE(helper.write("/q/old/c", "/tmp/test_shim_big"));
+    //files quota counts dirs too
+    EXPECT_EQ(0, setxattr(quota, "user.ceph.quota.max_bytes", "0", 1, 0));
+    EXPECT_EQ(0, setxattr(quota, "user.ceph.quota.max_files", "5", 1, 0));
+    EXPECT_FALSE(helper.write_tree("/q/tree", "/tmp/test_shim"));
+    EXPECT_TRUE(helper.write("/q/e", "/tmp/test_shim/a"));
+    system("/bin/rm -rf /tmp/test_shim /tmp/test_shim_big");
+}
+
+TEST_F(CephfsToolShim, tar){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    system("mkdir -p /tmp/test_shim/sub/deep; echo a > /tmp/test_shim/a; \
+            head -c 9000000 /dev/urandom > /tmp/test_shim/sub/big; \
+            head -c 5000000 /dev/zero >> /tmp/test_shim/sub/big; \
+            : > /tmp/test_shim/sub/deep/empty; ln -s ../a /tmp/test_shim/sub/l; \
+            ln /tmp/test_shim/a /tmp/test_shim/sub/hard; chmod 600 /tmp/test_shim/a; \
+            cd /tmp/test_shim && tar -cf /tmp/test_shim.tar .");
+    EXPECT_TRUE(helper.ingest_tar("/tree", "/tmp/test_shim.tar"));
+    const std::string root = "/tmp/cephfs_tool_shim/test_root/tree";
+    EXPECT_EQ(0, system(("diff -r /tmp/test_shim " + root).c_str()));
+    struct stat st;
+    ASSERT_EQ(0, lstat((root + "/sub/l").c_str(), &st));
+    EXPECT_TRUE(S_ISLNK(st.st_mode));
+    ASSERT_EQ(0, stat((root + "/sub/hard").c_str(), &st));
+    EXPECT_EQ(2u, st.st_nlink);
+    EXPECT_EQ(0600u, st.st_mode & 0777);
+    //a path out of the tree is skipped
+    system("printf x > /tmp/test_shim_x; tar -cPf /tmp/test_shim_bad.tar \
+            --transform 's,^,../,' /tmp/test_shim_x");
+    EXPECT_TRUE(helper.ingest_tar("/tree2", "/tmp/test_shim_bad.tar"));
+    EXPECT_NE(0, access("/tmp/cephfs_tool_shim/test_root/test_shim_x", F_OK));
+    //export and extract again
+    EXPECT_TRUE(helper.export_tar("/tree", "/tmp/test_shim_out.tar"));
+    system("mkdir -p /tmp/test_shim_down && tar -xf /tmp/test_shim_out.tar -C /tmp/test_shim_down");
+    EXPECT_EQ(0, system("diff -r /tmp/test_shim /tmp/test_shim_down"));
+    system("/bin/rm -rf /tmp/test_shim /tmp/test_shim_down /tmp/test_shim*.tar /tmp/test_shim_x");
+}
+
+TEST_F(CephfsToolShim, pack){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    system("mkdir -p /tmp/test_shim/sub/deep; echo a > /tmp/test_shim/a; \
+            printf bcdef > /tmp/test_shim/sub/b; chmod 600 /tmp/test_shim/sub/b; \
+            head -c 9000000 /dev/urandom > /tmp/test_shim/sub/big; \
+            : > /tmp/test_shim/sub/deep/empty; echo z > /tmp/test_shim/z");
+    //a container per 4 bytes, big alone
+    EXPECT_TRUE(helper.pack_tree("/pack", "/tmp/test_shim", 4));
+    std::vector<std::string> list;
+    EXPECT_TRUE(helper.pack_list("/pack", list));
+    std::vector<std::string> expect = {"a", "sub/b", "sub/big", "sub/deep/empty", "z"};
+    EXPECT_EQ(expect, list);
+    char buf[16];
+    EXPECT_EQ(3, helper.pack_read("/pack", "sub/b", buf, sizeof(buf), 2));
+    EXPECT_EQ("def", std::string(buf, 3));
+    EXPECT_EQ(-1, helper.pack_read("/pack", "sub/none", buf, sizeof(buf)));
+    EXPECT_TRUE(helper.pack_extract("/pack", "./sub/big", "/tmp/test_shim_big"));
+    EXPECT_EQ(0, system("cmp /tmp/test_shim/sub/big /tmp/test_shim_big"));
+    EXPECT_TRUE(helper.unpack_tree("/pack", "/tmp/test_shim_down"));
+    EXPECT_EQ(0, system("diff -r /tmp/test_shim /tmp/test_shim_down"));
+    struct stat st;
+    ASSERT_EQ(0, stat("/tmp/test_shim_down/sub/b", &st));
+    EXPECT_EQ(0600u, st.st_mode & 0777);
+    //a smaller pack by another helper replaces it whole, the cached index
+    //of this one is not used again
+    system("/bin/rm -rf /tmp/test_shim/sub; echo zzzz > /tmp/test_shim/a");
+    CephfsHelper other;
+    login(other, nullptr);
+    EXPECT_TRUE(other.pack_tree("/pack", "/tmp/test_shim"));
+    list.clear();
+    EXPECT_TRUE(helper.pack_list("/pack", list));
+    EXPECT_EQ(2u, list.size());
+    EXPECT_EQ(5, helper.pack_read("/pack", "a", buf, sizeof(buf)));
+    EXPECT_EQ("zzzz\n", std::string(buf, 5));
+    //one generation of containers and no temp index left
+    EXPECT_EQ(0, system("cd /tmp/cephfs_tool_shim/test_root/pack && \
+        test $(ls | wc -l) = 2 -a $(ls *.pack | wc -l) = 1 -a -f pack.idx"));
+    system("/bin/rm -rf /tmp/test_shim /tmp/test_shim_down /tmp/test_shim_big");
+}
+
+TEST_F(CephfsToolShim, async){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    helper.set_async(8, 16);
+    //many ops in flight from this thread
+    std::vector<std::string> data;
+    std::vector<std::future<int64_t>> writes;
+    for(int i = 0; i < 100; ++i) data.push_back(std::string(1000 + i, 'a' + i % 26));
+    for(int i = 0; i < 100; ++i){
+        std::string path = "/async/f" + std::to_string(i);
+        writes.push_back(helper.write_async(path.c_str(), data[i].data(), data[i].size()));
+    }
+    for(int i = 0; i < 100; ++i) EXPECT_EQ(1000 + i, writes[i].get());
+    char buf[2000];
+    std::future<int64_t> r = helper.read_async("/async/f42", buf, sizeof(buf));
+    EXPECT_EQ(1042, r.get());
+    EXPECT_EQ(data[42], std::string(buf, 1042));
+    EXPECT_EQ(1, helper.stat_async("/async").get());
+    EXPECT_EQ(-1, helper.stat_async("/async/none").get());
+    std::vector<std::string> list;
+    EXPECT_TRUE(helper.listdir_async("/async", list).get());
+    EXPECT_EQ(100u, list.size());
+    //callbacks run on the executor
+    std::atomic<int> removed(0);
+    for(int i = 0; i < 100; ++i){
+        std::string path = "/async/f" + std::to_string(i);
+        helper.remove_async(path.c_str(), [&removed](bool ok){ if(ok) ++removed;});
+    }
+    EXPECT_FALSE(helper.remove_async("/async/none").get());
+    //waits for the queued ops
+    helper.set_async(8, 16);
+    EXPECT_EQ(100, removed.load());
+    std::promise<size_t> count;
+    helper.listdir_async("/async", [&count](bool ok, std::vector<std::string>& l){
+        count.set_value(ok ? l.size() : 1000);
+    });
+    EXPECT_EQ(0u, count.get_future().get());
+}
+
+TEST_F(CephfsToolShim, glob){
+    CephfsHelper helper;
+    login(helper, nullptr);
+    const std::string root = "/tmp/cephfs_tool_shim/test_root/g";
+    system(("mkdir -p " + root + "/r1/tmp/d " + root + "/r2/tmp " + root + "/r2/.hid/tmp "
+        + root + "/.r3/tmp; cd " + root + " && echo a > r1/tmp/a && echo b > r1/tmp/d/b && "
+        "echo k > r1/keep && echo c > r2/tmp/c && echo x > r2/.hid/tmp/x && "
+        "echo y > .r3/tmp/y").c_str());
+    std::vector<std::string> paths;
+    EXPECT_TRUE(helper.expand_glob("/g/*/tmp", paths));
+    EXPECT_EQ(std::vector<std::string>({"/g/r1/tmp", "/g/r2/tmp"}), paths);
+    paths.clear();
+    EXPECT_TRUE(helper.expand_glob("/g/*/tmp/**", paths));
+    EXPECT_EQ(std::vector<std::string>({"/g/r1/tmp/a", "/g/r1/tmp/d", "/g/r1/tmp/d/b",
+        "/g/r2/tmp/c"}), paths);
+    paths.clear();
+    EXPECT_TRUE(helper.expand_glob("/g/**/b", paths));
+    EXPECT_EQ(std::vector<std::string>({"/g/r1/tmp/d/b"}), paths);
+    paths.clear();
+    EXPECT_TRUE(helper.expand_glob("/g/r?/k[a-f]ep", paths));
+    EXPECT_EQ(std::vector<std::string>({"/g/r1/keep"}), paths);
+    paths.clear();
+    EXPECT_TRUE(helper.expand_glob("/g/.*/tmp/*", paths));
+    EXPECT_EQ(std::vector<std::string>({"/g/.r3/tmp/y"}), paths);
+    paths.clear();
+    EXPECT_TRUE(helper.expand_glob("/g/none/*", paths));
+    EXPECT_TRUE(paths.empty());
+    //a matched dir stands for the paths below it
+    EXPECT_TRUE(helper.expand_glob("/g/**", paths, false));
+    EXPECT_EQ(std::vector<std::string>({"/g/r1", "/g/r2"}), paths);
+    EXPECT_TRUE(helper.read_glob("/g/*/tmp/**", "/tmp/test_shim_down"));
+    EXPECT_EQ(0, system("cd /tmp/test_shim_down && test \"$(find . -type f | sort)\" = \
+        \"$(printf './r1/tmp/a\\n./r1/tmp/d/b\\n./r2/tmp/c')\""));
+    EXPECT_TRUE(helper.remove_glob("/g/*/tmp/**"));
+    EXPECT_EQ(0, system(("cd " + root + " && test \"$(find . | sort | tr '\\n' ' ')\" = \
+        '. ./.r3 ./.r3/tmp ./.r3/tmp/y ./r1 ./r1/keep ./r1/tmp ./r2 ./r2/.hid \
+./r2/.hid/tmp ./r2/.hid/tmp/x ./r2/tmp '").c_str()));
+    system("/bin/rm -rf /tmp/test_shim_down");
+}
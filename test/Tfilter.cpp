@@ -0,0 +1,69 @@
+#include "src/utils.h"
+#include "src/filter.h"
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+
+TEST(Filter, glob_match){
+    EXPECT_TRUE(glob_match("*.o", "a.o"));
+    EXPECT_FALSE(glob_match("*.o", "a.oo"));
+    EXPECT_FALSE(glob_match("*.o", "d/a.o"));
+    EXPECT_TRUE(glob_match("a?c", "abc"));
+    EXPECT_FALSE(glob_match("a?c", "a/c"));
+    EXPECT_TRUE(glob_match("[a-c]x", "bx"));
+    EXPECT_FALSE(glob_match("[!a-c]x", "bx"));
+    EXPECT_TRUE(glob_match("[!a-c]x", "dx"));
+    EXPECT_TRUE(glob_match("**/tmp", "tmp"));
+    EXPECT_TRUE(glob_match("**/tmp", "a/b/tmp"));
+    EXPECT_TRUE(glob_match("a/**/b", "a/b"));
+    EXPECT_TRUE(glob_match("a/**/b", "a/x/y/b"));
+    EXPECT_TRUE(glob_match("logs/**", "logs/x/y"));
+    EXPECT_FALSE(glob_match("logs/*", "logs/x/y"));
+    EXPECT_TRUE(glob_match("\\*", "*"));
+    EXPECT_FALSE(glob_match("\\*", "a"));
+}
+
+TEST(Filter, rules){
+    path_filter f;
+    EXPECT_TRUE(f.empty());
+    //dot files out by default when asked, back in by a rule
+    EXPECT_TRUE(f.skip(".git", ".git", S_IFDIR, 0, 0, true));
+    EXPECT_FALSE(f.skip(".git", ".git", S_IFDIR, 0, 0, false));
+    ASSERT_TRUE(f.add("# build output"));
+    ASSERT_TRUE(f.add("*.o"));
+    ASSERT_TRUE(f.add("build/"));
+    ASSERT_TRUE(f.add("/top.txt"));
+    ASSERT_TRUE(f.add("doc/**/*.tmp"));
+    ASSERT_TRUE(f.add("!keep.o"));
+    ASSERT_TRUE(f.add("!.env"));
+    EXPECT_FALSE(f.add("!/"));
+    EXPECT_FALSE(f.empty());
+    EXPECT_TRUE(f.skip("src/a.o", "a.o", S_IFREG, 1, 0, true));
+    EXPECT_FALSE(f.skip("src/keep.o", "keep.o", S_IFREG, 1, 0, true));
+    EXPECT_TRUE(f.skip("x/build", "build", S_IFDIR, 0, 0, true));
+    //a dir rule is no file rule
+    EXPECT_FALSE(f.skip("x/build", "build", S_IFREG, 1, 0, true));
+    EXPECT_TRUE(f.skip("top.txt", "top.txt", S_IFREG, 1, 0, true));
+    EXPECT_FALSE(f.skip("d/top.txt", "top.txt", S_IFREG, 1, 0, true));
+    EXPECT_TRUE(f.skip("doc/a/b/x.tmp", "x.tmp", S_IFREG, 1, 0, true));
+    EXPECT_FALSE(f.skip("src/x.tmp", "x.tmp", S_IFREG, 1, 0, true));
+    EXPECT_FALSE(f.skip(".env", ".env", S_IFREG, 1, 0, true));
+    EXPECT_TRUE(f.skip(".hidden", ".hidden", S_IFREG, 1, 0, true));
+    //the dirs above count
+    EXPECT_TRUE(f.skip_path("build/keep.o", S_IFREG, 1, 0, true));
+    EXPECT_FALSE(f.skip_path("src/keep.o", S_IFREG, 1, 0, true));
+    //a later rule wins
+    ASSERT_TRUE(f.add("keep.o"));
+    EXPECT_TRUE(f.skip("src/keep.o", "keep.o", S_IFREG, 1, 0, true));
+    //size and mtime apply to files
+    f.clear();
+    f.set_size(10, 100);
+    f.set_mtime(1000, 2000);
+    const int64_t s = 1000000000;
+    EXPECT_TRUE(f.skip("a", "a", S_IFREG, 5, 1500 * s, false));
+    EXPECT_TRUE(f.skip("a", "a", S_IFREG, 101, 1500 * s, false));
+    EXPECT_FALSE(f.skip("a", "a", S_IFREG, 50, 1500 * s, false));
+    EXPECT_TRUE(f.skip("a", "a", S_IFREG, 50, 999 * s, false));
+    EXPECT_TRUE(f.skip("a", "a", S_IFREG, 50, 2000 * s, false));
+    EXPECT_FALSE(f.skip("d", "d", S_IFDIR, 0, 0, false));
+}
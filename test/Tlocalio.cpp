@@ -0,0 +1,81 @@
+#include "src/utils.h"
+#include "src/localio.h"
+#include "src/bufpool.h"
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * local io, on io_uring when the kernel allows it and on pread/pwrite
+ */
+static void copy_file(bool uring){
+    buffer_pool pool(64 * 1024, 1024 * 1024);
+    buffer_lease lease(pool, 4);
+    ASSERT_EQ(4, lease.size());
+    local_io io(uring);
+    io.attach(lease.data(), lease.size(), pool.chunk_size());
+    EXPECT_EQ(0, io.pending());
+    const char* src = "/tmp/localio_src";
+    const char* dst = "/tmp/localio_dst";
+    system("head -c 5000000 /dev/urandom > /tmp/localio_src");
+    int in = open(src, O_RDONLY), out = open(dst, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    ASSERT_GE(in, 0);
+    ASSERT_GE(out, 0);
+    //reads of all buffers in flight, each result is written back in pieces
+    uint64_t offset = 0;
+    bool eof = false;
+    while(!eof){
+        int n = 0;
+        for(; n < io.buffers(); ++n){
+            io.submit(local_io::request{false, in, n, 0, io.buffer_size(), offset});
+            offset += io.buffer_size();
+        }
+        std::vector<local_io::completion> reads;
+        local_io::completion c;
+        while(io.wait(c)) reads.push_back(c);
+        ASSERT_EQ((size_t)n, reads.size());
+        for(auto& r : reads){
+            ASSERT_GE(r.res, 0);
+            if(r.res < (int64_t)r.req.len) eof = true;
+            for(int64_t pos = 0; pos < r.res; pos += 1000){
+                size_t len = std::min<int64_t>(1000, r.res - pos);
+                io.submit(local_io::request{true, out, r.req.buf, (size_t)pos, len,
+                    r.req.offset + pos});
+            }
+        }
+        while(io.wait(c)){
+            EXPECT_TRUE(c.req.write);
+            EXPECT_EQ((int64_t)c.req.len, c.res);
+        }
+    }
+    close(in);
+    close(out);
+    EXPECT_EQ(0, system("cmp -s /tmp/localio_src /tmp/localio_dst"));
+    remove(src);
+    remove(dst);
+}
+
+TEST(LocalIo, uring){
+    local_io io(true);
+    EXPECT_TRUE(io.wants_uring());
+    copy_file(true);
+}
+
+TEST(LocalIo, sync){
+    local_io io(false);
+    EXPECT_FALSE(io.uring());
+    copy_file(false);
+}
+
+TEST(LocalIo, errors){
+    buffer_pool pool(4096, 4096);
+    buffer_lease lease(pool, 1);
+    local_io io(true);
+    io.attach(lease.data(), lease.size(), pool.chunk_size());
+    io.submit(local_io::request{false, -1, 0, 0, 4096, 0});
+    local_io::completion c;
+    ASSERT_TRUE(io.wait(c));
+    EXPECT_EQ(-EBADF, c.res);
+    EXPECT_FALSE(io.wait(c));
+}
@@ -0,0 +1,75 @@
+#include "src/utils.h"
+#include "src/manifest.h"
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+static std::vector<std::string> diff_of(const manifest_view& a, const manifest_view& b){
+    std::vector<std::string> out;
+    manifest_diff(a, b, [&](manifest_change kind, const std::string& path,
+        const manifest_record*, const manifest_record*){
+        const char* tag[] = {"+", "~", "-"};
+        out.push_back(tag[kind] + path);
+    });
+    return out;
+}
+
+TEST(Manifest, write_open_find){
+    manifest_builder b;
+    b.add("b/file", 10, 1, S_IFREG|0644);
+    b.add("a", 0, 2, S_IFDIR|0755);
+    b.add("a.txt", 3, 3, S_IFREG|0644);
+    b.add("a/x", 4, 4, S_IFREG|0600);
+    b.add("b", 0, 5, S_IFDIR|0755);
+    const char* file = "/tmp/test_manifest";
+    ASSERT_TRUE(b.write(file));
+    manifest_view mf;
+    ASSERT_TRUE(mf.open(file));
+    ASSERT_EQ(5u, mf.size());
+    //a dir sorts before its files
+    EXPECT_EQ("a", mf.path(0));
+    EXPECT_EQ("a.txt", mf.path(1));
+    EXPECT_EQ("a/x", mf.path(2));
+    EXPECT_EQ("b", mf.path(3));
+    EXPECT_EQ("b/file", mf.path(4));
+    EXPECT_EQ(2, mf.find("a/x"));
+    EXPECT_EQ(4u, mf.at(mf.find("a/x")).size);
+    EXPECT_EQ(0600u, mf.at(2).mode & 0777);
+    EXPECT_EQ(-1, mf.find("a/y"));
+    EXPECT_EQ(-1, mf.find(""));
+    //truncated or foreign files are refused
+    ASSERT_EQ(0, truncate(file, 100));
+    EXPECT_FALSE(mf.open(file));
+    EXPECT_EQ(0u, mf.size());
+    EXPECT_FALSE(mf.open("/tmp/no_such_manifest"));
+    unlink(file);
+}
+
+TEST(Manifest, diff){
+    manifest_builder a, b;
+    uint8_t h1[32] = {1}, h2[32] = {2};
+    a.add("same", 1, 1, S_IFREG|0644);
+    a.add("gone", 1, 1, S_IFREG|0644);
+    a.add("size", 1, 1, S_IFREG|0644);
+    a.add("mtime", 1, 1, S_IFREG|0644);
+    a.add("mode", 1, 1, S_IFREG|0644);
+    a.add("hash", 1, 1, S_IFREG|0644, h1);
+    a.add("nohash", 1, 1, S_IFREG|0644, h1);
+    b.add("same", 1, 1, S_IFREG|0644);
+    b.add("size", 2, 1, S_IFREG|0644);
+    b.add("mtime", 1, 2, S_IFREG|0644);
+    b.add("mode", 1, 1, S_IFREG|0600);
+    b.add("hash", 1, 1, S_IFREG|0644, h2);
+    b.add("nohash", 1, 1, S_IFREG|0644);
+    b.add("new", 1, 1, S_IFREG|0644);
+    std::string ia = a.serialize(), ib = b.serialize();
+    manifest_view va, vb, empty;
+    ASSERT_TRUE(va.attach(ia.data(), ia.size()));
+    ASSERT_TRUE(vb.attach(ib.data(), ib.size()));
+    std::vector<std::string> expect = {"-gone", "~hash", "~mode", "~mtime", "+new", "~size"};
+    EXPECT_EQ(expect, diff_of(va, vb));
+    EXPECT_TRUE(diff_of(va, va).empty());
+    EXPECT_EQ(7u, diff_of(empty, va).size());
+    EXPECT_EQ("-gone", diff_of(va, empty)[0]);
+}
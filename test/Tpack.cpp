@@ -0,0 +1,48 @@
+#include "src/utils.h"
+#include "src/pack.h"
+#include <gtest/gtest.h>
+
+TEST(Pack, index){
+    pack_index_builder b;
+    b.add("b/x", 0100644, 10, 5, 7);
+    b.add("a", 0100600, 0, 10, 0);
+    b.add("b", 0100644, 15, 1, 0);
+    b.set_generation(42);
+    EXPECT_EQ(3u, b.size());
+    std::string image = b.serialize();
+    pack_index_view v;
+    ASSERT_TRUE(v.attach(image.data(), image.size()));
+    ASSERT_EQ(3u, v.size());
+    EXPECT_EQ(42u, v.generation());
+    //a dir sorts before its files
+    EXPECT_EQ("a", v.path(0));
+    EXPECT_EQ("b", v.path(1));
+    EXPECT_EQ("b/x", v.path(2));
+    EXPECT_EQ(2, v.find("b/x"));
+    EXPECT_EQ(10u, v.at(2).offset);
+    EXPECT_EQ(7, v.at(2).mtime_ns);
+    EXPECT_EQ(-1, v.find("b/y"));
+    EXPECT_EQ(2, v.floor("b/y"));
+    EXPECT_EQ(-1, v.floor("0"));
+    EXPECT_EQ(0, v.floor("a/z"));
+}
+
+TEST(Pack, broken){
+    pack_index_builder b;
+    b.add("a", 0100644, 0, 1, 0);
+    std::string image = b.serialize();
+    pack_index_view v;
+    EXPECT_FALSE(v.attach(image.data(), image.size() - 1));
+    EXPECT_EQ(0u, v.size());
+    std::string bad = image;
+    bad[0] = 'X';
+    EXPECT_FALSE(v.attach(bad.data(), bad.size()));
+    //a name without its '\0'
+    bad = image;
+    bad[bad.size() - 1] = 'b';
+    EXPECT_FALSE(v.attach(bad.data(), bad.size()));
+    pack_index_builder empty;
+    image = empty.serialize();
+    EXPECT_TRUE(v.attach(image.data(), image.size()));
+    EXPECT_EQ(-1, v.floor("a"));
+}
@@ -0,0 +1,59 @@
+#include "src/utils.h"
+#include "src/ratelimit.h"
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+TEST(RateLimiter, unlimited){
+    rate_limiter limiter;
+    timer t;
+    for(int i = 0; i < 100000; ++i) limiter.acquire(1024*1024);
+    EXPECT_LT(t.elapsed(), 100);
+}
+
+TEST(RateLimiter, burst){
+    rate_limiter limiter;
+    limiter.set_rate(1000);
+    timer t;
+    //200ms burst credit after idle
+    for(int i = 0; i < 150; ++i) limiter.acquire(1);
+    EXPECT_LT(t.elapsed(), 50);
+}
+
+TEST(RateLimiter, rate){
+    rate_limiter limiter;
+    limiter.set_rate(1000);
+    timer t;
+    for(int i = 0; i < 500; ++i) limiter.acquire(1);
+    //500 ops at 1000/s, minus the burst credit
+    EXPECT_GE(t.elapsed(), 250);
+    EXPECT_LT(t.elapsed(), 500);
+}
+
+TEST(RateLimiter, shared){
+    rate_limiter limiter;
+    limiter.set_rate(100*1024*1024);
+    std::vector<std::thread> threads;
+    timer t;
+    for(int i = 0; i < 8; ++i){
+        threads.emplace_back([&limiter]{
+            for(int j = 0; j < 8; ++j) limiter.acquire(1024*1024);
+        });
+    }
+    for(auto& th : threads) th.join();
+    //64MB at 100MB/s, minus the burst credit
+    EXPECT_GE(t.elapsed(), 400);
+    EXPECT_LT(t.elapsed(), 700);
+}
+
+TEST(RateLimiter, change_rate){
+    rate_limiter limiter;
+    limiter.set_rate(10);
+    EXPECT_EQ(10, limiter.get_rate());
+    limiter.set_rate(-1);
+    EXPECT_EQ(0, limiter.get_rate());
+    timer t;
+    for(int i = 0; i < 1000; ++i) limiter.acquire(1);
+    EXPECT_LT(t.elapsed(), 50);
+}
@@ -0,0 +1,36 @@
+#include "src/sha256.h"
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+static std::string hash_of(const std::string& s){
+    sha256 h;
+    h.update(s.data(), s.size());
+    return h.hex_digest();
+}
+
+TEST(Sha256, vectors){
+    EXPECT_EQ("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855", hash_of(""));
+    EXPECT_EQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", hash_of("abc"));
+    EXPECT_EQ("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+        hash_of("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"));
+    EXPECT_EQ("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+        hash_of(std::string(1000000, 'a')));
+}
+
+TEST(Sha256, split_updates){
+    std::vector<char> data(100000);
+    for(size_t i = 0; i < data.size(); ++i) data[i] = (char)(i * 7 + i / 255);
+    sha256 whole;
+    whole.update(data.data(), data.size());
+    std::string expect = whole.hex_digest();
+    //pieces across block bounds, 55 and 56 bytes are the padding edges
+    size_t sizes[] = {1, 55, 56, 63, 64, 65, 4096, 12345};
+    for(size_t step : sizes){
+        sha256 h;
+        for(size_t pos = 0; pos < data.size(); pos += step)
+            h.update(data.data() + pos, std::min(step, data.size() - pos));
+        EXPECT_EQ(expect, h.hex_digest()) << step;
+    }
+}
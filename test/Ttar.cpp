@@ -0,0 +1,100 @@
+#include "src/utils.h"
+#include "src/tar.h"
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+TEST(Tar, clean_path){
+    std::string rel;
+    EXPECT_TRUE(tar_clean_path("./a/b", rel));
+    EXPECT_EQ(rel, "a/b");
+    EXPECT_TRUE(tar_clean_path("/a//./b/", rel));
+    EXPECT_EQ(rel, "a/b");
+    EXPECT_FALSE(tar_clean_path("a/../../b", rel));
+    EXPECT_FALSE(tar_clean_path("./", rel));
+}
+
+//written here, listed by tar, read back
+TEST(Tar, round_trip){
+    const char* tf = "/tmp/test_tar.tar";
+    std::string long_name(120, 'n');
+    std::string deep = "d/" + std::string(300, 'p');
+    int fd = ::open(tf, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+    tar_writer w(fd);
+    EXPECT_TRUE(w.header(tar_entry{"d", "", TAR_DIR, 0755, 0, 1000}));
+    EXPECT_TRUE(w.header(tar_entry{"d/a", "", TAR_FILE, 0640, 5, 2000}));
+    EXPECT_TRUE(w.data("hello", 5));
+    EXPECT_TRUE(w.header(tar_entry{"d/" + long_name, "", TAR_FILE, 0600, 3, 0}));
+    //short data is padded with zeros
+    EXPECT_TRUE(w.data("x", 1));
+    EXPECT_TRUE(w.header(tar_entry{deep, "", TAR_FILE, 0644, 0, 0}));
+    EXPECT_TRUE(w.header(tar_entry{"d/l", "a", TAR_SYMLINK, 0777, 0, 0}));
+    EXPECT_TRUE(w.finish());
+    ::close(fd);
+    EXPECT_EQ(0, system("tar -tf /tmp/test_tar.tar > /tmp/test_tar.list"));
+    EXPECT_EQ(0, system(("grep -q '^" + deep + "$' /tmp/test_tar.list").c_str()));
+    fd = ::open(tf, O_RDONLY);
+    ASSERT_GE(fd, 0);
+    tar_reader r(fd);
+    ASSERT_TRUE(r.open());
+    EXPECT_STREQ(r.compression(), "tar");
+    tar_entry e;
+    ASSERT_TRUE(r.next(e));
+    EXPECT_EQ(e.path, "d/");
+    EXPECT_EQ(e.type, TAR_DIR);
+    EXPECT_EQ(e.mode, 0755u);
+    ASSERT_TRUE(r.next(e));
+    EXPECT_EQ(e.path, "d/a");
+    EXPECT_EQ(e.size, 5u);
+    EXPECT_EQ(e.mtime, 2000);
+    char buf[16];
+    EXPECT_EQ(5, r.read(buf, sizeof(buf)));
+    EXPECT_EQ(0, memcmp(buf, "hello", 5));
+    ASSERT_TRUE(r.next(e));
+    EXPECT_EQ(e.path, "d/" + long_name);
+    EXPECT_EQ(3, r.read(buf, sizeof(buf)));
+    EXPECT_EQ(0, memcmp(buf, "x\0\0", 3));
+    ASSERT_TRUE(r.next(e));
+    EXPECT_EQ(e.path, deep);
+    ASSERT_TRUE(r.next(e));
+    EXPECT_EQ(e.type, TAR_SYMLINK);
+    EXPECT_EQ(e.link, "a");
+    EXPECT_FALSE(r.next(e));
+    EXPECT_TRUE(r.ok());
+    ::close(fd);
+    remove(tf);
+    remove("/tmp/test_tar.list");
+}
+
+//gnu tar output, long names and gzip
+TEST(Tar, gnu_gzip){
+    std::string long_name(150, 'g');
+    system(("mkdir -p /tmp/test_tar_src/sub; echo data > /tmp/test_tar_src/sub/" +
+        long_name + "; cd /tmp/test_tar_src && tar --format=gnu -czf /tmp/test_tar.tgz .").c_str());
+    int fd = ::open("/tmp/test_tar.tgz", O_RDONLY);
+    ASSERT_GE(fd, 0);
+    tar_reader r(fd);
+    bool found = false;
+#ifdef HAVE_ZLIB
+    ASSERT_TRUE(r.open());
+    EXPECT_STREQ(r.compression(), "gzip");
+    tar_entry e;
+    while(r.next(e)){
+        if(e.path != "./sub/" + long_name) continue;
+        found = true;
+        char buf[16];
+        EXPECT_EQ(5, r.read(buf, sizeof(buf)));
+        EXPECT_EQ(0, memcmp(buf, "data\n", 5));
+    }
+    EXPECT_TRUE(r.ok());
+#else
+    //built without zlib, refused up front
+    EXPECT_FALSE(r.open());
+    found = true;
+#endif
+    EXPECT_TRUE(found);
+    ::close(fd);
+    system("/bin/rm -rf /tmp/test_tar_src /tmp/test_tar.tgz");
+}
@@ -0,0 +1,69 @@
+#include "src/utils.h"
+#include "src/walker.h"
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sys/stat.h>
+
+static const char* WALK_ROOT = "/tmp/test_walker";
+
+TEST(Walker, deep_tree){
+    system("rm -rf /tmp/test_walker");
+    //far deeper than a recursive walk would want on the stack
+    const int depth = 1500;
+    std::string dir = WALK_ROOT;
+    for(int i = 0; i < depth; ++i) dir += "/d";
+    ASSERT_TRUE(mk_local_dirs(dir));
+    std::ofstream((dir + "/leaf").c_str())<<"leaf";
+    local_dir_source source;
+    tree_walker walker(source);
+    int dirs = 0, files = 0, deepest = 0;
+    ASSERT_TRUE(walker.walk(WALK_ROOT, [&](const walk_entry& e){
+        if(S_ISDIR(e.mode)) ++dirs;
+        else ++files;
+        deepest = std::max(deepest, e.depth);
+        EXPECT_EQ(std::string(WALK_ROOT) + "/" + e.rel, e.path);
+        return tree_walker::VISIT_ENTER;
+    }));
+    EXPECT_EQ(depth, dirs);
+    EXPECT_EQ(1, files);
+    EXPECT_EQ(depth, deepest);
+}
+
+TEST(Walker, skip_stop_listed){
+    system("rm -rf /tmp/test_walker");
+    ASSERT_TRUE(mk_local_dirs(std::string(WALK_ROOT) + "/a/b"));
+    ASSERT_TRUE(mk_local_dirs(std::string(WALK_ROOT) + "/skip/c"));
+    std::ofstream((std::string(WALK_ROOT) + "/a/f").c_str())<<"0123456789";
+    std::ofstream((std::string(WALK_ROOT) + "/a/b/g").c_str())<<"g";
+    local_dir_source source;
+    tree_walker walker(source);
+    std::vector<std::string> seen, listed;
+    ASSERT_TRUE(walker.walk(WALK_ROOT, [&](const walk_entry& e){
+        seen.push_back(e.rel);
+        if(e.rel == "a/f"){
+            EXPECT_EQ(10u, e.size);
+        }
+        return strcmp(e.name, "skip") == 0 ? tree_walker::VISIT_SKIP :
+            tree_walker::VISIT_ENTER;
+    }, [&](const std::string&, const std::string& rel, int){
+        //every entry of a dir comes before the dir is listed as done
+        listed.push_back(rel);
+        return true;
+    }));
+    std::sort(seen.begin(), seen.end());
+    EXPECT_EQ((std::vector<std::string>{"a", "a/b", "a/b/g", "a/f", "skip"}), seen);
+    EXPECT_EQ((std::vector<std::string>{"", "a", "a/b"}), listed);
+    //a stop ends the walk with false
+    int visits = 0;
+    EXPECT_FALSE(walker.walk(WALK_ROOT, [&](const walk_entry&){
+        ++visits;
+        return tree_walker::VISIT_STOP;
+    }));
+    EXPECT_EQ(1, visits);
+    EXPECT_FALSE(walker.walk("/tmp/test_walker/none", [&](const walk_entry&){
+        return tree_walker::VISIT_ENTER;
+    }));
+    system("rm -rf /tmp/test_walker");
+}
@@ -0,0 +1,257 @@
+#include "src/utils.h"
+#include "src/workers.h"
+#include <gtest/gtest.h>
+
+TEST(AimdLimiter, bounds){
+    aimd_limiter limiter(2, 8);
+    EXPECT_EQ(8, limiter.max());
+    EXPECT_EQ(4, limiter.current());
+    aimd_limiter small(1, 2);
+    EXPECT_EQ(2, small.current());
+    aimd_limiter bad(4, 1);
+    EXPECT_EQ(4, bad.max());
+}
+
+TEST(AimdLimiter, increase){
+    aimd_limiter limiter(1, 8);
+    for(int i = 0; i < 1000; ++i) limiter.observe(1000, true);
+    EXPECT_EQ(8, limiter.current());
+}
+
+TEST(AimdLimiter, decrease_on_error){
+    aimd_limiter limiter(1, 32);
+    for(int i = 0; i < 1000; ++i) limiter.observe(1000, true);
+    EXPECT_EQ(32, limiter.current());
+    for(int i = 0; i < 1000; ++i) limiter.observe(1000, i % 10 != 0);
+    EXPECT_LT(limiter.current(), 8);
+    for(int i = 0; i < 100; ++i) limiter.observe(1000, false);
+    EXPECT_EQ(1, limiter.current());
+}
+
+TEST(AimdLimiter, decrease_on_latency){
+    aimd_limiter limiter(2, 32);
+    for(int i = 0; i < 1000; ++i) limiter.observe(1000, true);
+    EXPECT_EQ(32, limiter.current());
+    for(int i = 0; i < 100; ++i) limiter.observe(10000, true);
+    EXPECT_LT(limiter.current(), 32);
+}
+
+TEST(WorkerPool, run_all){
+    aimd_limiter limiter(1, 4);
+    worker_pool pool(limiter);
+    std::atomic<int> count(0);
+    for(int i = 0; i < 1000; ++i)
+        pool.submit([&count]{ ++count; return true;});
+    EXPECT_TRUE(pool.wait());
+    EXPECT_EQ(1000, count.load());
+    EXPECT_TRUE(pool.wait());
+}
+
+TEST(WorkerPool, limit_inflight){
+    aimd_limiter limiter(2, 2);
+    worker_pool pool(limiter);
+    std::atomic<int> inflight(0), peak(0);
+    for(int i = 0; i < 50; ++i){
+        pool.submit([&]{
+            int cur = ++inflight;
+            int old = peak.load();
+            while(cur > old && !peak.compare_exchange_weak(old, cur));
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            --inflight;
+            return true;
+        });
+    }
+    EXPECT_TRUE(pool.wait());
+    EXPECT_LE(peak.load(), 2);
+}
+
+TEST(WorkerPool, cancel_on_failure){
+    aimd_limiter limiter(1, 1);
+    worker_pool pool(limiter);
+    std::atomic<int> count(0);
+    pool.submit([]{ return false;});
+    for(int i = 0; i < 100; ++i)
+        pool.submit([&count]{ ++count; return true;});
+    EXPECT_FALSE(pool.wait());
+    EXPECT_FALSE(pool.ok());
+    EXPECT_EQ(0, count.load());
+}
+
+//a failed task cancels nothing, the destructor runs the queued tasks
+TEST(TaskExecutor, independent_tasks){
+    std::atomic<int> count(0);
+    {
+        task_executor exec(4, 8);
+        for(int i = 0; i < 1000; ++i){
+            exec.submit([&count, i]{
+                if(i % 10 == 0) return;
+                ++count;
+            });
+        }
+        EXPECT_LE(exec.queued(), 8u);
+    }
+    EXPECT_EQ(900, count.load());
+}
+
+TEST(BufferPipeline, copy_in_order){
+    buffer_pool pool(4096, 3 * 4096);
+    buffer_pipeline pipe(pool, 3);
+    std::string src(100000, 'a'), dst;
+    for(size_t i = 0; i < src.size(); ++i) src[i] = 'a' + i % 26;
+    size_t pos = 0;
+    EXPECT_TRUE(pipe.run(
+        [&](char* buf, size_t len){
+            EXPECT_EQ(0u, (uintptr_t)buf % 4096);
+            size_t n = std::min(len, src.size() - pos);
+            memcpy(buf, src.data() + pos, n);
+            pos += n;
+            return (int64_t)n;
+        },
+        [&](const char* buf, size_t len){ dst.append(buf, len); return true;}));
+    EXPECT_EQ(src, dst);
+    EXPECT_EQ((int64_t)src.size(), pipe.bytes());
+}
+
+TEST(BufferPipeline, errors){
+    buffer_pool pool(4096, 2 * 4096);
+    buffer_pipeline pipe(pool, 2);
+    int fills = 0;
+    EXPECT_FALSE(pipe.run(
+        [&](char*, size_t){ return ++fills < 3 ? (int64_t)10 : -1;},
+        [](const char*, size_t){ return true;}));
+    EXPECT_EQ(20, pipe.bytes());
+    int drains = 0;
+    EXPECT_FALSE(pipe.run(
+        [](char*, size_t len){ return (int64_t)len;},
+        [&](const char*, size_t){ return ++drains < 5;}));
+    EXPECT_EQ(5, drains);
+}
+
+TEST(BufferPool, reuse_and_cap){
+    buffer_pool pool(4096, 3 * 4096);
+    char *a = pool.acquire(), *b = pool.acquire(), *c = pool.acquire();
+    ASSERT_TRUE(a && b && c);
+    EXPECT_EQ(0u, (uintptr_t)a % 4096);
+    EXPECT_EQ(nullptr, pool.try_acquire());
+    pool.release(b);
+    EXPECT_EQ(b, pool.try_acquire());
+    //a lease takes what fits, at least one chunk
+    std::thread t([&]{
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        pool.release(c);
+    });
+    {
+        buffer_lease lease(pool, 4);
+        EXPECT_EQ(1, lease.size());
+        EXPECT_EQ(c, lease[0]);
+    }
+    t.join();
+    buffer_pool::stats_t st = pool.stats();
+    EXPECT_EQ(5u, st.acquires);
+    EXPECT_EQ(2u, st.hits);
+    EXPECT_EQ(1u, st.waits);
+    EXPECT_EQ(3u * 4096, st.peak);
+    //a lower cap frees idle chunks
+    pool.configure(4096, false);
+    pool.release(a);
+    pool.release(b);
+    char *d = pool.try_acquire();
+    EXPECT_NE(nullptr, d);
+    EXPECT_EQ(nullptr, pool.try_acquire());
+    pool.release(d);
+    EXPECT_EQ(d, pool.acquire());
+    pool.release(d);
+}
+
+TEST(TransferPlan, split_and_order){
+    const uint64_t MB = 1024*1024;
+    //split from 100MB in 40MB chunks, small below 1MB, 4 files a batch
+    transfer_plan plan(100*MB, 40*MB, MB, 4, 0);
+    plan.add(10*MB);
+    plan.add(250*MB);
+    for(int i = 0; i < 10; ++i) plan.add(1000);
+    plan.add(300*MB, false);
+    plan.add(50*MB);
+    EXPECT_TRUE(plan.is_split(1));
+    EXPECT_FALSE(plan.is_split(12));
+    std::vector<transfer_plan::batch> order = plan.schedule(1);
+    //250MB as 40MB chunks and a 10MB tail, 3 whole large files, 3 batches
+    size_t chunks = 0, whole = 0, small = 0;
+    uint64_t bytes = 0;
+    for(const transfer_plan::batch& b : order){
+        for(const transfer_plan::task& t : b){
+            bytes += t.len;
+            if(t.chunk){
+                ++chunks;
+                EXPECT_EQ(1u, t.file);
+                EXPECT_EQ(0u, t.offset % (40*MB));
+            }else if(t.len >= MB){
+                ++whole;
+            }else{
+                ++small;
+            }
+        }
+        EXPECT_LE(b.size(), 4u);
+    }
+    EXPECT_EQ(7u, chunks);
+    EXPECT_EQ(3u, whole);
+    EXPECT_EQ(10u, small);
+    EXPECT_EQ(610*MB + 10000, bytes);
+    //largest first, the small batches spread out
+    ASSERT_EQ(1u, order[0].size());
+    EXPECT_EQ(12u, order[0][0].file);
+    uint64_t last = UINT64_MAX;
+    size_t first_small = order.size(), last_small = 0;
+    for(size_t i = 0; i < order.size(); ++i){
+        if(order[i][0].len < MB){
+            first_small = std::min(first_small, i);
+            last_small = i;
+            continue;
+        }
+        EXPECT_LE(order[i][0].len, last);
+        last = order[i][0].len;
+    }
+    EXPECT_LT(first_small, order.size() / 2);
+    EXPECT_GE(last_small, order.size() / 2);
+    //nothing to split
+    transfer_plan none(0, 40*MB, MB, 4, 0);
+    none.add(500*MB);
+    EXPECT_FALSE(none.is_split(0));
+    EXPECT_EQ(1u, none.schedule(4).size());
+}
+
+TEST(TransferPlan, shard){
+    const uint64_t MB = 1024*1024;
+    std::vector<std::string> paths;
+    transfer_plan plan(100*MB, 40*MB, MB, 4, 0);
+    plan.add(250*MB);
+    paths.push_back("/tree/big");
+    for(int i = 0; i < 40; ++i){
+        plan.add(1000);
+        paths.push_back("/tree/f" + std::to_string(i));
+    }
+    //the same path gives the same shard, every run
+    EXPECT_EQ(shard_of("/tree/f1", 0, 7), shard_of(std::string("/tree/f1"), 0, 7));
+    EXPECT_EQ(0, shard_of("/tree/f1", 0, 1));
+    //the shards together take each task once
+    const int count = 3;
+    std::vector<int> taken(41 * 8, 0);
+    uint64_t bytes = 0;
+    for(int s = 0; s < count; ++s){
+        std::vector<transfer_plan::batch> order = plan.schedule(2,
+            [&](const transfer_plan::task& t){
+                return shard_of(paths[t.file], t.offset, count) == s;
+            });
+        EXPECT_FALSE(order.empty());
+        for(const transfer_plan::batch& b : order){
+            for(const transfer_plan::task& t : b){
+                ++taken[t.file * 8 + t.offset / (40*MB)];
+                bytes += t.len;
+            }
+        }
+    }
+    EXPECT_EQ(250*MB + 40000, bytes);
+    for(int n : taken){
+        EXPECT_LE(n, 1);
+    }
+}